@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -16,15 +16,78 @@ SOURCES += main.cpp\
         mainwindow.cpp \
     camerawidget.cpp \
     camera.cpp \
-    audioworker.cpp
+    audioworker.cpp \
+    transition.cpp \
+    compositor.cpp \
+    capturethread.cpp \
+    timeshiftbuffer.cpp \
+    jpegdc.cpp \
+    switchingpolicy.cpp \
+    switchingcore.cpp \
+    tracefile.cpp \
+    allocationcounter.cpp \
+    logger.cpp \
+    sourceregistry.cpp \
+    nodeconnection.cpp \
+    remotecamera.cpp \
+    nodeclient.cpp \
+    nodeserver.cpp \
+    controlserver.cpp \
+    persondetector.cpp \
+    latencystrip.cpp \
+    syntheticcamera.cpp \
+    threadpolicy.cpp \
+    framepool.cpp \
+    audiomixer.cpp \
+    eventtrace.cpp \
+    metricslog.cpp \
+    gccphat.cpp \
+    bleeddetector.cpp \
+    programoutput.cpp \
+    headlessswitcher.cpp \
+    audiorecorder.cpp
 
 HEADERS  += mainwindow.h \
     radioviz.h \
     camerawidget.h \
-    camera.h
+    camera.h \
+    transition.h \
+    compositor.h \
+    capturethread.h \
+    timeshiftbuffer.h \
+    jpegdc.h \
+    switchingpolicy.h \
+    switchingcore.h \
+    tracefile.h \
+    allocationcounter.h \
+    logger.h \
+    sourceregistry.h \
+    nodeconnection.h \
+    remotecamera.h \
+    nodeclient.h \
+    nodeserver.h \
+    controlserver.h \
+    persondetector.h \
+    latencystrip.h \
+    syntheticcamera.h \
+    audioworker.h \
+    threadpolicy.h \
+    framepool.h \
+    spscring.h \
+    audiomixer.h \
+    eventtrace.h \
+    metricslog.h \
+    gccphat.h \
+    bleeddetector.h \
+    programoutput.h \
+    headlessswitcher.h \
+    audiorecorder.h
 
 FORMS    +=
 
+# qmake CONFIG+=alloccount counts heap allocations per presented frame
+alloccount: DEFINES += ALLOCATION_COUNTER
+
 macx: INCLUDEPATH += /usr/local/include/
 
 unix: LIBS += -L/usr/local/lib -lavutil -lavcodec -lavformat -lavdevice  -lswscale -lopencv_core -lopencv_imgproc -lopencv_highgui -lrt -lasound -ljack -lpthread -lportaudio
@@ -0,0 +1,198 @@
+/***
+ * RadioViz - allocationcounter.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Heap allocation counter. With ALLOCATION_COUNTER defined the global operator new/delete are
+ *              replaced with versions that count every allocation, in total and for the calling thread, so we can
+ *              check the per-frame loop doesn't allocate once it has warmed up. cv::Mat, FFmpeg and libjpeg get
+ *              their memory from malloc()/posix_memalign() rather than new, so those are counted too, by putting
+ *              our own in front of glibc's. Without ALLOCATION_COUNTER nothing is replaced and every count is zero.
+ *
+ */
+#include <atomic>
+#include <new>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "allocationcounter.h"
+
+#ifdef ALLOCATION_COUNTER
+
+static std::atomic<unsigned long long> allocations(0);
+static std::atomic<unsigned long long> allocatedBytes(0);
+static thread_local unsigned long long threadAllocations = 0;
+static thread_local unsigned long long threadLargeAllocations = 0;
+
+// glibc's own allocator, which the replacements below hand on to
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+}
+
+static inline void Count(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    threadAllocations++;
+    if(size >= ALLOCATION_LARGE_SIZE)
+        threadLargeAllocations++;
+}
+
+static void *CountedAllocate(size_t size)
+{
+    Count(size);
+    return __libc_malloc(size ? size : 1);
+}
+
+extern "C" void *malloc(size_t size)
+{
+    Count(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    Count(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    Count(size);
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+    Count(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    Count(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+    void *memory;
+
+    if(alignment < sizeof(void *) || (alignment & (alignment - 1))) return EINVAL;
+    Count(size);
+    memory = __libc_memalign(alignment, size);
+    if(!memory) return ENOMEM;
+    *pointer = memory;
+    return 0;
+}
+
+extern "C" void free(void *pointer)
+{
+    __libc_free(pointer);
+}
+
+void *operator new(size_t size)
+{
+    void *pointer = CountedAllocate(size);
+    if(!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+void *operator new[](size_t size)
+{
+    void *pointer = CountedAllocate(size);
+    if(!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    __libc_free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    __libc_free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    __libc_free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+    __libc_free(pointer);
+}
+
+bool AllocationCounter::IsEnabled(void)
+{
+    return true;
+}
+
+unsigned long long AllocationCounter::GetAllocations(void)
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+unsigned long long AllocationCounter::GetBytes(void)
+{
+    return allocatedBytes.load(std::memory_order_relaxed);
+}
+
+/***
+ * Get Thread Allocations
+ * Author: Matthew Ribbins
+ * Description: Allocations made by the calling thread only, so the GUI thread's loop can be measured without
+ *              counting what the capture threads are doing at the same time
+ */
+unsigned long long AllocationCounter::GetThreadAllocations(void)
+{
+    return threadAllocations;
+}
+
+unsigned long long AllocationCounter::GetThreadLargeAllocations(void)
+{
+    return threadLargeAllocations;
+}
+
+#else
+
+bool AllocationCounter::IsEnabled(void)
+{
+    return false;
+}
+
+unsigned long long AllocationCounter::GetAllocations(void)
+{
+    return 0;
+}
+
+unsigned long long AllocationCounter::GetBytes(void)
+{
+    return 0;
+}
+
+unsigned long long AllocationCounter::GetThreadAllocations(void)
+{
+    return 0;
+}
+
+unsigned long long AllocationCounter::GetThreadLargeAllocations(void)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+// Counts of every heap allocation, only kept when built with CONFIG+=alloccount (ALLOCATION_COUNTER)
+
+// Allocations this size or larger are frame sized, and are the ones that fragment the heap
+#define ALLOCATION_LARGE_SIZE 65536
+
+class AllocationCounter
+{
+public:
+    static bool IsEnabled(void);
+    static unsigned long long GetAllocations(void);
+    static unsigned long long GetBytes(void);
+    static unsigned long long GetThreadAllocations(void);
+    static unsigned long long GetThreadLargeAllocations(void);
+};
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,249 @@
+/***
+ * RadioViz - audiomixer.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Program audio. Each camera's mic fills a lock free ring from its own audio callback, and the output
+ *              callback here mixes from the rings, so the mixer never waits, locks or allocates. The GUI thread only
+ *              sets a target gain per mic and the callback ramps to it over the crossfade time.
+ *
+ *              Follow mode puts the mics of the cameras on program in the mix, so audio follows the cuts. Auto mode
+ *              mixes every mic that is being heard and ducks the rest.
+ *
+ *              The mics and the output run off different clocks. Each callback takes one buffer from every ring;
+ *              if a ring has more than the latency allows we skip its oldest samples, and if it runs short we
+ *              pad with silence, so the program audio stays within the latency of the video.
+ *
+ */
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "audiomixer.h"
+
+AudioMixer::AudioMixer()
+{
+    stream = NULL;
+    mode = AUDIO_MIX_OFF;
+    inputCount = 0;
+    latencyFrames = 0;
+    fadeFrames.store(1);
+    mixCount.store(0);
+    underruns.store(0);
+    skipped.store(0);
+
+    for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++) {
+        inputs[i].store(NULL);
+        targets[i].store(0);
+        activeUntil[i] = 0;
+        gains[i] = 0;
+        rampTargets[i] = 0;
+        rampSteps[i] = 0;
+    }
+}
+
+AudioMixer::~AudioMixer()
+{
+    Close();
+}
+
+qint64 AudioMixer::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/***
+ * Open Mixer
+ * Author: Matthew Ribbins
+ * Description: Start the program audio output on a PortAudio device (-1 for the default), with latency and
+ *              crossfade times in ms
+ *
+ * Return: (bool) true if the output is running
+ */
+bool AudioMixer::Open(int device, int latency, int fade)
+{
+    PaStreamParameters outputParameters;
+    PaError err;
+
+    if(stream) return true;
+
+    outputParameters.device = (device < 0) ? Pa_GetDefaultOutputDevice() : device;
+    if(paNoDevice == outputParameters.device) {
+        LOG_ERROR(LOG_AUDIO, "Error: No audio output for the program audio");
+        return false;
+    }
+    outputParameters.channelCount = AUDIO_MIX_CHANNELS;
+    outputParameters.sampleFormat = paFloat32;
+    outputParameters.suggestedLatency = latency / 1000.0;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+
+    latencyFrames = latency * AUDIO_MIX_SAMPLE_RATE / 1000;
+    fadeFrames.store((fade > 0) ? fade * AUDIO_MIX_SAMPLE_RATE / 1000 : 1);
+
+    err = Pa_OpenStream(&stream, NULL, &outputParameters, AUDIO_MIX_SAMPLE_RATE, AUDIO_MIX_BUFFER, paClipOff, Callback, this);
+    if(paNoError == err)
+        err = Pa_StartStream(stream);
+    if(paNoError != err) {
+        LOG_ERROR(LOG_AUDIO, "Error: Could not start the program audio: %s", Pa_GetErrorText(err));
+        if(stream) Pa_CloseStream(stream);
+        stream = NULL;
+        return false;
+    }
+
+    const PaStreamInfo *info = Pa_GetStreamInfo(stream);
+    LOG_INFO(LOG_AUDIO, "Program audio on %s, output latency %.1f ms", Pa_GetDeviceInfo(outputParameters.device)->name,
+             info ? info->outputLatency * 1000 : 0.0);
+    return true;
+}
+
+void AudioMixer::Close(void)
+{
+    if(!stream) return;
+    Pa_StopStream(stream);
+    Pa_CloseStream(stream);
+    stream = NULL;
+}
+
+bool AudioMixer::IsOpen(void)
+{
+    return (NULL != stream);
+}
+
+/***
+ * Set Input
+ * Author: Matthew Ribbins
+ * Description: Mix from a source's mic ring. The ring must outlive the mixer's output.
+ */
+void AudioMixer::SetInput(int sourceId, AudioRing *ring)
+{
+    if(sourceId < 0 || sourceId >= MAX_CAMERAS_AVAILABLE) return;
+    inputs[sourceId].store(ring, std::memory_order_release);
+    if(sourceId >= inputCount) {
+        inputCount = sourceId + 1;
+        mixCount.store(inputCount, std::memory_order_release);
+    }
+}
+
+void AudioMixer::SetMode(int mode)
+{
+    this->mode = mode;
+}
+
+/***
+ * Set Active
+ * Author: Matthew Ribbins
+ * Description: Which sources should be heard: the ones on program in follow mode, or the ones over the audio
+ *              threshold in auto mode. Those in the mix share it equally in power, the rest are off in follow mode
+ *              or ducked in auto mode.
+ */
+void AudioMixer::SetActive(const bool *active, int count)
+{
+    bool heard[MAX_CAMERAS_AVAILABLE];
+    int heardCount = 0;
+    qint64 now = Now();
+    float off = (AUDIO_MIX_AUTO == mode) ? powf(10, AUDIO_MIX_DUCK / 20.0f) : 0;
+
+    if(count > MAX_CAMERAS_AVAILABLE) count = MAX_CAMERAS_AVAILABLE;
+    for(int i = 0; i < count; i++) {
+        heard[i] = active[i];
+        if(AUDIO_MIX_AUTO == mode) {
+            if(active[i]) activeUntil[i] = now + AUDIO_MIX_HOLD * 1000000LL;
+            heard[i] = (now < activeUntil[i]);
+        }
+        heardCount += heard[i];
+    }
+
+    float on = heardCount ? 1 / sqrtf(heardCount) : 0;
+    for(int i = 0; i < count; i++) {
+        float target = heard[i] ? on : off;
+        if(target != targets[i].load(std::memory_order_relaxed))
+            targets[i].store(target, std::memory_order_relaxed);
+    }
+}
+
+/***
+ * Get Stats
+ * Author: Matthew Ribbins
+ * Description: Since the last call: samples padded because a mic ran short, skipped because it ran ahead, and
+ *              dropped because a ring was full
+ */
+void AudioMixer::GetStats(unsigned int &underruns, unsigned int &skipped, unsigned int &dropped)
+{
+    underruns = this->underruns.exchange(0, std::memory_order_relaxed);
+    skipped = this->skipped.exchange(0, std::memory_order_relaxed);
+    dropped = 0;
+    for(int i = 0; i < inputCount; i++) {
+        AudioRing *ring = inputs[i].load(std::memory_order_acquire);
+        if(ring) dropped += ring->TakeDropped();
+    }
+}
+
+int AudioMixer::Callback(const void *, void *output, unsigned long frames, const PaStreamCallbackTimeInfo *,
+                         PaStreamCallbackFlags, void *userData)
+{
+    AudioMixer *mixer = (AudioMixer *)userData;
+    float *out = (float *)output;
+
+    // PortAudio should give us AUDIO_MIX_BUFFER frames, but doesn't have to
+    while(frames) {
+        unsigned long chunk = (frames < AUDIO_MIX_BUFFER) ? frames : AUDIO_MIX_BUFFER;
+        mixer->Mix(out, chunk);
+        out += chunk * AUDIO_MIX_CHANNELS;
+        frames -= chunk;
+    }
+    return paContinue;
+}
+
+/***
+ * Mix
+ * Author: Matthew Ribbins
+ * Description: One buffer of program audio, at most AUDIO_MIX_BUFFER frames. Runs on PortAudio's callback thread.
+ */
+void AudioMixer::Mix(float *output, unsigned long frames)
+{
+    int count = mixCount.load(std::memory_order_acquire);
+    int fade = fadeFrames.load(std::memory_order_relaxed);
+
+    memset(mix, 0, frames * sizeof(float));
+
+    for(int i = 0; i < count; i++) {
+        AudioRing *ring = inputs[i].load(std::memory_order_acquire);
+        if(!ring) continue;
+
+        // Keep no more than the latency waiting, and take one buffer
+        unsigned int available = ring->GetAvailable();
+        if(available > latencyFrames + frames)
+            skipped.fetch_add(ring->Skip(available - latencyFrames - frames), std::memory_order_relaxed);
+        unsigned int got = ring->Pop(samples, frames);
+        if(got < frames) {
+            underruns.fetch_add(frames - got, std::memory_order_relaxed);
+            memset(samples + got, 0, (frames - got) * sizeof(float));
+        }
+
+        float target = targets[i].load(std::memory_order_relaxed);
+        if(target != rampTargets[i]) {
+            rampTargets[i] = target;
+            rampSteps[i] = (target - gains[i]) / fade;
+        }
+        if(!gains[i] && !target) continue;
+
+        float gain = gains[i];
+        float step = rampSteps[i];
+        for(unsigned long s = 0; s < frames; s++) {
+            if(gain != target) {
+                gain += step;
+                if((step > 0 && gain > target) || (step < 0 && gain < target)) gain = target;
+            }
+            mix[s] += samples[s] * gain;
+        }
+        gains[i] = gain;
+    }
+
+    for(unsigned long s = 0; s < frames; s++) {
+        float sample = mix[s];
+        if(sample > 1) sample = 1;
+        if(sample < -1) sample = -1;
+        for(int c = 0; c < AUDIO_MIX_CHANNELS; c++)
+            *output++ = sample;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+#include <portaudiocpp/PortAudioCpp.hxx>
+#include <atomic>
+
+#include "camera.h"
+#include "logger.h"
+#include "radioviz.h"
+
+// Auto mix: a mic stays in the mix this long after it was last heard (ms), so it isn't ducked between words
+#define AUDIO_MIX_HOLD 500
+
+class AudioMixer
+{
+public:
+    AudioMixer();
+    ~AudioMixer();
+    bool Open(int device, int latency, int fade);
+    void Close(void);
+    bool IsOpen(void);
+
+    // GUI thread
+    void SetInput(int sourceId, AudioRing *ring);
+    void SetMode(int mode);
+    void SetActive(const bool *active, int count);
+    void GetStats(unsigned int &underruns, unsigned int &skipped, unsigned int &dropped);
+
+private:
+    static int Callback(const void *input, void *output, unsigned long frames,
+                        const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags flags, void *userData);
+    void Mix(float *output, unsigned long frames);
+    static qint64 Now(void);
+
+    PaStream *stream;
+    int mode;
+    int inputCount;
+    unsigned int latencyFrames;
+    qint64 activeUntil[MAX_CAMERAS_AVAILABLE];
+
+    // GUI thread to callback
+    std::atomic<AudioRing *> inputs[MAX_CAMERAS_AVAILABLE];
+    std::atomic<float> targets[MAX_CAMERAS_AVAILABLE];
+    std::atomic<int> fadeFrames;
+    std::atomic<int> mixCount;
+
+    // Callback only
+    float gains[MAX_CAMERAS_AVAILABLE];
+    float rampTargets[MAX_CAMERAS_AVAILABLE];
+    float rampSteps[MAX_CAMERAS_AVAILABLE];
+    float samples[AUDIO_MIX_BUFFER];
+    float mix[AUDIO_MIX_BUFFER];
+
+    std::atomic<unsigned int> underruns;
+    std::atomic<unsigned int> skipped;
+};
+
+#endif // AUDIOMIXER_H
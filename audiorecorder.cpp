@@ -0,0 +1,419 @@
+/***
+ * RadioViz - audiorecorder.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Every camera mic recorded to its own track for post production. The mics' audio callbacks push
+ *              their samples into a ring each (see Camera::EnableAudioRecording) and never wait on us. This thread
+ *              empties every ring each AUDIO_RECORD_INTERVAL and writes each track's samples with one write(), into
+ *              file space allocated AUDIO_RECORD_PREALLOCATE seconds ahead, so the files don't fragment and a
+ *              write rarely has to wait for the filesystem to find blocks.
+ *
+ *              Tracks are kept in line with each other and the clock: anything a ring had to drop because we fell
+ *              behind (an overrun) is replaced with silence, as is any gap of more than AUDIO_RECORD_MAX_LAG where
+ *              a mic gave us nothing (an underrun). Both are counted in samples.
+ *
+ *              Files are named for when recording started and the source, e.g. mics-20150401-153000-2.wav, and
+ *              start a new part (mics-20150401-153000-2-2.wav) every AUDIO_RECORD_MAX_FILE MB, well inside WAV's
+ *              4 GB. The header's sizes are brought up to date whenever more space is allocated, so after a crash
+ *              a file is short by at most AUDIO_RECORD_PREALLOCATE seconds.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "audiorecorder.h"
+
+AudioRecorder::AudioRecorder(QObject *parent)
+    : QThread(parent)
+{
+    trackCount = 0;
+    sourceCount = 0;
+    running = false;
+    startTime = 0;
+    preallocate = true;
+    stamp[0] = '\0';
+    for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++) {
+        tracks[i].sourceId = -1;
+        tracks[i].ring = NULL;
+        tracks[i].fd = -1;
+        tracks[i].underruns.store(0);
+        tracks[i].overruns.store(0);
+    }
+    memset(silence, 0, sizeof(silence));
+    failed.store(0);
+}
+
+AudioRecorder::~AudioRecorder()
+{
+    Stop();
+}
+
+qint64 AudioRecorder::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/***
+ * Add Track
+ * Author: Matthew Ribbins
+ * Description: Record a source's mic from its record ring. Tracks are added before recording starts.
+ *
+ * Return: (bool) false if we are already recording, or have a track for every source we can
+ */
+bool AudioRecorder::AddTrack(int sourceId, RecordRing *ring)
+{
+    if(IsRecording() || !ring || trackCount >= MAX_CAMERAS_AVAILABLE) return false;
+
+    tracks[trackCount].sourceId = sourceId;
+    tracks[trackCount].ring = ring;
+    trackCount++;
+    return true;
+}
+
+/***
+ * Add Sources
+ * Author: Matthew Ribbins
+ * Description: A track for every source whose mic we can capture. Sources without one are logged and left out:
+ *              remote cameras (a node only sends us its scores, not its audio), mics that can't capture at
+ *              AUDIO_MIX_SAMPLE_RATE, and any source added once recording has started, see CheckSources().
+ *
+ * Return: (int) tracks we have
+ */
+int AudioRecorder::AddSources(SourceRegistry *sources, const QByteArray &studioName)
+{
+    this->studioName = studioName;
+
+    for(int i = 0; i < sources->GetCount(); i++) {
+        Camera *camera = sources->GetCamera(i);
+        if(!camera->HasAudioDevice())
+            LOG_WARNING(LOG_AUDIO, "%sWarning: Camera %d has no local mic, e.g. it is on a node, not recording it",
+                        studioName.constData(), i);
+        else if(!camera->EnableAudioRecording())
+            LOG_WARNING(LOG_AUDIO, "%sWarning: Camera %d's mic won't capture at %d Hz, not recording it",
+                        studioName.constData(), i, AUDIO_MIX_SAMPLE_RATE);
+        else
+            AddTrack(i, camera->GetRecordRing());
+    }
+    sourceCount = sources->GetCount();
+    return trackCount;
+}
+
+/***
+ * Check Sources
+ * Author: Matthew Ribbins
+ * Description: Log any source added since AddSources(), e.g. a node that connected late. Tracks can't be added
+ *              while recording, so they aren't recorded.
+ */
+void AudioRecorder::CheckSources(SourceRegistry *sources)
+{
+    if(!IsRecording()) return;
+
+    for(; sourceCount < sources->GetCount(); sourceCount++)
+        LOG_WARNING(LOG_AUDIO, "%sWarning: Camera %d was added after recording started, not recording it",
+                    studioName.constData(), sourceCount);
+}
+
+/***
+ * Start Recording
+ * Author: Matthew Ribbins
+ * Description: Open a file for every track in directory, named name-<start time>-<source>.wav
+ *
+ * Return: (bool) false if there are no tracks or none of the files could be made
+ */
+bool AudioRecorder::Start(const QString &directory, const QString &name)
+{
+    time_t now = time(NULL);
+    struct tm local;
+    int opened = 0;
+
+    if(IsRecording() || !trackCount) return false;
+
+    this->directory = directory.toLocal8Bit();
+    this->name = name.toLocal8Bit();
+    localtime_r(&now, &local);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+    mkdir(this->directory.constData(), 0755);
+    preallocate = true;
+    for(int i = 0; i < trackCount; i++) {
+        tracks[i].part = 0;
+        tracks[i].samples = 0;
+        tracks[i].stalled = false;
+        opened += OpenFile(tracks[i]);
+    }
+    if(!opened) return false;
+
+    // Only what is captured from now on
+    for(int i = 0; i < trackCount; i++) {
+        tracks[i].ring->Skip(tracks[i].ring->GetAvailable());
+        tracks[i].ring->TakeDropped();
+    }
+    startTime = Now();
+    running = true;
+    start();
+
+    LOG_INFO(LOG_AUDIO, "Recording %d mics to %s/%s-%s-*.wav", trackCount, this->directory.constData(),
+             this->name.constData(), stamp);
+    return true;
+}
+
+void AudioRecorder::Stop(void)
+{
+    if(!IsRecording()) return;
+    running = false;
+    wait();
+    for(int i = 0; i < trackCount; i++)
+        FinishFile(tracks[i]);
+    LOG_INFO(LOG_AUDIO, "Recording stopped after %.1f s", tracks[0].samples / (double)AUDIO_MIX_SAMPLE_RATE);
+}
+
+bool AudioRecorder::IsRecording(void)
+{
+    return running || isRunning();
+}
+
+int AudioRecorder::GetTrackCount(void)
+{
+    return trackCount;
+}
+
+/***
+ * Get Track Stats
+ * Author: Matthew Ribbins
+ * Description: Samples of silence put in a track since recording started, for gaps from the mic (underruns) and
+ *              for samples its ring had to drop (overruns)
+ */
+void AudioRecorder::GetTrackStats(int track, unsigned int &underruns, unsigned int &overruns)
+{
+    underruns = 0;
+    overruns = 0;
+    if(track < 0 || track >= trackCount) return;
+    underruns = tracks[track].underruns.load(std::memory_order_relaxed);
+    overruns = tracks[track].overruns.load(std::memory_order_relaxed);
+}
+
+/***
+ * Get Stats
+ * Author: Matthew Ribbins
+ * Description: Underruns and overruns over every track since recording started, and samples we couldn't write
+ *              since the last call
+ */
+void AudioRecorder::GetStats(unsigned int &underruns, unsigned int &overruns, unsigned int &failed)
+{
+    underruns = 0;
+    overruns = 0;
+    for(int i = 0; i < trackCount; i++) {
+        underruns += tracks[i].underruns.load(std::memory_order_relaxed);
+        overruns += tracks[i].overruns.load(std::memory_order_relaxed);
+    }
+    failed = this->failed.exchange(0);
+}
+
+/***
+ * Open File
+ * Author: Matthew Ribbins
+ * Description: Make the track's next file and write its header
+ *
+ * Return: (bool) false if it couldn't be made
+ */
+bool AudioRecorder::OpenFile(RecordTrack &track)
+{
+    int length = snprintf(track.path, sizeof(track.path), "%s/%s-%s-%d", directory.constData(), name.constData(),
+                          stamp, track.sourceId + 1);
+    if(track.part)
+        length += snprintf(track.path + length, sizeof(track.path) - length, "-%d", track.part + 1);
+    snprintf(track.path + length, sizeof(track.path) - length, ".wav");
+
+    track.dataBytes = 0;
+    track.allocated = 0;
+    track.fd = open(track.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(track.fd < 0) {
+        LOG_ERROR(LOG_AUDIO, "Error: Can't record to %s, %s", track.path, strerror(errno));
+        return false;
+    }
+    WriteHeader(track);
+    if(lseek(track.fd, AUDIO_RECORD_HEADER_SIZE, SEEK_SET) < 0) {
+        close(track.fd);
+        track.fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/***
+ * Finish File
+ * Author: Matthew Ribbins
+ * Description: Give back the space allocated past the end and write the final sizes
+ */
+void AudioRecorder::FinishFile(RecordTrack &track)
+{
+    if(track.fd < 0) return;
+
+    if(ftruncate(track.fd, AUDIO_RECORD_HEADER_SIZE + track.dataBytes)) {
+        // Still a valid file, with the spare space on the end
+    }
+    WriteHeader(track);
+    close(track.fd);
+    track.fd = -1;
+}
+
+static void PutLittle(unsigned char *at, unsigned int value, int bytes)
+{
+    for(int i = 0; i < bytes; i++)
+        at[i] = (value >> (8 * i)) & 0xff;
+}
+
+/***
+ * Write Header
+ * Author: Matthew Ribbins
+ * Description: RIFF header with the sizes of what has been written so far
+ */
+void AudioRecorder::WriteHeader(RecordTrack &track)
+{
+    unsigned char header[AUDIO_RECORD_HEADER_SIZE];
+    unsigned int dataBytes = (unsigned int)track.dataBytes;
+
+    memcpy(header, "RIFF", 4);
+    PutLittle(header + 4, AUDIO_RECORD_HEADER_SIZE - 8 + dataBytes, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    PutLittle(header + 16, 18, 4);                                  // fmt chunk size
+    PutLittle(header + 20, 3, 2);                                   // WAVE_FORMAT_IEEE_FLOAT
+    PutLittle(header + 22, 1, 2);                                   // channels
+    PutLittle(header + 24, AUDIO_MIX_SAMPLE_RATE, 4);
+    PutLittle(header + 28, AUDIO_MIX_SAMPLE_RATE * sizeof(float), 4);
+    PutLittle(header + 32, sizeof(float), 2);                       // block align
+    PutLittle(header + 34, 32, 2);                                  // bits per sample
+    PutLittle(header + 36, 0, 2);                                   // no extra format bytes
+    memcpy(header + 38, "fact", 4);
+    PutLittle(header + 42, 4, 4);
+    PutLittle(header + 46, dataBytes / sizeof(float), 4);
+    memcpy(header + 50, "data", 4);
+    PutLittle(header + 54, dataBytes, 4);
+
+    if(pwrite(track.fd, header, sizeof(header), 0) != (ssize_t)sizeof(header))
+        LOG_WARNING(LOG_AUDIO, "Warning: Couldn't update %s's header", track.path);
+}
+
+/***
+ * Append
+ * Author: Matthew Ribbins
+ * Description: Write samples to the end of a track, moving on to a new file or allocating more space first if need
+ *              be. If the track's file has failed the samples are counted and lost.
+ */
+void AudioRecorder::Append(RecordTrack &track, const float *samples, unsigned int count)
+{
+    long long bytes = (long long)count * sizeof(float);
+
+    track.samples += count;
+    if(track.fd < 0) {
+        failed += count;
+        return;
+    }
+
+    if(track.dataBytes + bytes > (long long)AUDIO_RECORD_MAX_FILE * 1024 * 1024) {
+        FinishFile(track);
+        track.part++;
+        if(!OpenFile(track)) {
+            failed += count;
+            return;
+        }
+    }
+
+    // Allocating doesn't change the file's size, what is past the end is given back when it is finished
+    if(track.dataBytes + bytes > track.allocated) {
+        long long ahead = (long long)AUDIO_RECORD_PREALLOCATE * AUDIO_MIX_SAMPLE_RATE * sizeof(float);
+        if(preallocate && fallocate(track.fd, FALLOC_FL_KEEP_SIZE, AUDIO_RECORD_HEADER_SIZE + track.allocated, ahead)) {
+            if(EOPNOTSUPP == errno) {
+                LOG_WARNING(LOG_AUDIO, "Warning: Can't allocate space ahead for recordings on this filesystem");
+                preallocate = false;
+            }
+        }
+        track.allocated += ahead;
+        WriteHeader(track);
+    }
+
+    const char *data = (const char *)samples;
+    while(bytes) {
+        ssize_t result = write(track.fd, data, bytes);
+        if(result < 0 && EINTR == errno) continue;
+        if(result <= 0) {
+            LOG_ERROR(LOG_AUDIO, "Error: Recording to %s failed, %s", track.path, strerror(errno));
+            failed += bytes / sizeof(float);
+            FinishFile(track);
+            return;
+        }
+        data += result;
+        bytes -= result;
+        track.dataBytes += result;
+    }
+}
+
+void AudioRecorder::Pad(RecordTrack &track, long long count)
+{
+    while(count > 0) {
+        unsigned int length = (count > AUDIO_RECORD_RING_SIZE) ? AUDIO_RECORD_RING_SIZE : (unsigned int)count;
+        Append(track, silence, length);
+        count -= length;
+    }
+}
+
+/***
+ * Drain
+ * Author: Matthew Ribbins
+ * Description: Write out everything in a track's ring, with silence for whatever it dropped, and silence up to
+ *              expected (samples since we started) if the mic has stopped and fallen more than AUDIO_RECORD_MAX_LAG
+ *              behind
+ */
+void AudioRecorder::Drain(RecordTrack &track, long long expected)
+{
+    unsigned int count = track.ring->Pop(batch, AUDIO_RECORD_RING_SIZE);
+    unsigned int dropped = track.ring->TakeDropped();
+
+    if(count) Append(track, batch, count);
+    if(dropped) {
+        Pad(track, dropped);
+        track.overruns.fetch_add(dropped, std::memory_order_relaxed);
+    }
+
+    // Only while the mic is giving us nothing, so a mic whose clock is a little slow isn't padded now and again.
+    // Once it has stopped we keep it up to the clock until it starts again.
+    long long behind = expected - track.samples;
+    if(count) {
+        track.stalled = false;
+    } else if(behind > 0 && (track.stalled || behind > (long long)AUDIO_RECORD_MAX_LAG * AUDIO_MIX_SAMPLE_RATE / 1000)) {
+        Pad(track, behind);
+        track.underruns.fetch_add((unsigned int)behind, std::memory_order_relaxed);
+        track.stalled = true;
+    }
+}
+
+/***
+ * Recorder Thread Loop
+ * Author: Matthew Ribbins
+ */
+void AudioRecorder::run()
+{
+    Logger::SetThreadName("recorder");
+    ThreadPolicy::Apply(THREAD_CLASS_NETWORK, "recorder");
+
+    while(running) {
+        ThreadPolicy::Sleep(AUDIO_RECORD_INTERVAL * 1000);
+
+        EVENT_SCOPE("record", -1);
+        long long expected = (Now() - startTime) * AUDIO_MIX_SAMPLE_RATE / 1000000000LL;
+        for(int i = 0; i < trackCount; i++)
+            Drain(tracks[i], expected);
+    }
+
+    // Whatever came in since the last pass
+    for(int i = 0; i < trackCount; i++) {
+        unsigned int count = tracks[i].ring->Pop(batch, AUDIO_RECORD_RING_SIZE);
+        if(count) Append(tracks[i], batch, count);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef AUDIORECORDER_H
+#define AUDIORECORDER_H
+
+#include <QThread>
+#include <QString>
+#include <QByteArray>
+#include <atomic>
+
+#include "camera.h"
+#include "sourceregistry.h"
+#include "threadpolicy.h"
+#include "logger.h"
+#include "radioviz.h"
+
+// Tracks are mono 32 bit float WAV (WAVE_FORMAT_IEEE_FLOAT, with the fact chunk that needs), samples from byte
+// AUDIO_RECORD_HEADER_SIZE
+#define AUDIO_RECORD_HEADER_SIZE 58
+#define AUDIO_RECORD_PATH_SIZE 512
+
+typedef struct _RecordTrack {
+    int sourceId;
+    RecordRing *ring;
+    int fd;
+    int part;
+    char path[AUDIO_RECORD_PATH_SIZE];
+    long long dataBytes;    // written to the current file
+    long long allocated;    // file space allocated for the current file
+    long long samples;      // since recording started, including any silence
+    bool stalled;           // the mic has stopped and we are padding it
+    std::atomic<unsigned int> underruns;
+    std::atomic<unsigned int> overruns;
+} RecordTrack;
+
+class AudioRecorder : public QThread
+{
+public:
+    AudioRecorder(QObject *parent = 0);
+    ~AudioRecorder();
+
+    // GUI thread
+    bool AddTrack(int sourceId, RecordRing *ring);
+    int AddSources(SourceRegistry *sources, const QByteArray &studioName);
+    void CheckSources(SourceRegistry *sources);
+    bool Start(const QString &directory, const QString &name);
+    void Stop(void);
+    bool IsRecording(void);
+    int GetTrackCount(void);
+    void GetTrackStats(int track, unsigned int &underruns, unsigned int &overruns);
+    void GetStats(unsigned int &underruns, unsigned int &overruns, unsigned int &failed);
+
+protected:
+    void run();
+
+private:
+    bool OpenFile(RecordTrack &track);
+    void FinishFile(RecordTrack &track);
+    void WriteHeader(RecordTrack &track);
+    void Append(RecordTrack &track, const float *samples, unsigned int count);
+    void Pad(RecordTrack &track, long long count);
+    void Drain(RecordTrack &track, long long expected);
+    static qint64 Now(void);
+
+    RecordTrack tracks[MAX_CAMERAS_AVAILABLE];
+    int trackCount;
+    int sourceCount;
+    QByteArray studioName;
+    QByteArray directory;
+    QByteArray name;
+    char stamp[32];
+    volatile bool running;
+    qint64 startTime;
+    bool preallocate;
+
+    // Writer only
+    float batch[AUDIO_RECORD_RING_SIZE];
+    float silence[AUDIO_RECORD_RING_SIZE];
+
+    // Samples we couldn't write, e.g. the disk is full
+    std::atomic<unsigned int> failed;
+};
+
+#endif // AUDIORECORDER_H
@@ -1,83 +1,120 @@
-#if 0
-// Audio detection QThread
-class AudioWorker : public QObject {
-    Q_OBJECT
-
-public:
-    AudioWorker(char *cameraArr, int availableCamera);
-    ~AudioWorker();
-
-public slots:
-    void process();
-
-signals:
-    void finished();
-    void error(QString err);
-
-private:
-    Camera *camera[MAX_CAMERAS_AVAILABLE];
-    int availableCameras;
-    int changeCamera;
-};
+/***
+ * RadioViz - audioworker.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Audio thread. Collects every source's level, so the GUI thread only picks up the latest levels. Each
+ *              mic keeps its own level from its audio callback (see Camera::InitialiseAudio), so nothing here waits
+ *              on a device, and one thread can serve every studio in the process without one studio's mics
+ *              slowing another's.
+ *
+ */
+#include "audioworker.h"
+
+AudioWorker::AudioWorker(QObject *parent)
+    : QThread(parent)
+{
+    this->running.store(false);
+    this->studioCount.store(0);
+    for(int s = 0; s < MAX_STUDIOS; s++) {
+        studios[s] = NULL;
+        sourceCounts[s].store(0);
+        for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++)
+            levels[s][i].store(AUDIO_LEVEL_SILENCE);
+    }
+}
 
 /***
- * AudioWorker Thread
+ * Start Audio Thread
+ * Author: Matthew Ribbins
+ * Description: running is set here rather than in run(), which only reads it, so a Stop() that comes before
+ *              the thread gets going still stops it
  */
-AudioWorker::AudioWorker(char *cameraArr, int availableCameras) {
-   // &this->camera = (Camera **)&cameraArr;
-    *this->camera = (Camera *)&cameraArr;
-    this->availableCameras = availableCameras;
+void AudioWorker::Start(QThread::Priority priority)
+{
+    running.store(true);
+    start(priority);
 }
 
-AudioWorker::~AudioWorker() {
-    // free resources
+/***
+ * Stop Audio Thread
+ * Author: Matthew Ribbins
+ * Description: Ask the thread to stop and wait for it
+ */
+void AudioWorker::Stop(void)
+{
+    running.store(false);
+    wait();
 }
 
-void AudioWorker::process() {
-    int levels[availableCameras];
-    bool active[availableCameras];
-    int activeCount = 0;
-    int loudestCamera = 0;
-    float loudestCameraLevel = 0;
+/***
+ * Add Studio
+ * Author: Matthew Ribbins
+ * Description: Read a studio's sources as well. Studios are only ever added, from the GUI thread.
+ *
+ * Return: (int) the studio's number for the calls below, or -1 if there are already MAX_STUDIOS
+ */
+int AudioWorker::AddStudio(SourceRegistry *sources)
+{
+    int studio = studioCount.load(std::memory_order_relaxed);
+
+    if(studio >= MAX_STUDIOS) return -1;
+    studios[studio] = sources;
+    studioCount.store(studio + 1, std::memory_order_release);
+    return studio;
+}
 
-    memset((void *)&active, 0, sizeof(bool)*availableCameras);
+/***
+ * Set Source Count
+ * Author: Matthew Ribbins
+ * Description: How many of a studio's sources to read. Sources are only ever added, so the GUI thread passes the
+ *              count on once a new source is in the registry.
+ */
+void AudioWorker::SetSourceCount(int studio, int count)
+{
+    if(studio < 0 || studio >= MAX_STUDIOS) return;
+    if(count > MAX_CAMERAS_AVAILABLE) count = MAX_CAMERAS_AVAILABLE;
+    sourceCounts[studio].store(count, std::memory_order_release);
+}
 
-    // Get current values
-    for(int i = 0; i < availableCameras; i++) {
-        levels[i] = camera[i]->GetAudioLevelFromDevice();
+float AudioWorker::GetLevel(int studio, int cameraId)
+{
+    if(studio < 0 || studio >= MAX_STUDIOS) return AUDIO_LEVEL_SILENCE;
+    if(cameraId < 0 || cameraId >= MAX_CAMERAS_AVAILABLE) return AUDIO_LEVEL_SILENCE;
+    return levels[studio][cameraId].load(std::memory_order_relaxed);
+}
 
-        if(levels[i] > loudestCameraLevel) {
-            loudestCamera = i;
-            loudestCameraLevel = levels[i];
+/***
+ * Audio Thread Loop
+ * Author: Matthew Ribbins
+ * Description: Collect each source's level once per AUDIO_POLL_INTERVAL
+ */
+void AudioWorker::run()
+{
+    Logger::SetThreadName("audio");
+    ThreadPolicy::Apply(THREAD_CLASS_AUDIO, "audio");
+
+    while(running.load(std::memory_order_relaxed)) {
+        qint64 start = ThreadPolicy::Now();
+        int count[MAX_STUDIOS];
+        int most = 0;
+        int studioTotal = studioCount.load(std::memory_order_acquire);
+
+        for(int s = 0; s < studioTotal; s++) {
+            count[s] = sourceCounts[s].load(std::memory_order_acquire);
+            if(count[s] > most) most = count[s];
         }
 
-        if(levels[i] > CAMERA_AUDIO_THRESHOLD) {
-            active[i] = true;
-            activeCount++;
+        // Each studio's first source, then each studio's second, and so on
+        for(int i = 0; i < most; i++) {
+            for(int s = 0; s < studioTotal; s++) {
+                if(i >= count[s]) continue;
+                EVENT_SCOPE("meter", i);
+                levels[s][i].store(studios[s]->GetCamera(i)->GetAudioLevelFromDevice(), std::memory_order_relaxed);
+            }
         }
-    }
+        ThreadPolicy::Tick();
 
-    if(activeCount) {
-        if(activeCount > 2) {
-            changeCamera = (loudestCamera);
-        } else {
-            changeCamera = (loudestCamera);
-        }
+        qint64 remaining = AUDIO_POLL_INTERVAL * 1000LL - (ThreadPolicy::Now() - start) / 1000;
+        if(remaining > 0)
+            ThreadPolicy::Sleep(remaining);
     }
 }
-
-/****
-        QThread *thread = new QThread;
-        AudioWorker *audioWorker = new AudioWorker((char *)&camera, availableCameras);
-
-        audioWorker->moveToThread(thread);
-        connect(audioWorker, SIGNAL(error(QString)), this, SLOT(errorString(QString)));
-        connect(thread, SIGNAL(started()), audioWorker, SLOT(process()));
-        connect(audioWorker, SIGNAL(finished()), thread, SLOT(quit()));
-        connect(audioWorker, SIGNAL(finished()), audioWorker, SLOT(deleteLater()));
-        connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
-        thread->start();
-*/
-#endif
-
-
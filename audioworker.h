@@ -0,0 +1,36 @@
+#ifndef AUDIOWORKER_H
+#define AUDIOWORKER_H
+
+#include <QThread>
+#include <atomic>
+
+#include "camera.h"
+#include "sourceregistry.h"
+#include "threadpolicy.h"
+#include "logger.h"
+#include "radioviz.h"
+
+class AudioWorker : public QThread
+{
+public:
+    AudioWorker(QObject *parent = 0);
+    void Start(QThread::Priority priority = QThread::InheritPriority);
+    void Stop(void);
+
+    // GUI thread
+    int AddStudio(SourceRegistry *sources);
+    void SetSourceCount(int studio, int count);
+    float GetLevel(int studio, int cameraId);
+
+protected:
+    void run();
+
+private:
+    SourceRegistry *studios[MAX_STUDIOS];
+    std::atomic<int> studioCount;
+    std::atomic<int> sourceCounts[MAX_STUDIOS];
+    std::atomic<float> levels[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+    std::atomic<bool> running;
+};
+
+#endif // AUDIOWORKER_H
@@ -0,0 +1,291 @@
+/***
+ * RadioViz - bleeddetector.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Bleed rejection. Every camera mic hears every speaker in a small studio, so the loudest mic can be
+ *              the wrong one. This thread takes the mics' samples from their analysis rings a hop at a time and
+ *              runs GCC-PHAT over every pair, so switching can turn down mics that are hearing someone nearer
+ *              another mic.
+ *
+ *              The delays only mean something if the mics' samples line up. Each mic is its own device, with its
+ *              own latency and its own clock, so the callback stamps its samples with when they were captured and
+ *              every hop we line the mics up by those stamps (see Align()): the devices' latencies are taken out
+ *              at the start, and their clocks drifting apart a sample or so at a time after that, well inside the
+ *              delays being measured.
+ *
+ *              With 8 mics a hop is 8 forward and 28 inverse transforms of BLEED_FRAME samples, a few percent of
+ *              a core; what it costs is logged every BLEED_STATS_INTERVAL.
+ *
+ */
+#include <time.h>
+#include <string.h>
+#include <limits.h>
+
+#include "bleeddetector.h"
+
+BleedDetector::BleedDetector(SourceRegistry *sources, float maxDelay, QObject *parent)
+    : QThread(parent), phat(BLEED_FRAME, SAMPLE_RATE)
+{
+    this->sources = sources;
+    this->maxDelay = maxDelay;
+    this->running.store(false);
+    sourceCount = 0;
+    mics = 0;
+    hopLevel = AUDIO_LEVEL_SILENCE;
+    aligned = false;
+    for(int m = 0; m < GCCPHAT_MAX_MICS; m++) {
+        micSources[m] = -1;
+        cameras[m] = NULL;
+        rings[m] = NULL;
+        skew[m] = 0;
+        frames[m] = history[m];
+    }
+    for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++)
+        bleed[i] = 0;
+    resultTime = 0;
+    statsStart = 0;
+    statsCpu = 0;
+    statsHops = 0;
+    statsUpdates = 0;
+    statsSkewed = 0;
+}
+
+qint64 BleedDetector::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+qint64 BleedDetector::CpuNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void BleedDetector::Start(QThread::Priority priority)
+{
+    running.store(true);
+    start(priority);
+}
+
+void BleedDetector::Stop(void)
+{
+    running.store(false);
+    wait();
+}
+
+/***
+ * Get Bleed
+ * Author: Matthew Ribbins
+ * Description: How sure we are that each source's mic is hearing someone nearer another mic (0-1). Sources
+ *              without an analysed mic, and all of them once the results are old, are 0.
+ */
+void BleedDetector::GetBleed(float *bleed, int count)
+{
+    qint64 oldest = Now() - (qint64)BLEED_RESULT_LIFETIME * 1000000;
+
+    QMutexLocker locker(&resultsMutex);
+    for(int i = 0; i < count && i < MAX_CAMERAS_AVAILABLE; i++)
+        bleed[i] = (resultTime > oldest) ? this->bleed[i] : 0;
+}
+
+/***
+ * Update Mics
+ * Author: Matthew Ribbins
+ * Description: Pick up the analysis rings of any new sources, and line them all up again
+ */
+void BleedDetector::UpdateMics(void)
+{
+    int count = sources->GetCount();
+
+    if(count == sourceCount) return;
+    sourceCount = count;
+
+    mics = 0;
+    for(int i = 0; i < count && mics < GCCPHAT_MAX_MICS; i++) {
+        Camera *camera = sources->GetCamera(i);
+        AudioRing *ring = camera->GetAnalysisRing();
+        if(!ring) continue;
+        micSources[mics] = i;
+        cameras[mics] = camera;
+        rings[mics] = ring;
+        memset(history[mics], 0, sizeof(history[mics]));
+        mics++;
+    }
+    for(int m = 0; m < mics; m++)
+        rings[m]->Skip(rings[m]->GetAvailable());
+    aligned = false;
+
+    phat.SetMics(mics, maxDelay);
+    LOG_INFO(LOG_AUDIO, "Bleed rejection comparing %d mics, %d pairs", mics, mics * (mics - 1) / 2);
+}
+
+/***
+ * Align
+ * Author: Matthew Ribbins
+ * Description: Line the mics up so their next samples were captured at the same moment. When each mic's next
+ *              sample was captured comes from its stamp, and how far that is after the first mic's is averaged
+ *              over BLEED_ALIGN_SMOOTHING hops, as the stamps jitter with the callbacks. A mic more than
+ *              BLEED_MAX_SKEW samples behind the one furthest ahead skips the difference. More than BLEED_REALIGN
+ *              (when we start, or a ring overflowed) starts the averages again.
+ *
+ * Return: (bool) false if a mic hasn't been stamped yet, or had to be left out
+ */
+bool BleedDetector::Align(void)
+{
+    qint64 next[GCCPHAT_MAX_MICS];
+    double furthest;
+    bool restart = false;
+
+    for(int m = 0; m < mics; m++) {
+        unsigned int position;
+        qint64 time;
+        if(!cameras[m]->GetAnalysisStamp(position, time)) {
+            // Capturing but not stamped, so its device can't tell us when: we can't line it up
+            if(rings[m]->GetAvailable() >= BLEED_FRAME) {
+                LOG_WARNING(LOG_AUDIO, "Warning: Source %d's audio device doesn't say when it captured, leaving it out of bleed rejection",
+                            micSources[m] + 1);
+                RemoveMic(m);
+            }
+            return false;
+        }
+
+        // Positions wrap, the difference between them doesn't
+        int fromStamp = (int)(rings[m]->GetReadPosition() - position);
+        next[m] = time + (qint64)fromStamp * 1000000000LL / SAMPLE_RATE;
+    }
+
+    for(int m = 0; m < mics; m++) {
+        double offset = (next[m] - next[0]) * (double)SAMPLE_RATE / 1e9;
+        skew[m] = aligned ? skew[m] + (offset - skew[m]) / BLEED_ALIGN_SMOOTHING : offset;
+        if(!m || skew[m] > furthest) furthest = skew[m];
+    }
+    aligned = true;
+
+    for(int m = 0; m < mics; m++) {
+        double behind = furthest - skew[m];
+        if(behind < BLEED_MAX_SKEW) continue;
+
+        // What it hasn't got yet is skipped next time
+        unsigned int count = rings[m]->Skip((unsigned int)(behind + 0.5));
+        skew[m] += count;
+        if(count > BLEED_REALIGN) restart = true;
+        statsSkewed++;
+    }
+
+    if(restart) phat.Reset();
+    return true;
+}
+
+/***
+ * Remove Mic
+ * Author: Matthew Ribbins
+ * Description: Stop comparing a mic, and line the rest up again
+ */
+void BleedDetector::RemoveMic(int mic)
+{
+    resultsMutex.lock();
+    bleed[micSources[mic]] = 0;
+    resultsMutex.unlock();
+
+    for(int m = mic; m < mics - 1; m++) {
+        micSources[m] = micSources[m + 1];
+        cameras[m] = cameras[m + 1];
+        rings[m] = rings[m + 1];
+        memcpy(history[m], history[m + 1], sizeof(history[m]));
+    }
+    mics--;
+    aligned = false;
+    phat.SetMics(mics, maxDelay);
+}
+
+unsigned int BleedDetector::Fewest(void)
+{
+    unsigned int fewest = UINT_MAX;
+
+    for(int m = 0; m < mics; m++) {
+        unsigned int available = rings[m]->GetAvailable();
+        if(available < fewest) fewest = available;
+    }
+    return fewest;
+}
+
+/***
+ * Read Hop
+ * Author: Matthew Ribbins
+ * Description: Move every mic's frame on by BLEED_HOP samples, once they are in line and all have that many
+ *              waiting. hopLevel is the loudest mic's level over the new samples.
+ *
+ * Return: (bool) false if a mic hasn't got a hop yet
+ */
+bool BleedDetector::ReadHop(void)
+{
+    if(Fewest() < BLEED_HOP || !Align() || Fewest() < BLEED_HOP) return false;
+
+    hopLevel = AUDIO_LEVEL_SILENCE;
+    for(int m = 0; m < mics; m++) {
+        memmove(history[m], history[m] + BLEED_HOP, (BLEED_FRAME - BLEED_HOP) * sizeof(float));
+        rings[m]->Pop(history[m] + BLEED_FRAME - BLEED_HOP, BLEED_HOP);
+
+        float level = Camera::CalculateAudioLevel(history[m] + BLEED_FRAME - BLEED_HOP, BLEED_HOP);
+        if(level > hopLevel) hopLevel = level;
+    }
+    return true;
+}
+
+/***
+ * Report Stats
+ * Author: Matthew Ribbins
+ * Description: Share of a core used, and how many hops had someone talking
+ */
+void BleedDetector::ReportStats(qint64 now)
+{
+    qint64 elapsed = now - statsStart;
+
+    if(elapsed < (qint64)BLEED_STATS_INTERVAL * 1000000) return;
+
+    LOG_INFO(LOG_AUDIO, "Bleed rejection used %.1f%% of a core, %u hops %.2f ms each, %u with speech, %u realigned",
+             100.0 * statsCpu / elapsed, statsHops, statsHops ? statsCpu / 1e6 / statsHops : 0.0, statsUpdates,
+             statsSkewed);
+    statsStart = now;
+    statsCpu = 0;
+    statsHops = 0;
+    statsUpdates = 0;
+    statsSkewed = 0;
+}
+
+/***
+ * Bleed Thread Loop
+ * Author: Matthew Ribbins
+ */
+void BleedDetector::run()
+{
+    Logger::SetThreadName("bleed");
+    ThreadPolicy::Apply(THREAD_CLASS_ANALYSIS, "bleed");
+    statsStart = Now();
+
+    while(running.load(std::memory_order_relaxed)) {
+        UpdateMics();
+        if(mics < 2 || !ReadHop()) {
+            ThreadPolicy::Sleep((mics < 2 ? DECISION_TIMER_INTERVAL : BLEED_POLL_INTERVAL) * 1000);
+            continue;
+        }
+
+        EVENT_SCOPE("bleed", -1);
+        qint64 cpuStart = CpuNow();
+        bool update = (hopLevel > BLEED_GATE);
+        phat.Analyse(frames, update);
+
+        if(update) {
+            QMutexLocker locker(&resultsMutex);
+            for(int m = 0; m < mics; m++)
+                bleed[micSources[m]] = phat.GetBleed(m);
+            resultTime = Now();
+            statsUpdates++;
+        }
+        statsCpu += CpuNow() - cpuStart;
+        statsHops++;
+        ReportStats(Now());
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef BLEEDDETECTOR_H
+#define BLEEDDETECTOR_H
+
+#include <QThread>
+#include <QMutex>
+#include <atomic>
+
+#include "camera.h"
+#include "gccphat.h"
+#include "sourceregistry.h"
+#include "threadpolicy.h"
+#include "logger.h"
+#include "radioviz.h"
+
+class BleedDetector : public QThread
+{
+public:
+    BleedDetector(SourceRegistry *sources, float maxDelay, QObject *parent = 0);
+    void Start(QThread::Priority priority = QThread::InheritPriority);
+    void Stop(void);
+
+    // GUI thread
+    void GetBleed(float *bleed, int count);
+
+protected:
+    void run();
+
+private:
+    void UpdateMics(void);
+    bool Align(void);
+    void RemoveMic(int mic);
+    unsigned int Fewest(void);
+    bool ReadHop(void);
+    void ReportStats(qint64 now);
+    static qint64 Now(void);
+    static qint64 CpuNow(void);
+
+    SourceRegistry *sources;
+    float maxDelay;
+    std::atomic<bool> running;
+    GccPhat phat;
+
+    // Detector thread only. Each mic's last frame, oldest sample first.
+    int sourceCount;
+    int mics;
+    int micSources[GCCPHAT_MAX_MICS];
+    Camera *cameras[GCCPHAT_MAX_MICS];
+    AudioRing *rings[GCCPHAT_MAX_MICS];
+    double skew[GCCPHAT_MAX_MICS];      // samples each mic's next sample was captured after the first mic's
+    bool aligned;
+    float history[GCCPHAT_MAX_MICS][BLEED_FRAME];
+    const float *frames[GCCPHAT_MAX_MICS];
+    float hopLevel;
+
+    // Results, read by the GUI thread
+    QMutex resultsMutex;
+    float bleed[MAX_CAMERAS_AVAILABLE];
+    qint64 resultTime;
+
+    qint64 statsStart;
+    qint64 statsCpu;
+    unsigned int statsHops;
+    unsigned int statsUpdates;
+    unsigned int statsSkewed;
+};
+
+#endif // BLEEDDETECTOR_H
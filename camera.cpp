@@ -4,23 +4,105 @@
  * Description: Camera class, handle camera
  *
  */
+#include <time.h>
+
 #include "camera.h"
 
+int Camera::tierWidth[CAMERA_TIER_COUNT] = { CAMERA_ANALYSIS_RES_WIDTH, CAMERA_DEFAULT_RES_WIDTH };
+int Camera::tierHeight[CAMERA_TIER_COUNT] = { CAMERA_ANALYSIS_RES_HEIGHT, CAMERA_DEFAULT_RES_HEIGHT };
+int Camera::tierFps[CAMERA_TIER_COUNT] = { CAMERA_ANALYSIS_FPS, CAMERA_DEFAULT_FPS };
+int Camera::stallTimeout = CAPTURE_STALL_TIMEOUT;
+
 Camera::Camera()
 {
+    this->audioGain = 0;
+    this->audio = NULL;
+    this->audioDevice = -1;
+    this->audioRing = NULL;
+    this->analysisRing.store(NULL);
+    this->recordRing.store(NULL);
+    this->stampSequence.store(0);
+    this->stampPosition.store(0);
+    this->stampTime.store(0);
+    this->audioLevel.store(AUDIO_LEVEL_SILENCE);
+    this->audioLevelSum = 0;
+    this->audioLevelCount = 0;
+    this->videoMode = CAMERA_MODE_OPENCV;
+    this->frameNumber = 0;
+    this->readyFrameNumber = 0;
+    this->frontFrameNumber = 0;
+    this->frameReady = false;
+    this->timeshift = NULL;
+    this->analysisOnly = false;
+    this->cameraId = -1;
+    this->requestedTier = CAMERA_TIER_FULL;
+    this->captureTier = CAMERA_TIER_FULL;
+    this->settledTier = CAMERA_TIER_FULL;
+    this->fullOnly = false;
+    this->watched = false;
+    this->lastFrameTime.store(0);
+    this->deadline.store(0);
+    this->interrupted.store(false);
+    this->lastReopen = 0;
 }
 
-Camera::Camera(int cameraId, int audioId)
+Camera::Camera(int cameraId, int audioId, int videoMode, int tier)
 {
     this->audioGain = 0;
-    this->videoMode = CAMERA_MODE_OPENCV;
+    this->audio = NULL;
+    this->audioDevice = -1;
+    this->audioRing = NULL;
+    this->analysisRing.store(NULL);
+    this->recordRing.store(NULL);
+    this->stampSequence.store(0);
+    this->stampPosition.store(0);
+    this->stampTime.store(0);
+    this->audioLevel.store(AUDIO_LEVEL_SILENCE);
+    this->audioLevelSum = 0;
+    this->audioLevelCount = 0;
+    this->frameNumber = 0;
+    this->readyFrameNumber = 0;
+    this->frontFrameNumber = 0;
+    this->frameReady = false;
+    this->timeshift = NULL;
+    this->analysisOnly = false;
+    this->videoMode = videoMode;
+    this->cameraId = cameraId;
+    this->requestedTier = tier;
+    this->captureTier = tier;
+    this->settledTier = tier;
+    this->fullOnly = false;
+    this->watched = true;
+    this->lastFrameTime.store(TimeshiftBuffer::Now());
+    this->deadline.store(0);
+    this->interrupted.store(false);
+    this->lastReopen = 0;
     InitialiseAudio(audioId);
     InitialiseVideo(cameraId);
+
+    // Not every device does the analysis format
+    if(!IsVideoValid() && CAMERA_TIER_FULL != tier) {
+        DeinitialiseVideo();
+        this->requestedTier = CAMERA_TIER_FULL;
+        this->captureTier = CAMERA_TIER_FULL;
+        this->settledTier = CAMERA_TIER_FULL;
+        this->fullOnly = true;
+        InitialiseVideo(cameraId);
+    }
 }
 
 Camera::~Camera()
 {
+    // Every mic is capturing through its callback, which must have stopped before the rings go
+    if(audio) {
+        Pa_StopStream(audio);
+        Pa_CloseStream(audio);
+    }
+    delete audioRing;
+    delete analysisRing.load();
+    delete recordRing.load();
     DeinitialiseVideo();
+    delete timeshift;
 }
 
 /***
@@ -62,35 +144,60 @@ void Camera::InitialiseVideo(int cameraId)
  */
 void Camera::InitialiseVideoFFmpeg(int cameraId)
 {
-    int numBytes;
-    uint8_t *buffer;
+    AVDictionary *options = NULL;
+    char option[32];
 
     av_register_all();
 
+    // Nothing left over from before a renegotiation
+    memset(&video, 0, sizeof(video));
+
     video.pFormatCtx = avformat_alloc_context();
     video.pFormatCtx->video_codec_id = AV_CODEC_ID_MJPEG;
     video.pFormatCtx->iformat = av_find_input_format("video4linux2");
     video.streamId = -1;
+    video.pSwsCtx = NULL;
 
+    // Nothing we wait on in FFmpeg can go past the deadline, or carry on once we are shutting down, so a device
+    // that stops can't hold the capture thread
+    video.pFormatCtx->interrupt_callback.callback = InterruptCallback;
+    video.pFormatCtx->interrupt_callback.opaque = this;
+    deadline.store(TimeshiftBuffer::Now() + CAPTURE_OPEN_TIMEOUT);
 
     sprintf(video.pFormatCtx->filename, "/dev/video%d", cameraId);
     qDebug() << "Initialising " << video.pFormatCtx->filename << ".";
 
     avdevice_list_input_sources(video.pFormatCtx->iformat, NULL, NULL, &video.pDeviceList);
 
-    if(avformat_open_input(&video.pFormatCtx, video.pFormatCtx->filename, NULL, NULL) != 0) return;
-    if(avformat_find_stream_info(video.pFormatCtx, NULL) < 0) return;
+    // The full tier is whatever the device gives us by default, as it always has been
+    if(CAMERA_TIER_FULL != captureTier) {
+        snprintf(option, sizeof(option), "%dx%d", tierWidth[captureTier], tierHeight[captureTier]);
+        av_dict_set(&options, "video_size", option, 0);
+        snprintf(option, sizeof(option), "%d", tierFps[captureTier]);
+        av_dict_set(&options, "framerate", option, 0);
+    }
+
+    int result = avformat_open_input(&video.pFormatCtx, video.pFormatCtx->filename, NULL, &options);
+    av_dict_free(&options);
+    if(result != 0) {
+        LOG_DEBUG(LOG_CAMERA, "Camera %d did not open", cameraId);
+        return;
+    }
+    if(avformat_find_stream_info(video.pFormatCtx, NULL) < 0) {
+        LOG_DEBUG(LOG_CAMERA, "Camera %d opened but gave us no stream", cameraId);
+        return;
+    }
 
     av_dump_format(video.pFormatCtx, 0, video.pFormatCtx->filename, 0); // Debug dump
 
     // Find a valid video stream
     for(unsigned int i=0; i < video.pFormatCtx->nb_streams; i++) {
-        if(video.pFormatCtx->streams[i]->codec->coder_type==AVMEDIA_TYPE_VIDEO) {
+        if(video.pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_VIDEO) {
             video.streamId = i;
             break;
         }
     }
-    if(!video.streamId) return; // No valid video stream found. This was pointless.
+    if(video.streamId < 0) return; // No valid video stream found. This was pointless.
 
     video.pCodecCtx = video.pFormatCtx->streams[video.streamId]->codec;
     if(av_find_best_stream(video.pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &video.pCodec, 0) < 0) return;
@@ -99,13 +206,8 @@ void Camera::InitialiseVideoFFmpeg(int cameraId)
 
     if(avcodec_open2(video.pCodecCtx, video.pCodec, NULL) < 0) return;
 
+    // Frames are converted straight into pool buffers, so there is no RGB frame of our own
     video.pFrame = av_frame_alloc();
-    video.pFrameRGB = av_frame_alloc();
-
-    video.pCodecCtx->pix_fmt = AV_PIX_FMT_RGB24;
-    numBytes = avpicture_get_size(video.pCodecCtx->pix_fmt, video.pCodecCtx->width, video.pCodecCtx->height);
-    buffer = (uint8_t *) av_malloc(numBytes * sizeof(uint8_t));
-    avpicture_fill((AVPicture *) video.pFrameRGB, buffer, video.pCodecCtx->pix_fmt, video.pCodecCtx->width, video.pCodecCtx->height);
 }
 
 /***
@@ -117,9 +219,9 @@ void Camera::InitialiseVideoOpenCV(int cameraId)
 {
     cv::VideoCapture temp(cameraId);
     cvvideo = temp;
-    cvvideo.set(CV_CAP_PROP_FRAME_WIDTH, CAMERA_DEFAULT_RES_WIDTH);
-    cvvideo.set(CV_CAP_PROP_FRAME_HEIGHT, CAMERA_DEFAULT_RES_HEIGHT);
-    cvvideo.set(CV_CAP_PROP_FPS, CAMERA_DEFAULT_FPS);
+    cvvideo.set(CV_CAP_PROP_FRAME_WIDTH, tierWidth[captureTier]);
+    cvvideo.set(CV_CAP_PROP_FRAME_HEIGHT, tierHeight[captureTier]);
+    cvvideo.set(CV_CAP_PROP_FPS, tierFps[captureTier]);
 }
 
 /***
@@ -134,7 +236,7 @@ void Camera::DeinitialiseVideo()
             //close(f_desw);
             avcodec_close(video.pCodecCtx);
             av_free(video.pFrame);
-            av_free(video.pFrameRGB);
+            sws_freeContext(video.pSwsCtx);
             avformat_close_input(&video.pFormatCtx);
             break;
         case CAMERA_MODE_OPENCV:
@@ -146,7 +248,8 @@ void Camera::DeinitialiseVideo()
 /***
  * Initialise Audio (PortAudio)
  * Author: Matthew Ribbins
- * Description: Because I don't want a memory leak
+ * Description: Open the mic at the first rate it can do and keep it capturing through AudioCallback, which keeps
+ *              its level up to date, so reading the level never waits on the device
  */
 void Camera::InitialiseAudio(int audioId)
 {
@@ -154,16 +257,204 @@ void Camera::InitialiseAudio(int audioId)
     PaError err;
 
     inputParameters.device = audioId + PORTAUDIO_TO_CAMERA_DEVICE_OFFSET;
+    audioDevice = inputParameters.device;
     inputParameters.channelCount = NUM_CHANNELS;
     inputParameters.sampleFormat = PA_SAMPLE_TYPE;
     inputParameters.suggestedLatency = Pa_GetDeviceInfo(inputParameters.device)->defaultHighInputLatency;
     inputParameters.hostApiSpecificStreamInfo = NULL;
 
-    err = Pa_OpenStream(&audio, &inputParameters, NULL, GetFirstAudioSampleRate(&inputParameters, NULL), FRAMES_PER_BUFFER, paClipOff, NULL, NULL);
+    err = Pa_OpenStream(&audio, &inputParameters, NULL, GetFirstAudioSampleRate(&inputParameters, NULL), FRAMES_PER_BUFFER, paClipOff, AudioCallback, this);
+    if(paNoError == err)
+        err = Pa_StartStream(audio);
     if(err != paNoError)
         qDebug() << "Error: Audio Device " << audioId << "failed to open.";
 }
 
+/***
+ * Has Audio Device
+ * Author: Matthew Ribbins
+ * Description: Whether there is a local mic we could capture, which remote and synthetic cameras don't have
+ */
+bool Camera::HasAudioDevice(void)
+{
+    return audioDevice >= 0;
+}
+
+/***
+ * Enable Audio Capture
+ * Author: Matthew Ribbins
+ * Description: Reopen the mic at the mixer's rate, AUDIO_MIX_SAMPLE_RATE, with a ring its samples go into for the
+ *              program audio mixer. A mic that can't do that rate is left as it was, keeping only its level.
+ *
+ * Return: (bool) true if the mic is capturing into its ring
+ */
+bool Camera::EnableAudioCapture(void)
+{
+    PaStreamParameters inputParameters;
+    PaError err;
+
+    if(audioRing) return true;
+    if(audioDevice < 0) return false;
+
+    inputParameters.device = audioDevice;
+    inputParameters.channelCount = NUM_CHANNELS;
+    inputParameters.sampleFormat = PA_SAMPLE_TYPE;
+    inputParameters.suggestedLatency = Pa_GetDeviceInfo(audioDevice)->defaultLowInputLatency;
+    inputParameters.hostApiSpecificStreamInfo = NULL;
+
+    if(paFormatIsSupported != Pa_IsFormatSupported(&inputParameters, NULL, AUDIO_MIX_SAMPLE_RATE)) {
+        LOG_WARNING(LOG_AUDIO, "Audio device %d can't capture at %d Hz, leaving it out of the mix", audioDevice, AUDIO_MIX_SAMPLE_RATE);
+        return false;
+    }
+
+    if(audio) Pa_CloseStream(audio);
+    audio = NULL;
+    audioRing = new AudioRing;
+
+    err = Pa_OpenStream(&audio, &inputParameters, NULL, AUDIO_MIX_SAMPLE_RATE, AUDIO_MIX_BUFFER, paClipOff, AudioCallback, this);
+    if(paNoError == err)
+        err = Pa_StartStream(audio);
+    if(paNoError != err) {
+        LOG_ERROR(LOG_AUDIO, "Error: Audio device %d won't capture for the mix: %s", audioDevice, Pa_GetErrorText(err));
+        if(audio) Pa_CloseStream(audio);
+        audio = NULL;
+        delete audioRing;
+        audioRing = NULL;
+        InitialiseAudio(audioDevice - PORTAUDIO_TO_CAMERA_DEVICE_OFFSET);
+        return false;
+    }
+    return true;
+}
+
+AudioRing *Camera::GetAudioRing(void)
+{
+    return audioRing;
+}
+
+/***
+ * Enable Audio Analysis
+ * Author: Matthew Ribbins
+ * Description: Capture as for the mixer, and copy the samples into a second ring for bleed rejection, which reads
+ *              them on its own thread
+ *
+ * Return: (bool) true if the mic is capturing into its analysis ring
+ */
+bool Camera::EnableAudioAnalysis(void)
+{
+    if(!EnableAudioCapture()) return false;
+    if(!analysisRing.load()) analysisRing.store(new AudioRing, std::memory_order_release);
+    return true;
+}
+
+AudioRing *Camera::GetAnalysisRing(void)
+{
+    return analysisRing.load(std::memory_order_acquire);
+}
+
+/***
+ * Get Analysis Stamp
+ * Author: Matthew Ribbins
+ * Description: When a sample in the analysis ring was captured: the sample at ring position (see
+ *              SpscRing::GetReadPosition) reached the mic's ADC at time (CLOCK_MONOTONIC ns). Later and earlier
+ *              samples are a sample period apart from it.
+ *
+ * Return: (bool) false if the callback hasn't stamped a block, which it never will if the device doesn't say when
+ *              its samples were captured
+ */
+bool Camera::GetAnalysisStamp(unsigned int &position, qint64 &time)
+{
+    // The callback is only ever a few stores into a stamp, so this is never waiting long
+    for(;;) {
+        unsigned int sequence = stampSequence.load(std::memory_order_acquire);
+        if(!sequence) return false;
+        if(sequence & 1) continue;
+        position = stampPosition.load(std::memory_order_relaxed);
+        time = stampTime.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(stampSequence.load(std::memory_order_relaxed) == sequence) return true;
+    }
+}
+
+/***
+ * Enable Audio Recording
+ * Author: Matthew Ribbins
+ * Description: Capture as for the mixer, and copy the samples into a third ring for the recorder
+ *
+ * Return: (bool) true if the mic is capturing into its record ring
+ */
+bool Camera::EnableAudioRecording(void)
+{
+    if(!EnableAudioCapture()) return false;
+    if(!recordRing.load()) recordRing.store(new RecordRing, std::memory_order_release);
+    return true;
+}
+
+RecordRing *Camera::GetRecordRing(void)
+{
+    return recordRing.load(std::memory_order_acquire);
+}
+
+/***
+ * Audio Callback
+ * Author: Matthew Ribbins
+ * Description: PortAudio's thread, with the mic's latest samples. Hands them to the mixer, bleed rejection and the
+ *              recorder, and keeps the level up to date, over FRAMES_PER_BUFFER samples as the blocking read did.
+ *              Bleed rejection's samples are stamped with when they were captured, see StampAnalysis(). Nothing here
+ *              waits or allocates.
+ */
+int Camera::AudioCallback(const void *input, void *, unsigned long frames, const PaStreamCallbackTimeInfo *timeInfo,
+                          PaStreamCallbackFlags, void *userData)
+{
+    Camera *camera = (Camera *)userData;
+    const float *samples = (const float *)input;
+
+    if(!samples) return paContinue;
+    if(camera->audioRing) camera->audioRing->Push(samples, frames);
+    AudioRing *analysis = camera->analysisRing.load(std::memory_order_acquire);
+    if(analysis) {
+        camera->StampAnalysis(analysis->GetWritePosition(), timeInfo);
+        analysis->Push(samples, frames);
+    }
+    RecordRing *record = camera->recordRing.load(std::memory_order_acquire);
+    if(record) record->Push(samples, frames);
+
+    for(unsigned long i = 0; i < frames; i++)
+        camera->audioLevelSum += samples[i] * samples[i];
+    camera->audioLevelCount += frames;
+    if(camera->audioLevelCount >= FRAMES_PER_BUFFER) {
+        double mean = camera->audioLevelSum / camera->audioLevelCount;
+        camera->audioLevel.store((mean > 0) ? 10 * log10(mean) : AUDIO_LEVEL_SILENCE, std::memory_order_relaxed);
+        camera->audioLevelSum = 0;
+        camera->audioLevelCount = 0;
+    }
+    return paContinue;
+}
+
+/***
+ * Stamp Analysis
+ * Author: Matthew Ribbins
+ * Description: Callback only. The block about to go into the analysis ring at position was captured at its
+ *              inputBufferAdcTime. That is on the stream's own clock, which needn't be anyone else's, so it is taken
+ *              as an age against the stream's currentTime and put on CLOCK_MONOTONIC, where every mic's stamps can
+ *              be compared. A host that doesn't give an ADC time can't tell us its latency, so its blocks aren't
+ *              stamped at all.
+ */
+void Camera::StampAnalysis(unsigned int position, const PaStreamCallbackTimeInfo *timeInfo)
+{
+    struct timespec ts;
+
+    if(!timeInfo || timeInfo->inputBufferAdcTime <= 0 || timeInfo->currentTime < timeInfo->inputBufferAdcTime) return;
+    double age = timeInfo->currentTime - timeInfo->inputBufferAdcTime;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    unsigned int sequence = stampSequence.load(std::memory_order_relaxed);
+    stampSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    stampPosition.store(position, std::memory_order_relaxed);
+    stampTime.store((qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec - (qint64)(age * 1e9), std::memory_order_relaxed);
+    stampSequence.store(sequence + 2, std::memory_order_release);
+}
+
 /***
  * Flush FFmpeg Video Buffer
  * Author: Matthew Ribbins
@@ -269,76 +560,326 @@ QPixmap Camera::AVPictureToPixmap(int height, int width, void* data)
 }
 
 /***
- * Get Audio Level from Device
+ * Calculate Audio Level
  * Author: Matthew Ribbins
+ * Description: RMS level of a buffer of samples in dB
  */
-float Camera::GetAudioLevelFromDevice()
+float Camera::CalculateAudioLevel(const float *samples, int length)
 {
-    PaError err;
-    QString *debugString = new QString();
-    float tempBuffer[FRAMES_PER_BUFFER];
-    float volume;
-
-    Pa_StartStream(audio);
-
-    err = Pa_ReadStream(audio, tempBuffer, FRAMES_PER_BUFFER);
-    if(err == paNoError) {
-        // Get a dB
-        float sum = 0;
-        for (int i = 0; i < FRAMES_PER_BUFFER; i++) {
-            sum += pow(tempBuffer[i], 2);
-        }
-        volume = 20 * log10(sqrt(sum / FRAMES_PER_BUFFER));
-        debugString->append(QString("%1").arg(volume));
-
-    } else {
-     qDebug() << "Error: " << Pa_GetErrorText(err);
+    float sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += pow(samples[i], 2);
     }
+    return 20 * log10(sqrt(sum / length));
+}
 
-    Pa_StopStream(audio);
-
-    qDebug() << volume << " += " << audioGain << " = " << (volume+audioGain);
-    volume += audioGain;
-
-    return volume;
+/***
+ * Get Audio Level from Device
+ * Author: Matthew Ribbins
+ * Description: The mic's latest level, kept by its audio callback, so this doesn't wait. A mic that couldn't be
+ *              opened stays silent.
+ */
+float Camera::GetAudioLevelFromDevice()
+{
+    return audioLevel.load(std::memory_order_relaxed) + audioGain;
 }
 
 /***
  * Get Video Frame
  * Author: Matthew Ribbins
+ * Description: Take the newest captured frame and convert it for display
  */
 QPixmap Camera::GetVideoFrame(void)
 {
     QPixmap frame;
+
+    AcquireFrame();
+    if(!frontFrame.IsNull()) {
+        // Pool rows are padded, so the image needs the stride
+        cv::Mat front = frontFrame.GetMat();
+        frame = QPixmap::fromImage(QImage(front.data, front.cols, front.rows, front.step, QImage::Format_RGB888));
+    }
+    return frame;
+}
+
+/***
+ * Capture Frame
+ * Author: Matthew Ribbins
+ * Description: Capture a frame from the device. This waits for the device to give us a frame, so it is called
+ *              from the camera's CaptureThread. The RGB frame is published with PublishFrame(), and the gray frame
+ *              is stored for motion detection. A camera that has stalled is reopened here.
+ *
+ * Return: (int) CAPTURE_NEW_FRAME if a frame was published, CAPTURE_ANALYSIS_ONLY if the frame was only used for
+ *         motion detection, CAPTURE_DROPPED if the frame pool had no buffer for it, or CAPTURE_NO_FRAME
+ */
+int Camera::CaptureFrame(void)
+{
+    int result = CAPTURE_NO_FRAME;
+    qint64 now = TimeshiftBuffer::Now();
+
+    if(interrupted.load(std::memory_order_relaxed)) return CAPTURE_NO_FRAME;
+    if(IsStalled(now)) {
+        if(now - lastReopen >= CAPTURE_REOPEN_INTERVAL)
+            Reopen();
+    } else if(requestedTier != captureTier) {
+        Renegotiate();
+    }
+
     switch(videoMode) {
         case CAMERA_MODE_FFMPEG:
-            frame = GetVideoFrameFFmpeg();
+            result = CaptureFrameFFmpeg();
             break;
         case CAMERA_MODE_OPENCV:
-            frame = GetVideoFrameOpenCV();
+            result = CaptureFrameOpenCV();
             break;
     }
-    return frame;
+
+    // A tier only counts once we have had a frame at it
+    if(CAPTURE_NO_FRAME != result) {
+        settledTier = captureTier;
+        lastFrameTime.store(TimeshiftBuffer::Now(), std::memory_order_relaxed);
+    }
+    return result;
+}
+
+/***
+ * Reopen
+ * Author: Matthew Ribbins
+ * Description: The camera has stalled, e.g. after a USB reset. Close the device and open it again, on the capture
+ *              thread so no other camera or the GUI waits on it.
+ */
+void Camera::Reopen(void)
+{
+    // Only the first attempt is worth a warning, the watchdog has already said the camera stalled
+    if(lastReopen < lastFrameTime.load(std::memory_order_relaxed))
+        LOG_WARNING(LOG_CAMERA, "Camera %d has stalled, reopening it", cameraId);
+    else
+        LOG_DEBUG(LOG_CAMERA, "Camera %d still stalled, reopening it again", cameraId);
+
+    DeinitialiseVideo();
+    InitialiseVideo(cameraId);
+    lastReopen = TimeshiftBuffer::Now();
+}
+
+/***
+ * Interrupt Callback
+ * Author: Matthew Ribbins
+ * Description: FFmpeg asks this while it waits on the device
+ *
+ * Return: (int) 1 to give up waiting, 0 to carry on
+ */
+int Camera::InterruptCallback(void *opaque)
+{
+    Camera *camera = (Camera *)opaque;
+    return camera->interrupted.load(std::memory_order_relaxed) ||
+           TimeshiftBuffer::Now() > camera->deadline.load(std::memory_order_relaxed);
+}
+
+/***
+ * Interrupt
+ * Author: Matthew Ribbins
+ * Description: Stop waiting on the device and don't wait on it again, for shutting down
+ */
+void Camera::Interrupt(void)
+{
+    interrupted.store(true);
+}
+
+/***
+ * Set Stall Timeout
+ * Author: Matthew Ribbins
+ * Description: How long a camera can go without a frame (ms) before it is stalled
+ */
+void Camera::SetStallTimeout(int timeout)
+{
+    if(timeout > 0) stallTimeout = timeout;
+}
+
+/***
+ * Is Stalled
+ * Author: Matthew Ribbins
+ * Description: Whether a local camera has gone stallTimeout without giving us a frame. Sources that aren't local
+ *              devices have no capture of ours to stall, and aren't unless they override this (a remote camera is
+ *              stalled while its node is gone).
+ */
+bool Camera::IsStalled(qint64 now)
+{
+    return watched && now - lastFrameTime.load(std::memory_order_relaxed) > stallTimeout;
+}
+
+/***
+ * Publish Frame
+ * Author: Matthew Ribbins
+ * Description: The back buffer has a complete frame, it becomes the newest frame. The previous newest frame goes
+ *              back to the pool, unless the GUI or another reader still holds it.
+ */
+void Camera::PublishFrame(void)
+{
+    frameMutex.lock();
+    backFrame.SetNumber(frameNumber + 1);
+    std::swap(latestFrame, backFrame);
+    readyFrameNumber = ++frameNumber;
+    frameReady = true;
+    frameMutex.unlock();
+
+    // Outside the lock, as this may take the pool's
+    backFrame.Release();
+    backMat = cv::Mat();
 }
 
 /***
- * Get video frame with FFMpeg library
+ * Get Back Buffer
+ * Author: Matthew Ribbins
+ * Description: A pool buffer for the next RGB24 frame, to be written into before PublishFrame(). Writing into it
+ *              with OpenCV doesn't reallocate, as it is already the right size and type.
+ *
+ * Return: (cv::Mat *) the buffer, or NULL if the pool is starved and this frame has to be dropped
+ */
+cv::Mat *Camera::GetBackBuffer(int width, int height)
+{
+    if(backFrame.IsNull() || backFrame.GetWidth() != width || backFrame.GetHeight() != height) {
+        backFrame = FramePool::Acquire(width, height, CV_8UC3);
+        if(backFrame.IsNull()) return NULL;
+        backMat = backFrame.GetMat();
+    }
+    return &backMat;
+}
+
+/***
+ * Acquire Frame
+ * Author: Matthew Ribbins
+ * Description: Swap the newest published frame to the front, where the capture thread won't touch it. Everything
+ *              on the GUI thread then works on the front frame through GetLastFrame().
+ *
+ * Return: (bool) true if there was a new frame
+ */
+bool Camera::AcquireFrame(void)
+{
+    QMutexLocker locker(&frameMutex);
+    if(!frameReady) return false;
+
+    frontFrame = latestFrame;
+    frontFrameNumber = readyFrameNumber;
+    frameReady = false;
+    return true;
+}
+
+/***
+ * Get Last Frame
+ * Author: Matthew Ribbins
+ * Description: The last acquired frame as RGB24. This points at the pool buffer the GUI holds, so it is only valid
+ *              until the next AcquireFrame().
+ */
+cv::Mat Camera::GetLastFrame(void)
+{
+    return frontFrame.GetMat();
+}
+
+/***
+ * Get Latest Frame
+ * Author: Matthew Ribbins
+ * Description: A reference to the newest published frame, for readers on other threads. The buffer is shared, not
+ *              copied, and nothing writes to it again until every reference has gone.
+ */
+Frame Camera::GetLatestFrame(void)
+{
+    QMutexLocker locker(&frameMutex);
+    return latestFrame;
+}
+
+/***
+ * Get Detection Frame
+ * Author: Matthew Ribbins
+ * Description: The newest frame scaled to width, for the person detector's thread. This is the newest published
+ *              frame if the camera is being fully decoded, otherwise the stored gray frame (the DC thumbnail for
+ *              MJPEG), which the capture thread doesn't write to while we hold the lock.
+ *
+ * Return: (bool) true if there was a frame
+ */
+bool Camera::GetDetectionFrame(cv::Mat &frame, int width)
+{
+    QMutexLocker locker(&frameMutex);
+    Frame latest;
+    cv::Mat source;
+
+    if(!analysisOnly || storedFrames[0].empty())
+        latest = latestFrame;
+    if(!latest.IsNull()) {
+        // We hold our own reference, so capture can carry on publishing while we scale it
+        locker.unlock();
+        source = latest.GetMat();
+    } else if(!storedFrames[0].empty()) {
+        source = storedFrames[0];
+    } else {
+        return false;
+    }
+
+    int height = source.rows * width / source.cols;
+    cv::resize(source, frame, cv::Size(width, height), 0, 0, (width < source.cols) ? cv::INTER_AREA : cv::INTER_LINEAR);
+    return true;
+}
+
+/***
+ * Get Frame Number
+ * Author: Matthew Ribbins
+ * Description: Number of the last acquired frame, so users of GetLastFrame() can tell if it has changed or if
+ *              frames were missed in between
+ */
+unsigned int Camera::GetFrameNumber(void)
+{
+    return frontFrameNumber;
+}
+
+/***
+ * Capture frame with FFMpeg library
  * Author: Matthew Ribbins
  *
  * Attribution: Code from http://hasanaga.info/how-to-capture-frame-from-webcam-witg-ffmpeg-api-and-display-image-with-opencv/
  * was used to assist with understanding and implementing this FFmpeg implementation.
  */
-QPixmap Camera::GetVideoFrameFFmpeg(void)
+int Camera::CaptureFrameFFmpeg(void)
 {
-    QPixmap convertedFrame;
     AVPacket packet;
     int res;
-    int frameFinished;
+    int frameFinished = 0;
+    int result = CAPTURE_NO_FRAME;
+
+    if(!IsVideoValid()) return CAPTURE_NO_FRAME;
 
-    if((res = av_read_frame(video.pFormatCtx, &packet)) >= 0) {
+    {
+        EVENT_SCOPE("av_read_frame", -1);
+        // Waits for the device, until InterruptCallback gives up at the deadline or when we shut down
+        deadline.store(TimeshiftBuffer::Now() + CAPTURE_READ_TIMEOUT, std::memory_order_relaxed);
+        res = av_read_frame(video.pFormatCtx, &packet);
+    }
+    if(res >= 0) {
         if(packet.stream_index == video.streamId) {
+            bool haveThumbnail = false;
+
+            if(AV_CODEC_ID_MJPEG == video.pCodecCtx->codec_id) {
+                // MJPEG packets go straight into the timeshift buffer
+                if(timeshift)
+                    timeshift->Push(packet.data, packet.size, TimeshiftBuffer::Now());
+
+                // Motion detection only needs the DC thumbnail, so a camera that isn't on screen stops here
+                {
+                    EVENT_SCOPE("thumbnail", -1);
+                    haveThumbnail = jpegDc.Decode(packet.data, packet.size);
+                    if(haveThumbnail) SaveStoredThumbnail();
+                }
+                if(haveThumbnail) {
+                    if(analysisOnly) {
+                        av_free_packet(&packet);
+                        return CAPTURE_ANALYSIS_ONLY;
+                    }
+                }
+            }
+
             // Decode
-            avcodec_decode_video2(video.pCodecCtx, video.pFrame, &frameFinished, &packet);
+            {
+                EVENT_SCOPE("decode", -1);
+                avcodec_decode_video2(video.pCodecCtx, video.pFrame, &frameFinished, &packet);
+            }
 
             // Fix deprecation errors
             switch (video.pCodecCtx->pix_fmt) {
@@ -350,38 +891,190 @@ QPixmap Camera::GetVideoFrameFFmpeg(void)
             }
 
             if(frameFinished) {
-                struct SwsContext *imgConvertCtx;
-                imgConvertCtx = sws_getCachedContext(NULL, video.pCodecCtx->width, video.pCodecCtx->height, video.pCodecCtx->pix_fmt, video.pCodecCtx->width, video.pCodecCtx->height, AV_PIX_FMT_RGB24, SWS_BILINEAR, NULL, NULL, NULL);
-                sws_scale(imgConvertCtx, ((AVPicture*)video.pFrame)->data, ((AVPicture*)video.pFrame)->linesize, 0, video.pCodecCtx->height, ((AVPicture *)video.pFrameRGB)->data, ((AVPicture *)video.pFrameRGB)->linesize);
-                convertedFrame = AVPictureToPixmap(video.pFrame->height, video.pFrame->width, video.pFrameRGB->data[0]);
-                SaveStoredFrame(cv::Mat(video.pFrame->height, video.pFrame->width, CV_8UC3, video.pFrameRGB->data[0]));
-
-                av_free_packet(&packet);
-                sws_freeContext(imgConvertCtx);
-
+                // Convert straight into a pool buffer
+                cv::Mat *backFrame = GetBackBuffer(video.pFrame->width, video.pFrame->height);
+                if(!backFrame) {
+                    av_free_packet(&packet);
+                    return CAPTURE_DROPPED;
+                }
+                uint8_t *dstData[1] = { backFrame->data };
+                int dstLinesize[1] = { (int)backFrame->step };
+
+                // Only recreated if the format changes
+                {
+                    EVENT_SCOPE("convert", -1);
+                    video.pSwsCtx = sws_getCachedContext(video.pSwsCtx, video.pCodecCtx->width, video.pCodecCtx->height, video.pCodecCtx->pix_fmt, video.pCodecCtx->width, video.pCodecCtx->height, AV_PIX_FMT_RGB24, SWS_BILINEAR, NULL, NULL, NULL);
+                    sws_scale(video.pSwsCtx, ((AVPicture*)video.pFrame)->data, ((AVPicture*)video.pFrame)->linesize, 0, video.pCodecCtx->height, dstData, dstLinesize);
+                }
+                if(!haveThumbnail)
+                    SaveStoredFrame(*backFrame);
+                if(timeshift && AV_CODEC_ID_MJPEG != video.pCodecCtx->codec_id)
+                    SaveTimeshiftFrame(*backFrame, CV_RGB2BGR);
+                PublishFrame();
+                result = CAPTURE_NEW_FRAME;
             }
         }
+        av_free_packet(&packet);
     }
-    return convertedFrame;
+    return result;
 }
 
 /***
- * Get video frame with OpenCV library
+ * Is Video Valid
  * Author: Matthew Ribbins
- * Description:
+ * Description: Whether the device opened properly and we can capture from it
  */
-QPixmap Camera::GetVideoFrameOpenCV(void) {
-    cv::Mat frame;
-    QPixmap convertedFrame;
+bool Camera::IsVideoValid(void)
+{
+    switch(videoMode) {
+        case CAMERA_MODE_FFMPEG:
+            return video.pFormatCtx && video.pFrame;
+        case CAMERA_MODE_OPENCV:
+            return cvvideo.isOpened();
+    }
+    return false;
+}
+
+/***
+ * Renegotiate
+ * Author: Matthew Ribbins
+ * Description: Switch the device to the requested capture tier, on the capture thread so the GUI never waits for
+ *              it. FFmpeg has to close and reopen the device, OpenCV can change format on the open device. If the
+ *              device won't do the analysis format we go back to full, and stay there.
+ */
+void Camera::Renegotiate(void)
+{
+    int tier = requestedTier;
 
+    LOG_INFO(LOG_CAMERA, "Camera %d to %s capture, %dx%d at %d fps", cameraId, (CAMERA_TIER_FULL == tier) ? "full" : "analysis",
+             tierWidth[tier], tierHeight[tier], tierFps[tier]);
+    captureTier = tier;
 
-    // Get the frame, convert
-    cvvideo >> frame;
-    if(!frame.empty()) {
-        SaveStoredFrame(frame);
-        convertedFrame = MatToPixmap(frame);
+    switch(videoMode) {
+        case CAMERA_MODE_FFMPEG:
+            DeinitialiseVideo();
+            InitialiseVideoFFmpeg(cameraId);
+            break;
+        case CAMERA_MODE_OPENCV:
+            cvvideo.set(CV_CAP_PROP_FRAME_WIDTH, tierWidth[tier]);
+            cvvideo.set(CV_CAP_PROP_FRAME_HEIGHT, tierHeight[tier]);
+            cvvideo.set(CV_CAP_PROP_FPS, tierFps[tier]);
+            break;
     }
-    return convertedFrame;
+
+    if(!IsVideoValid() && CAMERA_TIER_FULL != tier) {
+        LOG_WARNING(LOG_CAMERA, "Camera %d won't capture at the analysis format, staying at full", cameraId);
+        requestedTier = CAMERA_TIER_FULL;
+        captureTier = CAMERA_TIER_FULL;
+        DeinitialiseVideo();
+        InitialiseVideo(cameraId);
+        fullOnly = true;
+    }
+
+    // Reopening takes a while, which isn't a stall
+    lastFrameTime.store(TimeshiftBuffer::Now(), std::memory_order_relaxed);
+}
+
+/***
+ * Set Tier Format
+ * Author: Matthew Ribbins
+ * Description: Capture format for a tier, for every camera opened or renegotiated after this
+ */
+void Camera::SetTierFormat(int tier, int width, int height, int fps)
+{
+    if(tier < 0 || tier >= CAMERA_TIER_COUNT) return;
+    tierWidth[tier] = width;
+    tierHeight[tier] = height;
+    tierFps[tier] = fps;
+}
+
+/***
+ * Set Capture Tier
+ * Author: Matthew Ribbins
+ * Description: Ask for a capture tier. The capture thread renegotiates before its next frame.
+ */
+void Camera::SetCaptureTier(int tier)
+{
+    if(tier < 0 || tier >= CAMERA_TIER_COUNT || fullOnly) return;
+    requestedTier = tier;
+}
+
+/***
+ * Get Capture Tier
+ * Author: Matthew Ribbins
+ * Description: The tier the camera is actually capturing at, which lags SetCaptureTier() until the device has
+ *              been renegotiated and given us a frame
+ */
+int Camera::GetCaptureTier(void)
+{
+    return settledTier;
+}
+
+/***
+ * Capture frame with OpenCV library
+ * Author: Matthew Ribbins
+ * Description: OpenCV gives us BGR, so colour correct into the back buffer
+ */
+int Camera::CaptureFrameOpenCV(void)
+{
+    {
+        EVENT_SCOPE("read", -1);
+        cvvideo >> capturedFrame;
+    }
+    if(capturedFrame.empty()) return CAPTURE_NO_FRAME;
+
+    SaveStoredFrame(capturedFrame);
+    if(timeshift)
+        SaveTimeshiftFrame(capturedFrame, -1);
+
+    cv::Mat *backFrame = GetBackBuffer(capturedFrame.cols, capturedFrame.rows);
+    if(!backFrame) return CAPTURE_DROPPED;
+    {
+        EVENT_SCOPE("convert", -1);
+        cv::cvtColor(capturedFrame, *backFrame, CV_BGR2RGB);
+    }
+    PublishFrame();
+    return CAPTURE_NEW_FRAME;
+}
+
+/***
+ * Save Timeshift Frame
+ * Author: Matthew Ribbins
+ * Description: Encode a frame as JPEG for the timeshift buffer, for when the device doesn't give us MJPEG.
+ *              conversion is the colour conversion to BGR, or -1 if the frame is already BGR.
+ */
+void Camera::SaveTimeshiftFrame(const cv::Mat &frame, int conversion)
+{
+    EVENT_SCOPE("timeshift", -1);
+
+    if(encodeParams.empty()) {
+        encodeParams.push_back(CV_IMWRITE_JPEG_QUALITY);
+        encodeParams.push_back(TIMESHIFT_JPEG_QUALITY);
+    }
+
+    if(conversion >= 0) {
+        cv::cvtColor(frame, timeshiftFrame, conversion);
+        cv::imencode(".jpg", timeshiftFrame, encodedFrame, encodeParams);
+    } else {
+        cv::imencode(".jpg", frame, encodedFrame, encodeParams);
+    }
+    timeshift->Push(&encodedFrame[0], encodedFrame.size(), TimeshiftBuffer::Now());
+}
+
+/***
+ * Enable Timeshift
+ * Author: Matthew Ribbins
+ * Description: Keep the last seconds of video, in at most budget bytes. Call before the capture thread starts.
+ */
+void Camera::EnableTimeshift(int seconds, int budget)
+{
+    if(timeshift || seconds <= 0 || budget <= 0) return;
+    timeshift = new TimeshiftBuffer(seconds, budget, CAMERA_DEFAULT_FPS);
+}
+
+TimeshiftBuffer *Camera::GetTimeshift(void)
+{
+    return timeshift;
 }
 
 /***
@@ -389,14 +1082,60 @@ QPixmap Camera::GetVideoFrameOpenCV(void) {
  * Author: Matthew Ribbins
  * Description: Store frames so we can use for motion detection
  */
-void Camera::SaveStoredFrame(cv::Mat frame)
+void Camera::SaveStoredFrame(const cv::Mat &frame)
+{
+    EVENT_SCOPE("gray", -1);
+
+    // Gray image, into the spare buffer
+    cvtColor(frame, grayFrame, CV_RGB2GRAY);
+    StoreGrayFrame();
+}
+
+/***
+ * Save stored thumbnail
+ * Author: Matthew Ribbins
+ * Description: Store the 1/8 scale DC thumbnail from the last MJPEG frame for motion detection
+ */
+void Camera::SaveStoredThumbnail(void)
+{
+    cv::Mat thumbnail(jpegDc.GetHeight(), jpegDc.GetWidth(), CV_8UC1, (void *)jpegDc.GetThumbnail(), jpegDc.GetStride());
+
+    // The decoder reuses its buffer, so keep our own copy
+    thumbnail.copyTo(grayFrame);
+    StoreGrayFrame();
+}
+
+/***
+ * Store Gray Frame
+ * Author: Matthew Ribbins
+ * Description: grayFrame becomes the newest stored frame, and the oldest becomes the spare for next time. The four
+ *              buffers go round without being reallocated unless the frame size changes.
+ */
+void Camera::StoreGrayFrame(void)
 {
-    // Gray image
-    cvtColor(frame, frame, CV_RGB2GRAY);
     // Let's do a shuffle
+    QMutexLocker locker(&frameMutex);
+    cv::Mat oldest = storedFrames[2];
     storedFrames[2] = storedFrames[1];
     storedFrames[1] = storedFrames[0];
-    storedFrames[0] = frame;
+    storedFrames[0] = grayFrame;
+    grayFrame = oldest;
+}
+
+/***
+ * Set Analysis Only
+ * Author: Matthew Ribbins
+ * Description: A camera that isn't on screen only needs motion detection. For MJPEG cameras this means we can
+ *              skip the full decode and just use the DC thumbnail.
+ */
+void Camera::SetAnalysisOnly(bool analysisOnly)
+{
+    this->analysisOnly = analysisOnly;
+}
+
+bool Camera::IsAnalysisOnly(void)
+{
+    return analysisOnly;
 }
 
 /***
@@ -409,18 +1148,30 @@ void Camera::SaveStoredFrame(cv::Mat frame)
  */
 int Camera::GetMovementDetection()
 {
-    cv::Mat diff, motion;
+    cv::Mat &diff = processedFrames[0];
+    cv::Mat &motion = processedFrames[1];
     int numChangedPixels = 0;
     int totalPixels = 0;
     int pctChangedPixels = 0;
 
+    // The capture thread writes into the oldest buffer once it has been shuffled out, so diff under the lock
+    frameMutex.lock();
+
     // Avoid OpenCV assert by trying to work with zero
     if(storedFrames[2].cols == 0) {
-        qDebug() << "Camera has not got three stored frames!";
+        frameMutex.unlock();
+        LOG_DEBUG(LOG_CAMERA, "Camera has not got three stored frames!");
+        return 0;
+    }
+
+    // Happens for a frame or two if we move between full frames and thumbnails
+    if(storedFrames[2].size() != storedFrames[0].size()) {
+        frameMutex.unlock();
         return 0;
     }
 
     absdiff(storedFrames[2], storedFrames[0], diff);
+    frameMutex.unlock();
 
     // Set a threshold, define background and foreground objects
     threshold(diff, motion, MOTION_DETECTION_PIXEL_THRESHOLD, MOTION_DETECTION_PIXEL_MAX, CV_THRESH_BINARY);
@@ -428,7 +1179,7 @@ int Camera::GetMovementDetection()
     // Let's do some counting.
     for(int i = 0; i < motion.rows; i += MOTION_DETECTION_JUMP) {
         for(int j = 0; j < motion.cols; j += MOTION_DETECTION_JUMP) {
-            if(motion.at<int>(i,j) == MOTION_DETECTION_PIXEL_MAX) {
+            if(motion.at<uchar>(i,j) == MOTION_DETECTION_PIXEL_MAX) {
                 numChangedPixels++;
             }
         }
@@ -438,11 +1189,9 @@ int Camera::GetMovementDetection()
     totalPixels = motion.rows * motion.cols;
     pctChangedPixels = floor(numChangedPixels / (totalPixels / pow(MOTION_DETECTION_JUMP,2)) * 1000);
 
-    qDebug() << "Camera has " << numChangedPixels << "/" << (totalPixels/4) << "=%" << pctChangedPixels;
+    LOG_DEBUG(LOG_CAMERA, "Camera has %d/%d=%%%d", numChangedPixels, totalPixels / 4, pctChangedPixels);
 
-    // Save for debug purposes
-    processedFrames[0] = diff;
-    processedFrames[1] = motion;
+    // diff and motion are kept in processedFrames for debug purposes
     return pctChangedPixels;
 }
 
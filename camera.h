@@ -1,6 +1,8 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <QMutex>
+#include <atomic>
 #include <opencv2/opencv.hpp>
 #include <portaudiocpp/PortAudioCpp.hxx>
 
@@ -16,18 +18,29 @@ extern "C" {
 }
 
 
+#include "timeshiftbuffer.h"
+#include "jpegdc.h"
+#include "framepool.h"
+#include "spscring.h"
+#include "eventtrace.h"
+#include "logger.h"
 #include "radioviz.h"
 
 #define CAMERA_MODE_FFMPEG 0
 #define CAMERA_MODE_OPENCV 1
 
+// Samples from a camera's mic, from its audio callback to the program audio mixer
+typedef SpscRing<float, AUDIO_RING_SIZE> AudioRing;
+// and to the recorder, which only empties its rings every so often, so they are bigger
+typedef SpscRing<float, AUDIO_RECORD_RING_SIZE> RecordRing;
+
 typedef struct _FFmpegDevice {
     AVCodecContext *pCodecCtx;
     AVFormatContext *pFormatCtx;
     AVCodec *pCodec;
     AVFrame *pFrame;
-    AVFrame *pFrameRGB;
     AVDeviceInfoList *pDeviceList;
+    struct SwsContext *pSwsCtx;
     int streamId;
 
 } FFmpegDevice;
@@ -36,29 +49,95 @@ class Camera
 {
 public:
     Camera();
-    Camera(int cameraId, int audioId);
-    ~Camera();
+    Camera(int cameraId, int audioId, int videoMode = CAMERA_MODE_OPENCV, int tier = CAMERA_TIER_FULL);
+    virtual ~Camera();
     QPixmap GetVideoFrame(void);
-    QPixmap GetVideoFrameOpenCV(void);
-    QPixmap GetVideoFrameFFmpeg(void);
+    virtual int CaptureFrame(void);
+    bool AcquireFrame(void);
+    cv::Mat GetLastFrame(void);
+    Frame GetLatestFrame(void);
+    bool GetDetectionFrame(cv::Mat &frame, int width);
+    unsigned int GetFrameNumber(void);
+    void EnableTimeshift(int seconds, int budget);
+    TimeshiftBuffer *GetTimeshift(void);
     QPixmap GetProcessedFrame(int frameId);
-    float GetAudioLevelFromDevice(void);
+    virtual float GetAudioLevelFromDevice(void);
+    static float CalculateAudioLevel(const float *samples, int length);
+    bool HasAudioDevice(void);
+    bool EnableAudioCapture(void);
+    AudioRing *GetAudioRing(void);
+    bool EnableAudioAnalysis(void);
+    AudioRing *GetAnalysisRing(void);
+    bool GetAnalysisStamp(unsigned int &position, qint64 &time);
+    bool EnableAudioRecording(void);
+    RecordRing *GetRecordRing(void);
     void FlushBuffers(void);
 
     double GetAudioGain();
     void SetAudioGain(double gain);
-    int GetMovementDetection();
+    virtual int GetMovementDetection();
+    virtual void SetAnalysisOnly(bool analysisOnly);
+    bool IsAnalysisOnly(void);
+    static void SetTierFormat(int tier, int width, int height, int fps);
+    void SetCaptureTier(int tier);
+    int GetCaptureTier(void);
+    static void SetStallTimeout(int timeout);
+    virtual bool IsStalled(qint64 now);
+    void Interrupt(void);
 
 private:
     cv::VideoCapture cvvideo;
     FFmpegDevice video;
     int videoMode;
     PaStream *audio;
+    int audioDevice;
+    AudioRing *audioRing;
+    std::atomic<AudioRing *> analysisRing;
+    std::atomic<RecordRing *> recordRing;
+    // When the analysis ring's sample at stampPosition hit the mic's ADC (CLOCK_MONOTONIC ns), from the callback.
+    // The sequence is odd while the callback is changing them.
+    std::atomic<unsigned int> stampSequence;
+    std::atomic<unsigned int> stampPosition;
+    std::atomic<qint64> stampTime;
+    std::atomic<float> audioLevel;
+    double audioLevelSum;
+    int audioLevelCount;
     float audioGain;
     bool isActive;
     Camera *parentCamera;
     cv::Mat storedFrames[3];
+    cv::Mat grayFrame;
     cv::Mat processedFrames[3];
+    cv::Mat capturedFrame;
+    Frame backFrame;
+    cv::Mat backMat;
+    Frame latestFrame;
+    Frame frontFrame;
+    bool frameReady;
+    unsigned int frameNumber;
+    unsigned int readyFrameNumber;
+    unsigned int frontFrameNumber;
+    QMutex frameMutex;
+    TimeshiftBuffer *timeshift;
+    std::vector<uchar> encodedFrame;
+    std::vector<int> encodeParams;
+    cv::Mat timeshiftFrame;
+    JpegDcDecoder jpegDc;
+    volatile bool analysisOnly;
+    int cameraId;
+    volatile int requestedTier;
+    volatile int captureTier;
+    volatile int settledTier;
+    bool fullOnly;
+    bool watched;
+    std::atomic<qint64> lastFrameTime;
+    std::atomic<qint64> deadline;
+    std::atomic<bool> interrupted;
+    qint64 lastReopen;
+    static int stallTimeout;
+    static int tierWidth[CAMERA_TIER_COUNT];
+    static int tierHeight[CAMERA_TIER_COUNT];
+    static int tierFps[CAMERA_TIER_COUNT];
 
 protected:
     void DebugFFmpegError(int errno);
@@ -67,13 +146,26 @@ protected:
     void InitialiseVideoOpenCV(int cameraId);
     void DeinitialiseVideo();
     bool IsVideoValid(void);
+    int CaptureFrameFFmpeg(void);
+    int CaptureFrameOpenCV(void);
+    void Renegotiate(void);
+    void Reopen(void);
+    static int InterruptCallback(void *opaque);
+    void PublishFrame(void);
+    cv::Mat *GetBackBuffer(int width, int height);
 
     void InitialiseAudio(int audioId);
+    static int AudioCallback(const void *input, void *output, unsigned long frames,
+                             const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags flags, void *userData);
+    void StampAnalysis(unsigned int position, const PaStreamCallbackTimeInfo *timeInfo);
     double GetHighestAudioSampleRate(const PaStreamParameters *inputParameters, const PaStreamParameters *outputParameters);
     double GetFirstAudioSampleRate(const PaStreamParameters *inputParameters, const PaStreamParameters *outputParameters);
     void PrintSupportedStandardSampleRates(const PaStreamParameters *inputParameters, const PaStreamParameters *outputParameters);
 
-    void SaveStoredFrame(cv::Mat frame);
+    void SaveStoredFrame(const cv::Mat &frame);
+    void SaveStoredThumbnail(void);
+    void StoreGrayFrame(void);
+    void SaveTimeshiftFrame(const cv::Mat &frame, int conversion);
 
     QPixmap MatToPixmap(cv::Mat matImage);
     QPixmap MatToPixmapGray(cv::Mat matImage);
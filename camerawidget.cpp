@@ -4,6 +4,8 @@
  * Description: Camera widget to display camera video feed in a QLabel image
  *
  */
+#include <algorithm>
+
 #include "camerawidget.h"
 
 /***
@@ -25,6 +27,15 @@ CameraWidget::CameraWidget(QWidget *parent)
     windowWidth = parent->width();
     windowHeight = parent->height();
     cameraLabel->setAlignment(Qt::AlignHCenter);
+
+    latencyMeasure = false;
+    latencyStamp = false;
+    latencyPending = false;
+    latencyHaveCounter = false;
+    latencyCounter = 0;
+    latencyTimestamp = 0;
+    latencyReportTime = 0;
+    stampCounter = 0;
 }
 
 /***
@@ -42,6 +53,7 @@ CameraWidget::~CameraWidget(void)
  */
 void CameraWidget::putFrame(cv::Mat image)
 {
+    displayImage = QImage();
     QPixmap convertedImage = matToPixmap(image).scaled(windowWidth, windowHeight, Qt::KeepAspectRatio);
     cameraLabel->setPixmap(convertedImage);
 
@@ -49,10 +61,183 @@ void CameraWidget::putFrame(cv::Mat image)
 
 void CameraWidget::putFrame(QPixmap image)
 {
+    displayImage = QImage();
     image = image.scaled(windowWidth, windowHeight, Qt::KeepAspectRatio);
     cameraLabel->setPixmap(image);
 }
 
+/***
+ * Update Frame on display (RGB24)
+ * Author: Matthew Ribbins
+ * Description: Scale an RGB24 frame straight into the image we paint from. The image is kept between frames and
+ *              is already in the display's format, so nothing is allocated or converted again when painting.
+ */
+void CameraWidget::putFrameRGB(const cv::Mat &frame)
+{
+    if(frame.empty() || frame.type() != CV_8UC3) return;
+
+    int width = windowWidth;
+    int height = windowWidth * frame.rows / frame.cols;
+    EVENT_SCOPE("scale", -1);
+
+    // A new frame from a source carrying a latency strip, timed once it has been painted
+    if(latencyMeasure) {
+        unsigned int counter;
+        int64_t timestamp;
+        if(LatencyStrip::Decode(frame, counter, timestamp) && (!latencyHaveCounter || counter != latencyCounter)) {
+            latencyCounter = counter;
+            latencyHaveCounter = true;
+            latencyTimestamp = timestamp;
+            latencyPending = true;
+        }
+    }
+
+    // Same as Qt::KeepAspectRatio
+    if(height > windowHeight) {
+        height = windowHeight;
+        width = windowHeight * frame.cols / frame.rows;
+    }
+
+    if(displayImage.width() != width || displayImage.height() != height) {
+        cameraLabel->clear();
+        displayImage = QImage(width, height, QImage::Format_RGB32);
+        displayFrame = cv::Mat(height, width, CV_8UC4, displayImage.bits(), displayImage.bytesPerLine());
+    }
+
+    if(frame.cols == width && frame.rows == height) {
+        cv::cvtColor(frame, displayFrame, CV_RGB2BGRA);
+    } else {
+        if(scaleSource != frame.size() || scaleMap.cols != width || scaleMap.rows != height)
+            BuildScaleMaps(frame.size(), cv::Size(width, height));
+        cv::remap(frame, scaledFrame, scaleMap, scaleWeights, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+        cv::cvtColor(scaledFrame, displayFrame, CV_RGB2BGRA);
+    }
+    update();
+}
+
+/***
+ * Build Scale Maps
+ * Author: Matthew Ribbins
+ * Description: Bilinear scaling from source to destination size as cv::remap tables, sampling where cv::resize's
+ *              INTER_LINEAR does. cv::resize works its tables out again on the heap for every frame, so we do it
+ *              once here, each time the frame or window size changes, and remap with them.
+ */
+void CameraWidget::BuildScaleMaps(const cv::Size &source, const cv::Size &destination)
+{
+    cv::Mat mapX(destination, CV_32FC1);
+    cv::Mat mapY(destination, CV_32FC1);
+    float scaleX = (float)source.width / destination.width;
+    float scaleY = (float)source.height / destination.height;
+
+    for(int y = 0; y < destination.height; y++) {
+        float sourceY = std::min(std::max((y + 0.5f) * scaleY - 0.5f, 0.0f), (float)(source.height - 1));
+        float *rowX = mapX.ptr<float>(y);
+        float *rowY = mapY.ptr<float>(y);
+        for(int x = 0; x < destination.width; x++) {
+            rowX[x] = std::min(std::max((x + 0.5f) * scaleX - 0.5f, 0.0f), (float)(source.width - 1));
+            rowY[x] = sourceY;
+        }
+    }
+    cv::convertMaps(mapX, mapY, scaleMap, scaleWeights, CV_16SC2);
+    scaledFrame.create(destination, CV_8UC3);
+    scaleSource = source;
+}
+
+void CameraWidget::paintEvent(QPaintEvent *)
+{
+    if(displayImage.isNull()) return;
+    EVENT_SCOPE("paint", -1);
+
+    // Centred along the top, like the label
+    QPainter painter(this);
+    int x = (width() - displayImage.width()) / 2;
+    painter.drawImage(x, 0, displayImage);
+
+    if(!latencyMeasure && !latencyStamp) return;
+
+    int64_t now = LatencyStrip::Now();
+    if(latencyMeasure) {
+        if(latencyPending) {
+            latencyStats.Add(LatencyStrip::Elapsed(latencyTimestamp, now));
+            latencyPending = false;
+        }
+        ReportLatency(now);
+        if(!latencyText.isEmpty()) {
+            painter.setPen(Qt::yellow);
+            painter.drawText(x + 8, displayImage.height() - 8, latencyText);
+        }
+    }
+    if(latencyStamp)
+        DrawLatencyStamp(painter, x, now);
+}
+
+/***
+ * Set Latency Measurement
+ * Author: Matthew Ribbins
+ * Description: Read the latency strip from frames as they arrive, and time how long each takes to be painted
+ */
+void CameraWidget::SetLatencyMeasurement(bool measure)
+{
+    latencyMeasure = measure;
+    latencyPending = false;
+    latencyHaveCounter = false;
+    latencyText.clear();
+    latencyStats.Reset();
+    update();
+}
+
+/***
+ * Set Latency Stamp
+ * Author: Matthew Ribbins
+ * Description: Paint a fresh latency strip over each frame as it is displayed. A camera pointed at the screen, or a
+ *              grab of the screen fed back in as a source, then carries it back round, so with measurement on we
+ *              time the whole loop from painting to capturing and painting again. Only meaningful when the source
+ *              is on this machine, as the timestamps are from its monotonic clock.
+ */
+void CameraWidget::SetLatencyStamp(bool stamp)
+{
+    latencyStamp = stamp;
+    update();
+}
+
+/***
+ * Report Latency
+ * Author: Matthew Ribbins
+ * Description: Every LATENCY_REPORT_INTERVAL, log the percentiles of the recent latencies and update the overlay
+ */
+void CameraWidget::ReportLatency(int64_t now)
+{
+    int64_t p50, p95, p99, max;
+
+    if(now - latencyReportTime < LATENCY_REPORT_INTERVAL * 1000LL) return;
+    latencyReportTime = now;
+
+    if(!latencyStats.GetPercentiles(p50, p95, p99, max)) return;
+    LOG_INFO(LOG_DISPLAY, "Glass to glass latency p50 %.1f p95 %.1f p99 %.1f max %.1f ms, %d samples",
+             p50 / 1000.0, p95 / 1000.0, p99 / 1000.0, max / 1000.0, latencyStats.GetCount());
+    latencyText = QString("p50 %1  p95 %2  p99 %3  max %4 ms")
+            .arg(p50 / 1000.0, 0, 'f', 1).arg(p95 / 1000.0, 0, 'f', 1)
+            .arg(p99 / 1000.0, 0, 'f', 1).arg(max / 1000.0, 0, 'f', 1);
+}
+
+/***
+ * Draw Latency Stamp
+ * Author: Matthew Ribbins
+ * Description: Paint the strip along the top of the displayed image, timestamped now
+ */
+void CameraWidget::DrawLatencyStamp(QPainter &painter, int x, int64_t now)
+{
+    bool bits[LATENCY_STRIP_BITS];
+    int blockWidth = LatencyStrip::GetBlockWidth(displayImage.width());
+    int height = LatencyStrip::GetHeight(displayImage.height());
+
+    if(blockWidth < LATENCY_STRIP_MIN_BLOCK) return;
+
+    LatencyStrip::GetBits(stampCounter++, now, bits);
+    for(int i = 0; i < LATENCY_STRIP_BITS; i++)
+        painter.fillRect(x + i * blockWidth, 0, blockWidth, height, bits[i] ? Qt::white : Qt::black);
+}
+
 /***
  * Convert Mat to QPixmap
  * Author: Matthew Ribbins
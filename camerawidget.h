@@ -7,7 +7,13 @@
 #include <QVBoxLayout>
 #include <QImage>
 #include <QDebug>
+#include <QPainter>
 #include <opencv/cv.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "latencystrip.h"
+#include "eventtrace.h"
+#include "logger.h"
 
 class CameraWidget : public QWidget
 {
@@ -18,12 +24,39 @@ public:
     QPixmap matToPixmap(cv::Mat);
     void putFrame(cv::Mat);
     void putFrame(QPixmap image);
+    void putFrameRGB(const cv::Mat &frame);
+    void SetLatencyMeasurement(bool measure);
+    void SetLatencyStamp(bool stamp);
 
 private:
     QLabel *cameraLabel;
     QVBoxLayout *cameraLayout;
     int windowWidth;
     int windowHeight;
+    QImage displayImage;
+    cv::Mat displayFrame;
+    cv::Mat scaledFrame;
+    // Display scaling as cv::remap tables, see BuildScaleMaps()
+    cv::Mat scaleMap;
+    cv::Mat scaleWeights;
+    cv::Size scaleSource;
+    bool latencyMeasure;
+    bool latencyStamp;
+    bool latencyPending;
+    bool latencyHaveCounter;
+    unsigned int latencyCounter;
+    int64_t latencyTimestamp;
+    int64_t latencyReportTime;
+    unsigned int stampCounter;
+    LatencyStats latencyStats;
+    QString latencyText;
+
+    void BuildScaleMaps(const cv::Size &source, const cv::Size &destination);
+    void ReportLatency(int64_t now);
+    void DrawLatencyStamp(QPainter &painter, int x, int64_t now);
+
+protected:
+    void paintEvent(QPaintEvent *);
 };
 
 #endif // CAMERAWIDGET_H
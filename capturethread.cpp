@@ -0,0 +1,66 @@
+/***
+ * RadioViz - capturethread.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Capture thread, one per camera. Waits on the device so the GUI thread never has to, and tells the
+ *              main window every time a new frame has arrived.
+ *
+ */
+#include "capturethread.h"
+
+CaptureThread::CaptureThread(Camera *camera, int cameraId, QObject *parent)
+    : QThread(parent)
+{
+    this->camera = camera;
+    this->cameraId = cameraId;
+    this->running = false;
+}
+
+/***
+ * Stop Capture Thread
+ * Author: Matthew Ribbins
+ * Description: Ask the thread to stop and wait for it. An FFmpeg capture gives up waiting on the device straight
+ *              away, but OpenCV can't be interrupted, so we only wait so long for a camera that has stalled.
+ *
+ * Return: (bool) false if the thread is still stuck in the device
+ */
+bool CaptureThread::Stop(void)
+{
+    running = false;
+    camera->Interrupt();
+    return wait(CAPTURE_STOP_TIMEOUT);
+}
+
+/***
+ * Capture Thread Loop
+ * Author: Matthew Ribbins
+ */
+void CaptureThread::run()
+{
+    char threadName[16];
+
+    snprintf(threadName, sizeof(threadName), "capture%d", cameraId);
+    Logger::SetThreadName(threadName);
+    ThreadPolicy::Apply(THREAD_CLASS_CAPTURE, threadName);
+
+    running = true;
+    while(running) {
+        int result;
+        {
+            EVENT_SCOPE("capture", cameraId);
+            result = camera->CaptureFrame();
+        }
+
+        switch(result) {
+            case CAPTURE_NEW_FRAME:
+                ThreadPolicy::Tick();
+                emit frameArrived(cameraId);
+                break;
+            case CAPTURE_NO_FRAME:
+                ThreadPolicy::Sleep(CAPTURE_RETRY_DELAY * 1000);
+                break;
+            default:
+                ThreadPolicy::Tick();
+                break;
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef CAPTURETHREAD_H
+#define CAPTURETHREAD_H
+
+#include <QThread>
+
+#include "camera.h"
+#include "threadpolicy.h"
+#include "radioviz.h"
+
+class CaptureThread : public QThread
+{
+    Q_OBJECT
+public:
+    CaptureThread(Camera *camera, int cameraId, QObject *parent = 0);
+    bool Stop(void);
+
+signals:
+    void frameArrived(int cameraId);
+
+protected:
+    void run();
+
+private:
+    Camera *camera;
+    int cameraId;
+    volatile bool running;
+};
+
+#endif // CAPTURETHREAD_H
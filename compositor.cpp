@@ -0,0 +1,192 @@
+/***
+ * RadioViz - compositor.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Compose several cameras onto one program canvas, either as a split screen/grid or as picture in
+ *              picture. The canvas and layout are kept between frames, and a camera is only scaled onto the
+ *              canvas when it has given us a new frame.
+ *
+ */
+#include "compositor.h"
+
+Compositor::Compositor()
+{
+    sourceCount = 0;
+    layout = COMPOSITOR_LAYOUT_SPLIT;
+    for(int i = 0; i < COMPOSITOR_MAX_SOURCES; i++) {
+        sources[i] = -1;
+        lastFrameNumber[i] = 0;
+        tileValid[i] = false;
+    }
+    SetCanvasSize(CAMERA_DEFAULT_RES_WIDTH, CAMERA_DEFAULT_RES_HEIGHT);
+}
+
+/***
+ * Set Canvas Size
+ * Author: Matthew Ribbins
+ * Description: Allocate the output canvas. This is the only place the canvas is (re)allocated.
+ */
+void Compositor::SetCanvasSize(int width, int height)
+{
+    canvas.create(height, width, CV_8UC3);
+    UpdateLayout();
+}
+
+void Compositor::SetLayout(int layout)
+{
+    if(this->layout == layout) return;
+    this->layout = layout;
+    UpdateLayout();
+}
+
+int Compositor::GetLayout(void)
+{
+    return layout;
+}
+
+/***
+ * Set Sources
+ * Author: Matthew Ribbins
+ * Description: Set the cameras on the canvas, first source is the main one. Nothing is recalculated if the
+ *              sources are the same as last time.
+ */
+void Compositor::SetSources(const int *sources, int count)
+{
+    if(count > COMPOSITOR_MAX_SOURCES) count = COMPOSITOR_MAX_SOURCES;
+
+    if(count == sourceCount) {
+        bool same = true;
+        for(int i = 0; i < count; i++) {
+            if(this->sources[i] != sources[i]) {
+                same = false;
+                break;
+            }
+        }
+        if(same) return;
+    }
+
+    for(int i = 0; i < count; i++)
+        this->sources[i] = sources[i];
+    sourceCount = count;
+    UpdateLayout();
+}
+
+void Compositor::ClearSources(void)
+{
+    sourceCount = 0;
+}
+
+int Compositor::GetSourceCount(void)
+{
+    return sourceCount;
+}
+
+int Compositor::GetSource(int slot)
+{
+    if(slot < 0 || slot >= sourceCount) return -1;
+    return sources[slot];
+}
+
+const cv::Mat &Compositor::GetCanvas(void)
+{
+    return canvas;
+}
+
+/***
+ * Update Layout
+ * Author: Matthew Ribbins
+ * Description: Work out the cell for each source. Everything is redrawn after a layout change.
+ */
+void Compositor::UpdateLayout(void)
+{
+    int width = canvas.cols;
+    int height = canvas.rows;
+
+    for(int i = 0; i < COMPOSITOR_MAX_SOURCES; i++) {
+        tileValid[i] = false;
+        lastFrameNumber[i] = 0;
+    }
+    canvas.setTo(cv::Scalar::all(0));
+
+    if(COMPOSITOR_LAYOUT_PIP == layout) {
+        // Main source full screen, the rest along the bottom right
+        int insetWidth = width / COMPOSITOR_PIP_SCALE;
+        int insetHeight = height / COMPOSITOR_PIP_SCALE;
+        int margin = width / COMPOSITOR_PIP_MARGIN;
+
+        cells[0] = cv::Rect(0, 0, width, height);
+        for(int i = 1; i < sourceCount; i++)
+            cells[i] = cv::Rect(width - i * (insetWidth + margin), height - insetHeight - margin, insetWidth, insetHeight);
+    } else if(sourceCount <= 2) {
+        // Side by side
+        for(int i = 0; i < sourceCount; i++)
+            cells[i] = cv::Rect(i * (width / 2), 0, width / 2, height);
+    } else {
+        // 2x2 grid
+        for(int i = 0; i < sourceCount; i++)
+            cells[i] = cv::Rect((i % 2) * (width / 2), (i / 2) * (height / 2), width / 2, height / 2);
+    }
+}
+
+/***
+ * Fit To Cell
+ * Author: Matthew Ribbins
+ * Description: Largest rectangle with the frame's aspect ratio, centred in the cell
+ */
+cv::Rect Compositor::FitToCell(const cv::Rect &cell, const cv::Size &frameSize)
+{
+    int width = cell.width;
+    int height = cell.width * frameSize.height / frameSize.width;
+
+    if(height > cell.height) {
+        height = cell.height;
+        width = cell.height * frameSize.width / frameSize.height;
+    }
+    return cv::Rect(cell.x + (cell.width - width) / 2, cell.y + (cell.height - height) / 2, width, height);
+}
+
+/***
+ * Put Frame
+ * Author: Matthew Ribbins
+ * Description: Scale a source's frame onto the canvas. If frameNumber is the same as the frame we last drew for
+ *              this slot it is skipped.
+ *
+ * Return: (bool) true if the canvas changed
+ */
+bool Compositor::PutFrame(int slot, const cv::Mat &frame, unsigned int frameNumber)
+{
+    if(slot < 0 || slot >= sourceCount || frame.empty() || frame.type() != CV_8UC3) return false;
+    if(tileValid[slot] && lastFrameNumber[slot] == frameNumber) return false;
+
+    if(!tileValid[slot] || frameSizes[slot] != frame.size()) {
+        if(tileValid[slot])
+            canvas(cells[slot]).setTo(cv::Scalar::all(0));
+        frameSizes[slot] = frame.size();
+        tiles[slot] = FitToCell(cells[slot], frame.size());
+        tileValid[slot] = true;
+    }
+    lastFrameNumber[slot] = frameNumber;
+
+    if(COMPOSITOR_LAYOUT_PIP == layout && slot > 0) {
+        // Insets are kept to one side so they can be put back on top whenever the main source is redrawn
+        insetFrames[slot].create(tiles[slot].height, tiles[slot].width, CV_8UC3);
+        cv::resize(frame, insetFrames[slot], insetFrames[slot].size(), 0, 0, cv::INTER_AREA);
+        insetFrames[slot].copyTo(canvas(tiles[slot]));
+        return true;
+    }
+
+    // Scale straight onto the canvas
+    cv::Mat tile = canvas(tiles[slot]);
+    cv::resize(frame, tile, tile.size(), 0, 0, cv::INTER_AREA);
+
+    if(COMPOSITOR_LAYOUT_PIP == layout)
+        DrawInsets();
+    return true;
+}
+
+void Compositor::DrawInsets(void)
+{
+    for(int i = 1; i < sourceCount; i++) {
+        if(tileValid[i] && !insetFrames[i].empty())
+            insetFrames[i].copyTo(canvas(tiles[i]));
+    }
+}
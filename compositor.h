@@ -0,0 +1,40 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <opencv2/opencv.hpp>
+
+#include "radioviz.h"
+
+class Compositor
+{
+public:
+    Compositor();
+    void SetCanvasSize(int width, int height);
+    void SetLayout(int layout);
+    int GetLayout(void);
+    void SetSources(const int *sources, int count);
+    void ClearSources(void);
+    int GetSourceCount(void);
+    int GetSource(int slot);
+    bool PutFrame(int slot, const cv::Mat &frame, unsigned int frameNumber);
+    const cv::Mat &GetCanvas(void);
+
+private:
+    cv::Mat canvas;
+    cv::Rect cells[COMPOSITOR_MAX_SOURCES];
+    cv::Rect tiles[COMPOSITOR_MAX_SOURCES];
+    cv::Size frameSizes[COMPOSITOR_MAX_SOURCES];
+    cv::Mat insetFrames[COMPOSITOR_MAX_SOURCES];
+    int sources[COMPOSITOR_MAX_SOURCES];
+    unsigned int lastFrameNumber[COMPOSITOR_MAX_SOURCES];
+    bool tileValid[COMPOSITOR_MAX_SOURCES];
+    int sourceCount;
+    int layout;
+
+protected:
+    void UpdateLayout(void);
+    cv::Rect FitToCell(const cv::Rect &cell, const cv::Size &frameSize);
+    void DrawInsets(void);
+};
+
+#endif // COMPOSITOR_H
@@ -0,0 +1,363 @@
+/***
+ * RadioViz - controlserver.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Control socket for automation systems and hardware panels. Runs on its own thread, so commands are
+ *              read and parsed without waiting on the GUI. Parsed commands go through a lock free queue that the
+ *              GUI thread drains every time it presents a frame, rather than through the GUI event queue, and
+ *              replies and telemetry come back the same way.
+ *
+ *              One command per line, case doesn't matter:
+ *                MODE <mode>                   set the switching mode (0-4, see radioviz.h)
+ *                CUT <source>                  cut to a source (from 1), as the number keys do
+ *                NEXT                          cut to the next source
+ *                GAIN <source> <gain>          set a source's audio gain
+ *                AUDIOTHRESHOLD <level>        set the switching thresholds
+ *                MOVEMENTTHRESHOLD <amount>
+ *                SUBSCRIBE / UNSUBSCRIBE       start or stop telemetry
+ *                STATS                         command to cut latency so far
+ *                TRACE                         save the last minute of pipeline events (see eventtrace.cpp)
+ *                PING
+ *
+ *              Replies are "OK <command> <us>", with how long the command took from arriving here to being done
+ *              (for a cut, to the first frame of it being shown), or "ERR <reason>". Telemetry is a line every
+ *              decision tick, "STATE <tick> <mode> <program> <count>" then "<level> <movement> <tally>" for each
+ *              source, where tally is 2 on program, 1 in a split screen and 0 off. "TALLY <program>" is also sent
+ *              straight away whenever program changes.
+ *
+ */
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+#include "controlserver.h"
+#include "nodeconnection.h"
+
+ControlServer::ControlServer(QObject *parent)
+    : QObject(parent)
+{
+    tcpServer = NULL;
+    localServer = NULL;
+    for(int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        clients[i] = NULL;
+        clientIds[i] = -1;
+        subscribed[i] = false;
+    }
+    connections = 0;
+    subscriberCount.store(0);
+    commandHead.store(0);
+    commandTail.store(0);
+    replyHead.store(0);
+    replyTail.store(0);
+    flushPending.store(false);
+    droppedReplies.store(0);
+}
+
+ControlServer::~ControlServer()
+{
+}
+
+qint64 ControlServer::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/***
+ * Thread Started
+ * Author: Matthew Ribbins
+ * Description: Connected directly to the control thread's started(), so this runs on the control thread itself
+ */
+void ControlServer::ThreadStarted(void)
+{
+    Logger::SetThreadName("control");
+    ThreadPolicy::Apply(THREAD_CLASS_NETWORK, "control");
+}
+
+/***
+ * Listen
+ * Author: Matthew Ribbins
+ * Description: Listen on a port, host:port, or unix:/path for a Unix socket. Call this before moving the server to
+ *              its thread.
+ *
+ * Return: (bool) true if we are listening
+ */
+bool ControlServer::Listen(const QString &address)
+{
+    bool result;
+
+    if(NodeConnection::IsLocalAddress(address)) {
+        QString path = address.startsWith("unix:") ? address.mid(5) : address;
+        localServer = new QLocalServer(this);
+        QLocalServer::removeServer(path);
+        connect(localServer, SIGNAL(newConnection()), this, SLOT(NewConnection()));
+        result = localServer->listen(path);
+    } else {
+        int separator = address.lastIndexOf(':');
+        QHostAddress host = (separator < 0) ? QHostAddress(QHostAddress::LocalHost) : QHostAddress(address.left(separator));
+        tcpServer = new QTcpServer(this);
+        connect(tcpServer, SIGNAL(newConnection()), this, SLOT(NewConnection()));
+        result = tcpServer->listen(host, address.mid(separator + 1).toUShort());
+    }
+
+    if(!result)
+        LOG_ERROR(LOG_GENERAL, "Error: Control socket could not listen on %s", address.toLocal8Bit().constData());
+    else
+        LOG_INFO(LOG_GENERAL, "Control socket listening on %s", address.toLocal8Bit().constData());
+    return result;
+}
+
+void ControlServer::NewConnection(void)
+{
+    QIODevice *client;
+    int slot;
+
+    if(tcpServer) {
+        QTcpSocket *socket = tcpServer->nextPendingConnection();
+        if(socket) socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        client = socket;
+    } else {
+        client = localServer->nextPendingConnection();
+    }
+    if(!client) return;
+
+    for(slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        if(!clients[slot]) break;
+    }
+    if(slot >= CONTROL_MAX_CLIENTS) {
+        LOG_WARNING(LOG_GENERAL, "More than %d control clients, refusing another", CONTROL_MAX_CLIENTS);
+        client->write("ERR too many clients\n");
+        client->close();
+        client->deleteLater();
+        return;
+    }
+
+    clients[slot] = client;
+    connections = (connections + 1) % (INT_MAX / CONTROL_MAX_CLIENTS);
+    clientIds[slot] = connections * CONTROL_MAX_CLIENTS + slot;
+    subscribed[slot] = false;
+    connect(client, SIGNAL(readyRead()), this, SLOT(ReadCommands()));
+    connect(client, SIGNAL(disconnected()), this, SLOT(ClientDisconnected()));
+    LOG_INFO(LOG_GENERAL, "Control client %d connected", slot);
+}
+
+void ControlServer::ClientDisconnected(void)
+{
+    for(int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if(clients[i] != sender()) continue;
+        if(subscribed[i]) subscriberCount.fetch_sub(1);
+        subscribed[i] = false;
+        clients[i]->deleteLater();
+        clients[i] = NULL;
+        clientIds[i] = -1;
+        LOG_INFO(LOG_GENERAL, "Control client %d disconnected", i);
+        return;
+    }
+}
+
+/***
+ * Read Commands
+ * Author: Matthew Ribbins
+ * Description: Parse every complete line a client has sent
+ */
+void ControlServer::ReadCommands(void)
+{
+    QIODevice *client = qobject_cast<QIODevice *>(sender());
+    bool overlong = false;
+    int slot;
+
+    for(slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        if(clients[slot] == client) break;
+    }
+    if(slot >= CONTROL_MAX_CLIENTS) return;
+
+    while(client->canReadLine()) {
+        qint64 length = client->readLine(line, sizeof(line));
+        if(length <= 0) break;
+        // Only the start of a line too long for the buffer was read, which mustn't be run as a command
+        if(line[length - 1] != '\n') {
+            overlong = true;
+            break;
+        }
+        while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+        if(length && !ParseCommand(slot, line))
+            Send(slot, "ERR bad command\n");
+    }
+
+    // Nobody sends a line this long, so they aren't speaking our protocol
+    if(overlong || client->bytesAvailable() >= CONTROL_LINE_SIZE) {
+        LOG_WARNING(LOG_GENERAL, "Control client %d sent an overlong line, disconnecting", slot);
+        client->close();
+    }
+}
+
+/***
+ * Parse Command
+ * Author: Matthew Ribbins
+ * Description: Turn a line into a command for the GUI thread. Subscriptions are dealt with here.
+ *
+ * Return: (bool) false if the line isn't a command we know
+ */
+bool ControlServer::ParseCommand(int client, char *text)
+{
+    ControlCommand command;
+    char *save = NULL;
+    char *name = strtok_r(text, " \t", &save);
+    char *first = strtok_r(NULL, " \t", &save);
+    char *second = strtok_r(NULL, " \t", &save);
+
+    if(!name) return false;
+
+    command.received = Now();
+    command.client = clientIds[client];
+    command.source = 0;
+    command.value = 0;
+
+    if(!strcasecmp(name, "SUBSCRIBE") || !strcasecmp(name, "UNSUBSCRIBE")) {
+        bool subscribe = !strcasecmp(name, "SUBSCRIBE");
+        if(subscribe != subscribed[client])
+            subscriberCount.fetch_add(subscribe ? 1 : -1);
+        subscribed[client] = subscribe;
+        Send(client, subscribe ? "OK SUBSCRIBE 0\n" : "OK UNSUBSCRIBE 0\n");
+        return true;
+    } else if(!strcasecmp(name, "MODE") && first) {
+        command.type = CONTROL_MODE;
+        command.value = atoi(first);
+    } else if(!strcasecmp(name, "CUT") && first) {
+        command.type = CONTROL_CUT;
+        command.source = atoi(first);
+    } else if(!strcasecmp(name, "NEXT")) {
+        command.type = CONTROL_NEXT;
+    } else if(!strcasecmp(name, "GAIN") && first && second) {
+        command.type = CONTROL_GAIN;
+        command.source = atoi(first);
+        command.value = atof(second);
+    } else if(!strcasecmp(name, "AUDIOTHRESHOLD") && first) {
+        command.type = CONTROL_AUDIO_THRESHOLD;
+        command.value = atof(first);
+    } else if(!strcasecmp(name, "MOVEMENTTHRESHOLD") && first) {
+        command.type = CONTROL_MOVEMENT_THRESHOLD;
+        command.value = atoi(first);
+    } else if(!strcasecmp(name, "STATS")) {
+        command.type = CONTROL_STATS;
+    } else if(!strcasecmp(name, "PING")) {
+        command.type = CONTROL_PING;
+    } else if(!strcasecmp(name, "TRACE")) {
+        command.type = CONTROL_TRACE;
+    } else {
+        return false;
+    }
+
+    unsigned int head = commandHead.load(std::memory_order_relaxed);
+    if(head - commandTail.load(std::memory_order_acquire) >= CONTROL_QUEUE_SIZE) {
+        Send(client, "ERR busy\n");
+        return true;
+    }
+    commands[head & (CONTROL_QUEUE_SIZE - 1)] = command;
+    commandHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+/***
+ * Take Command
+ * Author: Matthew Ribbins
+ * Description: Next command for the GUI thread, if there is one. Only the GUI thread may call this.
+ *
+ * Return: (bool) true if command was filled in
+ */
+bool ControlServer::TakeCommand(ControlCommand &command)
+{
+    unsigned int tail = commandTail.load(std::memory_order_relaxed);
+
+    if(tail == commandHead.load(std::memory_order_acquire)) return false;
+    command = commands[tail & (CONTROL_QUEUE_SIZE - 1)];
+    commandTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool ControlServer::HasSubscribers(void)
+{
+    return subscriberCount.load(std::memory_order_relaxed) > 0;
+}
+
+/***
+ * Reply
+ * Author: Matthew Ribbins
+ * Description: Send a line to the client a command came from (its client). Dropped if that client has since gone.
+ *              Only the GUI thread may call this.
+ */
+void ControlServer::Reply(int client, const char *text)
+{
+    QueueReply(client, text);
+}
+
+/***
+ * Publish
+ * Author: Matthew Ribbins
+ * Description: Send a line to every subscribed client. Only the GUI thread may call this.
+ */
+void ControlServer::Publish(const char *text)
+{
+    if(!HasSubscribers()) return;
+    QueueReply(-1, text);
+}
+
+void ControlServer::QueueReply(int client, const char *text)
+{
+    unsigned int head = replyHead.load(std::memory_order_relaxed);
+
+    if(head - replyTail.load(std::memory_order_acquire) >= CONTROL_REPLY_SIZE) {
+        droppedReplies.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    ControlReply &reply = replies[head & (CONTROL_REPLY_SIZE - 1)];
+    reply.client = client;
+    strncpy(reply.text, text, sizeof(reply.text) - 1);
+    reply.text[sizeof(reply.text) - 1] = '\0';
+    replyHead.store(head + 1, std::memory_order_release);
+
+    // Wake the control thread, once however many lines are waiting
+    if(!flushPending.exchange(true))
+        QMetaObject::invokeMethod(this, "FlushReplies", Qt::QueuedConnection);
+}
+
+/***
+ * Flush Replies
+ * Author: Matthew Ribbins
+ * Description: Write out everything the GUI thread has queued for the clients
+ */
+void ControlServer::FlushReplies(void)
+{
+    unsigned int tail = replyTail.load(std::memory_order_relaxed);
+    unsigned int dropped;
+
+    flushPending.store(false);
+    unsigned int head = replyHead.load(std::memory_order_acquire);
+
+    for(; tail != head; tail++) {
+        const ControlReply &reply = replies[tail & (CONTROL_REPLY_SIZE - 1)];
+        if(reply.client >= 0) {
+            int slot = reply.client % CONTROL_MAX_CLIENTS;
+            if(clientIds[slot] == reply.client) Send(slot, reply.text);
+            continue;
+        }
+        for(int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+            if(subscribed[i]) Send(i, reply.text);
+        }
+    }
+    replyTail.store(tail, std::memory_order_release);
+
+    dropped = droppedReplies.exchange(0, std::memory_order_relaxed);
+    if(dropped)
+        LOG_WARNING(LOG_GENERAL, "Control socket dropped %u replies", dropped);
+}
+
+void ControlServer::Send(int client, const char *text)
+{
+    if(client < 0 || client >= CONTROL_MAX_CLIENTS || !clients[client]) return;
+    clients[client]->write(text);
+}
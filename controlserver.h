@@ -0,0 +1,98 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+#include <QLocalServer>
+#include <QIODevice>
+#include <atomic>
+
+#include "logger.h"
+#include "threadpolicy.h"
+#include "radioviz.h"
+
+// Commands, as queued for the GUI thread
+#define CONTROL_MODE 0
+#define CONTROL_CUT 1
+#define CONTROL_NEXT 2
+#define CONTROL_GAIN 3
+#define CONTROL_AUDIO_THRESHOLD 4
+#define CONTROL_MOVEMENT_THRESHOLD 5
+#define CONTROL_STATS 6
+#define CONTROL_PING 7
+#define CONTROL_TRACE 8
+
+// Rings must be a power of two
+#define CONTROL_QUEUE_SIZE 64
+#define CONTROL_REPLY_SIZE 64
+#define CONTROL_LINE_SIZE 1024
+#define CONTROL_MAX_CLIENTS 8
+
+// A command's client is its connection's id, so a reply meant for a client that has gone never reaches whoever
+// connects in its slot next. The slot is the id modulo CONTROL_MAX_CLIENTS.
+typedef struct _ControlCommand {
+    int type;
+    int client;
+    int source;
+    float value;
+    qint64 received;
+} ControlCommand;
+
+typedef struct _ControlReply {
+    int client;
+    char text[CONTROL_LINE_SIZE];
+} ControlReply;
+
+class ControlServer : public QObject
+{
+    Q_OBJECT
+public:
+    ControlServer(QObject *parent = 0);
+    ~ControlServer();
+    bool Listen(const QString &address);
+    static qint64 Now(void);
+
+    // GUI thread
+    bool TakeCommand(ControlCommand &command);
+    void Reply(int client, const char *text);
+    void Publish(const char *text);
+    bool HasSubscribers(void);
+
+public slots:
+    void ThreadStarted(void);
+
+private slots:
+    void NewConnection(void);
+    void ReadCommands(void);
+    void ClientDisconnected(void);
+    void FlushReplies(void);
+
+private:
+    bool ParseCommand(int client, char *line);
+    void QueueReply(int client, const char *text);
+    void Send(int client, const char *text);
+
+    QTcpServer *tcpServer;
+    QLocalServer *localServer;
+    QIODevice *clients[CONTROL_MAX_CLIENTS];
+    int clientIds[CONTROL_MAX_CLIENTS];
+    int connections;
+    bool subscribed[CONTROL_MAX_CLIENTS];
+    std::atomic<int> subscriberCount;
+    char line[CONTROL_LINE_SIZE];
+
+    // Control thread to GUI thread
+    ControlCommand commands[CONTROL_QUEUE_SIZE];
+    std::atomic<unsigned int> commandHead;
+    std::atomic<unsigned int> commandTail;
+
+    // GUI thread to control thread
+    ControlReply replies[CONTROL_REPLY_SIZE];
+    std::atomic<unsigned int> replyHead;
+    std::atomic<unsigned int> replyTail;
+    std::atomic<bool> flushPending;
+    std::atomic<unsigned int> droppedReplies;
+};
+
+#endif // CONTROLSERVER_H
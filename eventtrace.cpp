@@ -0,0 +1,319 @@
+/***
+ * RadioViz - eventtrace.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Timeline of what every thread was doing, for finding out why a frame was late. Code marks the
+ *              stages of the pipeline (capture, decode, conversion, motion, metering, decisions, painting) with
+ *              EVENT_SCOPE, and each thread keeps its events in its own ring, like the logger. Nothing is written
+ *              while the show runs; the rings always hold the last minute or so, and Save() writes the last
+ *              Events/seconds of them as Chrome trace JSON, which opens in chrome://tracing or ui.perfetto.dev.
+ *
+ *              Settings:
+ *                Events/file      where to save, e.g. events.json, saved as events-<date>-<time>.json. Tracing
+ *                                 is off if this isn't set.
+ *                Events/seconds   how much to save, the rings permitting
+ *
+ *              Saves happen on the TRACE control command and when we exit. Recording an event is two clock
+ *              reads and a copy into the ring, with no locks or allocation, and a disabled EVENT_SCOPE is a
+ *              single load.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "eventtrace.h"
+#include "logger.h"
+
+std::atomic<bool> EventTrace::enabled(false);
+std::atomic<bool> EventTrace::saving(false);
+QMutex EventTrace::ringsMutex;
+std::vector<EventRing *> EventTrace::rings;
+char EventTrace::path[EVENT_PATH_SIZE];
+int EventTrace::seconds = EVENT_DEFAULT_SECONDS;
+
+static thread_local EventRing *threadRing = NULL;
+
+// One thread's events, copied out of its ring for saving
+typedef struct _EventSnapshot {
+    int tid;
+    char threadName[16];
+    std::vector<TraceEvent> events;
+} EventSnapshot;
+
+// Writes snapshots out, so the thread that asked for one isn't held up by the disk. There is one, started with the
+// first save and kept for the next, so saving doesn't leave a log ring behind each time, until Shutdown().
+class EventTraceWriter : public QThread
+{
+public:
+    EventTraceWriter()
+    {
+        path[0] = '\0';
+        snapshots = NULL;
+        stopping = false;
+    }
+
+    // Only one save is written at a time (EventTrace::saving), so there is never one already waiting
+    void Queue(const char *path, std::vector<EventSnapshot> *snapshots)
+    {
+        QMutexLocker locker(&mutex);
+        strncpy(this->path, path, sizeof(this->path) - 1);
+        this->path[sizeof(this->path) - 1] = '\0';
+        this->snapshots = snapshots;
+        queued.wakeOne();
+    }
+
+    // Finish writing anything queued, then end the thread and wait for it
+    void Stop(void)
+    {
+        mutex.lock();
+        stopping = true;
+        queued.wakeOne();
+        mutex.unlock();
+        wait();
+    }
+
+    static void Write(const char *path, const std::vector<EventSnapshot> &snapshots);
+
+protected:
+    void run()
+    {
+        Logger::SetThreadName("events");
+        for(;;) {
+            mutex.lock();
+            while(!snapshots && !stopping)
+                queued.wait(&mutex);
+            if(!snapshots) {
+                mutex.unlock();
+                return;
+            }
+            std::vector<EventSnapshot> *writing = snapshots;
+            snapshots = NULL;
+            mutex.unlock();
+
+            Write(path, *writing);
+            delete writing;
+        }
+    }
+
+private:
+    QMutex mutex;
+    QWaitCondition queued;
+    char path[EVENT_PATH_SIZE];
+    std::vector<EventSnapshot> *snapshots;
+    bool stopping;
+};
+
+static EventTraceWriter *writer = NULL;
+
+/***
+ * Start Event Trace
+ * Author: Matthew Ribbins
+ * Description: Start recording events, to be saved to path (with the date and time added) covering the last
+ *              seconds. Call this before any of the threads start.
+ */
+void EventTrace::Start(const char *path, int seconds)
+{
+    if(!path || !*path) return;
+
+    strncpy(EventTrace::path, path, sizeof(EventTrace::path) - 1);
+    EventTrace::seconds = (seconds > 0) ? seconds : EVENT_DEFAULT_SECONDS;
+    enabled.store(true, std::memory_order_relaxed);
+    LOG_INFO(LOG_GENERAL, "Recording events, the last %d seconds are saved to %s", EventTrace::seconds, path);
+}
+
+/***
+ * Stop Event Trace
+ * Author: Matthew Ribbins
+ * Description: Stop recording events. Those already recorded can still be saved.
+ */
+void EventTrace::Stop(void)
+{
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+/***
+ * Shutdown Event Trace
+ * Author: Matthew Ribbins
+ * Description: Stop recording events and end the writer thread, once it has written anything still queued. Call
+ *              this as we exit, after the last Save() and before Logger::Stop(), as the writer logs.
+ */
+void EventTrace::Shutdown(void)
+{
+    Stop();
+    if(writer) {
+        writer->Stop();
+        delete writer;
+        writer = NULL;
+    }
+}
+
+/***
+ * Set Thread Name
+ * Author: Matthew Ribbins
+ * Description: What the calling thread is called in saved traces. Only makes a ring if tracing is on.
+ */
+void EventTrace::SetThreadName(const char *name)
+{
+    if(!IsEnabled()) return;
+    EventRing *ring = GetRing();
+    strncpy(ring->threadName, name, sizeof(ring->threadName) - 1);
+}
+
+/***
+ * Get Ring
+ * Author: Matthew Ribbins
+ * Description: The calling thread's ring, made the first time the thread records an event. Rings are never freed,
+ *              as a save may still be reading one after its thread has gone.
+ */
+EventRing *EventTrace::GetRing(void)
+{
+    if(!threadRing) {
+        EventRing *ring = new EventRing;
+        ring->head.store(0);
+        ring->tid = (int)syscall(SYS_gettid);
+        memset(ring->threadName, 0, sizeof(ring->threadName));
+
+        QMutexLocker locker(&ringsMutex);
+        snprintf(ring->threadName, sizeof(ring->threadName), "thread%d", (int)rings.size());
+        rings.push_back(ring);
+        threadRing = ring;
+    }
+    return threadRing;
+}
+
+/***
+ * Record Event
+ * Author: Matthew Ribbins
+ * Description: Add an event that ran from start to end (ns) to the calling thread's ring
+ */
+void EventTrace::Record(const char *name, int source, qint64 start, qint64 end)
+{
+    EventRing *ring = GetRing();
+    unsigned int head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent &event = ring->events[head & (EVENT_RING_SIZE - 1)];
+
+    event.start = start;
+    event.duration = end - start;
+    event.name = name;
+    event.source = source;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+/***
+ * Save Event Trace
+ * Author: Matthew Ribbins
+ * Description: Copy the last seconds of every thread's events and write them out as Chrome trace JSON. Unless
+ *              wait is set the file is written on a thread of its own, so only the copy happens here. The file's
+ *              name goes in savedPath.
+ *
+ * Return: (bool) false if tracing is off, or a save is already being written and we aren't waiting
+ */
+bool EventTrace::Save(char *savedPath, int size, bool wait)
+{
+    if(!path[0]) return false;
+
+    // Saving as we exit, so let a save that is still being written finish first
+    while(wait && saving.load()) QThread::msleep(10);
+    if(saving.exchange(true)) return false;
+
+    // events.json becomes events-20150401-153000.json
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(stamp, sizeof(stamp), "-%Y%m%d-%H%M%S", &local);
+
+    const char *extension = strrchr(path, '.');
+    int baseLength = (extension && !strchr(extension, '/')) ? (int)(extension - path) : (int)strlen(path);
+    snprintf(savedPath, size, "%.*s%s%s", baseLength, path, stamp, path + baseLength);
+
+    std::vector<EventSnapshot> *snapshots = new std::vector<EventSnapshot>;
+    qint64 from = Now() - seconds * 1000000000LL;
+    {
+        QMutexLocker locker(&ringsMutex);
+        snapshots->resize(rings.size());
+        for(size_t i = 0; i < rings.size(); i++) {
+            EventRing *ring = rings[i];
+            EventSnapshot &snapshot = (*snapshots)[i];
+            unsigned int head = ring->head.load(std::memory_order_acquire);
+            unsigned int first = (head > EVENT_RING_SIZE) ? head - EVENT_RING_SIZE : 0;
+
+            snapshot.tid = ring->tid;
+            memcpy(snapshot.threadName, ring->threadName, sizeof(snapshot.threadName));
+            std::vector<TraceEvent> copied(head - first);
+            for(unsigned int n = first; n != head; n++)
+                copied[n - first] = ring->events[n & (EVENT_RING_SIZE - 1)];
+
+            // The thread carried on while we copied, so anything it may have been writing over is thrown away
+            std::atomic_thread_fence(std::memory_order_acquire);
+            unsigned int latest = ring->head.load(std::memory_order_relaxed);
+            unsigned int valid = (latest - first >= EVENT_RING_SIZE) ? latest - EVENT_RING_SIZE + 1 - first : 0;
+
+            for(size_t n = valid; n < copied.size(); n++) {
+                if(copied[n].start >= from) snapshot.events.push_back(copied[n]);
+            }
+        }
+    }
+
+    if(wait) {
+        EventTraceWriter::Write(savedPath, *snapshots);
+        delete snapshots;
+        return true;
+    }
+    if(!writer) {
+        writer = new EventTraceWriter;
+        writer->start(QThread::LowPriority);
+    }
+    writer->Queue(savedPath, snapshots);
+    return true;
+}
+
+/***
+ * Write Event Trace
+ * Author: Matthew Ribbins
+ * Description: Chrome trace JSON, one complete ("X") event per line with times in microseconds, and each thread
+ *              named as we know it
+ */
+void EventTraceWriter::Write(const char *path, const std::vector<EventSnapshot> &snapshots)
+{
+    FILE *file = fopen(path, "w");
+    int pid = (int)getpid();
+    size_t count = 0;
+
+    if(!file) {
+        LOG_ERROR(LOG_GENERAL, "Error: Could not save events to %s", path);
+        EventTrace::saving.store(false);
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"RadioViz\"}}", pid);
+    for(size_t i = 0; i < snapshots.size(); i++) {
+        const EventSnapshot &snapshot = snapshots[i];
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, snapshot.tid, snapshot.threadName);
+    }
+
+    for(size_t i = 0; i < snapshots.size(); i++) {
+        const EventSnapshot &snapshot = snapshots[i];
+        for(size_t n = 0; n < snapshot.events.size(); n++) {
+            const TraceEvent &event = snapshot.events[n];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    event.name, pid, snapshot.tid, event.start / 1000.0, event.duration / 1000.0);
+            if(event.source >= 0)
+                fprintf(file, ",\"args\":{\"source\":%d}", event.source + 1);
+            fprintf(file, "}");
+            count++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    if(fclose(file))
+        LOG_ERROR(LOG_GENERAL, "Error: Could not finish writing events to %s", path);
+    else
+        LOG_INFO(LOG_GENERAL, "Saved %zu events to %s", count, path);
+    EventTrace::saving.store(false);
+}
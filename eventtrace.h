@@ -0,0 +1,93 @@
+#ifndef EVENTTRACE_H
+#define EVENTTRACE_H
+
+#include <QMutex>
+#include <atomic>
+#include <vector>
+#include <time.h>
+
+// Each thread's ring (events), must be a power of two. A capture thread makes a few events a frame and the GUI
+// thread a few per source per frame, so this holds a minute or more of either.
+#define EVENT_RING_SIZE 65536
+#define EVENT_DEFAULT_SECONDS 60
+#define EVENT_PATH_SIZE 512
+
+// Time what's left of the enclosing block as an event. name must be a string literal, source is the source it was
+// for or -1.
+#define EVENT_CONCAT_(a, b) a##b
+#define EVENT_CONCAT(a, b) EVENT_CONCAT_(a, b)
+#define EVENT_SCOPE(name, source) EventScope EVENT_CONCAT(eventScope, __LINE__)(name, source)
+
+typedef struct _TraceEvent {
+    qint64 start;
+    qint64 duration;
+    const char *name;
+    int source;
+} TraceEvent;
+
+// Single producer (the thread that owns it). It never waits for readers, the oldest events are overwritten.
+typedef struct _EventRing {
+    TraceEvent events[EVENT_RING_SIZE];
+    std::atomic<unsigned int> head;
+    int tid;
+    char threadName[16];
+} EventRing;
+
+class EventTrace
+{
+public:
+    static void Start(const char *path, int seconds);
+    static void Stop(void);
+    static void Shutdown(void);
+    static bool Save(char *savedPath, int size, bool wait);
+    static void SetThreadName(const char *name);
+
+    static inline bool IsEnabled(void)
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static inline qint64 Now(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    static void Record(const char *name, int source, qint64 start, qint64 end);
+
+private:
+    friend class EventTraceWriter;
+    static EventRing *GetRing(void);
+
+    static std::atomic<bool> enabled;
+    static std::atomic<bool> saving;
+    static QMutex ringsMutex;
+    static std::vector<EventRing *> rings;
+    static char path[EVENT_PATH_SIZE];
+    static int seconds;
+};
+
+// Times its own lifetime. Costs one load when tracing is off.
+class EventScope
+{
+public:
+    inline EventScope(const char *name, int source)
+    {
+        this->name = name;
+        this->source = source;
+        start = EventTrace::IsEnabled() ? EventTrace::Now() : 0;
+    }
+
+    inline ~EventScope()
+    {
+        if(start) EventTrace::Record(name, source, start, EventTrace::Now());
+    }
+
+private:
+    const char *name;
+    int source;
+    qint64 start;
+};
+
+#endif // EVENTTRACE_H
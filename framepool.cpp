@@ -0,0 +1,231 @@
+/***
+ * RadioViz - framepool.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Pool of aligned frame buffers shared by every camera. Capture writes a frame into a buffer once,
+ *              and display, analysis and anything else that wants the frame holds a Frame reference to that same
+ *              buffer rather than copying it. The buffer goes back to the pool when the last reference goes.
+ *
+ *              Buffers are kept once allocated, up to the budget. A free buffer that is too small is only given
+ *              back to make room for one of a new size, e.g. when a camera changes capture tier. If the pool is
+ *              full and nothing is free the frame is dropped and counted as starved.
+ *
+ */
+#include <stdlib.h>
+
+#include "framepool.h"
+
+QMutex FramePool::poolMutex;
+FrameBuffer *FramePool::freeList = NULL;
+long long FramePool::budget = FRAMEPOOL_DEFAULT_BUDGET * 1024LL * 1024LL;
+FramePoolStats FramePool::stats = { 0, 0, 0, 0, 0, 0 };
+
+Frame::Frame()
+{
+    buffer = NULL;
+}
+
+Frame::Frame(FrameBuffer *buffer)
+{
+    this->buffer = buffer;
+}
+
+Frame::Frame(const Frame &other)
+{
+    buffer = other.buffer;
+    if(buffer) buffer->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+Frame &Frame::operator=(const Frame &other)
+{
+    if(other.buffer) other.buffer->references.fetch_add(1, std::memory_order_relaxed);
+    Release();
+    buffer = other.buffer;
+    return *this;
+}
+
+Frame::~Frame()
+{
+    Release();
+}
+
+bool Frame::IsNull(void) const
+{
+    return !buffer;
+}
+
+/***
+ * Get Mat
+ * Author: Matthew Ribbins
+ * Description: The frame as a cv::Mat pointing at the pool's buffer. It doesn't hold a reference of its own, so is
+ *              only valid while this Frame (or a copy) is held.
+ */
+cv::Mat Frame::GetMat(void) const
+{
+    if(!buffer) return cv::Mat();
+    return cv::Mat(buffer->height, buffer->width, buffer->type, buffer->data, buffer->step);
+}
+
+int Frame::GetWidth(void) const
+{
+    return buffer ? buffer->width : 0;
+}
+
+int Frame::GetHeight(void) const
+{
+    return buffer ? buffer->height : 0;
+}
+
+unsigned int Frame::GetNumber(void) const
+{
+    return buffer ? buffer->number : 0;
+}
+
+void Frame::SetNumber(unsigned int number)
+{
+    if(buffer) buffer->number = number;
+}
+
+void Frame::Release(void)
+{
+    if(buffer && 1 == buffer->references.fetch_sub(1, std::memory_order_acq_rel))
+        FramePool::Return(buffer);
+    buffer = NULL;
+}
+
+/***
+ * Set Budget
+ * Author: Matthew Ribbins
+ * Description: Most memory the pool will hold, in bytes
+ */
+void FramePool::SetBudget(long long bytes)
+{
+    QMutexLocker locker(&poolMutex);
+    budget = bytes;
+}
+
+size_t FramePool::GetStep(int width, int type)
+{
+    size_t step = width * CV_ELEM_SIZE(type);
+    return (step + FRAMEPOOL_ALIGNMENT - 1) & ~(size_t)(FRAMEPOOL_ALIGNMENT - 1);
+}
+
+FrameBuffer *FramePool::Allocate(size_t capacity)
+{
+    void *data;
+
+    if(posix_memalign(&data, FRAMEPOOL_ALIGNMENT, capacity)) return NULL;
+
+    FrameBuffer *buffer = new FrameBuffer;
+    buffer->data = (uchar *)data;
+    buffer->capacity = capacity;
+    buffer->references.store(0);
+    buffer->next = NULL;
+    stats.buffers++;
+    stats.bytes += capacity;
+    return buffer;
+}
+
+void FramePool::Free(FrameBuffer *buffer)
+{
+    stats.buffers--;
+    stats.bytes -= buffer->capacity;
+    free(buffer->data);
+    delete buffer;
+}
+
+/***
+ * Reserve
+ * Author: Matthew Ribbins
+ * Description: Allocate count buffers for frames of this size up front, so capture doesn't have to
+ */
+void FramePool::Reserve(int count, int width, int height, int type)
+{
+    QMutexLocker locker(&poolMutex);
+    size_t capacity = GetStep(width, type) * height;
+
+    for(int i = 0; i < count && stats.bytes + (long long)capacity <= budget; i++) {
+        FrameBuffer *buffer = Allocate(capacity);
+        if(!buffer) break;
+        buffer->next = freeList;
+        freeList = buffer;
+    }
+}
+
+/***
+ * Acquire
+ * Author: Matthew Ribbins
+ * Description: A buffer for a frame of this size, with one reference held by the caller. The smallest free buffer
+ *              it fits in is used, otherwise a new one is allocated if the budget allows.
+ *
+ * Return: (Frame) the frame, which is null if the pool is starved
+ */
+Frame FramePool::Acquire(int width, int height, int type)
+{
+    QMutexLocker locker(&poolMutex);
+    size_t step = GetStep(width, type);
+    size_t capacity = step * height;
+    FrameBuffer **best = NULL;
+    FrameBuffer *buffer;
+    long long freeBytes = 0;
+
+    for(FrameBuffer **entry = &freeList; *entry; entry = &(*entry)->next) {
+        freeBytes += (*entry)->capacity;
+        if((*entry)->capacity >= capacity && (!best || (*entry)->capacity < (*best)->capacity))
+            best = entry;
+    }
+
+    if(best) {
+        buffer = *best;
+        *best = buffer->next;
+    } else {
+        // Give back free buffers that are too small until there is room for this one, unless giving them all back
+        // still wouldn't make room, as then they would only have to be allocated again
+        if(stats.bytes - freeBytes + (long long)capacity > budget) {
+            stats.starved++;
+            return Frame();
+        }
+        while(freeList && stats.bytes + (long long)capacity > budget) {
+            buffer = freeList;
+            freeList = buffer->next;
+            Free(buffer);
+        }
+        buffer = Allocate(capacity);
+        if(!buffer) {
+            stats.starved++;
+            return Frame();
+        }
+    }
+
+    buffer->width = width;
+    buffer->height = height;
+    buffer->type = type;
+    buffer->step = step;
+    buffer->number = 0;
+    buffer->next = NULL;
+    buffer->references.store(1, std::memory_order_relaxed);
+
+    stats.acquisitions++;
+    if(++stats.inUse > stats.peakInUse) stats.peakInUse = stats.inUse;
+    return Frame(buffer);
+}
+
+void FramePool::Return(FrameBuffer *buffer)
+{
+    QMutexLocker locker(&poolMutex);
+    buffer->next = freeList;
+    freeList = buffer;
+    stats.inUse--;
+}
+
+/***
+ * Get Stats
+ * Author: Matthew Ribbins
+ * Description: Buffers and memory held, how many are in use now and at most, and how often the pool has been
+ *              starved. The peak is reset each time.
+ */
+void FramePool::GetStats(FramePoolStats &stats)
+{
+    QMutexLocker locker(&poolMutex);
+    stats = FramePool::stats;
+    FramePool::stats.peakInUse = FramePool::stats.inUse;
+}
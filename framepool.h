@@ -0,0 +1,84 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QMutex>
+#include <atomic>
+#include <stddef.h>
+#include <opencv2/core/core.hpp>
+
+// Rows start on a cache line, so SIMD conversions never straddle one
+#define FRAMEPOOL_ALIGNMENT 64
+
+// Pool size (MB) and buffers reserved per source: one being captured into, the newest published, the one on
+// screen and one for a reader such as the detector or a node subscriber
+#define FRAMEPOOL_DEFAULT_BUDGET 256
+#define FRAMEPOOL_BUFFERS_PER_SOURCE 4
+
+typedef struct _FrameBuffer {
+    uchar *data;
+    size_t capacity;
+    std::atomic<int> references;
+    int width;
+    int height;
+    int type;
+    size_t step;
+    unsigned int number;
+    struct _FrameBuffer *next;
+} FrameBuffer;
+
+typedef struct _FramePoolStats {
+    int buffers;
+    int inUse;
+    int peakInUse;
+    long long bytes;
+    unsigned long long acquisitions;
+    unsigned long long starved;
+} FramePoolStats;
+
+// A reference to a frame in the pool. Copies share the buffer, which goes back to the pool when the last one is
+// released or destroyed.
+class Frame
+{
+public:
+    Frame();
+    Frame(const Frame &other);
+    Frame &operator=(const Frame &other);
+    ~Frame();
+
+    bool IsNull(void) const;
+    cv::Mat GetMat(void) const;
+    int GetWidth(void) const;
+    int GetHeight(void) const;
+    unsigned int GetNumber(void) const;
+    void SetNumber(unsigned int number);
+    void Release(void);
+
+private:
+    friend class FramePool;
+    Frame(FrameBuffer *buffer);
+
+    FrameBuffer *buffer;
+};
+
+class FramePool
+{
+public:
+    static void SetBudget(long long bytes);
+    static void Reserve(int count, int width, int height, int type);
+    static Frame Acquire(int width, int height, int type);
+    static void GetStats(FramePoolStats &stats);
+
+private:
+    friend class Frame;
+    static size_t GetStep(int width, int type);
+    static FrameBuffer *Allocate(size_t capacity);
+    static void Free(FrameBuffer *buffer);
+    static void Return(FrameBuffer *buffer);
+
+    static QMutex poolMutex;
+    static FrameBuffer *freeList;
+    static long long budget;
+    static FramePoolStats stats;
+};
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,210 @@
+/***
+ * RadioViz - gccphat.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Which mic is nearest whoever is talking, from the delays between mics (GCC-PHAT). In a small studio
+ *              every mic hears every speaker, a few dB down and a few ms late, so the loudest mic isn't always
+ *              the right one, but the nearest mic always hears them first.
+ *
+ *              Each frame is windowed and transformed once per mic, and whitened (magnitude divided out, so only
+ *              the phase is left, over the speech band). For every pair of mics the product of one whitened
+ *              spectrum and the conjugate of the other is averaged over recent frames, and its inverse transform
+ *              peaks at the delay between them, 1 for a pure delay, lower the more the pair disagree. The
+ *              transforms and complex products are OpenCV's, in its packed (CCS) format, into Mats made once, so
+ *              a frame costs one forward transform per mic and one inverse per pair, with no allocation.
+ *
+ *              A mic's bleed is how sure we are that another mic heard the sound first: near 0 for the nearest
+ *              mic, near 1 for one that is only hearing someone else.
+ *
+ */
+#include <math.h>
+
+#include "gccphat.h"
+
+/***
+ * GCC-PHAT Constructor
+ * Author: Matthew Ribbins
+ * Description: Frames are frameSize samples (even, and ideally a power of two) at sampleRate
+ */
+GccPhat::GccPhat(int frameSize, int sampleRate)
+{
+    this->frameSize = frameSize;
+    this->sampleRate = sampleRate;
+    mics = 0;
+    maxLag = 0;
+
+    // Hann window, as frames overlap by half
+    window.create(1, frameSize, CV_32F);
+    for(int i = 0; i < frameSize; i++)
+        window.at<float>(i) = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / frameSize);
+
+    // Bins outside the speech band are left out of the whitened spectra
+    int bandBins = 0;
+    bandWeights.assign(frameSize / 2, 0);
+    for(int k = 1; k < frameSize / 2; k++) {
+        float frequency = (float)k * sampleRate / frameSize;
+        if(frequency >= GCCPHAT_LOW_FREQUENCY && frequency <= GCCPHAT_HIGH_FREQUENCY) {
+            bandWeights[k] = 1;
+            bandBins++;
+        }
+    }
+    // A pure delay over every band bin (and its mirror) peaks at 2 * bandBins / frameSize
+    peakScale = bandBins ? (float)frameSize / (2 * bandBins) : 0;
+
+    windowed.create(1, frameSize, CV_32F);
+    for(int m = 0; m < GCCPHAT_MAX_MICS; m++)
+        spectra[m].create(1, frameSize, CV_32F);
+    cross.create(1, frameSize, CV_32F);
+    correlation.create(1, frameSize, CV_32F);
+    Reset();
+}
+
+/***
+ * Set Mics
+ * Author: Matthew Ribbins
+ * Description: Number of mics, and the longest delay (ms) there can be between two of them, i.e. the furthest
+ *              apart they are over the speed of sound (about 3 ms a metre). Starts the averages again.
+ */
+void GccPhat::SetMics(int mics, float maxDelay)
+{
+    if(mics > GCCPHAT_MAX_MICS) mics = GCCPHAT_MAX_MICS;
+    if(mics < 0) mics = 0;
+    this->mics = mics;
+
+    maxLag = (int)(maxDelay * sampleRate / 1000);
+    if(maxLag < 1) maxLag = 1;
+    if(maxLag >= frameSize / 2) maxLag = frameSize / 2 - 1;
+
+    averaged.resize(mics * (mics - 1) / 2);
+    for(size_t p = 0; p < averaged.size(); p++)
+        averaged[p].create(1, frameSize, CV_32F);
+    Reset();
+}
+
+void GccPhat::Reset(void)
+{
+    for(size_t p = 0; p < averaged.size(); p++)
+        averaged[p].setTo(0);
+    for(int a = 0; a < GCCPHAT_MAX_MICS; a++) {
+        bleed[a] = 0;
+        for(int b = 0; b < GCCPHAT_MAX_MICS; b++) {
+            coherence[a][b] = 0;
+            lead[a][b] = 0;
+        }
+    }
+}
+
+int GccPhat::PairIndex(int a, int b)
+{
+    // Pairs are numbered (0,1) (0,2) .. (0,n-1) (1,2) ..
+    return a * mics - a * (a + 1) / 2 + (b - a - 1);
+}
+
+/***
+ * Whiten
+ * Author: Matthew Ribbins
+ * Description: Divide each bin of a packed spectrum by its magnitude, leaving only its phase, and zero the bins
+ *              outside the band. DC and Nyquist, the only bins without an imaginary part, are always outside.
+ */
+void GccPhat::Whiten(cv::Mat &spectrum)
+{
+    float *bins = spectrum.ptr<float>();
+    const float *weights = &bandWeights[0];
+
+    bins[0] = 0;
+    bins[frameSize - 1] = 0;
+    for(int k = 1; k < frameSize / 2; k++) {
+        float re = bins[2 * k - 1];
+        float im = bins[2 * k];
+        float scale = weights[k] / (sqrtf(re * re + im * im) + 1e-20f);
+        bins[2 * k - 1] = re * scale;
+        bins[2 * k] = im * scale;
+    }
+}
+
+/***
+ * Analyse
+ * Author: Matthew Ribbins
+ * Description: Take the latest frame from every mic, frames[m] being frameSize samples, oldest first. Unless update
+ *              is set (e.g. when nobody is talking) the averages and results are left as they were.
+ */
+void GccPhat::Analyse(const float *const *frames, bool update)
+{
+    if(mics < 2) return;
+
+    for(int m = 0; m < mics; m++) {
+        cv::Mat frame(1, frameSize, CV_32F, (void *)frames[m]);
+        cv::multiply(frame, window, windowed);
+        cv::dft(windowed, spectra[m]);
+        Whiten(spectra[m]);
+    }
+    if(!update) return;
+
+    for(int a = 0; a < mics; a++) {
+        for(int b = a + 1; b < mics; b++) {
+            cv::Mat &average = averaged[PairIndex(a, b)];
+
+            cv::mulSpectrums(spectra[a], spectra[b], cross, 0, true);
+            cv::addWeighted(average, GCCPHAT_SMOOTHING, cross, 1 - GCCPHAT_SMOOTHING, 0, average);
+            cv::dft(average, correlation, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+
+            // Peak within the longest possible delay. It is at -d if b hears everything d samples after a.
+            const float *values = correlation.ptr<float>();
+            int peakLag = 0;
+            float peak = values[0];
+            for(int lag = 1; lag <= maxLag; lag++) {
+                if(values[lag] > peak) {
+                    peak = values[lag];
+                    peakLag = lag;
+                }
+                if(values[frameSize - lag] > peak) {
+                    peak = values[frameSize - lag];
+                    peakLag = -lag;
+                }
+            }
+
+            float sure = peak * peakScale;
+            sure = (sure < 0) ? 0 : ((sure > 1) ? 1 : sure);
+            coherence[a][b] = coherence[b][a] = sure;
+            lead[a][b] = -peakLag;
+            lead[b][a] = peakLag;
+        }
+    }
+
+    for(int m = 0; m < mics; m++) {
+        bleed[m] = 0;
+        for(int other = 0; other < mics; other++) {
+            if(other != m && lead[other][m] >= GCCPHAT_MIN_LEAD && coherence[other][m] > bleed[m])
+                bleed[m] = coherence[other][m];
+        }
+    }
+}
+
+/***
+ * Get Bleed
+ * Author: Matthew Ribbins
+ *
+ * Return: (float) 0 if nothing was heard sooner on another mic, up to 1 if we're sure it was
+ */
+float GccPhat::GetBleed(int mic)
+{
+    if(mic < 0 || mic >= mics) return 0;
+    return bleed[mic];
+}
+
+float GccPhat::GetCoherence(int a, int b)
+{
+    if(a < 0 || a >= mics || b < 0 || b >= mics) return 0;
+    return coherence[a][b];
+}
+
+/***
+ * Get Lead
+ * Author: Matthew Ribbins
+ *
+ * Return: (int) how many samples sooner mic a heard the loudest sound than mic b, negative if later
+ */
+int GccPhat::GetLead(int a, int b)
+{
+    if(a < 0 || a >= mics || b < 0 || b >= mics) return 0;
+    return lead[a][b];
+}
@@ -0,0 +1,56 @@
+#ifndef GCCPHAT_H
+#define GCCPHAT_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Most mics compared, every pair of them is (120 pairs)
+#define GCCPHAT_MAX_MICS 16
+// Speech band the delays are measured over (Hz). Outside it there is little speech and mostly room noise.
+#define GCCPHAT_LOW_FREQUENCY 200
+#define GCCPHAT_HIGH_FREQUENCY 6000
+// Weight of the past in each pair's averaged cross spectrum, per frame
+#define GCCPHAT_SMOOTHING 0.85f
+// A mic has to hear the sound this many samples before another for it to count as nearer. Bleed rejection lines
+// the mics up by their capture times to within BLEED_MAX_SKEW (4) samples of each other, and up to 6.5 when the
+// callbacks jitter, so a lead any shorter could be the alignment rather than the mics. 8 samples (0.18 ms at
+// 44.1 kHz) is about 6 cm further from the talker, much closer than two guests' mics.
+#define GCCPHAT_MIN_LEAD 8
+
+class GccPhat
+{
+public:
+    GccPhat(int frameSize, int sampleRate);
+    void SetMics(int mics, float maxDelay);
+    void Reset(void);
+    void Analyse(const float *const *frames, bool update);
+    float GetBleed(int mic);
+    float GetCoherence(int a, int b);
+    int GetLead(int a, int b);
+
+private:
+    void Whiten(cv::Mat &spectrum);
+    int PairIndex(int a, int b);
+
+    int frameSize;
+    int sampleRate;
+    int mics;
+    int maxLag;
+    float peakScale;
+
+    cv::Mat window;
+    std::vector<float> bandWeights;
+    cv::Mat windowed;
+    cv::Mat spectra[GCCPHAT_MAX_MICS];
+    cv::Mat cross;
+    cv::Mat correlation;
+    std::vector<cv::Mat> averaged;
+
+    // Results of the last update, for every pair a < b: lead (samples) is how much sooner a heard the loudest
+    // sound than b, coherence (0-1) how sure we are of it
+    float coherence[GCCPHAT_MAX_MICS][GCCPHAT_MAX_MICS];
+    int lead[GCCPHAT_MAX_MICS][GCCPHAT_MAX_MICS];
+    float bleed[GCCPHAT_MAX_MICS];
+};
+
+#endif // GCCPHAT_H
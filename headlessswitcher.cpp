@@ -0,0 +1,278 @@
+/***
+ * RadioViz - headlessswitcher.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Switcher without a window, for rack machines whose output goes to a recorder or another process.
+ *              Capture and analysis are the same as MainWindow's, on a QCoreApplication, and so is switching as
+ *              both decide through a SwitchingCore. The program camera's frames go straight from the frame pool to
+ *              a ProgramOutput. There is no widget
+ *              tree and no pixmap conversion, and only the program camera is fully decoded.
+ *
+ *              Cuts are hard cuts: transitions, the compositor, replay and program audio need the display path
+ *              and are left to the GUI build.
+ *
+ */
+#include "headlessswitcher.h"
+#include "syntheticcamera.h"
+
+/***
+ * Headless Switcher Constructor
+ * Author: Matthew Ribbins
+ * Description: Settings as MainWindow's, under the studio's group if it has one. Output/program is where the
+ *              program frames go (a file or FIFO, or shm:name), at Output/width x Output/height.
+ */
+HeadlessSwitcher::HeadlessSwitcher(const QString &studio, const QStringList &nodes, const QList<int> &devices,
+                                   AudioWorker *audio, PersonDetector *detector, QObject *parent)
+    : QObject(parent), policy(CAMERA_AUDIO_THRESHOLD, CAMERA_MOVEMENT_THRESHOLD), core(&sources, &policy)
+{
+    QSettings settings("settings.ini", QSettings::IniFormat);
+
+    if(!studio.isEmpty())
+        settings.beginGroup(studio);
+    studioName = studio.isEmpty() ? QByteArray("") : studio.toLocal8Bit().append(": ");
+
+    this->audio = audio;
+    bleedDetector = NULL;
+    currentCamera = 0;
+    timerCount = 0;
+    statsCount = 0;
+    outputFrameNumber = 0;
+    cuts = 0;
+
+    sources.AddLocalCameras(settings, devices, nodes.isEmpty() && studio.isEmpty());
+    for(int i = 0; i < nodes.size(); i++) {
+        NodeClient *node = new NodeClient(nodes.at(i), &sources, this);
+        connect(node, SIGNAL(frameArrived(int)), this, SLOT(FrameArrived(int)));
+    }
+    int syntheticSources = settings.value(QString("Latency/synthetic"), 0).toInt();
+    for(int i = 0; i < syntheticSources; i++) {
+        Camera *synthetic = new SyntheticCamera(CAMERA_DEFAULT_RES_WIDTH, CAMERA_DEFAULT_RES_HEIGHT, CAMERA_DEFAULT_FPS);
+        if(sources.Add(synthetic) < 0) {
+            delete synthetic;
+            break;
+        }
+    }
+
+    policy.SetAudioThreshold(settings.value(QString("Policy/audioThreshold"), CAMERA_AUDIO_THRESHOLD).toFloat());
+    policy.SetMovementThreshold(settings.value(QString("Policy/movementThreshold"), CAMERA_MOVEMENT_THRESHOLD).toInt());
+    policy.SetPresenceWeight(settings.value(QString("Detector/weight"), DETECTOR_DEFAULT_WEIGHT).toFloat());
+    mode = settings.value(QString("mode"), MODE_AUTO_AUDIO).toInt();
+
+    FramePool::Reserve(sources.GetCount() * FRAMEPOOL_BUFFERS_PER_SOURCE, CAMERA_DEFAULT_RES_WIDTH, CAMERA_DEFAULT_RES_HEIGHT, CV_8UC3);
+    UpdateAnalysisCameras();
+    for(int i = 0; i < sources.GetCount(); i++)
+        sources.StartCapture(i, this, SLOT(FrameArrived(int)));
+
+    if(settings.value(QString("Bleed/enabled"), false).toBool()) {
+        for(int i = 0; i < sources.GetCount(); i++)
+            sources.GetCamera(i)->EnableAudioAnalysis();
+        policy.SetBleedWeight(settings.value(QString("Bleed/weight"), BLEED_DEFAULT_WEIGHT).toFloat());
+        bleedDetector = new BleedDetector(&sources, settings.value(QString("Bleed/maxDelay"), BLEED_DEFAULT_MAX_DELAY).toFloat());
+        bleedDetector->Start();
+        core.SetBleedDetector(bleedDetector);
+    }
+
+    // Every mic to its own track for post production, written out on a thread of its own
+    if(settings.value(QString("Record/enabled"), false).toBool()) {
+        recorder.AddSources(&sources, studioName);
+        recorder.Start(settings.value(QString("Record/directory"), QString(".")).toString(),
+                       settings.value(QString("Record/name"), studio.isEmpty() ? QString("mics") : studio).toString());
+    }
+
+    studioIndex = audio->AddStudio(&sources);
+    audio->SetSourceCount(studioIndex, sources.GetCount());
+    core.SetStudio(studioName, audio, studioIndex);
+
+    if(detector && settings.value(QString("Detector/enabled"), false).toBool()) {
+        int detectorStudio = detector->AddStudio(&sources);
+        if(detectorStudio >= 0) core.SetDetector(detector, detectorStudio);
+    }
+
+    QString outputTarget = settings.value(QString("Output/program")).toString();
+    if(outputTarget.isEmpty())
+        LOG_WARNING(LOG_DISPLAY, "%sWarning: No Output/program, switching without any output", studioName.constData());
+    else
+        output.Open(outputTarget, settings.value(QString("Output/width"), CAMERA_DEFAULT_RES_WIDTH).toInt(),
+                    settings.value(QString("Output/height"), CAMERA_DEFAULT_RES_HEIGHT).toInt());
+
+    LOG_INFO(LOG_GENERAL, "%sHeadless with %d sources, mode %d", studioName.constData(), sources.GetCount(), mode);
+    startTimer(DECISION_TIMER_INTERVAL);
+}
+
+/***
+ * Headless Switcher Destructor
+ * Author: Matthew Ribbins
+ * Description: The shared audio worker and detector have already been stopped
+ */
+HeadlessSwitcher::~HeadlessSwitcher()
+{
+    if(bleedDetector) {
+        bleedDetector->Stop();
+        delete bleedDetector;
+    }
+    recorder.Stop();
+    output.Close();
+    sources.StopCapture();
+}
+
+/***
+ * Frame Arrived
+ * Author: Matthew Ribbins
+ * Description: A new frame from the program camera goes to the output, as a reference to its pool buffer
+ */
+void HeadlessSwitcher::FrameArrived(int cameraId)
+{
+    if(cameraId != currentCamera) return;
+
+    Frame frame = sources.GetCamera(cameraId)->GetLatestFrame();
+    if(frame.IsNull() || frame.GetNumber() == outputFrameNumber) return;
+    outputFrameNumber = frame.GetNumber();
+    output.Put(frame, cameraId);
+}
+
+/***
+ * Change Camera
+ * Author: Matthew Ribbins
+ */
+void HeadlessSwitcher::ChangeCamera(int cameraId)
+{
+    if(!sources.GetCamera(cameraId) || cameraId == currentCamera) return;
+
+    LOG_INFO(LOG_SWITCHING, "%sChanging from %d to %d", studioName.constData(), currentCamera, cameraId);
+    currentCamera = cameraId;
+    outputFrameNumber = 0;
+    cuts++;
+    UpdateAnalysisCameras();
+}
+
+/***
+ * Select suitable camera based on audio
+ * Author: Matthew Ribbins
+ */
+void HeadlessSwitcher::SelectCameraBasedOnAudio(void)
+{
+    EVENT_SCOPE("decision", -1);
+
+    core.ReadLevels();
+    int loudestCamera = core.SelectBasedOnAudio();
+    if(policy.GetActiveCount() && core.IsReadyForProgram(loudestCamera))
+        ChangeCamera(loudestCamera);
+}
+
+/***
+ * Select suitable camera based on video
+ * Author: Matthew Ribbins
+ */
+void HeadlessSwitcher::SelectCameraBasedOnVideo(void)
+{
+    EVENT_SCOPE("decision", -1);
+
+    core.ReadMovement();
+    int highestActive = core.SelectBasedOnVideo();
+    if(policy.GetActiveCount() && core.IsReadyForProgram(highestActive))
+        ChangeCamera(highestActive);
+}
+
+/***
+ * Update Stalled Sources
+ * Author: Matthew Ribbins
+ * Description: Stalled cameras are left out of selection, and in an automatic mode we cut away from one on program
+ */
+void HeadlessSwitcher::UpdateStalledSources(void)
+{
+    if(core.UpdateStalledSources(currentCamera) && MODE_MANUAL != mode && MODE_DISABLED != mode)
+        ChangeCamera(core.GetNextHealthy(currentCamera));
+}
+
+/***
+ * Update Capture Tiers
+ * Author: Matthew Ribbins
+ * Description: Only the program camera counts as on program, there are no transitions or composites here
+ */
+void HeadlessSwitcher::UpdateCaptureTiers(void)
+{
+    bool onProgram[MAX_CAMERAS_AVAILABLE];
+
+    for(int i = 0; i < sources.GetCount(); i++)
+        onProgram[i] = (i == currentCamera);
+    core.UpdateCaptureTiers(mode, onProgram);
+}
+
+/***
+ * Update Analysis Cameras
+ * Author: Matthew Ribbins
+ * Description: Only the program camera is fully decoded
+ */
+void HeadlessSwitcher::UpdateAnalysisCameras(void)
+{
+    for(int i = 0; i < sources.GetCount(); i++)
+        sources.GetCamera(i)->SetAnalysisOnly(i != currentCamera);
+}
+
+/***
+ * Report Stats
+ * Author: Matthew Ribbins
+ * Description: Frames out and cuts made every DISPLAY_STATS_INTERVAL ticks
+ */
+void HeadlessSwitcher::ReportStats(void)
+{
+    unsigned int written, dropped, failed;
+
+    if(++statsCount < DISPLAY_STATS_INTERVAL) return;
+    statsCount = 0;
+
+    output.GetStats(written, dropped, failed);
+    LOG_INFO(LOG_DISPLAY, "%sProgram output %u frames, %u dropped, %u failed, %u cuts", studioName.constData(),
+             written, dropped, failed, cuts);
+    cuts = 0;
+
+    if(recorder.IsRecording()) {
+        unsigned int underruns, overruns;
+        recorder.GetStats(underruns, overruns, failed);
+        LOG_INFO(LOG_AUDIO, "%sRecording %d mics, samples padded %u dropped %u failed %u", studioName.constData(),
+                 recorder.GetTrackCount(), underruns, overruns, failed);
+    }
+
+    if(0 == studioIndex) {
+        FramePoolStats poolStats;
+        FramePool::GetStats(poolStats);
+        LOG_INFO(LOG_DISPLAY, "Frame pool %d buffers %.1f MB, %d in use peak %d, %llu acquired %llu starved",
+                 poolStats.buffers, poolStats.bytes / (1024.0 * 1024.0), poolStats.inUse, poolStats.peakInUse,
+                 poolStats.acquisitions, poolStats.starved);
+    }
+}
+
+/***
+ * Timer Event Handler
+ * Author: Matthew Ribbins
+ * Description: Camera selection for the current mode, at the same rate as MainWindow's
+ */
+void HeadlessSwitcher::timerEvent(QTimerEvent *)
+{
+    EVENT_SCOPE("timer", -1);
+
+    timerCount++;
+    if(0 == studioIndex) ThreadPolicy::Tick();
+    audio->SetSourceCount(studioIndex, sources.GetCount());
+    UpdateStalledSources();
+    UpdateCaptureTiers();
+    recorder.CheckSources(&sources);
+
+    switch(mode) {
+        case MODE_AUTO_AUDIO:
+            if(10 <= timerCount) {
+                SelectCameraBasedOnAudio();
+                timerCount = 0;
+            }
+            break;
+        case MODE_AUTO_MOVEMENT:
+            if(timerCount >= 3) {
+                SelectCameraBasedOnVideo();
+            }
+            break;
+        default:
+            break;
+    }
+
+    ReportStats();
+    if(0 == studioIndex) ThreadPolicy::Report();
+}
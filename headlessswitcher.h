@@ -0,0 +1,65 @@
+#ifndef HEADLESSSWITCHER_H
+#define HEADLESSSWITCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QSettings>
+
+#include "camera.h"
+#include "sourceregistry.h"
+#include "nodeclient.h"
+#include "audioworker.h"
+#include "persondetector.h"
+#include "bleeddetector.h"
+#include "switchingpolicy.h"
+#include "switchingcore.h"
+#include "programoutput.h"
+#include "audiorecorder.h"
+#include "threadpolicy.h"
+#include "eventtrace.h"
+#include "logger.h"
+#include "radioviz.h"
+
+class HeadlessSwitcher : public QObject
+{
+    Q_OBJECT
+public:
+    HeadlessSwitcher(const QString &studio, const QStringList &nodes, const QList<int> &devices, AudioWorker *audio,
+                     PersonDetector *detector, QObject *parent = 0);
+    ~HeadlessSwitcher();
+
+public slots:
+    void FrameArrived(int cameraId);
+
+protected:
+    void timerEvent(QTimerEvent *);
+
+private:
+    void SelectCameraBasedOnAudio(void);
+    void SelectCameraBasedOnVideo(void);
+    void ChangeCamera(int cameraId);
+    void UpdateStalledSources(void);
+    void UpdateCaptureTiers(void);
+    void UpdateAnalysisCameras(void);
+    void ReportStats(void);
+
+    QByteArray studioName;
+    SourceRegistry sources;
+    SwitchingPolicy policy;
+    SwitchingCore core;
+    AudioWorker *audio;
+    int studioIndex;
+    BleedDetector *bleedDetector;
+    ProgramOutput output;
+    AudioRecorder recorder;
+    int mode;
+    int currentCamera;
+    int timerCount;
+    int statsCount;
+    unsigned int outputFrameNumber;
+    unsigned int cuts;
+};
+
+#endif // HEADLESSSWITCHER_H
@@ -0,0 +1,588 @@
+/***
+ * RadioViz - jpegdc.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: DC-only baseline JPEG decoder. MJPEG webcams give us a JPEG per frame, and the DC coefficient of
+ *              each 8x8 luma block is just the block's average brightness. By Huffman decoding the scan and
+ *              skipping over the AC coefficients (no dequantising or IDCT) we get a 1/8 scale gray thumbnail
+ *              that is plenty for motion detection, for a fraction of the cost of a full decode.
+ *
+ */
+#include <string.h>
+#include <limits.h>
+
+#include "jpegdc.h"
+
+// Default Huffman tables from the JPEG standard (ITU T.81 Annex K.3), used by MJPEG frames without a DHT
+static const unsigned char defaultDcLuminanceCounts[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const unsigned char defaultDcChrominanceCounts[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const unsigned char defaultDcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const unsigned char defaultAcLuminanceCounts[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const unsigned char defaultAcLuminanceValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const unsigned char defaultAcChrominanceCounts[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const unsigned char defaultAcChrominanceValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+// The default tables as one DHT segment, less its marker: length, then class/id, counts and values for each
+#define JPEG_DEFAULT_DHT_LENGTH (2 + 4 * 17 + 12 + 12 + 162 + 162)
+
+JpegDcDecoder::JpegDcDecoder()
+{
+    numComponents = 0;
+    imageWidth = 0;
+    imageHeight = 0;
+    restartInterval = 0;
+    thumbnailWidth = 0;
+    thumbnailHeight = 0;
+    thumbnailStride = 0;
+    customTables = false;
+    position = NULL;
+    end = NULL;
+    bitBuffer = 0;
+    bitCount = 0;
+
+    for(int i = 0; i < 4; i++)
+        quantDc[i] = 1;
+    LoadDefaultHuffmanTables();
+}
+
+const unsigned char *JpegDcDecoder::GetThumbnail(void)
+{
+    return thumbnail.empty() ? NULL : &thumbnail[0];
+}
+
+int JpegDcDecoder::GetWidth(void)
+{
+    return thumbnailWidth;
+}
+
+int JpegDcDecoder::GetHeight(void)
+{
+    return thumbnailHeight;
+}
+
+int JpegDcDecoder::GetStride(void)
+{
+    return thumbnailStride;
+}
+
+/***
+ * Build Huffman Table
+ * Author: Matthew Ribbins
+ * Description: Canonical Huffman decoding tables (ITU T.81 F.2.2.3), plus a lookup table so codes up to
+ *              JPEG_HUFFMAN_LOOKUP_BITS long (nearly all of them) are decoded with a single peek.
+ */
+void JpegDcDecoder::BuildHuffmanTable(JpegHuffmanTable *table, const unsigned char *counts, const unsigned char *values)
+{
+    int code = 0;
+    int k = 0;
+
+    memset(table->lookup, 0, sizeof(table->lookup));
+
+    for(int length = 1; length <= 16; length++) {
+        table->valueOffset[length] = k - code;
+        for(int i = 0; i < counts[length - 1]; i++) {
+            table->values[k] = values[k];
+            if(length <= JPEG_HUFFMAN_LOOKUP_BITS) {
+                int shift = JPEG_HUFFMAN_LOOKUP_BITS - length;
+                for(int j = 0; j < (1 << shift); j++)
+                    table->lookup[(code << shift) | j] = (unsigned short)((length << 8) | values[k]);
+            }
+            k++;
+            code++;
+        }
+        table->maxCode[length] = counts[length - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    table->maxCode[17] = INT_MAX;
+    table->isValid = true;
+}
+
+void JpegDcDecoder::LoadDefaultHuffmanTables(void)
+{
+    BuildHuffmanTable(&dcTables[0], defaultDcLuminanceCounts, defaultDcValues);
+    BuildHuffmanTable(&dcTables[1], defaultDcChrominanceCounts, defaultDcValues);
+    BuildHuffmanTable(&acTables[0], defaultAcLuminanceCounts, defaultAcLuminanceValues);
+    BuildHuffmanTable(&acTables[1], defaultAcChrominanceCounts, defaultAcChrominanceValues);
+    dcTables[2].isValid = dcTables[3].isValid = false;
+    acTables[2].isValid = acTables[3].isValid = false;
+}
+
+/***
+ * Add Default Huffman Tables
+ * Author: Matthew Ribbins
+ * Description: Most MJPEG webcams leave the Huffman tables out of their frames, as MJPEG (like AVI1) says the
+ *              standard ones are to be used. Decoders other than ours and FFmpeg's (e.g. libjpeg behind
+ *              cv::imdecode) won't decode such a frame, so put the standard tables in as a DHT segment before the
+ *              first scan, as FFmpeg's mjpeg2jpeg does. Done in place, so once the buffer has grown to fit a frame
+ *              this doesn't allocate.
+ *
+ * Return: (bool) true if the tables were added, false if the frame has its own or isn't a JPEG we can walk
+ */
+bool JpegDcDecoder::AddDefaultHuffmanTables(std::vector<unsigned char> &jpeg)
+{
+    const unsigned char *data = jpeg.data();
+    const unsigned char *p = data + 2;
+    const unsigned char *dataEnd = data + jpeg.size();
+
+    if(jpeg.size() < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI) return false;
+
+    while(p + 4 <= dataEnd) {
+        int marker, segmentLength;
+
+        if(p[0] != 0xFF) return false;
+        marker = p[1];
+        if(0xFF == marker) {
+            p++;
+            continue;
+        }
+        if(JPEG_MARKER_DHT == marker || JPEG_MARKER_EOI == marker) return false;
+        if((marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7) || 0x01 == marker) {
+            p += 2;
+            continue;
+        }
+
+        if(JPEG_MARKER_SOS == marker) {
+            unsigned char segment[4 + JPEG_DEFAULT_DHT_LENGTH];
+            unsigned char *q = segment;
+            const unsigned char *counts[4] = { defaultDcLuminanceCounts, defaultDcChrominanceCounts,
+                                               defaultAcLuminanceCounts, defaultAcChrominanceCounts };
+            const unsigned char *values[4] = { defaultDcValues, defaultDcValues, defaultAcLuminanceValues,
+                                               defaultAcChrominanceValues };
+            const unsigned char tableIds[4] = { 0x00, 0x01, 0x10, 0x11 };
+
+            *q++ = 0xFF;
+            *q++ = JPEG_MARKER_DHT;
+            *q++ = JPEG_DEFAULT_DHT_LENGTH >> 8;
+            *q++ = JPEG_DEFAULT_DHT_LENGTH & 0xFF;
+            for(int i = 0; i < 4; i++) {
+                int total = 0;
+                *q++ = tableIds[i];
+                memcpy(q, counts[i], 16);
+                q += 16;
+                for(int j = 0; j < 16; j++)
+                    total += counts[i][j];
+                memcpy(q, values[i], total);
+                q += total;
+            }
+
+            jpeg.insert(jpeg.begin() + (p - data), segment, q);
+            return true;
+        }
+
+        segmentLength = (p[2] << 8) | p[3];
+        if(segmentLength < 2 || p + 2 + segmentLength > dataEnd) return false;
+        p += 2 + segmentLength;
+    }
+    return false;
+}
+
+/***
+ * Read Quantisation Tables (DQT)
+ * Author: Matthew Ribbins
+ * Description: We only need the first entry of each table, the DC quantiser
+ */
+bool JpegDcDecoder::ReadQuantTables(const unsigned char *segment, int length)
+{
+    while(length > 0) {
+        int precision = segment[0] >> 4;
+        int id = segment[0] & 0x0F;
+        int size = precision ? 129 : 65;
+
+        if(id > 3 || length < size) return false;
+        quantDc[id] = precision ? ((segment[1] << 8) | segment[2]) : segment[1];
+        segment += size;
+        length -= size;
+    }
+    return true;
+}
+
+/***
+ * Read Huffman Tables (DHT)
+ * Author: Matthew Ribbins
+ */
+bool JpegDcDecoder::ReadHuffmanTables(const unsigned char *segment, int length)
+{
+    while(length >= 17) {
+        int tableClass = segment[0] >> 4;
+        int id = segment[0] & 0x0F;
+        int total = 0;
+
+        for(int i = 0; i < 16; i++)
+            total += segment[1 + i];
+        if(id > 3 || tableClass > 1 || total > 256 || length < 17 + total) return false;
+
+        BuildHuffmanTable(tableClass ? &acTables[id] : &dcTables[id], segment + 1, segment + 17);
+        customTables = true;
+        segment += 17 + total;
+        length -= 17 + total;
+    }
+    return (0 == length);
+}
+
+/***
+ * Read Frame Header (SOF0/SOF1)
+ * Author: Matthew Ribbins
+ */
+bool JpegDcDecoder::ReadFrameHeader(const unsigned char *segment, int length)
+{
+    if(length < 6 || segment[0] != 8) return false;
+
+    imageHeight = (segment[1] << 8) | segment[2];
+    imageWidth = (segment[3] << 8) | segment[4];
+    numComponents = segment[5];
+
+    if(imageWidth <= 0 || imageHeight <= 0 || numComponents < 1 || numComponents > JPEG_MAX_COMPONENTS) return false;
+    if(length < 6 + numComponents * 3) return false;
+
+    for(int i = 0; i < numComponents; i++) {
+        const unsigned char *c = segment + 6 + i * 3;
+        components[i].id = c[0];
+        components[i].horizontalSampling = c[1] >> 4;
+        components[i].verticalSampling = c[1] & 0x0F;
+        components[i].quantTable = c[2] & 0x03;
+        components[i].predictor = 0;
+        if(components[i].horizontalSampling < 1 || components[i].horizontalSampling > 4 ||
+           components[i].verticalSampling < 1 || components[i].verticalSampling > 4) return false;
+    }
+    return true;
+}
+
+/***
+ * Decode
+ * Author: Matthew Ribbins
+ * Description: Walk the JPEG markers up to the first scan and decode the luma DC coefficients from it
+ *
+ * Return: (bool) true if we have a thumbnail. Progressive/lossless/arithmetic coded JPEGs are not supported.
+ */
+bool JpegDcDecoder::Decode(const unsigned char *data, int length)
+{
+    const unsigned char *p = data;
+    const unsigned char *dataEnd = data + length;
+    bool haveFrame = false;
+
+    if(length < 4 || p[0] != 0xFF || p[1] != JPEG_MARKER_SOI) return false;
+    p += 2;
+
+    // Tables from the last frame don't carry over
+    if(customTables) {
+        LoadDefaultHuffmanTables();
+        customTables = false;
+    }
+    restartInterval = 0;
+
+    while(p + 4 <= dataEnd) {
+        int marker, segmentLength;
+
+        if(p[0] != 0xFF) return false;
+        marker = p[1];
+        p += 2;
+
+        if(0xFF == marker) {
+            // Fill byte
+            p--;
+            continue;
+        }
+        if(JPEG_MARKER_EOI == marker) return false;
+        if((marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7) || 0x01 == marker) continue;
+
+        segmentLength = (p[0] << 8) | p[1];
+        if(segmentLength < 2 || p + segmentLength > dataEnd) return false;
+
+        switch(marker) {
+            case JPEG_MARKER_DQT:
+                if(!ReadQuantTables(p + 2, segmentLength - 2)) return false;
+                break;
+            case JPEG_MARKER_DHT:
+                if(!ReadHuffmanTables(p + 2, segmentLength - 2)) return false;
+                break;
+            case JPEG_MARKER_SOF0:
+            case JPEG_MARKER_SOF1:
+                if(!ReadFrameHeader(p + 2, segmentLength - 2)) return false;
+                haveFrame = true;
+                break;
+            case JPEG_MARKER_DRI:
+                if(segmentLength < 4) return false;
+                restartInterval = (p[2] << 8) | p[3];
+                break;
+            case JPEG_MARKER_SOS:
+                if(!haveFrame) return false;
+                return DecodeScan(p + 2, segmentLength - 2, dataEnd);
+            default:
+                // Any other frame type (progressive, lossless, arithmetic) we can't do
+                if(marker >= 0xC2 && marker <= 0xCF && marker != JPEG_MARKER_DHT && marker != 0xC8 && marker != 0xCC)
+                    return false;
+                break;
+        }
+        p += segmentLength;
+    }
+    return false;
+}
+
+/***
+ * Fill Bits
+ * Author: Matthew Ribbins
+ * Description: Top up the bit buffer from the entropy coded data, removing stuffed zero bytes. We stop at a
+ *              marker and feed zeros after it, so we never read past a restart marker.
+ */
+void JpegDcDecoder::FillBits(void)
+{
+    while(bitCount <= 24) {
+        unsigned int byte = 0;
+
+        if(position < end) {
+            byte = *position;
+            if(0xFF == byte) {
+                if(position + 1 < end && 0x00 == position[1])
+                    position += 2;
+                else
+                    byte = 0;
+            } else {
+                position++;
+            }
+        }
+        bitBuffer = (bitBuffer << 8) | byte;
+        bitCount += 8;
+    }
+}
+
+int JpegDcDecoder::GetBits(int count)
+{
+    int value;
+
+    if(!count) return 0;
+    FillBits();
+    bitCount -= count;
+    value = (bitBuffer >> bitCount) & ((1 << count) - 1);
+    return value;
+}
+
+/***
+ * Decode Huffman
+ * Author: Matthew Ribbins
+ * Description: Decode one Huffman coded symbol
+ *
+ * Return: (int) symbol, or -1 on a bad code
+ */
+int JpegDcDecoder::DecodeHuffman(const JpegHuffmanTable *table)
+{
+    int peek, entry, code, length;
+
+    FillBits();
+    peek = (bitBuffer >> (bitCount - JPEG_HUFFMAN_LOOKUP_BITS)) & ((1 << JPEG_HUFFMAN_LOOKUP_BITS) - 1);
+    entry = table->lookup[peek];
+    if(entry) {
+        bitCount -= entry >> 8;
+        return entry & 0xFF;
+    }
+
+    // Longer code, one bit at a time
+    bitCount -= JPEG_HUFFMAN_LOOKUP_BITS;
+    code = peek;
+    for(length = JPEG_HUFFMAN_LOOKUP_BITS + 1; length <= 16; length++) {
+        code = (code << 1) | GetBits(1);
+        if(code <= table->maxCode[length])
+            return table->values[code + table->valueOffset[length]];
+    }
+    return -1;
+}
+
+/***
+ * Decode Block
+ * Author: Matthew Ribbins
+ * Description: Decode an 8x8 block's DC coefficient, and skip its AC coefficients without decoding their values
+ */
+bool JpegDcDecoder::DecodeBlock(JpegComponent *component, int *dc)
+{
+    const JpegHuffmanTable *acTable = &acTables[component->acTable];
+    int size = DecodeHuffman(&dcTables[component->dcTable]);
+
+    if(size < 0 || size > 11) return false;
+    if(size) {
+        int diff = GetBits(size);
+        if(diff < (1 << (size - 1)))
+            diff -= (1 << size) - 1;
+        component->predictor += diff;
+    }
+    *dc = component->predictor;
+
+    for(int k = 1; k < 64; ) {
+        int symbol = DecodeHuffman(acTable);
+        int run = symbol >> 4;
+        int bits = symbol & 0x0F;
+
+        if(symbol < 0) return false;
+        if(!bits) {
+            if(run != 15) break; // End of block
+            k += 16;
+            continue;
+        }
+        // Skip the coefficient's value
+        FillBits();
+        bitCount -= bits;
+        k += run + 1;
+    }
+    return true;
+}
+
+/***
+ * Restart
+ * Author: Matthew Ribbins
+ * Description: Skip a restart marker, throw away the padding bits and reset the DC predictors
+ */
+bool JpegDcDecoder::Restart(void)
+{
+    bitBuffer = 0;
+    bitCount = 0;
+
+    if(position + 1 >= end || position[0] != 0xFF || position[1] < JPEG_MARKER_RST0 || position[1] > JPEG_MARKER_RST7)
+        return false;
+    position += 2;
+
+    for(int i = 0; i < numComponents; i++)
+        components[i].predictor = 0;
+    return true;
+}
+
+/***
+ * Put DC
+ * Author: Matthew Ribbins
+ * Description: A block's average is its dequantised DC / 8, plus 128 to undo the level shift
+ */
+void JpegDcDecoder::PutDc(int x, int y, int dc, int quant)
+{
+    int value = ((dc * quant + 4) >> 3) + 128;
+
+    if(value < 0) value = 0;
+    if(value > 255) value = 255;
+    thumbnail[y * thumbnailStride + x] = (unsigned char)value;
+}
+
+/***
+ * Decode Scan (SOS)
+ * Author: Matthew Ribbins
+ * Description: Decode every block of the scan, keeping the DC of the first (luma) component
+ */
+bool JpegDcDecoder::DecodeScan(const unsigned char *segment, int length, const unsigned char *dataEnd)
+{
+    JpegComponent *scanComponents[JPEG_MAX_COMPONENTS];
+    int scanCount;
+    int maxH = 1, maxV = 1;
+    int mcusX, mcusY, mcuCount;
+    int restartsLeft;
+    JpegComponent *luma = &components[0];
+
+    if(length < 1) return false;
+    scanCount = segment[0];
+    if(scanCount < 1 || scanCount > numComponents || length < 4 + scanCount * 2) return false;
+
+    for(int i = 0; i < scanCount; i++) {
+        int id = segment[1 + i * 2];
+        int tables = segment[2 + i * 2];
+
+        scanComponents[i] = NULL;
+        for(int j = 0; j < numComponents; j++) {
+            if(components[j].id == id) scanComponents[i] = &components[j];
+        }
+        if(!scanComponents[i]) return false;
+        scanComponents[i]->dcTable = tables >> 4;
+        scanComponents[i]->acTable = tables & 0x0F;
+        if(scanComponents[i]->dcTable > 3 || scanComponents[i]->acTable > 3) return false;
+        if(!dcTables[scanComponents[i]->dcTable].isValid || !acTables[scanComponents[i]->acTable].isValid) return false;
+        scanComponents[i]->predictor = 0;
+    }
+
+    // We only want a scan with luma in it
+    bool hasLuma = false;
+    for(int i = 0; i < scanCount; i++) {
+        if(scanComponents[i] == luma) hasLuma = true;
+    }
+    if(!hasLuma) return false;
+
+    for(int i = 0; i < numComponents; i++) {
+        if(components[i].horizontalSampling > maxH) maxH = components[i].horizontalSampling;
+        if(components[i].verticalSampling > maxV) maxV = components[i].verticalSampling;
+    }
+
+    // Luma blocks across and down, within whole MCUs
+    int lumaWidth = (imageWidth * luma->horizontalSampling + maxH - 1) / maxH;
+    int lumaHeight = (imageHeight * luma->verticalSampling + maxV - 1) / maxV;
+    thumbnailWidth = (lumaWidth + 7) / 8;
+    thumbnailHeight = (lumaHeight + 7) / 8;
+
+    if(scanCount > 1) {
+        mcusX = (imageWidth + 8 * maxH - 1) / (8 * maxH);
+        mcusY = (imageHeight + 8 * maxV - 1) / (8 * maxV);
+        thumbnailStride = mcusX * luma->horizontalSampling;
+        thumbnail.resize(thumbnailStride * mcusY * luma->verticalSampling);
+    } else {
+        // Non-interleaved, each block is an MCU
+        mcusX = thumbnailWidth;
+        mcusY = thumbnailHeight;
+        thumbnailStride = thumbnailWidth;
+        thumbnail.resize(thumbnailStride * thumbnailHeight);
+    }
+
+    position = segment + length;
+    end = dataEnd;
+    bitBuffer = 0;
+    bitCount = 0;
+    mcuCount = mcusX * mcusY;
+    restartsLeft = restartInterval;
+
+    for(int mcu = 0; mcu < mcuCount; mcu++) {
+        int mcuX = mcu % mcusX;
+        int mcuY = mcu / mcusX;
+        int dc;
+
+        if(restartInterval) {
+            if(!restartsLeft) {
+                if(!Restart()) return false;
+                restartsLeft = restartInterval;
+            }
+            restartsLeft--;
+        }
+
+        if(1 == scanCount) {
+            if(!DecodeBlock(luma, &dc)) return false;
+            PutDc(mcuX, mcuY, dc, quantDc[luma->quantTable]);
+            continue;
+        }
+
+        for(int i = 0; i < scanCount; i++) {
+            JpegComponent *component = scanComponents[i];
+            for(int v = 0; v < component->verticalSampling; v++) {
+                for(int h = 0; h < component->horizontalSampling; h++) {
+                    if(!DecodeBlock(component, &dc)) return false;
+                    if(component == luma)
+                        PutDc(mcuX * component->horizontalSampling + h, mcuY * component->verticalSampling + v, dc, quantDc[component->quantTable]);
+                }
+            }
+        }
+    }
+    return true;
+}
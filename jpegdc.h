@@ -0,0 +1,86 @@
+#ifndef JPEGDC_H
+#define JPEGDC_H
+
+#include <vector>
+
+// JPEG markers we care about
+#define JPEG_MARKER_SOI 0xD8
+#define JPEG_MARKER_EOI 0xD9
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_SOF1 0xC1
+#define JPEG_MARKER_DHT 0xC4
+#define JPEG_MARKER_DQT 0xDB
+#define JPEG_MARKER_DRI 0xDD
+#define JPEG_MARKER_SOS 0xDA
+#define JPEG_MARKER_RST0 0xD0
+#define JPEG_MARKER_RST7 0xD7
+
+#define JPEG_MAX_COMPONENTS 4
+#define JPEG_HUFFMAN_LOOKUP_BITS 9
+
+typedef struct _JpegHuffmanTable {
+    int maxCode[18];
+    int valueOffset[17];
+    unsigned char values[256];
+    unsigned short lookup[1 << JPEG_HUFFMAN_LOOKUP_BITS];
+    bool isValid;
+} JpegHuffmanTable;
+
+typedef struct _JpegComponent {
+    int id;
+    int horizontalSampling;
+    int verticalSampling;
+    int quantTable;
+    int dcTable;
+    int acTable;
+    int predictor;
+} JpegComponent;
+
+class JpegDcDecoder
+{
+public:
+    JpegDcDecoder();
+    bool Decode(const unsigned char *data, int length);
+    const unsigned char *GetThumbnail(void);
+    int GetWidth(void);
+    int GetHeight(void);
+    int GetStride(void);
+    static bool AddDefaultHuffmanTables(std::vector<unsigned char> &jpeg);
+
+private:
+    JpegHuffmanTable dcTables[4];
+    JpegHuffmanTable acTables[4];
+    int quantDc[4];
+    JpegComponent components[JPEG_MAX_COMPONENTS];
+    int numComponents;
+    int imageWidth;
+    int imageHeight;
+    int restartInterval;
+    bool customTables;
+    std::vector<unsigned char> thumbnail;
+    int thumbnailWidth;
+    int thumbnailHeight;
+    int thumbnailStride;
+
+    // Entropy coded segment reader
+    const unsigned char *position;
+    const unsigned char *end;
+    unsigned int bitBuffer;
+    int bitCount;
+
+protected:
+    void BuildHuffmanTable(JpegHuffmanTable *table, const unsigned char *counts, const unsigned char *values);
+    void LoadDefaultHuffmanTables(void);
+    bool ReadQuantTables(const unsigned char *segment, int length);
+    bool ReadHuffmanTables(const unsigned char *segment, int length);
+    bool ReadFrameHeader(const unsigned char *segment, int length);
+    bool DecodeScan(const unsigned char *segment, int length, const unsigned char *dataEnd);
+    void FillBits(void);
+    int GetBits(int count);
+    int DecodeHuffman(const JpegHuffmanTable *table);
+    bool DecodeBlock(JpegComponent *component, int *dc);
+    bool Restart(void);
+    void PutDc(int x, int y, int dc, int quant);
+};
+
+#endif // JPEGDC_H
@@ -0,0 +1,179 @@
+/***
+ * RadioViz - latencystrip.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Machine readable frame counter and timestamp, drawn as a strip of black and white blocks along the
+ *              top of a frame, for measuring latency. The blocks are big enough to survive scaling, JPEG and being
+ *              filmed off a screen. Timestamps are CLOCK_MONOTONIC, so the strip must be read on the machine that
+ *              drew it.
+ *
+ */
+#include <time.h>
+#include <algorithm>
+
+#include "latencystrip.h"
+
+int64_t LatencyStrip::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint8_t LatencyStrip::Check(uint16_t counter, int64_t timestamp)
+{
+    uint8_t check = 0xA5 ^ (counter >> 8) ^ (counter & 0xFF);
+
+    for(int i = 0; i < 6; i++)
+        check ^= (timestamp >> (i * 8)) & 0xFF;
+    return check;
+}
+
+/***
+ * Get Bits
+ * Author: Matthew Ribbins
+ * Description: The strip's blocks, LATENCY_STRIP_BITS of them, true for white
+ */
+void LatencyStrip::GetBits(unsigned int counter, int64_t timestamp, bool *bits)
+{
+    uint16_t shortCounter = counter & 0xFFFF;
+    int64_t shortTimestamp = timestamp & LATENCY_TIMESTAMP_MASK;
+    uint8_t check = Check(shortCounter, shortTimestamp);
+    int bit = 0;
+
+    bits[bit++] = true;
+    bits[bit++] = false;
+    for(int i = 15; i >= 0; i--)
+        bits[bit++] = (shortCounter >> i) & 1;
+    for(int i = 47; i >= 0; i--)
+        bits[bit++] = (shortTimestamp >> i) & 1;
+    for(int i = 7; i >= 0; i--)
+        bits[bit++] = (check >> i) & 1;
+}
+
+int LatencyStrip::GetBlockWidth(int frameWidth)
+{
+    return frameWidth / LATENCY_STRIP_BITS;
+}
+
+int LatencyStrip::GetHeight(int frameHeight)
+{
+    int height = frameHeight / 16;
+    return (height < LATENCY_STRIP_MIN_BLOCK * 2) ? LATENCY_STRIP_MIN_BLOCK * 2 : height;
+}
+
+/***
+ * Encode
+ * Author: Matthew Ribbins
+ * Description: Draw the strip into a gray or RGB frame
+ */
+void LatencyStrip::Encode(cv::Mat &frame, unsigned int counter, int64_t timestamp)
+{
+    bool bits[LATENCY_STRIP_BITS];
+    int blockWidth = GetBlockWidth(frame.cols);
+    int height = GetHeight(frame.rows);
+
+    if(blockWidth < LATENCY_STRIP_MIN_BLOCK || height > frame.rows) return;
+
+    GetBits(counter, timestamp, bits);
+    for(int i = 0; i < LATENCY_STRIP_BITS; i++) {
+        cv::Mat block = frame(cv::Rect(i * blockWidth, 0, blockWidth, height));
+        block.setTo(cv::Scalar::all(bits[i] ? 255 : 0));
+    }
+}
+
+/***
+ * Decode
+ * Author: Matthew Ribbins
+ * Description: Read the strip back from a gray or RGB frame. Each block is sampled across its middle half, and the
+ *              markers and check have to match.
+ *
+ * Return: (bool) true if there was a valid strip
+ */
+bool LatencyStrip::Decode(const cv::Mat &frame, unsigned int &counter, int64_t &timestamp)
+{
+    int blockWidth = GetBlockWidth(frame.cols);
+    int height = GetHeight(frame.rows);
+    int channels = frame.channels();
+    uint64_t value = 0;
+    bool bits[LATENCY_STRIP_BITS];
+
+    if(blockWidth < LATENCY_STRIP_MIN_BLOCK || height > frame.rows || frame.depth() != CV_8U) return false;
+
+    const uchar *row = frame.ptr<uchar>(height / 2);
+    for(int i = 0; i < LATENCY_STRIP_BITS; i++) {
+        int start = i * blockWidth + blockWidth / 4;
+        int end = i * blockWidth + blockWidth * 3 / 4;
+        int sum = 0;
+        for(int x = start; x < end; x++)
+            sum += row[x * channels];
+        bits[i] = (sum > 128 * (end - start));
+    }
+    if(!bits[0] || bits[1]) return false;
+
+    uint16_t shortCounter = 0;
+    for(int i = 2; i < 18; i++)
+        shortCounter = (shortCounter << 1) | bits[i];
+    for(int i = 18; i < 66; i++)
+        value = (value << 1) | bits[i];
+    uint8_t check = 0;
+    for(int i = 66; i < LATENCY_STRIP_BITS; i++)
+        check = (check << 1) | bits[i];
+
+    if(check != Check(shortCounter, (int64_t)value)) return false;
+    counter = shortCounter;
+    timestamp = (int64_t)value;
+    return true;
+}
+
+/***
+ * Elapsed
+ * Author: Matthew Ribbins
+ * Description: Time from a decoded timestamp to now (us), allowing for the 48 bit timestamp wrapping
+ */
+int64_t LatencyStrip::Elapsed(int64_t timestamp, int64_t now)
+{
+    return ((now & LATENCY_TIMESTAMP_MASK) - timestamp) & LATENCY_TIMESTAMP_MASK;
+}
+
+LatencyStats::LatencyStats()
+{
+    Reset();
+}
+
+void LatencyStats::Reset(void)
+{
+    count = 0;
+    next = 0;
+}
+
+void LatencyStats::Add(int64_t latency)
+{
+    samples[next] = latency;
+    next = (next + 1) % LATENCY_WINDOW;
+    if(count < LATENCY_WINDOW) count++;
+}
+
+int LatencyStats::GetCount(void)
+{
+    return count;
+}
+
+/***
+ * Get Percentiles
+ * Author: Matthew Ribbins
+ * Description: Percentiles over the last LATENCY_WINDOW samples
+ *
+ * Return: (bool) false if there are no samples yet
+ */
+bool LatencyStats::GetPercentiles(int64_t &p50, int64_t &p95, int64_t &p99, int64_t &max)
+{
+    if(!count) return false;
+
+    std::copy(samples, samples + count, sorted);
+    std::sort(sorted, sorted + count);
+    p50 = sorted[count * 50 / 100];
+    p95 = sorted[count * 95 / 100];
+    p99 = sorted[count * 99 / 100];
+    max = sorted[count - 1];
+    return true;
+}
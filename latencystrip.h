@@ -0,0 +1,49 @@
+#ifndef LATENCYSTRIP_H
+#define LATENCYSTRIP_H
+
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+// Barcode strip along the top of a frame: two marker blocks (white, black), a 16 bit frame counter, a 48 bit
+// timestamp (us, CLOCK_MONOTONIC) and an 8 bit check, most significant bit first
+#define LATENCY_STRIP_BITS 74
+#define LATENCY_STRIP_DATA_BITS 72
+#define LATENCY_STRIP_MIN_BLOCK 4
+#define LATENCY_TIMESTAMP_MASK 0xFFFFFFFFFFFFLL
+
+// Latency samples the percentiles are worked out over, and how often they are reported (ms)
+#define LATENCY_WINDOW 1024
+#define LATENCY_REPORT_INTERVAL 1000
+
+class LatencyStrip
+{
+public:
+    static int64_t Now(void);
+    static void GetBits(unsigned int counter, int64_t timestamp, bool *bits);
+    static int GetBlockWidth(int frameWidth);
+    static int GetHeight(int frameHeight);
+    static void Encode(cv::Mat &frame, unsigned int counter, int64_t timestamp);
+    static bool Decode(const cv::Mat &frame, unsigned int &counter, int64_t &timestamp);
+    static int64_t Elapsed(int64_t timestamp, int64_t now);
+
+private:
+    static uint8_t Check(uint16_t counter, int64_t timestamp);
+};
+
+class LatencyStats
+{
+public:
+    LatencyStats();
+    void Add(int64_t latency);
+    bool GetPercentiles(int64_t &p50, int64_t &p95, int64_t &p99, int64_t &max);
+    int GetCount(void);
+    void Reset(void);
+
+private:
+    int64_t samples[LATENCY_WINDOW];
+    int64_t sorted[LATENCY_WINDOW];
+    int count;
+    int next;
+};
+
+#endif // LATENCYSTRIP_H
@@ -0,0 +1,336 @@
+/***
+ * RadioViz - logger.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Asynchronous logger. Every thread that logs gets its own lock free ring of records, which only hold
+ *              the format string and the arguments. The logger thread drains the rings, formats the records and
+ *              writes them out, so a log statement on the capture or GUI thread never formats, allocates or waits
+ *              on the terminal. If a ring is full the record is dropped and counted.
+ *
+ */
+#include <string.h>
+#include <time.h>
+
+#include "logger.h"
+
+static const char *categoryNames[LOG_CATEGORY_COUNT] = { "general", "camera", "audio", "switching", "display" };
+static const char *levelNames[] = { "E", "W", "I", "D" };
+
+std::atomic<int> Logger::levels[LOG_CATEGORY_COUNT] = {
+    { LOG_LEVEL_DEFAULT }, { LOG_LEVEL_DEFAULT }, { LOG_LEVEL_DEFAULT }, { LOG_LEVEL_DEFAULT }, { LOG_LEVEL_DEFAULT }
+};
+Logger *Logger::instance = NULL;
+QMutex Logger::ringsMutex;
+std::vector<LogRing *> Logger::rings;
+
+static thread_local LogRing *threadRing = NULL;
+
+static qint64 Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+Logger::Logger(FILE *output)
+{
+    this->output = output;
+    this->running = false;
+}
+
+Logger::~Logger()
+{
+    if(output != stderr)
+        fclose(output);
+}
+
+/***
+ * Start Logger
+ * Author: Matthew Ribbins
+ * Description: Start the logger thread, writing to path or to stderr if there is no path. Anything logged before
+ *              this is kept in the rings until the logger starts.
+ */
+void Logger::Start(const char *path)
+{
+    FILE *output = stderr;
+
+    if(instance) return;
+    if(path && *path) {
+        output = fopen(path, "a");
+        if(!output) {
+            fprintf(stderr, "Error: Could not open log file %s\n", path);
+            output = stderr;
+        }
+    }
+
+    instance = new Logger(output);
+    instance->running = true;
+    instance->start(QThread::LowPriority);
+}
+
+/***
+ * Stop Logger
+ * Author: Matthew Ribbins
+ * Description: Stop the logger thread, writing out everything still in the rings first
+ */
+void Logger::Stop(void)
+{
+    if(!instance) return;
+    instance->running = false;
+    instance->wait();
+    delete instance;
+    instance = NULL;
+}
+
+void Logger::SetLevel(int category, int level)
+{
+    if(category < 0 || category >= LOG_CATEGORY_COUNT) return;
+    levels[category].store(level, std::memory_order_relaxed);
+}
+
+void Logger::SetLevel(int level)
+{
+    for(int i = 0; i < LOG_CATEGORY_COUNT; i++)
+        SetLevel(i, level);
+}
+
+int Logger::GetLevel(int category)
+{
+    if(category < 0 || category >= LOG_CATEGORY_COUNT) return LOG_LEVEL_OFF;
+    return levels[category].load(std::memory_order_relaxed);
+}
+
+/***
+ * Get Category
+ * Author: Matthew Ribbins
+ * Description: Category from its name, as used in the settings file
+ *
+ * Return: (int) category, or -1 if there isn't one with that name
+ */
+int Logger::GetCategory(const char *name)
+{
+    for(int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        if(!strcmp(categoryNames[i], name)) return i;
+    }
+    return -1;
+}
+
+const char *Logger::GetCategoryName(int category)
+{
+    if(category < 0 || category >= LOG_CATEGORY_COUNT) return "";
+    return categoryNames[category];
+}
+
+/***
+ * Set Thread Name
+ * Author: Matthew Ribbins
+ * Description: Name the calling thread in its log lines
+ */
+void Logger::SetThreadName(const char *name)
+{
+    LogRing *ring = GetRing();
+    strncpy(ring->threadName, name, sizeof(ring->threadName) - 1);
+}
+
+/***
+ * Get Ring
+ * Author: Matthew Ribbins
+ * Description: The calling thread's ring, made the first time the thread logs. Rings are never freed, as the
+ *              logger thread may still be reading one after its thread has gone.
+ */
+LogRing *Logger::GetRing(void)
+{
+    if(!threadRing) {
+        LogRing *ring = new LogRing;
+        ring->head.store(0);
+        ring->tail.store(0);
+        ring->dropped.store(0);
+
+        QMutexLocker locker(&ringsMutex);
+        snprintf(ring->threadName, sizeof(ring->threadName), "thread%d", (int)rings.size());
+        rings.push_back(ring);
+        threadRing = ring;
+    }
+    return threadRing;
+}
+
+/***
+ * Begin Record
+ * Author: Matthew Ribbins
+ * Description: Claim the next record in this thread's ring
+ *
+ * Return: (LogRecord *) record to fill in, or NULL if the ring is full
+ */
+LogRecord *Logger::Begin(int category, int level, const char *fmt)
+{
+    LogRing *ring = GetRing();
+    unsigned int head = ring->head.load(std::memory_order_relaxed);
+    LogRecord *record;
+
+    if(head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    record = &ring->records[head & (LOG_RING_SIZE - 1)];
+    record->timestamp = Now();
+    record->fmt = fmt;
+    record->category = category;
+    record->level = level;
+    record->argCount = 0;
+    record->textLength = 0;
+    return record;
+}
+
+void Logger::Commit(void)
+{
+    threadRing->head.fetch_add(1, std::memory_order_release);
+}
+
+void Logger::PackArg(LogRecord *record, long long value)
+{
+    if(record->argCount >= LOG_MAX_ARGS) return;
+    record->args[record->argCount].type = LOG_ARG_INT;
+    record->args[record->argCount++].i = value;
+}
+
+void Logger::PackArg(LogRecord *record, double value)
+{
+    if(record->argCount >= LOG_MAX_ARGS) return;
+    record->args[record->argCount].type = LOG_ARG_DOUBLE;
+    record->args[record->argCount++].d = value;
+}
+
+/***
+ * Pack String Argument
+ * Author: Matthew Ribbins
+ * Description: Strings are copied into the record, as they may be gone by the time the logger gets to it. Long
+ *              strings are cut short.
+ */
+void Logger::PackArg(LogRecord *record, const char *value)
+{
+    int length;
+
+    if(record->argCount >= LOG_MAX_ARGS) return;
+    if(!value) value = "(null)";
+
+    length = strlen(value);
+    if(length > LOG_TEXT_SIZE - record->textLength - 1)
+        length = LOG_TEXT_SIZE - record->textLength - 1;
+    if(length < 0) length = 0;
+
+    record->args[record->argCount].type = LOG_ARG_STRING;
+    record->args[record->argCount++].text = record->textLength;
+    memcpy(record->text + record->textLength, value, length);
+    record->textLength += length;
+    record->text[record->textLength] = '\0';
+    if(record->textLength < LOG_TEXT_SIZE - 1)
+        record->textLength++;
+}
+
+/***
+ * Format Record
+ * Author: Matthew Ribbins
+ * Description: printf style formatting of a record into line, one conversion at a time so each is given the
+ *              argument in the type it was logged with
+ */
+void Logger::FormatRecord(const LogRecord &record, const char *threadName)
+{
+    const char *fmt = record.fmt;
+    int length;
+    int arg = 0;
+    char spec[16];
+
+    length = snprintf(line, sizeof(line), "%10.6f %s %-9s %-8s ", record.timestamp / 1e9,
+                      levelNames[record.level], categoryNames[record.category], threadName);
+
+    while(*fmt && length < (int)sizeof(line) - 1) {
+        if(*fmt != '%') {
+            line[length++] = *fmt++;
+            continue;
+        }
+        if(fmt[1] == '%') {
+            line[length++] = '%';
+            fmt += 2;
+            continue;
+        }
+
+        // Copy the conversion spec, e.g. %5.1f, without any length modifier as we add our own
+        int specLength = 0;
+        do {
+            if(!strchr("lhzjt", *fmt))
+                spec[specLength++] = *fmt;
+            fmt++;
+        } while(*fmt && !strchr("diufFeEgGxXsc", *fmt) && specLength < (int)sizeof(spec) - 4);
+        if(!*fmt) break;
+        char conversion = *fmt++;
+        int size = sizeof(line) - length;
+
+        if(arg >= record.argCount) {
+            length += snprintf(line + length, size, "?");
+        } else {
+            const LogArg &value = record.args[arg++];
+            if(LOG_ARG_STRING == value.type) {
+                spec[specLength++] = 's';
+                spec[specLength] = '\0';
+                length += snprintf(line + length, size, spec, record.text + value.text);
+            } else if(strchr("fFeEgG", conversion)) {
+                spec[specLength++] = conversion;
+                spec[specLength] = '\0';
+                length += snprintf(line + length, size, spec, (LOG_ARG_DOUBLE == value.type) ? value.d : (double)value.i);
+            } else {
+                spec[specLength++] = 'l';
+                spec[specLength++] = 'l';
+                spec[specLength++] = (conversion == 'c' || conversion == 's') ? 'd' : conversion;
+                spec[specLength] = '\0';
+                length += snprintf(line + length, size, spec, (LOG_ARG_INT == value.type) ? value.i : (long long)value.d);
+            }
+        }
+        if(length > (int)sizeof(line) - 1) length = sizeof(line) - 1;
+    }
+    line[length] = '\0';
+}
+
+/***
+ * Drain Rings
+ * Author: Matthew Ribbins
+ * Description: Write out everything in every thread's ring
+ */
+void Logger::Drain(void)
+{
+    // Only held while we copy the list, so a thread logging for the first time never waits on our writes. The
+    // copy keeps its capacity, so it is only allocated again when there are more threads.
+    ringsMutex.lock();
+    drainRings.assign(rings.begin(), rings.end());
+    ringsMutex.unlock();
+
+    for(size_t i = 0; i < drainRings.size(); i++) {
+        LogRing *ring = drainRings[i];
+        unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+        unsigned int head = ring->head.load(std::memory_order_acquire);
+        unsigned int dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+
+        for(; tail != head; tail++) {
+            FormatRecord(ring->records[tail & (LOG_RING_SIZE - 1)], ring->threadName);
+            fputs(line, output);
+            fputc('\n', output);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        if(dropped)
+            fprintf(output, "%s dropped %u log messages\n", ring->threadName, dropped);
+    }
+    fflush(output);
+}
+
+/***
+ * Logger Thread Loop
+ * Author: Matthew Ribbins
+ */
+void Logger::run()
+{
+    while(running) {
+        Drain();
+        msleep(LOG_DRAIN_INTERVAL);
+    }
+    Drain();
+}
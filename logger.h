@@ -0,0 +1,144 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <QThread>
+#include <QMutex>
+#include <atomic>
+#include <vector>
+#include <stdio.h>
+
+// Levels
+#define LOG_LEVEL_OFF (-1)
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARNING 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+#define LOG_LEVEL_DEFAULT LOG_LEVEL_INFO
+
+// Categories
+#define LOG_GENERAL 0
+#define LOG_CAMERA 1
+#define LOG_AUDIO 2
+#define LOG_SWITCHING 3
+#define LOG_DISPLAY 4
+#define LOG_CATEGORY_COUNT 5
+
+// Each thread's ring (records), must be a power of two
+#define LOG_RING_SIZE 1024
+#define LOG_MAX_ARGS 8
+#define LOG_TEXT_SIZE 64
+#define LOG_DRAIN_INTERVAL 20
+
+// Only the level check is done in the calling thread if the statement is disabled, and only a copy into the ring
+// if it is enabled. Formatting and writing out happen on the logger's own thread.
+#define LOG(category, level, ...) \
+    do { if(Logger::IsEnabled(category, level)) Logger::Write(category, level, __VA_ARGS__); } while(0)
+#define LOG_ERROR(category, ...) LOG(category, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARNING(category, ...) LOG(category, LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_INFO(category, ...) LOG(category, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(category, ...) LOG(category, LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#define LOG_ARG_INT 0
+#define LOG_ARG_DOUBLE 1
+#define LOG_ARG_STRING 2
+
+typedef struct _LogArg {
+    int type;
+    union {
+        long long i;
+        double d;
+        int text;
+    };
+} LogArg;
+
+// A log statement as it was made, formatted later by the logger thread. fmt must be a string literal.
+typedef struct _LogRecord {
+    qint64 timestamp;
+    const char *fmt;
+    short category;
+    short level;
+    int argCount;
+    int textLength;
+    LogArg args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+// Single producer (the thread that owns it), single consumer (the logger thread)
+typedef struct _LogRing {
+    LogRecord records[LOG_RING_SIZE];
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    std::atomic<unsigned int> dropped;
+    char threadName[16];
+} LogRing;
+
+class Logger : public QThread
+{
+public:
+    static void Start(const char *path = NULL);
+    static void Stop(void);
+    static void SetLevel(int category, int level);
+    static void SetLevel(int level);
+    static int GetLevel(int category);
+    static int GetCategory(const char *name);
+    static const char *GetCategoryName(int category);
+    static void SetThreadName(const char *name);
+
+    static inline bool IsEnabled(int category, int level)
+    {
+        return level <= levels[category].load(std::memory_order_relaxed);
+    }
+
+    template<typename... Args>
+    static void Write(int category, int level, const char *fmt, Args... args)
+    {
+        LogRecord *record = Begin(category, level, fmt);
+        if(!record) return;
+        Pack(record, args...);
+        Commit();
+    }
+
+private:
+    Logger(FILE *output);
+    ~Logger();
+    void Drain(void);
+    void FormatRecord(const LogRecord &record, const char *threadName);
+
+    static LogRing *GetRing(void);
+    static LogRecord *Begin(int category, int level, const char *fmt);
+    static void Commit(void);
+
+    static inline void Pack(LogRecord *) {}
+    template<typename T, typename... Args>
+    static inline void Pack(LogRecord *record, T value, Args... args)
+    {
+        PackArg(record, value);
+        Pack(record, args...);
+    }
+    static void PackArg(LogRecord *record, long long value);
+    static void PackArg(LogRecord *record, double value);
+    static void PackArg(LogRecord *record, const char *value);
+    static inline void PackArg(LogRecord *record, int value) { PackArg(record, (long long)value); }
+    static inline void PackArg(LogRecord *record, unsigned int value) { PackArg(record, (long long)value); }
+    static inline void PackArg(LogRecord *record, long value) { PackArg(record, (long long)value); }
+    static inline void PackArg(LogRecord *record, unsigned long value) { PackArg(record, (long long)value); }
+    static inline void PackArg(LogRecord *record, unsigned long long value) { PackArg(record, (long long)value); }
+    static inline void PackArg(LogRecord *record, bool value) { PackArg(record, (long long)value); }
+    static inline void PackArg(LogRecord *record, float value) { PackArg(record, (double)value); }
+    static inline void PackArg(LogRecord *record, char *value) { PackArg(record, (const char *)value); }
+
+    static std::atomic<int> levels[LOG_CATEGORY_COUNT];
+    static Logger *instance;
+    static QMutex ringsMutex;
+    static std::vector<LogRing *> rings;
+
+    FILE *output;
+    volatile bool running;
+    char line[512];
+    std::vector<LogRing *> drainRings;
+
+protected:
+    void run();
+};
+
+#endif // LOGGER_H
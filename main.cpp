@@ -7,26 +7,243 @@
 
 #include <QApplication>
 #include <QtWidgets>
+#include <QSocketNotifier>
 #include <opencv2/opencv.hpp>
 #include <assert.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "mainwindow.h"
+#include "headlessswitcher.h"
+#include "audioworker.h"
+#include "persondetector.h"
+#include "sourceregistry.h"
+#include "nodeserver.h"
+#include "logger.h"
+#include "threadpolicy.h"
+#include "framepool.h"
+#include "eventtrace.h"
 
-int main(int argc, char **argv) {
+/***
+ * Start Logging
+ * Author: Matthew Ribbins
+ * Description: Log/level is the level for every category, Log/<category> overrides it for one category, and
+ *              Log/file sends the log to a file instead of stderr
+ */
+static void StartLogging(void)
+{
+    QSettings settings("settings.ini", QSettings::IniFormat);
+
+    Logger::SetLevel(settings.value(QString("Log/level"), LOG_LEVEL_DEFAULT).toInt());
+    for(int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        QString key = QString("Log/").append(Logger::GetCategoryName(i));
+        if(settings.contains(key))
+            Logger::SetLevel(i, settings.value(key).toInt());
+    }
+    Logger::Start(settings.value(QString("Log/file")).toString().toLocal8Bit().constData());
+    Logger::SetThreadName("gui");
+}
+
+/***
+ * Run Capture Node
+ * Author: Matthew Ribbins
+ * Description: Capture and analyse this machine's cameras for a central switcher, with no window of our own
+ */
+static int RunNode(int argc, char **argv, const QString &listen, const QList<int> &devices)
+{
+    QCoreApplication app(argc, argv);
+    QSettings settings("settings.ini", QSettings::IniFormat);
+    SourceRegistry sources;
+    NodeServer server(&sources);
+
+    sources.AddLocalCameras(settings, devices, true);
+    if(!server.Listen(listen)) return 1;
+    FramePool::Reserve(sources.GetCount() * FRAMEPOOL_BUFFERS_PER_SOURCE, CAMERA_DEFAULT_RES_WIDTH, CAMERA_DEFAULT_RES_HEIGHT, CV_8UC3);
+
+    for(int i = 0; i < sources.GetCount(); i++)
+        sources.StartCapture(i, &server, SLOT(FrameArrived(int)));
+
+    int retval = app.exec();
+
+    sources.StopCapture();
+    return retval;
+}
+
+/***
+ * Parse Devices
+ * Author: Matthew Ribbins
+ * Description: Camera device numbers from a list like 0,2,3
+ */
+static QList<int> ParseDevices(const QString &list)
+{
+    QList<int> devices;
+    QStringList items = list.split(',', QString::SkipEmptyParts);
+
+    for(int i = 0; i < items.size(); i++)
+        devices.append(items.at(i).trimmed().toInt());
+    return devices;
+}
+
+/***
+ * Add Studios
+ * Author: Matthew Ribbins
+ * Description: A switcher (MainWindow, or HeadlessSwitcher) for each studio. With no Studios/names there is the one
+ *              studio using the top level settings, otherwise each studio's settings (and its Node/connect and
+ *              Node/devices) are in a group of its own name. The studios share the audio thread, the person
+ *              detector and its budget, and the frame pool, and each studio's cameras still capture on their own
+ *              threads.
+ */
+template<class Switcher>
+static void AddStudios(QList<Switcher *> &switchers, const QStringList &nodes, const QList<int> &devices,
+                       AudioWorker *audio, PersonDetector *detector)
+{
+    QSettings settings("settings.ini", QSettings::IniFormat);
+    QStringList studios = settings.value(QString("Studios/names")).toStringList();
 
+    if(studios.size() > MAX_STUDIOS) {
+        LOG_WARNING(LOG_GENERAL, "Warning: only the first %d of %d studios are run", MAX_STUDIOS, studios.size());
+        studios = studios.mid(0, MAX_STUDIOS);
+    }
 
+    if(studios.isEmpty()) {
+        switchers.append(new Switcher(QString(), nodes, devices, audio, detector));
+        return;
+    }
+    for(int i = 0; i < studios.size(); i++) {
+        QString studio = studios.at(i);
+        QStringList studioNodes = settings.value(studio + "/Node/connect").toStringList();
+        QList<int> studioDevices = ParseDevices(settings.value(studio + "/Node/devices").toString());
+
+        LOG_INFO(LOG_GENERAL, "Studio %s: %d capture nodes", studio.toLocal8Bit().constData(), studioNodes.size());
+        switchers.append(new Switcher(studio, studioNodes, studioDevices, audio, detector));
+    }
+}
+
+/***
+ * Run Studios
+ * Author: Matthew Ribbins
+ * Description: A switcher window for each studio
+ */
+static int RunStudios(int argc, char **argv, const QStringList &nodes, const QList<int> &devices)
+{
     QApplication app(argc, argv);
+    QSettings settings("settings.ini", QSettings::IniFormat);
+    AudioWorker audio;
+    PersonDetector detector(settings.value(QString("Detector/budget"), DETECTOR_DEFAULT_BUDGET).toInt());
+    QList<MainWindow *> windows;
+
+    // Open up the main windows
+    AddStudios(windows, nodes, devices, &audio, &detector);
+    for(int i = 0; i < windows.size(); i++)
+        windows.at(i)->show();
+
+    audio.Start();
+    // Only if a studio asked for it, as it costs CPU
+    if(detector.HasStudios())
+        detector.Start(QThread::LowestPriority);
+
+    int retval = app.exec();
+
+    // The shared threads look at every studio's sources, so they stop first
+    detector.Stop();
+    audio.Stop();
+    for(int i = 0; i < windows.size(); i++)
+        delete windows.at(i);
+    return retval;
+}
+
+// Written to from the signal handler, so a daemon shuts down (and closes its output) cleanly on SIGTERM
+static int quitPipe[2] = { -1, -1 };
+
+static void QuitSignal(int)
+{
+    char byte = 1;
+    if(write(quitPipe[1], &byte, 1)) {
+        // Nothing more we can safely do in a handler
+    }
+}
+
+/***
+ * Run Headless
+ * Author: Matthew Ribbins
+ * Description: Switch each studio with no window, program output to a file or shared memory only. No widgets are
+ *              made, so this runs on a QCoreApplication without a display.
+ */
+static int RunHeadless(int argc, char **argv, const QStringList &nodes, const QList<int> &devices)
+{
+    QCoreApplication app(argc, argv);
+    QSettings settings("settings.ini", QSettings::IniFormat);
+    AudioWorker audio;
+    PersonDetector detector(settings.value(QString("Detector/budget"), DETECTOR_DEFAULT_BUDGET).toInt());
+    QList<HeadlessSwitcher *> switchers;
+
+    if(!pipe(quitPipe)) {
+        QSocketNotifier *notifier = new QSocketNotifier(quitPipe[0], QSocketNotifier::Read, &app);
+        QObject::connect(notifier, SIGNAL(activated(int)), &app, SLOT(quit()));
+        signal(SIGTERM, QuitSignal);
+        signal(SIGINT, QuitSignal);
+    }
+
+    AddStudios(switchers, nodes, devices, &audio, &detector);
+
+    audio.Start();
+    if(detector.HasStudios())
+        detector.Start(QThread::LowestPriority);
+
+    int retval = app.exec();
+    LOG_INFO(LOG_GENERAL, "Shutting down");
+
+    detector.Stop();
+    audio.Stop();
+    for(int i = 0; i < switchers.size(); i++)
+        delete switchers.at(i);
+    return retval;
+}
+
+int main(int argc, char **argv) {
+    QSettings settings("settings.ini", QSettings::IniFormat);
+    QString listen = settings.value(QString("Node/listen")).toString();
+    QStringList nodes = settings.value(QString("Node/connect")).toStringList();
+    QList<int> devices = ParseDevices(settings.value(QString("Node/devices")).toString());
+    bool headless = settings.value(QString("Display/headless"), false).toBool();
+    int retval;
+
+    // --node <address> runs as a capture node, --connect <address> (as many as you like) uses a capture node's
+    // cameras, --devices 0,1 limits which local cameras we open, and --headless switches without a window
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--headless")) headless = true;
+        else if(i == argc - 1) break;
+        else if(!strcmp(argv[i], "--node")) listen = argv[++i];
+        else if(!strcmp(argv[i], "--connect")) nodes.append(argv[++i]);
+        else if(!strcmp(argv[i], "--devices")) devices = ParseDevices(argv[++i]);
+    }
 
     QCoreApplication::setOrganizationName("MPRS");
     QCoreApplication::setOrganizationDomain("mattyribbo.co.uk");
     QCoreApplication::setApplicationName("RadioViz");
 
-    // Open up the main window
-    MainWindow *window = new MainWindow();
-    window->show();
+    StartLogging();
+    EventTrace::Start(settings.value(QString("Events/file")).toString().toLocal8Bit().constData(),
+                      settings.value(QString("Events/seconds"), EVENT_DEFAULT_SECONDS).toInt());
+    ThreadPolicy::Load(settings);
+    ThreadPolicy::Apply(THREAD_CLASS_GUI, "gui");
+    FramePool::SetBudget(settings.value(QString("Frames/poolBudget"), FRAMEPOOL_DEFAULT_BUDGET).toLongLong() * 1024 * 1024);
 
-    int retval = app.exec();
-     
+    if(!listen.isEmpty()) {
+        retval = RunNode(argc, argv, listen, devices);
+    } else if(headless) {
+        retval = RunHeadless(argc, argv, nodes, devices);
+    } else {
+        retval = RunStudios(argc, argv, nodes, devices);
+    }
+
+    // Whatever led up to us stopping
+    char eventPath[EVENT_PATH_SIZE];
+    EventTrace::Save(eventPath, sizeof(eventPath), true);
+    EventTrace::Shutdown();
+
+    Logger::Stop();
     return retval;
 }
 
@@ -8,27 +8,69 @@
 #include "mainwindow.h"
 //#include "ui_mainwindow.h"
 #include "camera.h"
+#include "jpegdc.h"
 #include <QMainWindow>
 
 /***
  * Main Window Constructor
  * Author: Matthew Ribbins
  */
-MainWindow::MainWindow(QWidget *parent)
-    : QWidget(parent)
+MainWindow::MainWindow(const QString &studio, const QStringList &nodes, const QList<int> &devices,
+                       AudioWorker *audio, PersonDetector *detector, QWidget *parent)
+    : QWidget(parent), policy(CAMERA_AUDIO_THRESHOLD, CAMERA_MOVEMENT_THRESHOLD), core(&sources, &policy)
 {
-    PaError err;
     //int result;
     QSettings settings("settings.ini", QSettings::IniFormat, parent);
 
-    // Set up window. Full screen
+    // A studio's settings are all under its name, e.g. Studio1/Video/mode
+    if(!studio.isEmpty())
+        settings.beginGroup(studio);
+    studioName = studio.isEmpty() ? QByteArray("") : studio.toLocal8Bit().append(": ");
+
+    // Set up window. Full screen, each studio on its own screen
     QDesktopWidget *desktop = QApplication::desktop();
-    setGeometry(desktop->screenGeometry(0));
+    setGeometry(desktop->screenGeometry(settings.value(QString("Display/screen"), 0).toInt()));
 
     currentCamera = 0;
-    availableCameras = 0;
+    sourceEntry = 0;
     timerCount = 0;
+    traceTick = 0;
+    metricsDecision = -1;
     mode = 0;
+    transitionType = TRANSITION_CUT;
+    transitionDuration = TRANSITION_DEFAULT_DURATION;
+    transitionWaitFrame = 0;
+    compositorEnabled = true;
+    displayPacing = DISPLAY_PACING_ARRIVAL;
+    refreshTimer = NULL;
+    presentedCamera = -1;
+    presentedFrameNumber = 0;
+    presentedFrames = 0;
+    droppedFrames = 0;
+    duplicatedFrames = 0;
+    statsAllocations = 0;
+    statsLargeAllocations = 0;
+    statsPresentedFrames = 0;
+    levelText[0] = '\0';
+    replayActive = false;
+    replayCamera = 0;
+    statsCount = 0;
+    this->audio = audio;
+    bleedDetector = NULL;
+    control = NULL;
+    controlFrameBudget = 0;
+    controlCutPending = false;
+    controlCutClient = 0;
+    controlCutReceived = 0;
+    controlCuts = 0;
+    controlCutsLate = 0;
+    controlCutTotal = 0;
+    controlCutMax = 0;
+    tallyProgram = -1;
+    replayCue = TIMESHIFT_DEFAULT_CUE;
+    replayStart = 0;
+    replayPosition = 0;
+    replaySequence = -1;
 
     cameraWidget = new CameraWidget(this);
     cameraWidget->resize(this->width(), this->height());
@@ -44,80 +86,182 @@ MainWindow::MainWindow(QWidget *parent)
     layout->addWidget(button);
 
     setLayout(layout);
-    setWindowTitle("Camera");
+    setWindowTitle(studio.isEmpty() ? QString("Camera") : studio);
     setStyleSheet("background-color: black;");
     setWindowState(Qt::WindowFullScreen);
 
-    // Get available camera devices by using FFMpeg
-    av_register_all();
-    avdevice_register_all();
-    avcodec_register_all();
+    // Local cameras. With capture nodes, or other studios, only the devices asked for.
+    sources.AddLocalCameras(settings, devices, nodes.isEmpty() && studio.isEmpty());
 
-    AVDeviceInfoList* deviceList;
-    GetAvailableCamerasList(&deviceList);
-    availableCameras = deviceList->nb_devices;
+    // Cameras on capture nodes
+    for(int i = 0; i < nodes.size(); i++) {
+        NodeClient *node = new NodeClient(nodes.at(i), &sources, this);
+        connect(node, SIGNAL(frameArrived(int)), this, SLOT(FrameArrived(int)));
+    }
 
-    // Initialise PortAudio
-    err = Pa_Initialize();
-    if(err != paNoError)
-        qDebug() << "Error: PortAudio did not initialise";
+    // Glass to glass latency: synthetic sources carry a timestamp strip that is read back when it is painted. With
+    // stamping on a fresh strip is painted over the output, for a camera or screen grab to bring back round.
+    int syntheticSources = settings.value(QString("Latency/synthetic"), 0).toInt();
+    for(int i = 0; i < syntheticSources; i++) {
+        Camera *synthetic = new SyntheticCamera(CAMERA_DEFAULT_RES_WIDTH, CAMERA_DEFAULT_RES_HEIGHT, CAMERA_DEFAULT_FPS);
+        if(sources.Add(synthetic) < 0) {
+            delete synthetic;
+            break;
+        }
+    }
+    cameraWidget->SetLatencyMeasurement(settings.value(QString("Latency/measure"), syntheticSources > 0).toBool());
+    cameraWidget->SetLatencyStamp(settings.value(QString("Latency/stamp"), false).toBool());
+
+    // Switching thresholds, so they can be tuned against recorded traces
+    policy.SetAudioThreshold(settings.value(QString("Policy/audioThreshold"), CAMERA_AUDIO_THRESHOLD).toFloat());
+    policy.SetMovementThreshold(settings.value(QString("Policy/movementThreshold"), CAMERA_MOVEMENT_THRESHOLD).toInt());
+    policy.SetPresenceWeight(settings.value(QString("Detector/weight"), DETECTOR_DEFAULT_WEIGHT).toFloat());
+
+    // Record what every switching decision was made from
+    QString tracePath = settings.value(QString("Trace/file")).toString();
+    if(!tracePath.isEmpty()) {
+        TraceHeader header;
+        header.magic = TRACE_MAGIC;
+        header.version = TRACE_VERSION;
+        header.tickInterval = DECISION_TIMER_INTERVAL;
+        header.audioThreshold = policy.GetAudioThreshold();
+        header.movementThreshold = policy.GetMovementThreshold();
+        if(!traceWriter.Open(tracePath.toLocal8Bit().constData(), header))
+            qDebug() << "Error: Could not open trace file" << tracePath;
+    }
 
-    int numAudioDevices = Pa_GetDeviceCount();
-    if(numAudioDevices < 0)
-       qDebug() << "Error: PortAudio did not find any audio devices";
+    // Every camera's level and movement on every tick, all day, for tuning. Files rotate at Metrics/fileSize MB.
+    QString metricsPath = settings.value(QString("Metrics/file")).toString();
+    if(!metricsPath.isEmpty()) {
+        int metricsCameras = settings.value(QString("Metrics/cameras"), METRICS_DEFAULT_CAMERAS).toInt();
+        int metricsFileSize = settings.value(QString("Metrics/fileSize"), METRICS_DEFAULT_FILE_SIZE).toInt();
+        if(metricsWriter.Open(metricsPath.toLocal8Bit().constData(), metricsCameras, DECISION_TIMER_INTERVAL, metricsFileSize))
+            LOG_INFO(LOG_GENERAL, "Logging metrics for %d cameras to %s", metricsWriter.GetCameras(), metricsPath.toLocal8Bit().constData());
+        else
+            LOG_ERROR(LOG_GENERAL, "Error: Could not open metrics log %s", metricsPath.toLocal8Bit().constData());
+    }
 
-    qDebug() << "Number of available devices:"  << numAudioDevices - PORTAUDIO_TO_CAMERA_DEVICE_OFFSET << "\n";
+    mode = settings.value(QString("mode")).toInt();
+    if(!mode) {
+        // Initialise Mode
+        settings.setValue(QString("mode"), "1");
+        mode = 1;
+    }
 
-    for(int i = 0; i < numAudioDevices; i++)
-    {
-        const PaDeviceInfo *deviceInfo;
-        deviceInfo = Pa_GetDeviceInfo(i);
-        qDebug() << "Device " << i << ": " << deviceInfo->name;
+    // Transition between cameras
+    transitionType = settings.value(QString("Transition/type"), TRANSITION_CUT).toInt();
+    transitionDuration = settings.value(QString("Transition/duration"), TRANSITION_DEFAULT_DURATION).toInt();
+    if(transitionType < 0 || transitionType >= TRANSITION_COUNT) transitionType = TRANSITION_CUT;
+
+    // Split screen/picture in picture when more than one camera is active
+    compositorEnabled = settings.value(QString("Compositor/enabled"), true).toBool();
+    compositor.SetLayout(settings.value(QString("Compositor/layout"), COMPOSITOR_LAYOUT_SPLIT).toInt());
+
+    // Present frames as they arrive from the program camera, or at the display's refresh rate
+    displayPacing = settings.value(QString("Display/pacing"), DISPLAY_PACING_ARRIVAL).toInt();
+
+    // Timeshift buffers for instant replay, budget is per camera in MB
+    int replaySeconds = settings.value(QString("Replay/seconds"), TIMESHIFT_DEFAULT_SECONDS).toInt();
+    int replayBudget = settings.value(QString("Replay/budget"), TIMESHIFT_DEFAULT_BUDGET).toInt();
+    replayCue = settings.value(QString("Replay/cue"), TIMESHIFT_DEFAULT_CUE).toInt();
+    for(int i = 0; i < sources.GetCount(); i++) {
+        sources.GetCamera(i)->EnableTimeshift(replaySeconds, replayBudget * 1024 * 1024);
     }
 
-    // Initialise Cameras
-    for(int i=0; i < availableCameras; i++) {
-        camera[i] = new Camera(i,i);
+    connect(button, SIGNAL(pressed()), this, SLOT(ChangeCamera()));
+    for(int i = 0; i < sources.GetCount(); i++) {
+        sources.GetCamera(i)->FlushBuffers();
     }
 
-    // Settings
-    for(int i=0; i < availableCameras; i++) {
-        //For some reason there's a reversal
-        int ffmpegi = availableCameras - i - 1;
-        QString settingKey(QString("Devices/").append(deviceList->devices[ffmpegi]->device_description));
+    // Frame buffers for every source up front, more are made as remote sources arrive
+    FramePool::Reserve(sources.GetCount() * FRAMEPOOL_BUFFERS_PER_SOURCE, CAMERA_DEFAULT_RES_WIDTH, CAMERA_DEFAULT_RES_HEIGHT, CV_8UC3);
 
-        int result = QString::compare(settings.value(QString(settingKey).append("/enabled")).toString(), "true", Qt::CaseInsensitive);
+    // Start capturing
+    for(int i = 0; i < sources.GetCount(); i++) {
+        sources.StartCapture(i, this, SLOT(FrameArrived(int)));
+    }
 
-        if(!result) {
-            // We have settings to load
-            qDebug() << "Load " << settingKey << "to Camera " << ffmpegi;
-            float gain = (settings.value(QString(settingKey).append("/gain"))).toFloat();
-            qDebug() << "Gain " << gain;
-            camera[i]->SetAudioGain(gain);
+    // Program audio from the camera mics, following the cuts or mixing whoever is talking
+    audioMix = settings.value(QString("Audio/mix"), AUDIO_MIX_OFF).toInt();
+    if(AUDIO_MIX_OFF != audioMix) {
+        for(int i = 0; i < sources.GetCount(); i++) {
+            if(sources.GetCamera(i)->EnableAudioCapture())
+                mixer.SetInput(i, sources.GetCamera(i)->GetAudioRing());
+        }
+        mixer.SetMode(audioMix);
+        if(!mixer.Open(settings.value(QString("Audio/outputDevice"), -1).toInt(),
+                       settings.value(QString("Audio/latency"), AUDIO_MIX_DEFAULT_LATENCY).toInt(),
+                       settings.value(QString("Audio/fade"), AUDIO_MIX_DEFAULT_FADE).toInt()))
+            audioMix = AUDIO_MIX_OFF;
+    }
 
-        } else {
-            // We have a new device to save settings about
-            settings.setValue(QString(settingKey).append("/enabled"), true);
+    // Bleed rejection: every mic hears every speaker, so work out from the delays between them which is nearest.
+    // The mics capture continuously for this, so it has to be set up before the levels are read.
+    if(settings.value(QString("Bleed/enabled"), false).toBool()) {
+        for(int i = 0; i < sources.GetCount(); i++)
+            sources.GetCamera(i)->EnableAudioAnalysis();
+        policy.SetBleedWeight(settings.value(QString("Bleed/weight"), BLEED_DEFAULT_WEIGHT).toFloat());
+        bleedDetector = new BleedDetector(&sources, settings.value(QString("Bleed/maxDelay"), BLEED_DEFAULT_MAX_DELAY).toFloat());
+        bleedDetector->Start();
+        core.SetBleedDetector(bleedDetector);
+    }
 
-            // Set current settings
-            settings.setValue(QString(settingKey).append("/gain"), camera[i]->GetAudioGain());
-        }
+    // Every mic to its own track for post production, written out on a thread of its own
+    if(settings.value(QString("Record/enabled"), false).toBool()) {
+        recorder.AddSources(&sources, studioName);
+        recorder.Start(settings.value(QString("Record/directory"), QString(".")).toString(),
+                       settings.value(QString("Record/name"), studio.isEmpty() ? QString("mics") : studio).toString());
+    }
 
+    // Audio levels are read on the shared audio thread, the switching decisions just use the latest
+    studioIndex = audio->AddStudio(&sources);
+    audio->SetSourceCount(studioIndex, sources.GetCount());
+    core.SetStudio(studioName, audio, studioIndex);
+
+    // Source numbers can be more than one digit, so wait a moment for the next one
+    sourceEntryTimer = new QTimer(this);
+    sourceEntryTimer->setSingleShot(true);
+    connect(sourceEntryTimer, SIGNAL(timeout()), this, SLOT(CommitSourceEntry()));
+
+    UpdateAnalysisCameras();
+
+    // A control command should take effect within one frame
+    controlFrameBudget = 1000000000LL / CAMERA_DEFAULT_FPS;
+    if(DISPLAY_PACING_REFRESH == displayPacing) {
+        QScreen *screen = QGuiApplication::primaryScreen();
+        qreal refreshRate = (screen && screen->refreshRate() > 0) ? screen->refreshRate() : DISPLAY_DEFAULT_REFRESH_RATE;
+        controlFrameBudget = (qint64)(1000000000.0 / refreshRate);
+
+        refreshTimer = new QTimer(this);
+        refreshTimer->setTimerType(Qt::PreciseTimer);
+        connect(refreshTimer, SIGNAL(timeout()), this, SLOT(DisplayRefresh()));
+        refreshTimer->start(qRound(1000.0 / refreshRate));
+        qDebug() << "Display paced at" << refreshRate << "Hz";
     }
 
-    mode = settings.value(QString("mode")).toInt();
-    if(!mode) {
-        // Initialise Mode
-        settings.setValue(QString("mode"), "1");
-        mode = 1;
+    // Person detection to weight switching, off unless asked for as it costs CPU. The detector and its budget
+    // are shared by every studio.
+    if(detector && settings.value(QString("Detector/enabled"), false).toBool()) {
+        int detectorStudio = detector->AddStudio(&sources);
+        if(detectorStudio >= 0) core.SetDetector(detector, detectorStudio);
     }
 
-    connect(button, SIGNAL(pressed()), this, SLOT(ChangeCamera()));
-    for(int i = 0; i < availableCameras; i++) {
-        camera[i]->FlushBuffers();
+    // Control socket for automation systems and hardware panels, on its own thread
+    QString controlAddress = settings.value(QString("Control/listen")).toString();
+    if(!controlAddress.isEmpty()) {
+        control = new ControlServer();
+        if(control->Listen(controlAddress)) {
+            control->moveToThread(&controlThread);
+            connect(&controlThread, SIGNAL(started()), control, SLOT(ThreadStarted()), Qt::DirectConnection);
+            connect(&controlThread, SIGNAL(finished()), control, SLOT(deleteLater()));
+            controlThread.start();
+        } else {
+            delete control;
+            control = NULL;
+        }
     }
 
-    startTimer(40); // 30fps
+    startTimer(DECISION_TIMER_INTERVAL); // 25Hz
  }
 
 /***
@@ -126,57 +270,80 @@ MainWindow::MainWindow(QWidget *parent)
  */
 MainWindow::~MainWindow()
 {
-    for(int i = 0; i < availableCameras; i++) {
-        delete camera[i];
+    // The shared audio worker and detector have already been stopped
+    if(control) {
+        controlThread.quit();
+        controlThread.wait();
+    }
+    if(bleedDetector) {
+        bleedDetector->Stop();
+        delete bleedDetector;
     }
+    recorder.Stop();
+    mixer.Close();
+    sources.StopCapture();
 }
 
 void MainWindow::SelectCameraBasedOnInput(int input)
 {
-    if(input > availableCameras) return;
+    if(input < 1 || input > sources.GetCount()) return;
     ChangeCamera(--input);
 }
 
+/***
+ * Enter Source Digit
+ * Author: Matthew Ribbins
+ * Description: Number keys pick a source. Once no further digit could make a valid source number we switch
+ *              straight away, so with nine or fewer sources every key switches immediately. Otherwise we switch on
+ *              Enter or after SOURCE_ENTRY_TIMEOUT.
+ */
+void MainWindow::EnterSourceDigit(int digit)
+{
+    sourceEntry = sourceEntry * 10 + digit;
+    if(sourceEntry * 10 > sources.GetCount()) {
+        CommitSourceEntry();
+        return;
+    }
+    sourceEntryTimer->start(SOURCE_ENTRY_TIMEOUT);
+}
+
+void MainWindow::CommitSourceEntry(void)
+{
+    int input = sourceEntry;
+
+    sourceEntryTimer->stop();
+    sourceEntry = 0;
+    if(!input) return;
+
+    mode = MODE_MANUAL;
+    compositor.ClearSources();
+    SelectCameraBasedOnInput(input);
+}
+
 /***
  * Select suitable camera based on audio
  * Author: Matthew Ribbins
  */
 void MainWindow::SelectCameraBasedOnAudio()
 {
-    float levels[availableCameras];
-    bool active[availableCameras];
+    EVENT_SCOPE("decision", -1);
+    SourceState &state = sources.GetState();
     int activeCount = 0;
     int loudestCamera = 0;
-    float loudestCameraLevel = -50;
-    QString *debugString = new QString();
-
-    memset((void *)&active, 0, sizeof(bool)*availableCameras);
 
     // Get current values
-    for(int i = 0; i < availableCameras; i++) {
-        levels[i] = camera[i]->GetAudioLevelFromDevice();
-        debugString->append(QString("%1").arg(levels[i]));
-        qDebug() << "Camera " << i << ": " << levels[i];
-
-        if(i == currentCamera)
-            debugString->append(QString("*"));
-        debugString->append(QString(" "));
-
-        if(levels[i] > loudestCameraLevel) {
-            loudestCamera = i;
-            loudestCameraLevel = levels[i];
-        }
-
-        if(levels[i] > CAMERA_AUDIO_THRESHOLD) {
-            active[i] = true;
-            activeCount++;
-        }
-    }
-    debugLabel->setText(*debugString);
-
-    if(activeCount) {
-        if(activeCount > 2) {
-            qDebug() << "Two or more cameras loud.";
+    core.ReadLevels();
+    ShowAudioLevels(state.levels);
+
+    // The trace records the weighted levels the policy saw
+    loudestCamera = core.SelectBasedOnAudio();
+    activeCount = policy.GetActiveCount();
+    RecordTrace(TRACE_RECORD_AUDIO, state.levels, loudestCamera);
+
+    UpdateComposition(state.levels, state.active);
+    if(activeCount && core.IsReadyForProgram(loudestCamera)) {
+        if(activeCount >= 2) {
+            LOG_DEBUG(LOG_SWITCHING, "Two or more cameras loud.");
             ChangeCamera(loudestCamera);
         } else {
             ChangeCamera(loudestCamera);
@@ -190,32 +357,26 @@ void MainWindow::SelectCameraBasedOnAudio()
  */
 void MainWindow::SelectCameraBasedOnVideo()
 {
-    int movement[availableCameras];
-    bool active[availableCameras];
+    EVENT_SCOPE("decision", -1);
+    SourceState &state = sources.GetState();
+    int count = sources.GetCount();
     int numOfActive = 0;
     int highestActive = -1;
-    int highestActiveLevel = 0;
-
-    memset((void *)&active, 0, sizeof(bool)*availableCameras);
-
-    for(int i = 0; i < availableCameras; i++) {
-        camera[i]->GetVideoFrame();
-        movement[i] = camera[i]->GetMovementDetection();
-        qDebug() << "Camera " << i << ": " << movement[i];
-        if(movement[i] > CAMERA_MOVEMENT_THRESHOLD) {
-            numOfActive++;
-            active[i] = true;
-            if(movement[i] > highestActiveLevel) {
-                highestActive = i;
-                highestActiveLevel = movement[i];
-            }
-        }
-    }
-    if(numOfActive) {
-        if(numOfActive > 2) {
-            qDebug() << ">2 cameras with movement above threshold";
+
+    core.ReadMovement();
+    highestActive = core.SelectBasedOnVideo();
+    numOfActive = policy.GetActiveCount();
+    for(int i = 0; i < count; i++)
+        state.scores[i] = state.movement[i];
+    RecordTrace(TRACE_RECORD_VIDEO, state.scores, highestActive);
+
+    UpdateComposition(state.scores, state.active);
+    if(numOfActive && core.IsReadyForProgram(highestActive)) {
+        if(numOfActive >= 2) {
+            LOG_DEBUG(LOG_SWITCHING, ">=2 cameras with movement above threshold");
+            ChangeCamera(highestActive);
         } else {
-            qDebug() << "Camera " << highestActive << " active";
+            LOG_DEBUG(LOG_SWITCHING, "Camera %d active", highestActive);
             ChangeCamera(highestActive);
             //for(int i = 0; i < 2; i++) {
             //    cameraWidget->putFrame(camera[highestActive]->GetProcessedFrame(i));
@@ -223,7 +384,99 @@ void MainWindow::SelectCameraBasedOnVideo()
             //}
         }
     }
-    qDebug() << "----";
+}
+
+/***
+ * Show Audio Levels
+ * Author: Matthew Ribbins
+ * Description: Put the audio levels on the debug label, current camera marked with a *. The text is built in a
+ *              fixed buffer and the label is only touched when the text changes.
+ */
+void MainWindow::ShowAudioLevels(const float *levels)
+{
+    char text[sizeof(levelText)];
+    int length = 0;
+
+    text[0] = '\0';
+    for(int i = 0; i < sources.GetCount() && length < (int)sizeof(text); i++)
+        length += snprintf(text + length, sizeof(text) - length, "%.1f%s ", levels[i], (i == currentCamera) ? "*" : "");
+
+    if(!strcmp(text, levelText)) return;
+    strcpy(levelText, text);
+    debugLabel->setText(QString::fromLatin1(levelText));
+}
+
+/***
+ * Record Trace
+ * Author: Matthew Ribbins
+ * Description: If we are recording a trace, save what this decision was made from so it can be replayed later
+ *              with tools/tracereplay
+ */
+void MainWindow::RecordTrace(int kind, const float *values, int decision)
+{
+    TraceRecord record;
+
+    metricsDecision = decision;
+    if(!traceWriter.IsOpen()) return;
+
+    record.tick = traceTick;
+    record.kind = kind;
+    record.currentCamera = currentCamera;
+    record.decision = decision;
+    record.count = (sources.GetCount() > TRACE_MAX_CAMERAS) ? TRACE_MAX_CAMERAS : sources.GetCount();
+    memcpy(record.values, values, sizeof(float) * record.count);
+    traceWriter.WriteRecord(record);
+}
+
+/***
+ * Record Metrics
+ * Author: Matthew Ribbins
+ * Description: A row for the metrics log every tick: the latest audio levels, movement as last measured, the active
+ *              and stalled cameras, the camera on program and what was decided this tick (-1 for nothing)
+ */
+void MainWindow::RecordMetrics(void)
+{
+    MetricsRow row;
+    SourceState &state = sources.GetState();
+    int count = sources.GetCount();
+
+    if(!metricsWriter.IsOpen()) return;
+    if(count > METRICS_MAX_CAMERAS) count = METRICS_MAX_CAMERAS;
+
+    row.tick = traceTick;
+    row.mode = mode;
+    row.program = currentCamera;
+    row.decision = metricsDecision;
+    row.count = count;
+    row.active = 0;
+    row.stalled = 0;
+    for(int i = 0; i < count; i++) {
+        row.levels[i] = audio->GetLevel(studioIndex, i);
+        row.movement[i] = state.movement[i];
+        if(state.active[i]) row.active |= 1u << i;
+        if(core.IsStalled(i)) row.stalled |= 1u << i;
+    }
+    metricsWriter.Write(row);
+}
+
+/***
+ * Save Events
+ * Author: Matthew Ribbins
+ * Description: Save the pipeline events from the last Events/seconds, e.g. straight after a stutter on air. The
+ *              file is written in the background.
+ *
+ * Return: (bool) false if tracing is off or the last save hasn't finished
+ */
+bool MainWindow::SaveEvents(void)
+{
+    char path[EVENT_PATH_SIZE];
+
+    if(!EventTrace::Save(path, sizeof(path), false)) {
+        LOG_WARNING(LOG_GENERAL, "Warning: Can't save events, %s", EventTrace::IsEnabled() ? "still saving the last ones" : "tracing is off (Events/file)");
+        return false;
+    }
+    LOG_INFO(LOG_GENERAL, "Saving events to %s", path);
+    return true;
 }
 
 /***
@@ -232,49 +485,24 @@ void MainWindow::SelectCameraBasedOnVideo()
  */
 void MainWindow::SelectCameraBasedOnAudioVideo()
 {
-    float levels[availableCameras];
-    bool activeAudio[availableCameras];
+    EVENT_SCOPE("decision", -1);
+    SourceState &state = sources.GetState();
     int activeCount = 0;
     int loudestCamera = 0;
-    float loudestCameraLevel = -50;
-
-    int movement[availableCameras];
-    bool activeVideo[availableCameras];
-    int numOfActive = 0;
-    int highestActive = -1;
-    int highestActiveLevel = 0;
-    QString *debugString = new QString();
-
-    memset((void *)&activeAudio, 0, sizeof(bool)*availableCameras);
-    memset((void *)&activeVideo, 0, sizeof(bool)*availableCameras);
-
 
     // Get current values
-    for(int i = 0; i < availableCameras; i++) {
-        levels[i] = camera[i]->GetAudioLevelFromDevice();
-        movement[i] = camera[i]->GetMovementDetection();
-        debugString->append(QString("%1").arg(levels[i]));
-        qDebug() << "Camera " << i << ": " << levels[i];
-
-        if(i == currentCamera)
-            debugString->append(QString("*"));
-        debugString->append(QString(" "));
-
-        if(levels[i] > loudestCameraLevel) {
-            loudestCamera = i;
-            loudestCameraLevel = levels[i];
-        }
+    core.ReadLevels();
+    core.ReadMovement();
+    ShowAudioLevels(state.levels);
 
-        if(levels[i] > CAMERA_AUDIO_THRESHOLD) {
-            activeAudio[i] = true;
-            activeCount++;
-        }
-    }
-    debugLabel->setText(*debugString);
+    // Weighted by presence and bleed like audio alone, and only cut to a camera once it is at full capture
+    loudestCamera = core.SelectBasedOnAudio();
+    activeCount = policy.GetActiveCount();
 
-    if(activeCount) {
+    UpdateComposition(state.levels, state.active);
+    if(activeCount && core.IsReadyForProgram(loudestCamera)) {
         if(activeCount > 2) {
-            qDebug() << "Two or more cameras loud.";
+            LOG_DEBUG(LOG_SWITCHING, "Two or more cameras loud.");
             ChangeCamera(loudestCamera);
         } else {
             ChangeCamera(loudestCamera);
@@ -285,12 +513,280 @@ void MainWindow::SelectCameraBasedOnAudioVideo()
 /***
  * Refresh Camera Image
  * Author: Matthew Ribbins
- * Description: Acquire the image from the current camera using OpenCV. We then display the image using CameraWidget
+ * Description: Show the newest frame from the program camera using CameraWidget. Nothing is repainted unless
+ *              there is a new frame, or force is set (e.g. we have just changed camera).
+ *
+ * Return: (bool) true if the screen was updated
+ */
+bool MainWindow::RefreshCameraImage(bool force)
+{
+    EVENT_SCOPE("present", currentCamera);
+    Camera *program = sources.GetCamera(currentCamera);
+    unsigned int frameNumber;
+
+    if(replayActive) {
+        if(RefreshReplayImage()) return true;
+        if(replayActive) return false;
+    }
+
+    if(compositor.GetSourceCount() > 1)
+        return RefreshCompositeImage();
+
+    if(transition.IsActive() && RefreshTransitionImage())
+        return true;
+
+    if(!program) return false;
+    if(!program->AcquireFrame() && !force)
+        return false;
+
+    // Count any frames from this camera we never got to show
+    frameNumber = program->GetFrameNumber();
+    if(presentedCamera == currentCamera && frameNumber > presentedFrameNumber + 1)
+        droppedFrames += frameNumber - presentedFrameNumber - 1;
+    presentedCamera = currentCamera;
+    presentedFrameNumber = frameNumber;
+
+    cameraWidget->putFrameRGB(program->GetLastFrame());
+    return true;
+}
+
+/***
+ * Is Camera On Program
+ * Author: Matthew Ribbins
+ * Description: Whether a camera is currently part of what is on screen
+ */
+bool MainWindow::IsCameraOnProgram(int cameraId)
+{
+    if(replayActive) return (cameraId == replayCamera);
+    if(cameraId == currentCamera) return true;
+    if(transition.IsActive() && cameraId == transition.GetFromCamera()) return true;
+    for(int i = 0; i < compositor.GetSourceCount(); i++) {
+        if(compositor.GetSource(i) == cameraId) return true;
+    }
+    return false;
+}
+
+/***
+ * Update Analysis Cameras
+ * Author: Matthew Ribbins
+ * Description: Cameras that aren't on screen only need to be analysed, not fully decoded
+ */
+void MainWindow::UpdateAnalysisCameras(void)
+{
+    for(int i = 0; i < sources.GetCount(); i++)
+        sources.GetCamera(i)->SetAnalysisOnly(!IsCameraOnProgram(i));
+}
+
+/***
+ * Update Stalled Sources
+ * Author: Matthew Ribbins
+ * Description: Watchdog for the capture threads, see SwitchingCore. If the camera on program has stalled in an
+ *              automatic mode we cut away from it.
+ */
+void MainWindow::UpdateStalledSources(void)
+{
+    if(core.UpdateStalledSources(currentCamera) && MODE_MANUAL != mode && MODE_DISABLED != mode) {
+        compositor.ClearSources();
+        ChangeCamera();
+    }
+}
+
+/***
+ * Update Program Audio
+ * Author: Matthew Ribbins
+ * Description: Tell the mixer which mics should be heard: the cameras on program when following the video, or the
+ *              ones over the audio threshold in the auto mix
+ */
+void MainWindow::UpdateProgramAudio(void)
+{
+    bool active[MAX_CAMERAS_AVAILABLE];
+    int count = sources.GetCount();
+
+    if(AUDIO_MIX_OFF == audioMix) return;
+    for(int i = 0; i < count; i++) {
+        if(AUDIO_MIX_FOLLOW == audioMix)
+            active[i] = IsCameraOnProgram(i);
+        else
+            active[i] = (audio->GetLevel(studioIndex, i) > policy.GetAudioThreshold());
+    }
+    mixer.SetActive(active, count);
+}
+
+/***
+ * Update Capture Tiers
+ * Author: Matthew Ribbins
+ * Description: Everything on screen counts as on program: a transition's from camera and the composite's too
+ */
+void MainWindow::UpdateCaptureTiers(void)
+{
+    bool onProgram[MAX_CAMERAS_AVAILABLE];
+
+    for(int i = 0; i < sources.GetCount(); i++)
+        onProgram[i] = IsCameraOnProgram(i);
+    core.UpdateCaptureTiers(mode, onProgram);
+}
+
+/***
+ * Start Replay
+ * Author: Matthew Ribbins
+ * Description: Cue the camera's timeshift buffer back replayCue seconds and start playing it on program
+ */
+void MainWindow::StartReplay(int cameraId)
+{
+    TimeshiftBuffer *buffer = sources.GetCamera(cameraId)->GetTimeshift();
+
+    if(!buffer || buffer->GetLastSequence() < buffer->GetFirstSequence()) {
+        LOG_WARNING(LOG_DISPLAY, "Nothing to replay for camera %d", cameraId);
+        return;
+    }
+
+    replayCamera = cameraId;
+    replayStart = TimeshiftBuffer::Now();
+    replayPosition = replayStart - (qint64)replayCue * 1000;
+    replaySequence = -1;
+    replayActive = true;
+    LOG_INFO(LOG_DISPLAY, "Replay camera %d from %d s ago", cameraId, replayCue);
+    RefreshCameraImage(true);
+}
+
+void MainWindow::StopReplay(void)
+{
+    if(!replayActive) return;
+    replayActive = false;
+    RefreshCameraImage(true);
+}
+
+/***
+ * Refresh Replay Image
+ * Author: Matthew Ribbins
+ * Description: Play back from the timeshift buffer in real time from the cue point. Only frames we haven't shown
+ *              yet are decoded. Once we catch up with live, the replay ends.
+ *
+ * Return: (bool) true if the screen was updated
+ */
+bool MainWindow::RefreshReplayImage(void)
+{
+    TimeshiftBuffer *buffer = sources.GetCamera(replayCamera)->GetTimeshift();
+    qint64 target = replayPosition + (TimeshiftBuffer::Now() - replayStart);
+    qint64 sequence = buffer->Find(target);
+
+    if(sequence < 0 || sequence >= buffer->GetLastSequence()) {
+        LOG_INFO(LOG_DISPLAY, "Replay caught up with live");
+        replayActive = false;
+        return false;
+    }
+    if(sequence == replaySequence) return false;
+    if(!buffer->Read(sequence, replayPacket, NULL)) return false;
+
+    // Raw MJPEG from the camera usually relies on the standard Huffman tables, which imdecode needs spelled out
+    JpegDcDecoder::AddDefaultHuffmanTables(replayPacket);
+    cv::imdecode(replayPacket, CV_LOAD_IMAGE_COLOR, &replayFrame);
+    if(replayFrame.empty()) return false;
+    cv::cvtColor(replayFrame, replayFrame, CV_BGR2RGB);
+    replaySequence = sequence;
+
+    cameraWidget->putFrameRGB(replayFrame);
+    return true;
+}
+
+/***
+ * Start Transition
+ * Author: Matthew Ribbins
+ * Description: Transition from fromCamera to the camera now on program. A camera that was only being analysed (or
+ *              is still coming up to full capture) has nothing current to show, so its newest frame now is stale:
+ *              the transition holds fromCamera until a newer one arrives.
+ */
+void MainWindow::StartTransition(int fromCamera)
+{
+    transitionWaitFrame = sources.GetCamera(currentCamera)->GetLatestFrame().GetNumber();
+    transition.Start(fromCamera, transitionType, transitionDuration);
+}
+
+/***
+ * Refresh Transition Image
+ * Author: Matthew Ribbins
+ * Description: While a transition is running both cameras are captured, and blended from their own frame buffers
+ *              into transitionFrame. The camera we are going to is ready once it has a frame newer than the ones
+ *              it had when we cut to it, see StartTransition().
+ *
+ * Return: (bool) false once the transition has finished, so the caller shows the new camera as normal
  */
-void MainWindow::RefreshCameraImage(void)
+bool MainWindow::RefreshTransitionImage(void)
 {
-    QPixmap frame = camera[currentCamera]->GetVideoFrame();
-    cameraWidget->putFrame(frame);
+    EVENT_SCOPE("transition", -1);
+    int fromCamera = transition.GetFromCamera();
+
+    Camera *from = sources.GetCamera(fromCamera);
+    Camera *to = sources.GetCamera(currentCamera);
+
+    from->AcquireFrame();
+    to->AcquireFrame();
+
+    bool toReady = to->GetFrameNumber() > transitionWaitFrame;
+    if(!transition.Render(from->GetLastFrame(), to->GetLastFrame(), toReady, transitionFrame))
+        return false;
+
+    cameraWidget->putFrameRGB(transitionFrame);
+    return true;
+}
+
+/***
+ * Refresh Composite Image
+ * Author: Matthew Ribbins
+ * Description: Take the newest frame from every camera on the compositor. Only cameras with a new frame are
+ *              scaled onto the canvas, and we only send the canvas to the screen if something changed.
+ *
+ * Return: (bool) true if the screen was updated
+ */
+bool MainWindow::RefreshCompositeImage(void)
+{
+    EVENT_SCOPE("composite", -1);
+    bool changed = false;
+
+    for(int i = 0; i < compositor.GetSourceCount(); i++) {
+        Camera *source = sources.GetCamera(compositor.GetSource(i));
+        source->AcquireFrame();
+        if(compositor.PutFrame(i, source->GetLastFrame(), source->GetFrameNumber()))
+            changed = true;
+    }
+
+    if(changed)
+        cameraWidget->putFrameRGB(compositor.GetCanvas());
+    return changed;
+}
+
+/***
+ * Update Composition
+ * Author: Matthew Ribbins
+ * Description: Put the active cameras on the compositor, highest score first so it is the main picture. With
+ *              fewer than two active cameras we go back to showing a single camera.
+ */
+void MainWindow::UpdateComposition(const float *scores, const bool *active)
+{
+    int sources[COMPOSITOR_MAX_SOURCES];
+    int count = 0;
+
+    if(!compositorEnabled) {
+        compositor.ClearSources();
+        return;
+    }
+
+    // Insertion sort the active cameras by score, keeping the top few
+    for(int i = 0; i < sources.GetCount(); i++) {
+        if(!active[i]) continue;
+
+        int j = (count < COMPOSITOR_MAX_SOURCES) ? count++ : COMPOSITOR_MAX_SOURCES;
+        while(j > 0 && scores[sources[j-1]] < scores[i]) {
+            if(j < COMPOSITOR_MAX_SOURCES) sources[j] = sources[j-1];
+            j--;
+        }
+        if(j < COMPOSITOR_MAX_SOURCES) sources[j] = i;
+    }
+
+    if(count >= 2)
+        compositor.SetSources(sources, count);
+    else
+        compositor.ClearSources();
 }
 
 /***
@@ -376,52 +872,297 @@ int MainWindow::countAvailableCameras(void) {
  */
 void MainWindow::ChangeCamera(void)
 {
-    // Turn off the current camera to save USB bandwidth
-    //camera[currentCamera].release();
+    if(!sources.GetCount()) return;
+
+    // If no camera number provided, switch to the next available camera, passing over any that have stalled
+    int previousCamera = currentCamera;
+    currentCamera = core.GetNextHealthy(currentCamera);
+    if(previousCamera != currentCamera)
+        StartTransition(previousCamera);
+    PublishTally();
+    UpdateProgramAudio();
+
+    // Refresh image on screen. A camera that was only being analysed has no recent frame, so wait for one.
+    bool wasAnalysisOnly = sources.GetCamera(currentCamera)->IsAnalysisOnly();
+    UpdateAnalysisCameras();
+    if(MainWindow::RefreshCameraImage(!wasAnalysisOnly))
+        CompleteControlCut();
+}
+
+void MainWindow::ChangeCamera(int cameraToChange)
+{
+    if(!sources.GetCamera(cameraToChange)) return;
+
+    LOG_INFO(LOG_SWITCHING, "Changing from %d to %d", currentCamera, cameraToChange);
+    // Cameras off air drop to the analysis capture format to save USB bandwidth, see UpdateCaptureTiers()
 
-    // If no camera number provided, switch to the next available camera
-    (currentCamera+1 >= availableCameras) ? currentCamera = 0 : currentCamera++;
+    // Only transition if we are actually going somewhere else
+    int previousCamera = currentCamera;
+    currentCamera = cameraToChange;
+    if(previousCamera != currentCamera)
+        StartTransition(previousCamera);
+    PublishTally();
+    UpdateProgramAudio();
+
+    // Refresh image on screen. A camera that was only being analysed has no recent frame, so wait for one.
+    bool wasAnalysisOnly = sources.GetCamera(currentCamera)->IsAnalysisOnly();
+    UpdateAnalysisCameras();
+    if(MainWindow::RefreshCameraImage(!wasAnalysisOnly))
+        CompleteControlCut();
+}
 
-    // Open the new camera
-    //camera[currentCamera].open(currentCamera);
-    //camera[currentCamera].set(CV_CAP_PROP_FRAME_WIDTH, 1280);
-    //camera[currentCamera].set(CV_CAP_PROP_FRAME_HEIGHT, 720);
-    //camera[currentCamera].set(CV_CAP_PROP_FPS, 30);
 
-    // Refresh image on screen
-    MainWindow::RefreshCameraImage();
+/***
+ * Frame Arrived
+ * Author: Matthew Ribbins
+ * Description: A capture thread has a new frame. If we are pacing on frame arrival and the camera is on screen,
+ *              show it straight away.
+ */
+void MainWindow::FrameArrived(int cameraId)
+{
+    RunControlCommands();
+
+    if(DISPLAY_PACING_ARRIVAL != displayPacing) return;
+    if(!IsCameraOnProgram(cameraId)) return;
+
+    if(RefreshCameraImage()) {
+        presentedFrames++;
+        CompleteControlCut();
+    }
 }
 
-void MainWindow::ChangeCamera(int cameraToChange)
+/***
+ * Display Refresh
+ * Author: Matthew Ribbins
+ * Description: Display refresh tick when pacing to the display. If the program camera has not given us anything
+ *              new since the last refresh, the frame on screen is a duplicate.
+ */
+void MainWindow::DisplayRefresh(void)
 {
-    qDebug() << "Chaning from " << currentCamera << " to " << cameraToChange;
-    // Turn off the current camera to save USB bandwidth
-    //camera[currentCamera].release();
+    RunControlCommands();
 
-    // If no camera number provided, switch to the next available camera
-    currentCamera = cameraToChange;
+    if(RefreshCameraImage()) {
+        presentedFrames++;
+        CompleteControlCut();
+    } else {
+        duplicatedFrames++;
+    }
+}
+
+/***
+ * Run Control Commands
+ * Author: Matthew Ribbins
+ * Description: Carry out everything that has come in on the control socket. Called before every frame is
+ *              presented and every decision tick, so a command waits at most one frame. A cut is answered once
+ *              its first frame is on screen, everything else straight away.
+ */
+void MainWindow::RunControlCommands(void)
+{
+    static const char *commandNames[] = { "MODE", "CUT", "NEXT", "GAIN", "AUDIOTHRESHOLD", "MOVEMENTTHRESHOLD",
+                                          "STATS", "PING", "TRACE" };
+    ControlCommand command;
+
+    if(!control) return;
+
+    while(control->TakeCommand(command)) {
+        switch(command.type) {
+            case CONTROL_MODE:
+                if(command.value < MODE_DISABLED || command.value > MODE_MANUAL) {
+                    control->Reply(command.client, "ERR no such mode\n");
+                    continue;
+                }
+                mode = (int)command.value;
+                break;
+            case CONTROL_CUT:
+            case CONTROL_NEXT:
+                if(CONTROL_CUT == command.type && !sources.GetCamera(command.source - 1)) {
+                    control->Reply(command.client, "ERR no such source\n");
+                    continue;
+                }
+                if(!sources.GetCount()) {
+                    control->Reply(command.client, "ERR no sources\n");
+                    continue;
+                }
+                if(controlCutPending)
+                    control->Reply(controlCutClient, "ERR cut replaced by a later one\n");
+                controlCutPending = true;
+                controlCutClient = command.client;
+                controlCutReceived = command.received;
+
+                mode = MODE_MANUAL;
+                compositor.ClearSources();
+                if(CONTROL_CUT == command.type) ChangeCamera(command.source - 1);
+                else ChangeCamera();
+                continue;
+            case CONTROL_GAIN:
+                if(!sources.GetCamera(command.source - 1)) {
+                    control->Reply(command.client, "ERR no such source\n");
+                    continue;
+                }
+                sources.GetCamera(command.source - 1)->SetAudioGain(command.value);
+                break;
+            case CONTROL_AUDIO_THRESHOLD:
+                policy.SetAudioThreshold(command.value);
+                break;
+            case CONTROL_MOVEMENT_THRESHOLD:
+                policy.SetMovementThreshold((int)command.value);
+                break;
+            case CONTROL_STATS:
+                snprintf(controlText, sizeof(controlText), "STATS %u %lld %lld %u %lld\n", controlCuts,
+                         controlCuts ? controlCutTotal / controlCuts / 1000 : 0LL, controlCutMax / 1000,
+                         controlCutsLate, controlFrameBudget / 1000);
+                control->Reply(command.client, controlText);
+                continue;
+            case CONTROL_PING:
+                break;
+            case CONTROL_TRACE:
+                if(!SaveEvents()) {
+                    control->Reply(command.client, EventTrace::IsEnabled() ? "ERR still saving\n" : "ERR tracing off\n");
+                    continue;
+                }
+                break;
+        }
+
+        snprintf(controlText, sizeof(controlText), "OK %s %lld\n", commandNames[command.type],
+                 (ControlServer::Now() - command.received) / 1000);
+        control->Reply(command.client, controlText);
+    }
+}
+
+/***
+ * Complete Control Cut
+ * Author: Matthew Ribbins
+ * Description: A frame has just been presented. If it is the first since a cut from the control socket, answer
+ *              with how long the cut took and keep count of cuts that took longer than a frame.
+ */
+void MainWindow::CompleteControlCut(void)
+{
+    if(!controlCutPending) return;
+    controlCutPending = false;
+
+    qint64 latency = ControlServer::Now() - controlCutReceived;
+    controlCuts++;
+    controlCutTotal += latency;
+    if(latency > controlCutMax) controlCutMax = latency;
+    if(latency > controlFrameBudget) {
+        controlCutsLate++;
+        LOG_WARNING(LOG_SWITCHING, "Control cut took %lld us, more than a frame", latency / 1000);
+    }
 
-    // Open the new camera
-    //camera[currentCamera].open(currentCamera);
-    //camera[currentCamera].set(CV_CAP_PROP_FRAME_WIDTH, 1280);
-    //camera[currentCamera].set(CV_CAP_PROP_FRAME_HEIGHT, 720);
-    //camera[currentCamera].set(CV_CAP_PROP_FPS, 30);
+    snprintf(controlText, sizeof(controlText), "OK CUT %lld\n", latency / 1000);
+    control->Reply(controlCutClient, controlText);
+}
 
-    // Refresh image on screen
-    MainWindow::RefreshCameraImage();
+/***
+ * Publish Tally
+ * Author: Matthew Ribbins
+ * Description: Tell control clients as soon as program changes, so tally lights don't wait for the next tick
+ */
+void MainWindow::PublishTally(void)
+{
+    if(!control || tallyProgram == currentCamera) return;
+    tallyProgram = currentCamera;
+
+    snprintf(controlText, sizeof(controlText), "TALLY %d\n", currentCamera + 1);
+    control->Publish(controlText);
 }
 
+/***
+ * Publish Telemetry
+ * Author: Matthew Ribbins
+ * Description: Latest audio level, movement and tally of every source, for subscribed control clients
+ */
+void MainWindow::PublishTelemetry(void)
+{
+    SourceState &state = sources.GetState();
+    int count = sources.GetCount();
+    int length;
+
+    if(!control || !control->HasSubscribers()) return;
+
+    length = snprintf(controlText, sizeof(controlText), "STATE %u %d %d %d", traceTick, mode, currentCamera + 1, count);
+    for(int i = 0; i < count && length < (int)sizeof(controlText) - 1; i++) {
+        int tally = (i == currentCamera) ? 2 : (IsCameraOnProgram(i) ? 1 : 0);
+        length += snprintf(controlText + length, sizeof(controlText) - length, " %.1f %d %d", state.levels[i],
+                           state.movement[i], tally);
+    }
+    if(length > (int)sizeof(controlText) - 2) length = sizeof(controlText) - 2;
+    controlText[length++] = '\n';
+    controlText[length] = '\0';
+    control->Publish(controlText);
+}
 
 /***
  * Timer Event Handler
  * Author: Matthew Ribbins
- * Description: Every time the timer handler is called, we need to refresh the current image on screen
+ * Description: Every time the timer handler is called, run camera selection for the current mode. Frames are shown
+ *              by FrameArrived()/DisplayRefresh(), not here.
  */
 void MainWindow::timerEvent(QTimerEvent*)
 {
-    RefreshCameraImage();
+    EVENT_SCOPE("timer", -1);
+
+    RunControlCommands();
+
     timerCount++;
+    traceTick++;
+    // Every studio ticks on the GUI thread, the first one looks after the threads
+    if(0 == studioIndex) ThreadPolicy::Tick();
+    audio->SetSourceCount(studioIndex, sources.GetCount());
+    UpdateStalledSources();
+    UpdateAnalysisCameras();
+    UpdateCaptureTiers();
+    UpdateProgramAudio();
+    recorder.CheckSources(&sources);
+
+    if(++statsCount >= DISPLAY_STATS_INTERVAL) {
+        LOG_INFO(LOG_DISPLAY, "%sPresented %u dropped %u duplicated %u", studioName.constData(), presentedFrames,
+                 droppedFrames, duplicatedFrames);
+
+        if(mixer.IsOpen()) {
+            unsigned int underruns, skipped, dropped;
+            mixer.GetStats(underruns, skipped, dropped);
+            LOG_INFO(LOG_AUDIO, "%sProgram audio samples padded %u skipped %u dropped %u", studioName.constData(),
+                     underruns, skipped, dropped);
+        }
+
+        if(recorder.IsRecording()) {
+            unsigned int underruns, overruns, failed;
+            recorder.GetStats(underruns, overruns, failed);
+            LOG_INFO(LOG_AUDIO, "%sRecording %d mics, samples padded %u dropped %u failed %u", studioName.constData(),
+                     recorder.GetTrackCount(), underruns, overruns, failed);
+        }
+
+        unsigned int metricsDropped = metricsWriter.TakeDropped();
+        if(metricsDropped)
+            LOG_WARNING(LOG_GENERAL, "%sWarning: %u metrics rows dropped, the next log file couldn't be made",
+                        studioName.constData(), metricsDropped);
+        statsCount = 0;
+    }
+    // The frame pool and allocations are the process's, so only reported once
+    if(0 == studioIndex && 0 == statsCount) {
+        FramePoolStats poolStats;
+        FramePool::GetStats(poolStats);
+        LOG_INFO(LOG_DISPLAY, "Frame pool %d buffers %.1f MB, %d in use peak %d, %llu acquired %llu starved",
+                 poolStats.buffers, poolStats.bytes / (1024.0 * 1024.0), poolStats.inUse, poolStats.peakInUse,
+                 poolStats.acquisitions, poolStats.starved);
+        if(AllocationCounter::IsEnabled()) {
+            // GUI thread only, the capture threads are counted in the total
+            unsigned long long allocations = AllocationCounter::GetThreadAllocations() - statsAllocations;
+            unsigned long long largeAllocations = AllocationCounter::GetThreadLargeAllocations() - statsLargeAllocations;
+            unsigned int frames = presentedFrames - statsPresentedFrames;
+
+            LOG_INFO(LOG_DISPLAY, "Allocations %llu per frame %.2f frame sized %llu total %llu bytes %llu", allocations,
+                     frames ? (double)allocations / frames : 0.0, largeAllocations,
+                     AllocationCounter::GetAllocations(), AllocationCounter::GetBytes());
+            statsAllocations = AllocationCounter::GetThreadAllocations();
+            statsLargeAllocations = AllocationCounter::GetThreadLargeAllocations();
+            statsPresentedFrames = presentedFrames;
+        }
+    }
+    if(0 == studioIndex) ThreadPolicy::Report();
 
+    metricsDecision = -1;
     switch(mode) {
         case MODE_DISABLED:
             break;
@@ -443,6 +1184,8 @@ void MainWindow::timerEvent(QTimerEvent*)
             break;
     }
 
+    RecordMetrics();
+    PublishTelemetry();
 }
 
 /***
@@ -455,6 +1198,11 @@ void MainWindow::keyPressEvent(QKeyEvent *event)
     int key = event->key();
     switch(key) {
         case Qt::Key_0:
+            // Part of a source number, e.g. 10
+            if(sourceEntry) {
+                EnterSourceDigit(0);
+                break;
+            }
             mode = MODE_AUTO_AUDIO; break;
         case Qt::Key_M:
             mode = MODE_AUTO_MOVEMENT; break;
@@ -462,6 +1210,32 @@ void MainWindow::keyPressEvent(QKeyEvent *event)
             mode = MODE_AUTO_AUDIO; break;
         case Qt::Key_B:
             mode = MODE_AUTO_MULTI; break;
+        case Qt::Key_T:
+            // Cycle through transition types
+            transitionType = (transitionType + 1) % TRANSITION_COUNT;
+            LOG_INFO(LOG_DISPLAY, "Transition type %d", transitionType);
+            break;
+        case Qt::Key_C:
+            compositorEnabled = !compositorEnabled;
+            if(!compositorEnabled) compositor.ClearSources();
+            break;
+        case Qt::Key_R:
+            replayActive ? StopReplay() : StartReplay(currentCamera);
+            break;
+        case Qt::Key_Escape:
+            StopReplay();
+            break;
+        case Qt::Key_E:
+            // Save the last minute of pipeline events
+            SaveEvents();
+            break;
+        case Qt::Key_L:
+            // Debug logging on/off for everything
+            Logger::SetLevel((LOG_LEVEL_DEBUG == Logger::GetLevel(LOG_GENERAL)) ? LOG_LEVEL_DEFAULT : LOG_LEVEL_DEBUG);
+            break;
+        case Qt::Key_P:
+            compositor.SetLayout((COMPOSITOR_LAYOUT_PIP == compositor.GetLayout()) ? COMPOSITOR_LAYOUT_SPLIT : COMPOSITOR_LAYOUT_PIP);
+            break;
         case Qt::Key_1:
         case Qt::Key_2:
         case Qt::Key_3:
@@ -471,8 +1245,11 @@ void MainWindow::keyPressEvent(QKeyEvent *event)
         case Qt::Key_7:
         case Qt::Key_8:
         case Qt::Key_9:
-            mode = MODE_MANUAL;
-            SelectCameraBasedOnInput(key - 0x30);
+            EnterSourceDigit(key - 0x30);
+            break;
+        case Qt::Key_Return:
+        case Qt::Key_Enter:
+            CommitSourceEntry();
             break;
     }
 }
@@ -11,6 +11,8 @@
 #include <QSettings>
 #include <QThread>
 #include <QKeyEvent>
+#include <QTimer>
+#include <QScreen>
 
 #include <opencv2/opencv.hpp>
 #include <portaudiocpp/PortAudioCpp.hxx>
@@ -21,43 +23,139 @@ extern "C" {
 
 #include "camerawidget.h"
 #include "camera.h"
+#include "capturethread.h"
+#include "audioworker.h"
+#include "audiomixer.h"
+#include "threadpolicy.h"
+#include "eventtrace.h"
+#include "sourceregistry.h"
+#include "nodeclient.h"
+#include "syntheticcamera.h"
+#include "controlserver.h"
+#include "persondetector.h"
+#include "bleeddetector.h"
+#include "audiorecorder.h"
+#include "transition.h"
+#include "compositor.h"
+#include "switchingpolicy.h"
+#include "switchingcore.h"
+#include "tracefile.h"
+#include "metricslog.h"
+#include "allocationcounter.h"
 #include "radioviz.h"
 
 class MainWindow : public QWidget
 {
     Q_OBJECT
 public:
-    MainWindow(QWidget *parent=0);
+    MainWindow(const QString &studio, const QStringList &nodes, const QList<int> &devices, AudioWorker *audio,
+               PersonDetector *detector, QWidget *parent=0);
     ~MainWindow();
 
 private:
     CameraWidget *cameraWidget;
-    Camera *camera[MAX_CAMERAS_AVAILABLE];
+    SourceRegistry sources;
+    QByteArray studioName;
+    int studioIndex;
     int currentCamera;
-    int availableCameras;
+    int sourceEntry;
+    QTimer *sourceEntryTimer;
     int timerCount;
-    QThread audioThread;
+    unsigned int traceTick;
+    AudioWorker *audio;
+    AudioMixer mixer;
+    int audioMix;
     QLabel *debugLabel;
     int mode;
+    Transition transition;
+    int transitionType;
+    int transitionDuration;
+    cv::Mat transitionFrame;
+    unsigned int transitionWaitFrame;
+    Compositor compositor;
+    bool compositorEnabled;
+    SwitchingPolicy policy;
+    SwitchingCore core;
+    BleedDetector *bleedDetector;
+    AudioRecorder recorder;
+    TraceWriter traceWriter;
+    MetricsWriter metricsWriter;
+    int metricsDecision;
+    int displayPacing;
+    QTimer *refreshTimer;
+    int presentedCamera;
+    unsigned int presentedFrameNumber;
+    unsigned int presentedFrames;
+    unsigned int droppedFrames;
+    unsigned int duplicatedFrames;
+    unsigned long long statsAllocations;
+    unsigned long long statsLargeAllocations;
+    unsigned int statsPresentedFrames;
+    int statsCount;
+    char levelText[512];
+    bool replayActive;
+    int replayCamera;
+    int replayCue;
+    qint64 replayStart;
+    qint64 replayPosition;
+    qint64 replaySequence;
+    std::vector<uchar> replayPacket;
+    cv::Mat replayFrame;
+    QThread controlThread;
+    ControlServer *control;
+    qint64 controlFrameBudget;
+    bool controlCutPending;
+    int controlCutClient;
+    qint64 controlCutReceived;
+    unsigned int controlCuts;
+    unsigned int controlCutsLate;
+    qint64 controlCutTotal;
+    qint64 controlCutMax;
+    int tallyProgram;
+    char controlText[CONTROL_LINE_SIZE];
 
 protected:
     void timerEvent(QTimerEvent *);
     void keyPressEvent(QKeyEvent *);
     int CountAvailableCameras(void);
     int GetAvailableCamerasList(AVDeviceInfoList **deviceList);
-    void RefreshCameraImage(void);
+    bool RefreshCameraImage(bool force = false);
+    bool IsCameraOnProgram(int cameraId);
+    void UpdateAnalysisCameras(void);
+    void UpdateCaptureTiers(void);
+    void UpdateStalledSources(void);
+    void UpdateProgramAudio(void);
+    void StartReplay(int cameraId);
+    void StopReplay(void);
+    bool RefreshReplayImage(void);
+    void StartTransition(int fromCamera);
+    bool RefreshTransitionImage(void);
+    bool RefreshCompositeImage(void);
+    void UpdateComposition(const float *scores, const bool *active);
     void PrintSupportedStandardSampleRates(const PaStreamParameters *inputParameters, const PaStreamParameters *outputParameters);
     double GetHighestAudioSampleRate(const PaStreamParameters *inputParameters, const PaStreamParameters *outputParameters);
     int GetAudioLevelFromDevice(int devNum);
     void SelectCameraBasedOnAudio();
     void SelectCameraBasedOnVideo();
     void SelectCameraBasedOnAudioVideo();
+    void RecordTrace(int kind, const float *values, int decision);
+    void RecordMetrics(void);
+    bool SaveEvents(void);
+    void ShowAudioLevels(const float *levels);
+    void RunControlCommands(void);
+    void CompleteControlCut(void);
+    void PublishTally(void);
+    void PublishTelemetry(void);
 
     void SelectCameraBasedOnInput(int input);
+    void EnterSourceDigit(int digit);
 
 public slots:
     void ChangeCamera(void);
     void ChangeCamera(int cameraToChange);
+    void FrameArrived(int cameraId);
+    void DisplayRefresh(void);
+    void CommitSourceEntry(void);
 
 
 };
@@ -0,0 +1,530 @@
+/***
+ * RadioViz - metricslog.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Metrics log for tuning. Every decision tick we keep each camera's audio level and movement, which
+ *              cameras were active or stalled, the camera on program and anything decided, all day.
+ *
+ *              The file is memory mapped and laid out in blocks of METRICS_BLOCK_ROWS rows, each block holding
+ *              one fixed width column after another (the per-camera columns one per camera), so a row is a few
+ *              stores into memory with no syscalls, and the kernel writes the pages out in the background. Files
+ *              are allocated and mapped at their full size up front; once one is full we move on to the next,
+ *              which a helper thread has already made, and the helper finishes the full one off (trimmed to what
+ *              was used). Files are named for when they start, e.g. metrics.rvm becomes
+ *              metrics-20150401-153000.rvm.
+ *
+ *              tools/metricsexport turns them into CSV, or into a file per column.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metricslog.h"
+
+// Where the next file is up to
+#define METRICS_SPARE_NONE 0
+#define METRICS_SPARE_READY 1
+#define METRICS_SPARE_FAILED 2
+
+// Level or movement of a camera that wasn't there
+#define METRICS_NONE INT16_MIN
+
+/***
+ * Get Metrics Layout
+ * Author: Matthew Ribbins
+ * Description: Where each column starts in a block of METRICS_BLOCK_ROWS rows for this many cameras. Blocks are a
+ *              whole number of pages.
+ */
+void GetMetricsLayout(int cameras, MetricsLayout &layout)
+{
+    size_t rows = METRICS_BLOCK_ROWS;
+    size_t offset = sizeof(MetricsBlockHeader);
+
+    layout.time = offset;
+    offset += rows * sizeof(uint32_t);
+    layout.tick = offset;
+    offset += rows * sizeof(uint32_t);
+    layout.active = offset;
+    offset += rows * sizeof(uint32_t);
+    layout.stalled = offset;
+    offset += rows * sizeof(uint32_t);
+    layout.mode = offset;
+    offset += rows;
+    layout.program = offset;
+    offset += rows;
+    layout.decision = offset;
+    offset += rows;
+    offset += rows; // Keeps the int16 columns aligned
+    layout.levels = offset;
+    offset += rows * sizeof(int16_t) * cameras;
+    layout.movement = offset;
+    offset += rows * sizeof(int16_t) * cameras;
+    layout.blockSize = (offset + METRICS_PAGE_SIZE - 1) & ~(size_t)(METRICS_PAGE_SIZE - 1);
+}
+
+MetricsWriter::MetricsWriter()
+{
+    basePath[0] = '\0';
+    cameras = 0;
+    tickInterval = 0;
+    fileSize = 0;
+    blockCount = 0;
+    current.data = NULL;
+    current.fd = -1;
+    spare.data = NULL;
+    spare.fd = -1;
+    retired.data = NULL;
+    retired.fd = -1;
+    retiredBlocks = 0;
+    renameCurrent = false;
+    block = 0;
+    startMonotonic = 0;
+    sinceRetry = 0;
+    spareState.store(METRICS_SPARE_NONE);
+    dropped.store(0);
+}
+
+MetricsWriter::~MetricsWriter()
+{
+    Close();
+}
+
+int64_t MetricsWriter::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int64_t MetricsWriter::RealNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/***
+ * Open Metrics Log
+ * Author: Matthew Ribbins
+ * Description: Start logging to files named after path, with columns for this many cameras, each file fileSize MB
+ *
+ * Return: (bool) false if the first file couldn't be made
+ */
+bool MetricsWriter::Open(const char *path, int cameras, int tickInterval, int fileSize)
+{
+    char stamped[METRICS_PATH_SIZE];
+
+    Close();
+    if(cameras < 1) cameras = 1;
+    if(cameras > METRICS_MAX_CAMERAS) cameras = METRICS_MAX_CAMERAS;
+    if(fileSize < 1) fileSize = METRICS_DEFAULT_FILE_SIZE;
+
+    strncpy(basePath, path, sizeof(basePath) - 1);
+    basePath[sizeof(basePath) - 1] = '\0';
+    this->cameras = cameras;
+    this->tickInterval = tickInterval;
+    GetMetricsLayout(cameras, layout);
+    blockCount = (uint32_t)(((size_t)fileSize * 1024 * 1024 - METRICS_HEADER_SIZE) / layout.blockSize);
+    if(blockCount < 1) blockCount = 1;
+    this->fileSize = METRICS_HEADER_SIZE + blockCount * layout.blockSize;
+
+    int64_t start = RealNow();
+    MakeUniquePath(stamped, sizeof(stamped), start);
+    if(!Map(current, stamped)) return false;
+
+    ((MetricsHeader *)current.data)->startTime = start;
+    startMonotonic = Now();
+    block = 0;
+    sinceRetry = 0;
+    dropped.store(0);
+
+    // Have the next file ready well before we need it
+    spareState.store(METRICS_SPARE_NONE);
+    helper = std::thread(&MetricsWriter::Prepare, this);
+    return true;
+}
+
+/***
+ * Close Metrics Log
+ * Author: Matthew Ribbins
+ * Description: Finish the file we are writing, and throw away the next one if it was made
+ */
+void MetricsWriter::Close(void)
+{
+    if(!current.data) return;
+    if(helper.joinable()) helper.join();
+
+    if(METRICS_SPARE_READY == spareState.load()) {
+        char path[METRICS_PATH_SIZE];
+        strcpy(path, spare.path);
+        Finish(spare, 0);
+        unlink(path);
+    }
+    spareState.store(METRICS_SPARE_NONE);
+
+    MetricsBlockHeader *blockHeader = (MetricsBlockHeader *)(current.data + METRICS_HEADER_SIZE + block * layout.blockSize);
+    Finish(current, blockHeader->rows ? block + 1 : block);
+}
+
+bool MetricsWriter::IsOpen(void)
+{
+    return current.data != NULL;
+}
+
+int MetricsWriter::GetCameras(void)
+{
+    return cameras;
+}
+
+/***
+ * Take Dropped
+ * Author: Matthew Ribbins
+ * Description: Rows lost since the last call because the next file wasn't ready, e.g. the disk is full
+ *
+ * Return: (unsigned int) rows dropped
+ */
+unsigned int MetricsWriter::TakeDropped(void)
+{
+    return dropped.exchange(0, std::memory_order_relaxed);
+}
+
+/***
+ * Write Row
+ * Author: Matthew Ribbins
+ * Description: Add a row, stamped with the time. Only memory is touched unless a file has just filled up. Cameras
+ *              past the log's count are left out.
+ */
+void MetricsWriter::Write(MetricsRow &row)
+{
+    if(!current.data) return;
+
+    uint8_t *base = current.data + METRICS_HEADER_SIZE + block * layout.blockSize;
+    MetricsBlockHeader *blockHeader = (MetricsBlockHeader *)base;
+    uint32_t n = blockHeader->rows;
+
+    if(n >= METRICS_BLOCK_ROWS) {
+        if(block + 1 < blockCount) {
+            block++;
+        } else if(!Rotate()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        base = current.data + METRICS_HEADER_SIZE + block * layout.blockSize;
+        blockHeader = (MetricsBlockHeader *)base;
+        n = 0;
+    }
+
+    row.time = (uint32_t)(Now() - startMonotonic);
+    ((uint32_t *)(base + layout.time))[n] = row.time;
+    ((uint32_t *)(base + layout.tick))[n] = row.tick;
+    ((uint32_t *)(base + layout.active))[n] = row.active;
+    ((uint32_t *)(base + layout.stalled))[n] = row.stalled;
+    ((uint8_t *)(base + layout.mode))[n] = row.mode;
+    ((int8_t *)(base + layout.program))[n] = row.program;
+    ((int8_t *)(base + layout.decision))[n] = row.decision;
+
+    int16_t *levels = (int16_t *)(base + layout.levels);
+    int16_t *movement = (int16_t *)(base + layout.movement);
+    for(int i = 0; i < cameras; i++) {
+        int16_t level = METRICS_NONE;
+        int16_t moved = METRICS_NONE;
+        if(i < row.count) {
+            float scaled = row.levels[i] * METRICS_LEVEL_SCALE;
+            if(scaled == scaled)
+                level = (scaled > INT16_MAX) ? INT16_MAX : (scaled < -INT16_MAX) ? -INT16_MAX : (int16_t)lrintf(scaled);
+            moved = (row.movement[i] > INT16_MAX) ? INT16_MAX : (row.movement[i] < -INT16_MAX) ? -INT16_MAX : row.movement[i];
+        }
+        levels[i * METRICS_BLOCK_ROWS + n] = level;
+        movement[i * METRICS_BLOCK_ROWS + n] = moved;
+    }
+
+    // A reader of a live or crashed file only sees rows that are complete
+    std::atomic_thread_fence(std::memory_order_release);
+    blockHeader->rows = n + 1;
+}
+
+/***
+ * Rotate
+ * Author: Matthew Ribbins
+ * Description: Move on to the next file if the helper has made it, and have the helper finish this one and make
+ *              another. If it couldn't be made we try again every block's worth of rows.
+ *
+ * Return: (bool) true if we moved on
+ */
+bool MetricsWriter::Rotate(void)
+{
+    int state = spareState.load(std::memory_order_acquire);
+
+    if(METRICS_SPARE_READY != state) {
+        if(METRICS_SPARE_FAILED == state && ++sinceRetry >= METRICS_BLOCK_ROWS) {
+            sinceRetry = 0;
+            helper.join();
+            spareState.store(METRICS_SPARE_NONE);
+            helper = std::thread(&MetricsWriter::Prepare, this);
+        }
+        return false;
+    }
+
+    // The helper is done with, so this doesn't wait
+    helper.join();
+    retired = current;
+    retiredBlocks = block + 1;
+    current = spare;
+    spare.data = NULL;
+    spare.fd = -1;
+    block = 0;
+    startMonotonic = Now();
+    ((MetricsHeader *)current.data)->startTime = RealNow();
+    renameCurrent = true;
+
+    spareState.store(METRICS_SPARE_NONE);
+    helper = std::thread(&MetricsWriter::Prepare, this);
+    return true;
+}
+
+/***
+ * Prepare Next File
+ * Author: Matthew Ribbins
+ * Description: Runs on the helper thread. Names the file we have just moved to for when it started, finishes the
+ *              one before it and makes the next one under a temporary name.
+ */
+void MetricsWriter::Prepare(void)
+{
+    char path[METRICS_PATH_SIZE];
+
+    if(renameCurrent) {
+        MakeUniquePath(path, sizeof(path), ((MetricsHeader *)current.data)->startTime);
+        if(!rename(current.path, path)) strcpy(current.path, path);
+        renameCurrent = false;
+    }
+    if(retired.data) Finish(retired, retiredBlocks);
+
+    MakePath(path, sizeof(path), 0, "next");
+    spareState.store(Map(spare, path) ? METRICS_SPARE_READY : METRICS_SPARE_FAILED, std::memory_order_release);
+}
+
+/***
+ * Map File
+ * Author: Matthew Ribbins
+ * Description: Make a file at its full size, map it with every page already faulted in and write its header
+ *
+ * Return: (bool) false if it couldn't be made, e.g. the disk is full
+ */
+bool MetricsWriter::Map(MetricsFile &file, const char *path)
+{
+    file.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(file.fd < 0) return false;
+
+    if(posix_fallocate(file.fd, 0, fileSize)) {
+        close(file.fd);
+        unlink(path);
+        file.fd = -1;
+        return false;
+    }
+
+    void *data = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, file.fd, 0);
+    if(MAP_FAILED == data) {
+        close(file.fd);
+        unlink(path);
+        file.fd = -1;
+        return false;
+    }
+
+    file.data = (uint8_t *)data;
+    file.size = fileSize;
+    strncpy(file.path, path, sizeof(file.path) - 1);
+    file.path[sizeof(file.path) - 1] = '\0';
+
+    MetricsHeader *header = (MetricsHeader *)file.data;
+    header->magic = METRICS_MAGIC;
+    header->version = METRICS_VERSION;
+    header->tickInterval = tickInterval;
+    header->cameras = cameras;
+    header->blockRows = METRICS_BLOCK_ROWS;
+    header->blockSize = layout.blockSize;
+    header->blockCount = blockCount;
+    header->reserved = 0;
+    header->startTime = 0;
+    return true;
+}
+
+/***
+ * Finish File
+ * Author: Matthew Ribbins
+ * Description: Unmap a file and trim it to the blocks that were used
+ */
+void MetricsWriter::Finish(MetricsFile &file, uint32_t blocks)
+{
+    if(!file.data) return;
+
+    ((MetricsHeader *)file.data)->blockCount = blocks;
+    munmap(file.data, file.size);
+    if(ftruncate(file.fd, METRICS_HEADER_SIZE + blocks * layout.blockSize)) {
+        // Still readable at its full size, the reader stops at the first empty block
+    }
+    close(file.fd);
+    file.data = NULL;
+    file.fd = -1;
+}
+
+/***
+ * Make Path
+ * Author: Matthew Ribbins
+ * Description: metrics.rvm becomes metrics-20150401-153000.rvm for a file starting at time (ms since the epoch),
+ *              with -suffix added if there is one, or just metrics-suffix.rvm if time is 0
+ */
+void MetricsWriter::MakePath(char *path, int size, int64_t time, const char *suffix)
+{
+    char stamp[64];
+    int length = 0;
+
+    stamp[0] = '\0';
+    if(time) {
+        time_t seconds = (time_t)(time / 1000);
+        struct tm local;
+        localtime_r(&seconds, &local);
+        length = strftime(stamp, sizeof(stamp), "-%Y%m%d-%H%M%S", &local);
+    }
+    if(suffix) snprintf(stamp + length, sizeof(stamp) - length, "-%s", suffix);
+
+    const char *extension = strrchr(basePath, '.');
+    int baseLength = (extension && !strchr(extension, '/')) ? (int)(extension - basePath) : (int)strlen(basePath);
+    snprintf(path, size, "%.*s%s%s", baseLength, basePath, stamp, basePath + baseLength);
+}
+
+/***
+ * Make Unique Path
+ * Author: Matthew Ribbins
+ * Description: As MakePath, numbered if a file starting in the same second is already there
+ */
+void MetricsWriter::MakeUniquePath(char *path, int size, int64_t time)
+{
+    char number[16];
+
+    MakePath(path, size, time, NULL);
+    for(int n = 2; !access(path, F_OK) && n < 100; n++) {
+        snprintf(number, sizeof(number), "%d", n);
+        MakePath(path, size, time, number);
+    }
+}
+
+MetricsReader::MetricsReader()
+{
+    data = NULL;
+    size = 0;
+    blocks = 0;
+    block = 0;
+    row = 0;
+}
+
+MetricsReader::~MetricsReader()
+{
+    Close();
+}
+
+/***
+ * Open Metrics Log for Reading
+ * Author: Matthew Ribbins
+ * Description: Works on finished files, and on ones still being written or left behind by a crash
+ *
+ * Return: (bool) false if it isn't a metrics log we can read
+ */
+bool MetricsReader::Open(const char *path)
+{
+    struct stat info;
+
+    Close();
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+    if(fstat(fd, &info) || info.st_size < METRICS_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == mapped) return false;
+    data = (uint8_t *)mapped;
+    size = info.st_size;
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    memcpy(&header, data, sizeof(header));
+    if(METRICS_MAGIC != header.magic || METRICS_VERSION != header.version || METRICS_BLOCK_ROWS != header.blockRows ||
+       header.cameras < 1 || header.cameras > METRICS_MAX_CAMERAS) {
+        Close();
+        return false;
+    }
+    GetMetricsLayout(header.cameras, layout);
+    if(layout.blockSize != header.blockSize) {
+        Close();
+        return false;
+    }
+
+    blocks = (uint32_t)((size - METRICS_HEADER_SIZE) / layout.blockSize);
+    if(header.blockCount < blocks) blocks = header.blockCount;
+    block = 0;
+    row = 0;
+    return true;
+}
+
+void MetricsReader::Close(void)
+{
+    if(data) munmap(data, size);
+    data = NULL;
+    size = 0;
+    blocks = 0;
+}
+
+const MetricsHeader &MetricsReader::GetHeader(void)
+{
+    return header;
+}
+
+/***
+ * Next Row
+ * Author: Matthew Ribbins
+ * Description: Levels of cameras that weren't there come back as NAN, and their movement as -1
+ *
+ * Return: (bool) false at the end of the log
+ */
+bool MetricsReader::Next(MetricsRow &out)
+{
+    while(data && block < blocks) {
+        const uint8_t *base = data + METRICS_HEADER_SIZE + block * layout.blockSize;
+        uint32_t rows = ((const MetricsBlockHeader *)base)->rows;
+        if(rows > METRICS_BLOCK_ROWS) rows = METRICS_BLOCK_ROWS;
+
+        if(row < rows) {
+            out.time = ((const uint32_t *)(base + layout.time))[row];
+            out.tick = ((const uint32_t *)(base + layout.tick))[row];
+            out.active = ((const uint32_t *)(base + layout.active))[row];
+            out.stalled = ((const uint32_t *)(base + layout.stalled))[row];
+            out.mode = ((const uint8_t *)(base + layout.mode))[row];
+            out.program = ((const int8_t *)(base + layout.program))[row];
+            out.decision = ((const int8_t *)(base + layout.decision))[row];
+            out.count = header.cameras;
+
+            const int16_t *levels = (const int16_t *)(base + layout.levels);
+            const int16_t *movement = (const int16_t *)(base + layout.movement);
+            for(int i = 0; i < header.cameras; i++) {
+                int16_t level = levels[i * METRICS_BLOCK_ROWS + row];
+                int16_t moved = movement[i * METRICS_BLOCK_ROWS + row];
+                out.levels[i] = (METRICS_NONE == level) ? NAN : (float)level / METRICS_LEVEL_SCALE;
+                out.movement[i] = (METRICS_NONE == moved) ? -1 : moved;
+            }
+            row++;
+            return true;
+        }
+
+        // The writer stopped part way through this block
+        if(rows < METRICS_BLOCK_ROWS) return false;
+        block++;
+        row = 0;
+    }
+    return false;
+}
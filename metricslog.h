@@ -0,0 +1,144 @@
+#ifndef METRICSLOG_H
+#define METRICSLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+
+// Metrics log, every camera's level and movement and what was decided, on every decision tick
+#define METRICS_MAGIC 0x4d545652 // "RVTM"
+#define METRICS_VERSION 1
+#define METRICS_MAX_CAMERAS 32
+#define METRICS_DEFAULT_CAMERAS 16
+#define METRICS_DEFAULT_FILE_SIZE 64 // MB
+#define METRICS_PATH_SIZE 512
+
+// Rows per block, a multiple of 8. At 25Hz a block is 41 seconds.
+#define METRICS_BLOCK_ROWS 1024
+// The header has the first page to itself, so blocks start on page boundaries
+#define METRICS_HEADER_SIZE 4096
+#define METRICS_PAGE_SIZE 4096
+// Levels are kept in hundredths of a dB
+#define METRICS_LEVEL_SCALE 100
+
+typedef struct _MetricsHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t tickInterval;
+    uint16_t cameras;
+    uint16_t blockRows;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    uint32_t reserved;
+    int64_t startTime; // ms since the epoch that row times count from
+} MetricsHeader;
+
+// Start of each block. rows is only raised once a row's columns have all been written.
+typedef struct _MetricsBlockHeader {
+    uint32_t rows;
+    uint32_t reserved;
+} MetricsBlockHeader;
+
+// Where each column starts in a block, for a number of cameras. The per-camera columns are one after the other.
+typedef struct _MetricsLayout {
+    size_t time;     // uint32, ms since startTime
+    size_t tick;     // uint32
+    size_t active;   // uint32, bit per camera
+    size_t stalled;  // uint32, bit per camera
+    size_t mode;     // uint8
+    size_t program;  // int8, -1 for none
+    size_t decision; // int8, -1 if no decision was made on this tick
+    size_t levels;   // int16 per camera, in hundredths of a dB
+    size_t movement; // int16 per camera
+    size_t blockSize;
+} MetricsLayout;
+
+typedef struct _MetricsRow {
+    uint32_t time;
+    uint32_t tick;
+    uint32_t active;
+    uint32_t stalled;
+    uint8_t mode;
+    int8_t program;
+    int8_t decision;
+    uint8_t count;
+    float levels[METRICS_MAX_CAMERAS];
+    int movement[METRICS_MAX_CAMERAS];
+} MetricsRow;
+
+typedef struct _MetricsFile {
+    int fd;
+    uint8_t *data;
+    size_t size;
+    char path[METRICS_PATH_SIZE];
+} MetricsFile;
+
+void GetMetricsLayout(int cameras, MetricsLayout &layout);
+
+class MetricsWriter
+{
+public:
+    MetricsWriter();
+    ~MetricsWriter();
+    bool Open(const char *path, int cameras, int tickInterval, int fileSize);
+    void Close(void);
+    bool IsOpen(void);
+    void Write(MetricsRow &row);
+    unsigned int TakeDropped(void);
+    int GetCameras(void);
+
+private:
+    bool Map(MetricsFile &file, const char *path);
+    void Finish(MetricsFile &file, uint32_t blocks);
+    bool Rotate(void);
+    void Prepare(void);
+    void MakePath(char *path, int size, int64_t time, const char *suffix);
+    void MakeUniquePath(char *path, int size, int64_t time);
+    static int64_t Now(void);
+    static int64_t RealNow(void);
+
+    char basePath[METRICS_PATH_SIZE];
+    int cameras;
+    int tickInterval;
+    size_t fileSize;
+    MetricsLayout layout;
+    uint32_t blockCount;
+
+    // Decision thread
+    MetricsFile current;
+    uint32_t block;
+    int64_t startMonotonic;
+    unsigned int sinceRetry;
+
+    // Handed to the helper thread, which makes the next file and finishes the last one off the decision thread
+    std::thread helper;
+    MetricsFile spare;
+    MetricsFile retired;
+    uint32_t retiredBlocks;
+    bool renameCurrent;
+    std::atomic<int> spareState;
+    std::atomic<unsigned int> dropped;
+};
+
+class MetricsReader
+{
+public:
+    MetricsReader();
+    ~MetricsReader();
+    bool Open(const char *path);
+    void Close(void);
+    const MetricsHeader &GetHeader(void);
+    bool Next(MetricsRow &row);
+
+private:
+    uint8_t *data;
+    size_t size;
+    MetricsHeader header;
+    MetricsLayout layout;
+    uint32_t blocks;
+    uint32_t block;
+    uint32_t row;
+};
+
+#endif // METRICSLOG_H
@@ -0,0 +1,165 @@
+/***
+ * RadioViz - nodeclient.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: The central switcher's side of a capture node. Each of the node's cameras becomes a RemoteCamera in
+ *              the source registry, so the switching policy treats it like any local camera. Scores and frames
+ *              from the node are handed to those cameras, and if the node goes away we keep trying to get it back,
+ *              reusing the same sources.
+ *
+ */
+#include "nodeclient.h"
+
+NodeClient::NodeClient(const QString &address, SourceRegistry *sources, QObject *parent)
+    : QObject(parent)
+{
+    this->address = address;
+    this->sources = sources;
+    this->connection = NULL;
+
+    reconnectTimer = new QTimer(this);
+    reconnectTimer->setSingleShot(true);
+    connect(reconnectTimer, SIGNAL(timeout()), this, SLOT(Reconnect()));
+
+    Reconnect();
+}
+
+/***
+ * Subscribe
+ * Author: Matthew Ribbins
+ * Description: Ask the node for full frames from one of its cameras, or just previews
+ */
+void NodeClient::Subscribe(int remoteId, bool full)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+
+    if(!connection || !connection->IsConnected()) return;
+
+    stream << (qint32)remoteId << (quint8)full;
+    connection->Send(NODE_MSG_SUBSCRIBE, payload);
+}
+
+void NodeClient::Reconnect(void)
+{
+    if(connection) connection->deleteLater();
+
+    LOG_INFO(LOG_GENERAL, "Connecting to capture node %s", address.toLocal8Bit().constData());
+    connection = NodeConnection::Connect(address, this);
+    connect(connection, SIGNAL(connected()), this, SLOT(Connected()));
+    connect(connection, SIGNAL(disconnected()), this, SLOT(Disconnected()));
+    connect(connection, SIGNAL(messageReceived(int, const QByteArray &)), this, SLOT(MessageReceived(int, const QByteArray &)));
+}
+
+void NodeClient::Connected(void)
+{
+    LOG_INFO(LOG_GENERAL, "Connected to capture node %s", address.toLocal8Bit().constData());
+}
+
+void NodeClient::Disconnected(void)
+{
+    LOG_WARNING(LOG_GENERAL, "Lost capture node %s", address.toLocal8Bit().constData());
+
+    // Its cameras keep their sources, but nothing they say is current any more
+    for(int i = 0; i < cameras.size(); i++)
+        cameras[i]->SetConnected(false);
+
+    if(!reconnectTimer->isActive())
+        reconnectTimer->start(NODE_RECONNECT_INTERVAL);
+}
+
+void NodeClient::MessageReceived(int type, const QByteArray &payload)
+{
+    switch(type) {
+        case NODE_MSG_HELLO:
+            ReadHello(payload);
+            break;
+        case NODE_MSG_SCORES:
+            ReadScores(payload);
+            break;
+        case NODE_MSG_FRAME:
+            ReadFrame(payload);
+            break;
+        default:
+            LOG_WARNING(LOG_GENERAL, "Unknown message %d from capture node", type);
+            break;
+    }
+}
+
+/***
+ * Read Hello
+ * Author: Matthew Ribbins
+ * Description: The node tells us how many cameras it has. New ones are added to the registry, and if this is a
+ *              reconnect we ask again for full frames from any that are on program.
+ */
+void NodeClient::ReadHello(const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    quint32 version;
+    qint32 count;
+    QString name;
+
+    stream >> version >> count >> name;
+    if(NODE_PROTOCOL_VERSION != version) {
+        LOG_ERROR(LOG_GENERAL, "Error: Capture node %s speaks version %u, we speak %d", address.toLocal8Bit().constData(),
+                  version, NODE_PROTOCOL_VERSION);
+        connection->Close();
+        return;
+    }
+    LOG_INFO(LOG_GENERAL, "Capture node %s has %d cameras", name.toLocal8Bit().constData(), count);
+
+    for(int i = cameras.size(); i < count; i++) {
+        RemoteCamera *camera = new RemoteCamera(this, i);
+        int sourceId = sources->Add(camera);
+        if(sourceId < 0) {
+            delete camera;
+            break;
+        }
+        cameras.append(camera);
+        sourceIds.append(sourceId);
+        LOG_INFO(LOG_GENERAL, "Camera %d on %s is source %d", i, name.toLocal8Bit().constData(), sourceId + 1);
+    }
+
+    for(int i = 0; i < cameras.size(); i++) {
+        cameras[i]->SetConnected(true);
+        if(!cameras[i]->IsAnalysisOnly())
+            Subscribe(i, true);
+    }
+}
+
+/***
+ * Read Scores
+ * Author: Matthew Ribbins
+ * Description: Audio level and movement for each of the node's cameras, sent every decision tick
+ */
+void NodeClient::ReadScores(const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    qint32 count;
+    float level;
+    qint32 movement;
+
+    stream >> count;
+    for(int i = 0; i < count && i < cameras.size(); i++) {
+        stream >> level >> movement;
+        cameras[i]->PutScores(level, movement);
+    }
+}
+
+void NodeClient::ReadFrame(const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    qint32 remoteId;
+    quint8 full;
+    QByteArray jpeg;
+
+    stream >> remoteId >> full >> jpeg;
+    if(remoteId < 0 || remoteId >= cameras.size()) return;
+
+    bool arrived;
+    {
+        EVENT_SCOPE("receive", sourceIds[remoteId]);
+        arrived = cameras[remoteId]->PutFrame(jpeg, full);
+    }
+    if(arrived)
+        emit frameArrived(sourceIds[remoteId]);
+}
@@ -0,0 +1,44 @@
+#ifndef NODECLIENT_H
+#define NODECLIENT_H
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#include "nodeconnection.h"
+#include "remotecamera.h"
+#include "sourceregistry.h"
+#include "eventtrace.h"
+#include "radioviz.h"
+
+class NodeClient : public QObject
+{
+    Q_OBJECT
+public:
+    NodeClient(const QString &address, SourceRegistry *sources, QObject *parent = 0);
+    void Subscribe(int remoteId, bool full);
+
+signals:
+    void frameArrived(int sourceId);
+
+private slots:
+    void Reconnect(void);
+    void Connected(void);
+    void Disconnected(void);
+    void MessageReceived(int type, const QByteArray &payload);
+
+private:
+    void ReadHello(const QByteArray &payload);
+    void ReadScores(const QByteArray &payload);
+    void ReadFrame(const QByteArray &payload);
+
+    QString address;
+    SourceRegistry *sources;
+    NodeConnection *connection;
+    QTimer *reconnectTimer;
+    QVector<RemoteCamera *> cameras;
+    QVector<int> sourceIds;
+};
+
+#endif // NODECLIENT_H
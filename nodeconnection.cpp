@@ -0,0 +1,147 @@
+/***
+ * RadioViz - nodeconnection.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Message framing between capture nodes and the central switcher, over TCP or a Unix socket.
+ *              Each message is a 32 bit big endian length, a one byte type and then the payload, which is built
+ *              with QDataStream by whoever sends it.
+ *
+ *              Addresses are host:port for TCP, or unix:/path (or just /path) for a Unix socket.
+ *
+ */
+#include "nodeconnection.h"
+
+NodeConnection::NodeConnection(QTcpSocket *socket, QObject *parent)
+    : QObject(parent)
+{
+    device = socket;
+    tcpSocket = socket;
+    localSocket = NULL;
+    messageLength = 0;
+    socket->setParent(this);
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    connect(socket, SIGNAL(readyRead()), this, SLOT(ReadMessages()));
+    connect(socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)), this, SLOT(TcpStateChanged(QAbstractSocket::SocketState)));
+}
+
+NodeConnection::NodeConnection(QLocalSocket *socket, QObject *parent)
+    : QObject(parent)
+{
+    device = socket;
+    tcpSocket = NULL;
+    localSocket = socket;
+    messageLength = 0;
+    socket->setParent(this);
+    connect(socket, SIGNAL(readyRead()), this, SLOT(ReadMessages()));
+    connect(socket, SIGNAL(stateChanged(QLocalSocket::LocalSocketState)), this, SLOT(LocalStateChanged(QLocalSocket::LocalSocketState)));
+}
+
+NodeConnection::~NodeConnection()
+{
+}
+
+bool NodeConnection::IsLocalAddress(const QString &address)
+{
+    return address.startsWith("unix:") || address.startsWith("/");
+}
+
+/***
+ * Connect
+ * Author: Matthew Ribbins
+ * Description: Start connecting to a node. connected() is emitted once we are.
+ */
+NodeConnection *NodeConnection::Connect(const QString &address, QObject *parent)
+{
+    if(IsLocalAddress(address)) {
+        QLocalSocket *socket = new QLocalSocket();
+        NodeConnection *connection = new NodeConnection(socket, parent);
+        socket->connectToServer(address.startsWith("unix:") ? address.mid(5) : address);
+        return connection;
+    }
+
+    QTcpSocket *socket = new QTcpSocket();
+    NodeConnection *connection = new NodeConnection(socket, parent);
+    int separator = address.lastIndexOf(':');
+    socket->connectToHost(address.left(separator), address.mid(separator + 1).toUShort());
+    return connection;
+}
+
+void NodeConnection::Send(int type, const QByteArray &payload)
+{
+    QByteArray frame;
+    QDataStream stream(&frame, QIODevice::WriteOnly);
+
+    stream << (quint32)(payload.size() + 1) << (quint8)type;
+    device->write(frame);
+    device->write(payload);
+}
+
+/***
+ * Get Pending Bytes
+ * Author: Matthew Ribbins
+ * Description: Bytes we have sent that haven't gone yet, so the sender can drop frames rather than queue them
+ *              behind a slow link
+ */
+qint64 NodeConnection::GetPendingBytes(void)
+{
+    return device->bytesToWrite();
+}
+
+bool NodeConnection::IsConnected(void)
+{
+    if(tcpSocket) return (QAbstractSocket::ConnectedState == tcpSocket->state());
+    return (QLocalSocket::ConnectedState == localSocket->state());
+}
+
+void NodeConnection::Close(void)
+{
+    if(tcpSocket) tcpSocket->abort();
+    else localSocket->abort();
+}
+
+/***
+ * Read Messages
+ * Author: Matthew Ribbins
+ * Description: Pull every complete message out of the socket
+ */
+void NodeConnection::ReadMessages(void)
+{
+    for(;;) {
+        if(!messageLength) {
+            if(device->bytesAvailable() < 4) return;
+
+            QDataStream stream(device->read(4));
+            stream >> messageLength;
+            if(!messageLength || messageLength > NODE_MAX_MESSAGE) {
+                LOG_ERROR(LOG_GENERAL, "Error: Bad node message length %u, closing connection", messageLength);
+                messageLength = 0;
+                Close();
+                return;
+            }
+        }
+        if(device->bytesAvailable() < messageLength) return;
+
+        QByteArray message = device->read(messageLength);
+        messageLength = 0;
+        emit messageReceived((quint8)message.at(0), message.mid(1));
+    }
+}
+
+void NodeConnection::TcpStateChanged(QAbstractSocket::SocketState state)
+{
+    if(QAbstractSocket::ConnectedState == state) {
+        emit connected();
+    } else if(QAbstractSocket::UnconnectedState == state) {
+        messageLength = 0;
+        emit disconnected();
+    }
+}
+
+void NodeConnection::LocalStateChanged(QLocalSocket::LocalSocketState state)
+{
+    if(QLocalSocket::ConnectedState == state) {
+        emit connected();
+    } else if(QLocalSocket::UnconnectedState == state) {
+        messageLength = 0;
+        emit disconnected();
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef NODECONNECTION_H
+#define NODECONNECTION_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDataStream>
+#include <QIODevice>
+#include <QTcpSocket>
+#include <QLocalSocket>
+
+#include "logger.h"
+#include "radioviz.h"
+
+// Messages between capture nodes and the central switcher
+#define NODE_MSG_HELLO 1
+#define NODE_MSG_SCORES 2
+#define NODE_MSG_FRAME 3
+#define NODE_MSG_SUBSCRIBE 4
+
+#define NODE_PROTOCOL_VERSION 1
+
+// Largest message we will accept (bytes)
+#define NODE_MAX_MESSAGE (8 * 1024 * 1024)
+
+// Central switcher: time between attempts to reach a node we have lost (ms)
+#define NODE_RECONNECT_INTERVAL 2000
+
+// Capture node: previews are 1/NODE_PREVIEW_SCALE size, sent every NODE_PREVIEW_INTERVAL (ms). Frames are dropped
+// rather than queued once more than NODE_MAX_PENDING bytes are waiting to go to a subscriber.
+#define NODE_PREVIEW_SCALE 4
+#define NODE_PREVIEW_INTERVAL 200
+#define NODE_PREVIEW_QUALITY 60
+#define NODE_FRAME_QUALITY 85
+#define NODE_MAX_PENDING (4 * 1024 * 1024)
+
+class NodeConnection : public QObject
+{
+    Q_OBJECT
+public:
+    NodeConnection(QTcpSocket *socket, QObject *parent = 0);
+    NodeConnection(QLocalSocket *socket, QObject *parent = 0);
+    ~NodeConnection();
+    static NodeConnection *Connect(const QString &address, QObject *parent = 0);
+    static bool IsLocalAddress(const QString &address);
+
+    void Send(int type, const QByteArray &payload);
+    qint64 GetPendingBytes(void);
+    bool IsConnected(void);
+    void Close(void);
+
+signals:
+    void messageReceived(int type, const QByteArray &payload);
+    void connected(void);
+    void disconnected(void);
+
+private slots:
+    void ReadMessages(void);
+    void TcpStateChanged(QAbstractSocket::SocketState state);
+    void LocalStateChanged(QLocalSocket::LocalSocketState state);
+
+private:
+    QIODevice *device;
+    QTcpSocket *tcpSocket;
+    QLocalSocket *localSocket;
+    quint32 messageLength;
+};
+
+#endif // NODECONNECTION_H
@@ -0,0 +1,260 @@
+/***
+ * RadioViz - nodeserver.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Capture node. Captures and analyses the cameras on this machine and sends their audio levels and
+ *              movement to every connected switcher each decision tick. Switchers get a small preview of each
+ *              camera a few times a second, and full frames only from the cameras they have asked for, which is
+ *              whatever they have on program. Each frame is encoded once however many switchers want it, and if a
+ *              switcher can't keep up its frames are dropped rather than queued.
+ *
+ */
+#include <QHostInfo>
+
+#include "nodeserver.h"
+
+NodeServer::NodeServer(SourceRegistry *sources, QObject *parent)
+    : QObject(parent)
+{
+    this->sources = sources;
+    this->tcpServer = NULL;
+    this->localServer = NULL;
+    this->droppedFrames = 0;
+    for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++)
+        previewTimers[i].start();
+    encodeParams.push_back(CV_IMWRITE_JPEG_QUALITY);
+    encodeParams.push_back(NODE_FRAME_QUALITY);
+
+    startTimer(DECISION_TIMER_INTERVAL);
+}
+
+NodeServer::~NodeServer()
+{
+    for(int i = 0; i < subscribers.size(); i++)
+        delete subscribers[i];
+}
+
+/***
+ * Listen
+ * Author: Matthew Ribbins
+ * Description: Listen on a port, host:port, or unix:/path for a Unix socket
+ *
+ * Return: (bool) true if we are listening
+ */
+bool NodeServer::Listen(const QString &address)
+{
+    bool result;
+
+    if(NodeConnection::IsLocalAddress(address)) {
+        QString path = address.startsWith("unix:") ? address.mid(5) : address;
+        localServer = new QLocalServer(this);
+        QLocalServer::removeServer(path);
+        connect(localServer, SIGNAL(newConnection()), this, SLOT(NewConnection()));
+        result = localServer->listen(path);
+    } else {
+        int separator = address.lastIndexOf(':');
+        QHostAddress host = (separator < 0) ? QHostAddress(QHostAddress::Any) : QHostAddress(address.left(separator));
+        tcpServer = new QTcpServer(this);
+        connect(tcpServer, SIGNAL(newConnection()), this, SLOT(NewConnection()));
+        result = tcpServer->listen(host, address.mid(separator + 1).toUShort());
+    }
+
+    if(!result)
+        LOG_ERROR(LOG_GENERAL, "Error: Capture node could not listen on %s", address.toLocal8Bit().constData());
+    else
+        LOG_INFO(LOG_GENERAL, "Capture node listening on %s with %d cameras", address.toLocal8Bit().constData(),
+                 sources->GetCount());
+    return result;
+}
+
+/***
+ * New Connection
+ * Author: Matthew Ribbins
+ * Description: A switcher has connected. It starts on previews only, and is told how many cameras we have.
+ */
+void NodeServer::NewConnection(void)
+{
+    NodeConnection *connection;
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+
+    if(tcpServer) {
+        QTcpSocket *socket = tcpServer->nextPendingConnection();
+        if(!socket) return;
+        connection = new NodeConnection(socket, this);
+    } else {
+        QLocalSocket *socket = localServer->nextPendingConnection();
+        if(!socket) return;
+        connection = new NodeConnection(socket, this);
+    }
+
+    NodeSubscriber *subscriber = new NodeSubscriber;
+    subscriber->connection = connection;
+    for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++)
+        subscriber->full[i] = false;
+    subscribers.append(subscriber);
+
+    connect(connection, SIGNAL(disconnected()), this, SLOT(Disconnected()));
+    connect(connection, SIGNAL(messageReceived(int, const QByteArray &)), this, SLOT(MessageReceived(int, const QByteArray &)));
+
+    stream << (quint32)NODE_PROTOCOL_VERSION << (qint32)sources->GetCount() << QHostInfo::localHostName();
+    connection->Send(NODE_MSG_HELLO, payload);
+    LOG_INFO(LOG_GENERAL, "Switcher connected, %d connected", subscribers.size());
+}
+
+void NodeServer::Disconnected(void)
+{
+    for(int i = 0; i < subscribers.size(); i++) {
+        if(subscribers[i]->connection != sender()) continue;
+        subscribers[i]->connection->deleteLater();
+        delete subscribers[i];
+        subscribers.remove(i);
+        LOG_INFO(LOG_GENERAL, "Switcher disconnected, %d connected", subscribers.size());
+        for(int j = 0; j < sources->GetCount(); j++)
+            UpdateTier(j);
+        return;
+    }
+}
+
+NodeSubscriber *NodeServer::FindSubscriber(QObject *connection)
+{
+    for(int i = 0; i < subscribers.size(); i++) {
+        if(subscribers[i]->connection == connection) return subscribers[i];
+    }
+    return NULL;
+}
+
+void NodeServer::MessageReceived(int type, const QByteArray &payload)
+{
+    NodeSubscriber *subscriber = FindSubscriber(sender());
+    QDataStream stream(payload);
+    qint32 cameraId;
+    quint8 full;
+
+    if(!subscriber) return;
+    if(NODE_MSG_SUBSCRIBE != type) {
+        LOG_WARNING(LOG_GENERAL, "Unknown message %d from switcher", type);
+        return;
+    }
+
+    stream >> cameraId >> full;
+    if(cameraId < 0 || cameraId >= sources->GetCount()) return;
+    subscriber->full[cameraId] = full;
+    LOG_DEBUG(LOG_GENERAL, "Switcher wants %s frames from camera %d", full ? "full" : "preview", cameraId);
+    UpdateTier(cameraId);
+}
+
+/***
+ * Update Tier
+ * Author: Matthew Ribbins
+ * Description: With capture tiers, a camera only captures at full format while a switcher wants full frames
+ */
+void NodeServer::UpdateTier(int cameraId)
+{
+    bool wantFull = false;
+
+    if(!sources->IsTiering()) return;
+    for(int i = 0; i < subscribers.size(); i++) {
+        if(subscribers[i]->full[cameraId]) wantFull = true;
+    }
+    sources->GetCamera(cameraId)->SetCaptureTier(wantFull ? CAMERA_TIER_FULL : CAMERA_TIER_ANALYSIS);
+}
+
+/***
+ * Encode Frame
+ * Author: Matthew Ribbins
+ * Description: JPEG encode the camera's last frame, full size or as a preview, into a FRAME message payload
+ */
+const QByteArray &NodeServer::EncodeFrame(int cameraId, bool full)
+{
+    EVENT_SCOPE("encode", cameraId);
+    Camera *camera = sources->GetCamera(cameraId);
+
+    cv::cvtColor(camera->GetLastFrame(), bgrFrame, CV_RGB2BGR);
+    if(full) {
+        encodeParams[1] = NODE_FRAME_QUALITY;
+        cv::imencode(".jpg", bgrFrame, encodedFrame, encodeParams);
+    } else {
+        encodeParams[1] = NODE_PREVIEW_QUALITY;
+        cv::resize(bgrFrame, previewFrame, cv::Size(bgrFrame.cols / NODE_PREVIEW_SCALE, bgrFrame.rows / NODE_PREVIEW_SCALE),
+                   0, 0, cv::INTER_AREA);
+        cv::imencode(".jpg", previewFrame, encodedFrame, encodeParams);
+    }
+
+    framePayload.clear();
+    QDataStream stream(&framePayload, QIODevice::WriteOnly);
+    stream << (qint32)cameraId << (quint8)full;
+    stream.writeBytes((const char *)encodedFrame.data(), encodedFrame.size());
+    return framePayload;
+}
+
+void NodeServer::SendFrame(NodeSubscriber *subscriber, const QByteArray &payload)
+{
+    if(subscriber->connection->GetPendingBytes() > NODE_MAX_PENDING) {
+        if(!(droppedFrames++ % 100))
+            LOG_WARNING(LOG_GENERAL, "Switcher can't keep up, %u frames dropped", droppedFrames);
+        return;
+    }
+    subscriber->connection->Send(NODE_MSG_FRAME, payload);
+}
+
+/***
+ * Frame Arrived
+ * Author: Matthew Ribbins
+ * Description: A camera has a new frame. Send it to the switchers that want it full size, and every
+ *              NODE_PREVIEW_INTERVAL send a preview to the rest.
+ */
+void NodeServer::FrameArrived(int cameraId)
+{
+    Camera *camera = sources->GetCamera(cameraId);
+    bool wantFull = false;
+    bool wantPreview = false;
+
+    if(!camera || !subscribers.size()) return;
+    if(!camera->AcquireFrame()) return;
+
+    bool previewDue = previewTimers[cameraId].elapsed() >= NODE_PREVIEW_INTERVAL;
+    for(int i = 0; i < subscribers.size(); i++) {
+        if(subscribers[i]->full[cameraId]) wantFull = true;
+        else if(previewDue) wantPreview = true;
+    }
+
+    if(wantFull) {
+        const QByteArray &payload = EncodeFrame(cameraId, true);
+        for(int i = 0; i < subscribers.size(); i++) {
+            if(subscribers[i]->full[cameraId]) SendFrame(subscribers[i], payload);
+        }
+    }
+    if(wantPreview) {
+        const QByteArray &payload = EncodeFrame(cameraId, false);
+        for(int i = 0; i < subscribers.size(); i++) {
+            if(!subscribers[i]->full[cameraId]) SendFrame(subscribers[i], payload);
+        }
+        previewTimers[cameraId].restart();
+    }
+}
+
+/***
+ * Node Timer
+ * Author: Matthew Ribbins
+ * Description: Send every switcher our cameras' scores each decision tick. Levels are kept by each mic's audio
+ *              callback, so reading them doesn't wait on the device.
+ */
+void NodeServer::timerEvent(QTimerEvent*)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    int count = sources->GetCount();
+
+    ThreadPolicy::Tick();
+    ThreadPolicy::Report();
+    if(!subscribers.size()) return;
+
+    stream << (qint32)count;
+    for(int i = 0; i < count; i++) {
+        Camera *camera = sources->GetCamera(i);
+        stream << camera->GetAudioLevelFromDevice() << (qint32)camera->GetMovementDetection();
+    }
+
+    for(int i = 0; i < subscribers.size(); i++)
+        subscribers[i]->connection->Send(NODE_MSG_SCORES, payload);
+}
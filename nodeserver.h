@@ -0,0 +1,60 @@
+#ifndef NODESERVER_H
+#define NODESERVER_H
+
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+#include <QLocalServer>
+#include <QElapsedTimer>
+#include <QVector>
+#include <opencv2/opencv.hpp>
+
+#include "nodeconnection.h"
+#include "sourceregistry.h"
+#include "threadpolicy.h"
+#include "radioviz.h"
+
+typedef struct _NodeSubscriber {
+    NodeConnection *connection;
+    bool full[MAX_CAMERAS_AVAILABLE];
+} NodeSubscriber;
+
+class NodeServer : public QObject
+{
+    Q_OBJECT
+public:
+    NodeServer(SourceRegistry *sources, QObject *parent = 0);
+    ~NodeServer();
+    bool Listen(const QString &address);
+
+public slots:
+    void FrameArrived(int cameraId);
+
+private slots:
+    void NewConnection(void);
+    void Disconnected(void);
+    void MessageReceived(int type, const QByteArray &payload);
+
+protected:
+    void timerEvent(QTimerEvent *);
+
+private:
+    NodeSubscriber *FindSubscriber(QObject *connection);
+    const QByteArray &EncodeFrame(int cameraId, bool full);
+    void UpdateTier(int cameraId);
+    void SendFrame(NodeSubscriber *subscriber, const QByteArray &payload);
+
+    SourceRegistry *sources;
+    QTcpServer *tcpServer;
+    QLocalServer *localServer;
+    QVector<NodeSubscriber *> subscribers;
+    QElapsedTimer previewTimers[MAX_CAMERAS_AVAILABLE];
+    cv::Mat bgrFrame;
+    cv::Mat previewFrame;
+    std::vector<uchar> encodedFrame;
+    std::vector<int> encodeParams;
+    QByteArray framePayload;
+    unsigned int droppedFrames;
+};
+
+#endif // NODESERVER_H
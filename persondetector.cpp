@@ -0,0 +1,309 @@
+/***
+ * RadioViz - persondetector.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Background person detector. Runs OpenCV's HOG people detector on a small copy of one camera's frame
+ *              at a time, so switching can tell a presenter from a swinging door. The next camera is the one whose
+ *              audio or movement is rising fastest, or whose last result is oldest. Results are kept and reused
+ *              until that camera's turn comes round again.
+ *
+ *              The detector must never cost capture or display a frame, so it runs at the lowest priority and
+ *              after every detection idles for long enough that it uses no more than its budget of one core. Its
+ *              actual share is logged every DETECTOR_STATS_INTERVAL.
+ *
+ *              One detector and one budget serve every studio in the process. Studios take turns, so a busy studio
+ *              can't use up the budget while another's results go stale.
+ *
+ */
+#include <time.h>
+
+#include "persondetector.h"
+
+PersonDetector::PersonDetector(int budget, QObject *parent)
+    : QThread(parent)
+{
+    this->budget = (budget < 1) ? 1 : ((budget > 100) ? 100 : budget);
+    this->running.store(false);
+    this->studioCount.store(0);
+    for(int s = 0; s < MAX_STUDIOS; s++) {
+        studios[s] = NULL;
+        for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++) {
+            levels[s][i] = 0;
+            movement[s][i] = 0;
+            levelAverage[s][i] = 0;
+            movementAverage[s][i] = 0;
+            lastRun[s][i] = 0;
+            presence[s][i] = 1;
+            resultTime[s][i] = 0;
+        }
+    }
+    nextStudio = 0;
+    statsStart = 0;
+    statsCpu = 0;
+    statsRuns = 0;
+    statsDetections = 0;
+    hog.setSVMDetector(cv::HOGDescriptor::getDefaultPeopleDetector());
+}
+
+qint64 PersonDetector::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/***
+ * CPU Now
+ * Author: Matthew Ribbins
+ * Description: CPU time used by the calling thread (ns), which is what the budget is measured in, so time spent
+ *              preempted by capture or display isn't charged to us
+ */
+qint64 PersonDetector::CpuNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void PersonDetector::Start(QThread::Priority priority)
+{
+    running.store(true);
+    start(priority);
+}
+
+void PersonDetector::Stop(void)
+{
+    running.store(false);
+    wait();
+}
+
+/***
+ * Add Studio
+ * Author: Matthew Ribbins
+ * Description: Look at a studio's sources as well. Studios are only ever added, from the GUI thread.
+ *
+ * Return: (int) the studio's number for the calls below, or -1 if there are already MAX_STUDIOS
+ */
+int PersonDetector::AddStudio(SourceRegistry *sources)
+{
+    int studio = studioCount.load(std::memory_order_relaxed);
+
+    if(studio >= MAX_STUDIOS) return -1;
+    studios[studio] = sources;
+    studioCount.store(studio + 1, std::memory_order_release);
+    return studio;
+}
+
+bool PersonDetector::HasStudios(void)
+{
+    return studioCount.load(std::memory_order_relaxed) > 0;
+}
+
+void PersonDetector::UpdateLevels(int studio, const float *levels, int count)
+{
+    if(studio < 0 || studio >= MAX_STUDIOS) return;
+    QMutexLocker locker(&scoresMutex);
+    for(int i = 0; i < count && i < MAX_CAMERAS_AVAILABLE; i++)
+        this->levels[studio][i] = levels[i];
+}
+
+void PersonDetector::UpdateMovement(int studio, const int *movement, int count)
+{
+    if(studio < 0 || studio >= MAX_STUDIOS) return;
+    QMutexLocker locker(&scoresMutex);
+    for(int i = 0; i < count && i < MAX_CAMERAS_AVAILABLE; i++)
+        this->movement[studio][i] = movement[i];
+}
+
+/***
+ * Get Presence
+ * Author: Matthew Ribbins
+ * Description: Latest result for each of a studio's cameras, from 0 (nobody) to 1. Results older than
+ *              DETECTOR_RESULT_LIFETIME, and cameras not looked at yet, are 1 so they aren't held back on a guess.
+ */
+void PersonDetector::GetPresence(int studio, float *presence, int count)
+{
+    qint64 oldest = Now() - (qint64)DETECTOR_RESULT_LIFETIME * 1000000;
+
+    for(int i = 0; i < count && i < MAX_CAMERAS_AVAILABLE; i++)
+        presence[i] = 1;
+    if(studio < 0 || studio >= MAX_STUDIOS) return;
+
+    QMutexLocker locker(&resultsMutex);
+    for(int i = 0; i < count && i < MAX_CAMERAS_AVAILABLE; i++)
+        presence[i] = (resultTime[studio][i] > oldest) ? this->presence[studio][i] : 1;
+}
+
+/***
+ * Pick Camera
+ * Author: Matthew Ribbins
+ * Description: Choose the camera to look at next. Every studio's cameras are scored, and the studios take turns:
+ *              the next studio along that has a camera needing a look gets it.
+ *
+ * Return: (int) camera in studio, or -1 if none need looking at
+ */
+int PersonDetector::PickCamera(qint64 now, int &studio)
+{
+    int studioTotal = studioCount.load(std::memory_order_acquire);
+    int best[MAX_STUDIOS];
+    float priority;
+
+    for(int s = 0; s < studioTotal; s++)
+        best[s] = PickStudioCamera(now, s, priority);
+
+    for(int n = 0; n < studioTotal; n++) {
+        int s = (nextStudio + n) % studioTotal;
+        if(best[s] < 0) continue;
+        studio = s;
+        nextStudio = (s + 1) % studioTotal;
+        return best[s];
+    }
+    return -1;
+}
+
+/***
+ * Pick Studio Camera
+ * Author: Matthew Ribbins
+ * Description: Choose a studio's camera to look at next. Each camera's priority is how old its result is (1 at
+ *              DETECTOR_RESULT_LIFETIME) plus how far its audio (per 6 dB) and movement (per 10) are above their
+ *              recent average. Cameras looked at in the last DETECTOR_MIN_INTERVAL are left alone.
+ *
+ * Return: (int) camera, or -1 if none need looking at
+ */
+int PersonDetector::PickStudioCamera(qint64 now, int studio, float &bestPriority)
+{
+    int count = studios[studio]->GetCount();
+    int best = -1;
+    float currentLevels[MAX_CAMERAS_AVAILABLE];
+    int currentMovement[MAX_CAMERAS_AVAILABLE];
+
+    bestPriority = 0;
+    scoresMutex.lock();
+    for(int i = 0; i < count; i++) {
+        currentLevels[i] = levels[studio][i];
+        currentMovement[i] = movement[studio][i];
+    }
+    scoresMutex.unlock();
+
+    for(int i = 0; i < count; i++) {
+        float levelRise = currentLevels[i] - levelAverage[studio][i];
+        float movementRise = currentMovement[i] - movementAverage[studio][i];
+        levelAverage[studio][i] += (currentLevels[i] - levelAverage[studio][i]) * 0.1f;
+        movementAverage[studio][i] += (currentMovement[i] - movementAverage[studio][i]) * 0.1f;
+
+        qint64 age = (now - lastRun[studio][i]) / 1000000;
+        if(age < DETECTOR_MIN_INTERVAL) continue;
+
+        float priority = (float)age / DETECTOR_RESULT_LIFETIME;
+        if(levelRise > 0) priority += levelRise / 6;
+        if(movementRise > 0) priority += movementRise / 10;
+        if(priority > bestPriority) {
+            best = i;
+            bestPriority = priority;
+        }
+    }
+    return best;
+}
+
+/***
+ * Detect
+ * Author: Matthew Ribbins
+ * Description: Look for people in one of a studio's camera's frame
+ *
+ * Return: (float) 1 if there is someone in shot, 0 if not, or -1 if the camera had no frame
+ */
+float PersonDetector::Detect(int studio, int cameraId)
+{
+    EVENT_SCOPE("detect", cameraId);
+    Camera *camera = studios[studio]->GetCamera(cameraId);
+
+    if(!camera || !camera->GetDetectionFrame(frame, DETECTOR_WIDTH)) return -1;
+
+    if(3 == frame.channels())
+        cv::cvtColor(frame, grayFrame, CV_RGB2GRAY);
+    else
+        frame.copyTo(grayFrame);
+
+    // Our own image pyramid rather than detectMultiScale(), which spreads over every core where the budget can't
+    // see it. We only need to know if anyone is there, so stop at the first scale that finds someone.
+    for(double scale = 1; ; scale *= DETECTOR_SCALE_STEP) {
+        cv::Size size(cvRound(grayFrame.cols / scale), cvRound(grayFrame.rows / scale));
+
+        // The people detector's window is 64x128
+        if(size.width < hog.winSize.width || size.height < hog.winSize.height) break;
+
+        if(1 == scale) {
+            hog.detect(grayFrame, found, 0, cv::Size(8, 8));
+        } else {
+            cv::resize(grayFrame, scaledFrame, size, 0, 0, cv::INTER_AREA);
+            hog.detect(scaledFrame, found, 0, cv::Size(8, 8));
+        }
+        if(!found.empty()) return 1;
+    }
+    return 0;
+}
+
+/***
+ * Report Stats
+ * Author: Matthew Ribbins
+ * Description: Log the share of a core we have actually used, against the budget
+ */
+void PersonDetector::ReportStats(qint64 now)
+{
+    qint64 elapsed = now - statsStart;
+
+    if(elapsed < (qint64)DETECTOR_STATS_INTERVAL * 1000000) return;
+
+    LOG_INFO(LOG_SWITCHING, "Detector used %.1f%% of a core (budget %d%%), %u runs %.1f ms each, %u found people",
+             100.0 * statsCpu / elapsed, budget, statsRuns, statsRuns ? statsCpu / 1e6 / statsRuns : 0.0,
+             statsDetections);
+    statsStart = now;
+    statsCpu = 0;
+    statsRuns = 0;
+    statsDetections = 0;
+}
+
+/***
+ * Detector Thread Loop
+ * Author: Matthew Ribbins
+ */
+void PersonDetector::run()
+{
+    Logger::SetThreadName("detector");
+    ThreadPolicy::Apply(THREAD_CLASS_ANALYSIS, "detector");
+    statsStart = Now();
+
+    while(running.load(std::memory_order_relaxed)) {
+        qint64 now = Now();
+        int studio = 0;
+        int cameraId = PickCamera(now, studio);
+
+        if(cameraId < 0) {
+            ThreadPolicy::Sleep(DECISION_TIMER_INTERVAL * 1000);
+            continue;
+        }
+
+        qint64 cpuStart = CpuNow();
+        float result = Detect(studio, cameraId);
+        qint64 cost = CpuNow() - cpuStart;
+
+        lastRun[studio][cameraId] = now;
+        if(result >= 0) {
+            QMutexLocker locker(&resultsMutex);
+            // Smooth over single missed detections
+            if(resultTime[studio][cameraId])
+                presence[studio][cameraId] = (presence[studio][cameraId] + result) / 2;
+            else
+                presence[studio][cameraId] = result;
+            resultTime[studio][cameraId] = Now();
+        }
+
+        statsCpu += cost;
+        statsRuns++;
+        statsDetections += (result > 0);
+        ReportStats(Now());
+
+        // Idle long enough that this detection was no more than our budget of the time
+        qint64 idle = cost * (100 - budget) / budget;
+        ThreadPolicy::Sleep((idle < 1000000) ? 1000 : idle / 1000);
+    }
+}
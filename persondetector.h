@@ -0,0 +1,72 @@
+#ifndef PERSONDETECTOR_H
+#define PERSONDETECTOR_H
+
+#include <QThread>
+#include <QMutex>
+#include <opencv2/opencv.hpp>
+#include <atomic>
+
+#include "sourceregistry.h"
+#include "threadpolicy.h"
+#include "logger.h"
+#include "radioviz.h"
+
+class PersonDetector : public QThread
+{
+public:
+    PersonDetector(int budget, QObject *parent = 0);
+    void Start(QThread::Priority priority = QThread::InheritPriority);
+    void Stop(void);
+
+    // GUI thread
+    int AddStudio(SourceRegistry *sources);
+    bool HasStudios(void);
+    void UpdateLevels(int studio, const float *levels, int count);
+    void UpdateMovement(int studio, const int *movement, int count);
+    void GetPresence(int studio, float *presence, int count);
+
+protected:
+    void run();
+
+private:
+    int PickCamera(qint64 now, int &studio);
+    int PickStudioCamera(qint64 now, int studio, float &priority);
+    float Detect(int studio, int cameraId);
+    void ReportStats(qint64 now);
+    static qint64 Now(void);
+    static qint64 CpuNow(void);
+
+    SourceRegistry *studios[MAX_STUDIOS];
+    std::atomic<int> studioCount;
+    int budget;
+    std::atomic<bool> running;
+    cv::HOGDescriptor hog;
+    cv::Mat frame;
+    cv::Mat grayFrame;
+    cv::Mat scaledFrame;
+    std::vector<cv::Point> found;
+
+    // Scores from the GUI thread
+    QMutex scoresMutex;
+    float levels[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+    int movement[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+
+    // Detector thread only
+    float levelAverage[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+    float movementAverage[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+    qint64 lastRun[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+    int nextStudio;
+
+    // Results, read by the GUI thread
+    QMutex resultsMutex;
+    float presence[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+    qint64 resultTime[MAX_STUDIOS][MAX_CAMERAS_AVAILABLE];
+
+    // Budget accounting
+    qint64 statsStart;
+    qint64 statsCpu;
+    unsigned int statsRuns;
+    unsigned int statsDetections;
+};
+
+#endif // PERSONDETECTOR_H
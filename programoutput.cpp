@@ -0,0 +1,346 @@
+/***
+ * RadioViz - programoutput.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Program output for a headless switcher. The switcher hands over a reference to each program frame
+ *              (the pool buffer, not a copy) and a thread of our own writes it out, so a slow disk or a reader that
+ *              has fallen behind never holds up switching. If the last frame hasn't been written by the time the
+ *              next arrives it is dropped, and counted.
+ *
+ *              A file target gets raw RGB24 frames of the output size back to back, from the start of the file.
+ *              It can be a FIFO, which is waited on until something opens it for reading, and opened again if the
+ *              reader goes away. A reader that stops reading holds up the output thread, but never Close(). A
+ *              shm:name target is a shared memory segment with the newest few frames in it, see
+ *              OutputSharedHeader. Frames of a different size (e.g. a camera not yet back at its full capture
+ *              format) are scaled to the output size.
+ *
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "programoutput.h"
+
+ProgramOutput::ProgramOutput(QObject *parent)
+    : QThread(parent)
+{
+    kind = OUTPUT_NONE;
+    width = 0;
+    height = 0;
+    running = false;
+    pendingCamera = -1;
+    fd = -1;
+    shared = NULL;
+    sharedSize = 0;
+    written.store(0);
+    dropped.store(0);
+    failed.store(0);
+}
+
+ProgramOutput::~ProgramOutput()
+{
+    Close();
+}
+
+qint64 ProgramOutput::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/***
+ * Open Output
+ * Author: Matthew Ribbins
+ * Description: Start writing program frames of width x height to target, a file or FIFO path, or shm:name for
+ *              shared memory (/dev/shm/name)
+ *
+ * Return: (bool) false if the shared memory couldn't be made. A file is opened on the output thread.
+ */
+bool ProgramOutput::Open(const QString &target, int width, int height)
+{
+    if(IsOpen() || target.isEmpty() || width <= 0 || height <= 0) return false;
+
+    this->target = target;
+    this->width = width;
+    this->height = height;
+
+    if(target.startsWith("shm:")) {
+        if(!OpenShared(target.mid(4))) return false;
+        kind = OUTPUT_SHARED;
+    } else {
+        // A FIFO reader going away would otherwise kill us
+        signal(SIGPIPE, SIG_IGN);
+        packed.create(height, width, CV_8UC3);
+        kind = OUTPUT_FILE;
+    }
+
+    running = true;
+    start();
+    return true;
+}
+
+void ProgramOutput::Close(void)
+{
+    if(OUTPUT_NONE == kind) return;
+
+    pendingMutex.lock();
+    running = false;
+    pendingReady.wakeAll();
+    pendingMutex.unlock();
+    wait();
+
+    if(fd >= 0) close(fd);
+    fd = -1;
+    if(shared) {
+        munmap(shared, sharedSize);
+        shm_unlink(sharedName.toLocal8Bit().constData());
+        shared = NULL;
+    }
+    pending.Release();
+    kind = OUTPUT_NONE;
+}
+
+bool ProgramOutput::IsOpen(void)
+{
+    return OUTPUT_NONE != kind;
+}
+
+/***
+ * Open Shared Memory
+ * Author: Matthew Ribbins
+ * Description: Make the segment at its full size, every slot a frame of the output size, and write its header.
+ *              The header's size fields are only valid once magic is set.
+ *
+ * Return: (bool) false if it couldn't be made
+ */
+bool ProgramOutput::OpenShared(const QString &name)
+{
+    size_t stride = (size_t)width * 3;
+    size_t slotSize = (stride * height + 4095) & ~(size_t)4095;
+
+    sharedName = name.startsWith("/") ? name : QString("/").append(name);
+    sharedSize = OUTPUT_SHARED_HEADER_SIZE + OUTPUT_SHARED_SLOTS * slotSize;
+
+    int sharedFd = shm_open(sharedName.toLocal8Bit().constData(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(sharedFd < 0) {
+        LOG_ERROR(LOG_DISPLAY, "Error: Can't make program output %s, %s", sharedName.toLocal8Bit().constData(), strerror(errno));
+        return false;
+    }
+    if(ftruncate(sharedFd, sharedSize)) {
+        LOG_ERROR(LOG_DISPLAY, "Error: Can't size program output %s, %s", sharedName.toLocal8Bit().constData(), strerror(errno));
+        close(sharedFd);
+        shm_unlink(sharedName.toLocal8Bit().constData());
+        return false;
+    }
+
+    void *data = mmap(NULL, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, sharedFd, 0);
+    close(sharedFd);
+    if(MAP_FAILED == data) {
+        LOG_ERROR(LOG_DISPLAY, "Error: Can't map program output %s, %s", sharedName.toLocal8Bit().constData(), strerror(errno));
+        shm_unlink(sharedName.toLocal8Bit().constData());
+        return false;
+    }
+    shared = (uchar *)data;
+
+    OutputSharedHeader *header = (OutputSharedHeader *)shared;
+    header->version = OUTPUT_SHARED_VERSION;
+    header->slots = OUTPUT_SHARED_SLOTS;
+    header->width = width;
+    header->height = height;
+    header->stride = stride;
+    header->slotSize = slotSize;
+    header->latest.store(0);
+    header->frames.store(0);
+    for(int i = 0; i < OUTPUT_SHARED_SLOTS; i++) {
+        header->sequence[i].store(0);
+        header->time[i] = 0;
+        header->camera[i] = -1;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = OUTPUT_SHARED_MAGIC;
+
+    LOG_INFO(LOG_DISPLAY, "Program output %dx%d to shared memory %s", width, height, sharedName.toLocal8Bit().constData());
+    return true;
+}
+
+/***
+ * Open File
+ * Author: Matthew Ribbins
+ * Description: Runs on the output thread. A FIFO can't be opened for writing until it has a reader, so we keep
+ *              trying (without blocking, so Close() isn't held up) until it has one. It stays non-blocking, see
+ *              WriteFile(). A regular file is truncated the first time (not when reopened after a failed write), so
+ *              nothing of an earlier run is left after our frames.
+ *
+ * Return: (bool) false if we were closed first
+ */
+bool ProgramOutput::OpenFile(const QString &path, bool truncate)
+{
+    QByteArray name = path.toLocal8Bit();
+    bool waiting = false;
+
+    while(running) {
+        fd = open(name.constData(), O_WRONLY | O_CREAT | O_NONBLOCK, 0644);
+        if(fd >= 0) {
+            struct stat info;
+            if(truncate && !fstat(fd, &info) && S_ISREG(info.st_mode) && ftruncate(fd, 0))
+                LOG_WARNING(LOG_DISPLAY, "Warning: Can't truncate program output %s, %s", name.constData(), strerror(errno));
+            LOG_INFO(LOG_DISPLAY, "Program output %dx%d RGB24 to %s", width, height, name.constData());
+            return true;
+        }
+        if(ENXIO != errno) {
+            LOG_ERROR(LOG_DISPLAY, "Error: Can't open program output %s, %s", name.constData(), strerror(errno));
+            failed++;
+        } else if(!waiting) {
+            LOG_INFO(LOG_DISPLAY, "Program output waiting for a reader on %s", name.constData());
+            waiting = true;
+        }
+        ThreadPolicy::Sleep(100000);
+    }
+    return false;
+}
+
+/***
+ * Put Frame
+ * Author: Matthew Ribbins
+ * Description: Hand over the newest program frame. Only a reference is taken, so this never waits on the output.
+ */
+void ProgramOutput::Put(const Frame &frame, int cameraId)
+{
+    if(!IsOpen() || frame.IsNull()) return;
+
+    QMutexLocker locker(&pendingMutex);
+    if(!pending.IsNull()) dropped++;
+    pending = frame;
+    pendingCamera = cameraId;
+    pendingReady.wakeOne();
+}
+
+void ProgramOutput::GetStats(unsigned int &written, unsigned int &dropped, unsigned int &failed)
+{
+    written = this->written.exchange(0);
+    dropped = this->dropped.exchange(0);
+    failed = this->failed.exchange(0);
+}
+
+/***
+ * Scale
+ * Author: Matthew Ribbins
+ * Description: Copy a frame into destination, which is the output size, scaling it if it isn't
+ */
+void ProgramOutput::Scale(const cv::Mat &frame, cv::Mat &destination)
+{
+    if(frame.cols == width && frame.rows == height)
+        frame.copyTo(destination);
+    else
+        cv::resize(frame, destination, destination.size(), 0, 0, cv::INTER_AREA);
+}
+
+/***
+ * Write Shared
+ * Author: Matthew Ribbins
+ * Description: Write into the slot after the newest, which no reader should still be copying, then make it the
+ *              newest. The slot's sequence is odd while we write it, so a reader that was too slow can tell.
+ */
+void ProgramOutput::WriteShared(const cv::Mat &frame, int cameraId)
+{
+    OutputSharedHeader *header = (OutputSharedHeader *)shared;
+    uint32_t slot = (header->latest.load(std::memory_order_relaxed) + 1) % OUTPUT_SHARED_SLOTS;
+    uint64_t sequence = header->sequence[slot].load(std::memory_order_relaxed);
+    cv::Mat destination(height, width, CV_8UC3, shared + OUTPUT_SHARED_HEADER_SIZE + slot * header->slotSize,
+                        header->stride);
+
+    header->sequence[slot].store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Scale(frame, destination);
+    header->time[slot] = Now();
+    header->camera[slot] = cameraId;
+    header->sequence[slot].store(sequence + 2, std::memory_order_release);
+
+    header->latest.store(slot, std::memory_order_release);
+    header->frames.fetch_add(1, std::memory_order_release);
+    written++;
+}
+
+/***
+ * Write File
+ * Author: Matthew Ribbins
+ * Description: Write a frame, packed and at the output size. If a FIFO's reader has gone we wait for another. If
+ *              it is full we wait for the reader to make room, checking every OUTPUT_WRITE_POLL that we haven't
+ *              been closed, so a reader that has stopped reading can't hang Close().
+ */
+void ProgramOutput::WriteFile(const cv::Mat &frame)
+{
+    const cv::Mat *out = &frame;
+
+    if(frame.cols != width || frame.rows != height || !frame.isContinuous()) {
+        Scale(frame, packed);
+        out = &packed;
+    }
+
+    const uchar *data = out->data;
+    size_t remaining = (size_t)width * height * 3;
+    while(remaining) {
+        ssize_t result = write(fd, data, remaining);
+        if(result < 0 && EINTR == errno) continue;
+        if(result < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            struct pollfd ready = { fd, POLLOUT, 0 };
+            if(!running) {
+                // Part of a frame is out, nothing after it would line up
+                close(fd);
+                fd = -1;
+                return;
+            }
+            poll(&ready, 1, OUTPUT_WRITE_POLL);
+            continue;
+        }
+        if(result <= 0) {
+            LOG_WARNING(LOG_DISPLAY, "Warning: Program output write failed, %s", strerror(errno));
+            failed++;
+            close(fd);
+            fd = -1;
+            return;
+        }
+        data += result;
+        remaining -= result;
+    }
+    written++;
+}
+
+/***
+ * Output Thread Loop
+ * Author: Matthew Ribbins
+ */
+void ProgramOutput::run()
+{
+    Logger::SetThreadName("output");
+    ThreadPolicy::Apply(THREAD_CLASS_NETWORK, "output");
+    bool reopen = false;
+
+    while(running) {
+        if(OUTPUT_FILE == kind && fd < 0) {
+            if(!OpenFile(target, !reopen)) break;
+            reopen = true;
+        }
+
+        pendingMutex.lock();
+        while(running && pending.IsNull())
+            pendingReady.wait(&pendingMutex);
+        Frame frame = pending;
+        int cameraId = pendingCamera;
+        pending.Release();
+        pendingMutex.unlock();
+        if(frame.IsNull()) continue;
+
+        EVENT_SCOPE("output", cameraId);
+        if(OUTPUT_SHARED == kind)
+            WriteShared(frame.GetMat(), cameraId);
+        else
+            WriteFile(frame.GetMat());
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef PROGRAMOUTPUT_H
+#define PROGRAMOUTPUT_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <stdint.h>
+#include <atomic>
+#include <opencv2/opencv.hpp>
+
+#include "framepool.h"
+#include "threadpolicy.h"
+#include "logger.h"
+
+// Program output for headless switchers: raw RGB24 frames to a file or FIFO (e.g. for ffmpeg -f rawvideo), or the
+// newest frame in shared memory for another process to pick up
+#define OUTPUT_NONE 0
+#define OUTPUT_FILE 1
+#define OUTPUT_SHARED 2
+
+// How long a write to a FIFO that is full waits at a time before checking we are still running (ms)
+#define OUTPUT_WRITE_POLL 100
+
+// Shared memory layout. Readers take header.latest, copy that slot, and keep the copy if the slot's sequence was
+// the same (and even) before and after. Odd while the slot is being written.
+#define OUTPUT_SHARED_MAGIC 0x4f505652 // "RVPO"
+#define OUTPUT_SHARED_VERSION 1
+#define OUTPUT_SHARED_SLOTS 3
+#define OUTPUT_SHARED_HEADER_SIZE 4096
+
+typedef struct _OutputSharedHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slots;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t slotSize;    // bytes, slot i starts at OUTPUT_SHARED_HEADER_SIZE + i * slotSize
+    std::atomic<uint32_t> latest;
+    uint32_t reserved;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> sequence[OUTPUT_SHARED_SLOTS];
+    int64_t time[OUTPUT_SHARED_SLOTS];  // CLOCK_MONOTONIC ns when the frame was written
+    int32_t camera[OUTPUT_SHARED_SLOTS];
+} OutputSharedHeader;
+
+class ProgramOutput : public QThread
+{
+public:
+    ProgramOutput(QObject *parent = 0);
+    ~ProgramOutput();
+    bool Open(const QString &target, int width, int height);
+    void Close(void);
+    bool IsOpen(void);
+
+    // Switcher thread
+    void Put(const Frame &frame, int cameraId);
+    void GetStats(unsigned int &written, unsigned int &dropped, unsigned int &failed);
+
+protected:
+    void run();
+
+private:
+    bool OpenShared(const QString &name);
+    bool OpenFile(const QString &path, bool truncate);
+    void Scale(const cv::Mat &frame, cv::Mat &destination);
+    void WriteShared(const cv::Mat &frame, int cameraId);
+    void WriteFile(const cv::Mat &frame);
+    static qint64 Now(void);
+
+    int kind;
+    QString target;
+    int width;
+    int height;
+    volatile bool running;
+
+    // Switcher thread to writer
+    QMutex pendingMutex;
+    QWaitCondition pendingReady;
+    Frame pending;
+    int pendingCamera;
+
+    // Writer only
+    int fd;
+    QString sharedName;
+    uchar *shared;
+    size_t sharedSize;
+    cv::Mat packed;
+
+    std::atomic<unsigned int> written;
+    std::atomic<unsigned int> dropped;
+    std::atomic<unsigned int> failed;
+};
+
+#endif // PROGRAMOUTPUT_H
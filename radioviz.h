@@ -7,8 +7,14 @@
 #include "camerawidget.h"
 #include "radioviz.h"
 
-// Maximum number of cameras available for use
-#define MAX_CAMERAS_AVAILABLE 5
+// Maximum number of sources (cameras) available for use
+#define MAX_CAMERAS_AVAILABLE 32
+
+// Maximum number of studios run by one process, sharing its audio and detector threads
+#define MAX_STUDIOS 8
+
+// How long to wait for the next digit of a source number (ms)
+#define SOURCE_ENTRY_TIMEOUT 750
 
 // Maximum number of audio devices for each camera device
 #define MAX_AUDIO_DEVICES_PER_CAMERA 2
@@ -26,11 +32,85 @@
 #define NUM_SECONDS     (15)
 #define DITHER_FLAG     (0)
 
+// Audio thread: every source is read once per interval (ms). Sources with no audio read as silence (dB).
+#define AUDIO_POLL_INTERVAL 40
+#define AUDIO_LEVEL_SILENCE (-100)
+
+// Program audio: off, follows the program camera, or mixes the active mics and ducks the rest
+#define AUDIO_MIX_OFF 0
+#define AUDIO_MIX_FOLLOW 1
+#define AUDIO_MIX_AUTO 2
+
+// Mixer rate and callback size (frames), each input's ring (samples, a power of two), default latency and
+// crossfade (ms), and how far inactive mics are ducked in the auto mix (dB)
+#define AUDIO_MIX_SAMPLE_RATE SAMPLE_RATE
+#define AUDIO_MIX_BUFFER 64
+#define AUDIO_MIX_CHANNELS 2
+#define AUDIO_RING_SIZE 8192
+#define AUDIO_MIX_DEFAULT_LATENCY 5
+#define AUDIO_MIX_DEFAULT_FADE 20
+#define AUDIO_MIX_DUCK (-20)
+
+// Mic recording. Each mic's ring (samples, a power of two, 1.5 s) is emptied every AUDIO_RECORD_INTERVAL (ms), file
+// space is allocated AUDIO_RECORD_PREALLOCATE (s) ahead, and a track starts a new file at AUDIO_RECORD_MAX_FILE
+// (MB). A mic that stops for more than AUDIO_RECORD_MAX_LAG (ms) is padded with silence, as is anything dropped.
+#define AUDIO_RECORD_RING_SIZE 65536
+#define AUDIO_RECORD_INTERVAL 100
+#define AUDIO_RECORD_PREALLOCATE 60
+#define AUDIO_RECORD_MAX_FILE 2048
+#define AUDIO_RECORD_MAX_LAG 500
+
 // OpenCV Defaults
 #define CAMERA_DEFAULT_RES_WIDTH 960
 #define CAMERA_DEFAULT_RES_HEIGHT 544
 #define CAMERA_DEFAULT_FPS 15
 
+// Capture format tiers. Cameras off air can run at a low analysis format, and are brought back to full before we
+// cut to them. CAMERA_TIER_HOLD (ms) is how long a camera stays at full after it was last a candidate, and an
+// automatic cut waits up to CAMERA_TIER_CUT_TIMEOUT (ms) for a camera to get there.
+#define CAMERA_TIER_ANALYSIS 0
+#define CAMERA_TIER_FULL 1
+#define CAMERA_TIER_COUNT 2
+#define CAMERA_ANALYSIS_RES_WIDTH 424
+#define CAMERA_ANALYSIS_RES_HEIGHT 240
+#define CAMERA_ANALYSIS_FPS 10
+#define CAMERA_TIER_HOLD 5000
+#define CAMERA_TIER_CUT_TIMEOUT 1000
+#define CAMERA_TIER_AUDIO_MARGIN 6
+
+// Capture thread wait after a failed capture (ms)
+#define CAPTURE_RETRY_DELAY 5
+
+// Stalled devices, e.g. after a USB reset (ms). An FFmpeg read gives up after CAPTURE_READ_TIMEOUT, and opening a
+// device after CAPTURE_OPEN_TIMEOUT. A camera without a frame for CAPTURE_STALL_TIMEOUT is stalled: it is left out
+// of selection and reopened every CAPTURE_REOPEN_INTERVAL until it gives us frames again. Shutting down waits CAPTURE_STOP_TIMEOUT for each capture thread.
+#define CAPTURE_READ_TIMEOUT 200
+#define CAPTURE_OPEN_TIMEOUT 3000
+#define CAPTURE_STALL_TIMEOUT 1000
+#define CAPTURE_REOPEN_INTERVAL 2000
+#define CAPTURE_STOP_TIMEOUT 1000
+
+// Capture results
+#define CAPTURE_NO_FRAME 0
+#define CAPTURE_NEW_FRAME 1
+#define CAPTURE_ANALYSIS_ONLY 2
+#define CAPTURE_DROPPED 3
+
+// Presentation
+#define DISPLAY_PACING_ARRIVAL 0
+#define DISPLAY_PACING_REFRESH 1
+#define DISPLAY_DEFAULT_REFRESH_RATE 60
+#define DISPLAY_STATS_INTERVAL 250
+
+// Timeshift/Replay
+#define TIMESHIFT_DEFAULT_SECONDS 30
+#define TIMESHIFT_DEFAULT_BUDGET 32
+#define TIMESHIFT_DEFAULT_CUE 10
+#define TIMESHIFT_JPEG_QUALITY 80
+
+// Camera selection timer (ms)
+#define DECISION_TIMER_INTERVAL 40
+
 #define MOTION_DETECTION_PIXEL_THRESHOLD 42
 #define MOTION_DETECTION_PIXEL_MAX 255
 #define MOTION_DETECTION_JUMP 2
@@ -39,6 +119,32 @@
 #define CAMERA_AUDIO_THRESHOLD (-29)
 #define CAMERA_MOVEMENT_THRESHOLD 3
 
+// Person detection. Budget is the share of one core (%) the detector may use, and results are reused for
+// DETECTOR_RESULT_LIFETIME (ms) before they are no longer trusted.
+#define DETECTOR_DEFAULT_BUDGET 15
+#define DETECTOR_DEFAULT_WEIGHT 0.5
+#define DETECTOR_WIDTH 480
+#define DETECTOR_SCALE_STEP 1.2
+#define DETECTOR_MIN_INTERVAL 200
+#define DETECTOR_RESULT_LIFETIME 3000
+#define DETECTOR_STATS_INTERVAL 10000
+
+// Bleed rejection. Every camera mic is compared with every other over BLEED_FRAME samples every BLEED_HOP samples,
+// and only while one of them is above BLEED_GATE (dB). Results are trusted for BLEED_RESULT_LIFETIME (ms). The mics
+// are lined up by when their samples were captured, averaged over BLEED_ALIGN_SMOOTHING hops; one more than
+// BLEED_MAX_SKEW samples out is brought back in line, and one more than BLEED_REALIGN out starts the averages again.
+#define BLEED_FRAME 1024
+#define BLEED_HOP 512
+#define BLEED_GATE (-50)
+#define BLEED_DEFAULT_WEIGHT 1
+#define BLEED_DEFAULT_MAX_DELAY 10
+#define BLEED_RESULT_LIFETIME 500
+#define BLEED_POLL_INTERVAL 5
+#define BLEED_MAX_SKEW 4
+#define BLEED_REALIGN 64
+#define BLEED_ALIGN_SMOOTHING 16
+#define BLEED_STATS_INTERVAL 10000
+
 // Switching Modes
 #define MODE_DISABLED 0
 #define MODE_AUTO_AUDIO 1
@@ -46,6 +152,24 @@
 #define MODE_AUTO_MULTI 3
 #define MODE_MANUAL 4
 
+// Transitions
+#define TRANSITION_CUT 0
+#define TRANSITION_MIX 1
+#define TRANSITION_DIP 2
+#define TRANSITION_WIPE 3
+#define TRANSITION_COUNT 4
+#define TRANSITION_DEFAULT_DURATION 500
+#define TRANSITION_WEIGHT_MAX 256
+// How long (ms) a transition waits for the camera it is going to, e.g. one that was only being analysed
+#define TRANSITION_WAIT_TIMEOUT 500
+
+// Compositor
+#define COMPOSITOR_MAX_SOURCES 4
+#define COMPOSITOR_LAYOUT_SPLIT 0
+#define COMPOSITOR_LAYOUT_PIP 1
+#define COMPOSITOR_PIP_SCALE 4
+#define COMPOSITOR_PIP_MARGIN 32
+
 
 // Classes
 class VizCamera
@@ -0,0 +1,114 @@
+/***
+ * RadioViz - remotecamera.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: A camera on a capture node. The node does the capture and analysis, and we are given its scores and
+ *              frames by the NodeClient, all on the GUI thread. While the camera is on program we ask the node for
+ *              full frames, otherwise it only sends small previews.
+ *
+ */
+#include "remotecamera.h"
+#include "nodeclient.h"
+
+RemoteCamera::RemoteCamera(NodeClient *node, int remoteId)
+    : Camera()
+{
+    this->node = node;
+    this->remoteId = remoteId;
+    this->level.store(AUDIO_LEVEL_SILENCE);
+    this->movement.store(0);
+    this->connected.store(true);
+    Camera::SetAnalysisOnly(true);
+}
+
+/***
+ * Capture Frame
+ * Author: Matthew Ribbins
+ * Description: Nothing to capture, frames come in through PutFrame()
+ */
+int RemoteCamera::CaptureFrame(void)
+{
+    return CAPTURE_NO_FRAME;
+}
+
+float RemoteCamera::GetAudioLevelFromDevice(void)
+{
+    float level = this->level.load(std::memory_order_relaxed);
+    return (AUDIO_LEVEL_SILENCE == level) ? level : level + GetAudioGain();
+}
+
+int RemoteCamera::GetMovementDetection(void)
+{
+    return movement.load(std::memory_order_relaxed);
+}
+
+/***
+ * Set Analysis Only
+ * Author: Matthew Ribbins
+ * Description: Tell the node whether we want full frames or previews, only when that changes
+ */
+void RemoteCamera::SetAnalysisOnly(bool analysisOnly)
+{
+    if(analysisOnly != IsAnalysisOnly())
+        node->Subscribe(remoteId, !analysisOnly);
+    Camera::SetAnalysisOnly(analysisOnly);
+}
+
+void RemoteCamera::PutScores(float level, int movement)
+{
+    this->level.store(level, std::memory_order_relaxed);
+    this->movement.store(movement, std::memory_order_relaxed);
+}
+
+/***
+ * Set Connected
+ * Author: Matthew Ribbins
+ * Description: Whether the camera's node is there. While it isn't the camera is silent and still, and stalled, so
+ *              it is left out of selection and cut away from until the node is back.
+ */
+void RemoteCamera::SetConnected(bool connected)
+{
+    this->connected.store(connected, std::memory_order_relaxed);
+    if(!connected) PutScores(AUDIO_LEVEL_SILENCE, 0);
+}
+
+/***
+ * Is Stalled
+ * Author: Matthew Ribbins
+ * Description: The node does the capture, so we have no capture thread to watch. The camera is stalled while its
+ *              node is gone.
+ */
+bool RemoteCamera::IsStalled(qint64)
+{
+    return !connected.load(std::memory_order_relaxed);
+}
+
+/***
+ * Put Frame
+ * Author: Matthew Ribbins
+ * Description: Decode a JPEG frame from the node and publish it. Previews still in flight when we asked for full
+ *              frames are ignored, so program doesn't drop to preview resolution for a frame.
+ *
+ * Return: (bool) true if the frame was published
+ */
+bool RemoteCamera::PutFrame(const QByteArray &jpeg, bool full)
+{
+    if(!full && !IsAnalysisOnly()) return false;
+
+    encodedFrame.assign(jpeg.constData(), jpeg.constData() + jpeg.size());
+    cv::imdecode(encodedFrame, CV_LOAD_IMAGE_COLOR, &decodedFrame);
+    if(decodedFrame.empty()) {
+        LOG_WARNING(LOG_CAMERA, "Could not decode frame from remote camera %d", remoteId);
+        return false;
+    }
+
+    cv::Mat *backFrame = GetBackBuffer(decodedFrame.cols, decodedFrame.rows);
+    if(!backFrame) return false;
+    cv::cvtColor(decodedFrame, *backFrame, CV_BGR2RGB);
+    PublishFrame();
+    return true;
+}
+
+int RemoteCamera::GetRemoteId(void)
+{
+    return remoteId;
+}
@@ -0,0 +1,38 @@
+#ifndef REMOTECAMERA_H
+#define REMOTECAMERA_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+
+#include "camera.h"
+#include "radioviz.h"
+
+class NodeClient;
+
+class RemoteCamera : public Camera
+{
+public:
+    RemoteCamera(NodeClient *node, int remoteId);
+    int CaptureFrame(void);
+    float GetAudioLevelFromDevice(void);
+    int GetMovementDetection(void);
+    void SetAnalysisOnly(bool analysisOnly);
+    bool IsStalled(qint64 now);
+
+    void PutScores(float level, int movement);
+    void SetConnected(bool connected);
+    bool PutFrame(const QByteArray &jpeg, bool full);
+    int GetRemoteId(void);
+
+private:
+    NodeClient *node;
+    int remoteId;
+    // Written on the GUI thread, read on the audio and detector threads
+    std::atomic<float> level;
+    std::atomic<int> movement;
+    std::atomic<bool> connected;
+    std::vector<uchar> encodedFrame;
+    cv::Mat decodedFrame;
+};
+
+#endif // REMOTECAMERA_H
@@ -0,0 +1,196 @@
+/***
+ * RadioViz - sourceregistry.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Registry of every source we can switch to. Owns each source's Camera and CaptureThread, and keeps
+ *              the per source state the decision tick works on as structure of arrays.
+ *
+ */
+#include <string.h>
+
+#include "sourceregistry.h"
+
+SourceRegistry::SourceRegistry()
+{
+    count = 0;
+    tiering = false;
+    memset(&state, 0, sizeof(state));
+    for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++) {
+        cameras[i] = NULL;
+        captureThreads[i] = NULL;
+        stuck[i] = false;
+    }
+}
+
+SourceRegistry::~SourceRegistry()
+{
+    StopCapture();
+    for(int i = 0; i < count; i++) {
+        if(!stuck[i]) delete cameras[i];
+    }
+}
+
+/***
+ * Add Source
+ * Author: Matthew Ribbins
+ * Description: Register a camera, the registry owns it from now on. If it can't be added it is still the caller's,
+ *              to delete.
+ *
+ * Return: (int) source id, or -1 if the registry is full
+ */
+int SourceRegistry::Add(Camera *camera)
+{
+    if(count >= MAX_CAMERAS_AVAILABLE) {
+        LOG_ERROR(LOG_GENERAL, "Error: More than %d sources, ignoring the rest", MAX_CAMERAS_AVAILABLE);
+        return -1;
+    }
+    cameras[count] = camera;
+    return count++;
+}
+
+/***
+ * Add Local Cameras
+ * Author: Matthew Ribbins
+ * Description: Find the cameras on this machine with FFmpeg, and add the ones in devices. If devices is empty we
+ *              add all of them, or none if allIfNone isn't set. Each camera's audio gain comes from the settings.
+ */
+void SourceRegistry::AddLocalCameras(QSettings &settings, const QList<int> &devices, bool allIfNone)
+{
+    PaError err;
+    AVDeviceInfoList *deviceList = NULL;
+
+    if(devices.isEmpty() && !allIfNone) return;
+
+    // Get available camera devices by using FFMpeg
+    av_register_all();
+    avdevice_register_all();
+    avcodec_register_all();
+
+    avdevice_list_input_sources(av_find_input_format("video4linux2"), NULL, NULL, &deviceList);
+    int deviceCount = deviceList ? deviceList->nb_devices : 0;
+
+    // Initialise PortAudio
+    err = Pa_Initialize();
+    if(err != paNoError)
+        qDebug() << "Error: PortAudio did not initialise";
+
+    int numAudioDevices = Pa_GetDeviceCount();
+    if(numAudioDevices < 0)
+       qDebug() << "Error: PortAudio did not find any audio devices";
+
+    qDebug() << "Number of available devices:"  << numAudioDevices - PORTAUDIO_TO_CAMERA_DEVICE_OFFSET << "\n";
+
+    for(int i = 0; i < numAudioDevices; i++)
+    {
+        const PaDeviceInfo *deviceInfo;
+        deviceInfo = Pa_GetDeviceInfo(i);
+        qDebug() << "Device " << i << ": " << deviceInfo->name;
+    }
+
+    // Initialise Cameras. FFmpeg lets us analyse MJPEG cameras without fully decoding them.
+    int videoMode = settings.value(QString("Video/mode"), CAMERA_MODE_OPENCV).toInt();
+
+    // With capture tiers, cameras start at the analysis format until they are needed on air
+    int tier = CAMERA_TIER_FULL;
+    tiering = settings.value(QString("Video/tiering"), false).toBool();
+    if(tiering) {
+        tier = CAMERA_TIER_ANALYSIS;
+        Camera::SetTierFormat(CAMERA_TIER_ANALYSIS, settings.value(QString("Video/analysisWidth"), CAMERA_ANALYSIS_RES_WIDTH).toInt(),
+                              settings.value(QString("Video/analysisHeight"), CAMERA_ANALYSIS_RES_HEIGHT).toInt(),
+                              settings.value(QString("Video/analysisFps"), CAMERA_ANALYSIS_FPS).toInt());
+    }
+
+    // How long a camera can go without a frame before we give up on it and reopen it
+    Camera::SetStallTimeout(settings.value(QString("Video/stallTimeout"), CAPTURE_STALL_TIMEOUT).toInt());
+
+    for(int i = 0; i < deviceCount; i++) {
+        if(!devices.isEmpty() && !devices.contains(i)) continue;
+
+        Camera *camera = new Camera(i, i, videoMode, tier);
+        int sourceId = Add(camera);
+        if(sourceId < 0) {
+            delete camera;
+            break;
+        }
+
+        // Settings. For some reason there's a reversal
+        int ffmpegi = deviceCount - i - 1;
+        QString settingKey(QString("Devices/").append(deviceList->devices[ffmpegi]->device_description));
+
+        int result = QString::compare(settings.value(QString(settingKey).append("/enabled")).toString(), "true", Qt::CaseInsensitive);
+
+        if(!result) {
+            // We have settings to load
+            qDebug() << "Load " << settingKey << "to Camera " << ffmpegi;
+            float gain = (settings.value(QString(settingKey).append("/gain"))).toFloat();
+            qDebug() << "Gain " << gain;
+            cameras[sourceId]->SetAudioGain(gain);
+
+        } else {
+            // We have a new device to save settings about
+            settings.setValue(QString(settingKey).append("/enabled"), true);
+
+            // Set current settings
+            settings.setValue(QString(settingKey).append("/gain"), cameras[sourceId]->GetAudioGain());
+        }
+    }
+}
+
+/***
+ * Start Capture
+ * Author: Matthew Ribbins
+ * Description: Start a source's capture thread, with its frameArrived(int) signal going to receiver's slot
+ */
+void SourceRegistry::StartCapture(int sourceId, QObject *receiver, const char *slot)
+{
+    if(sourceId < 0 || sourceId >= count || captureThreads[sourceId]) return;
+
+    captureThreads[sourceId] = new CaptureThread(cameras[sourceId], sourceId);
+    QObject::connect(captureThreads[sourceId], SIGNAL(frameArrived(int)), receiver, slot);
+    captureThreads[sourceId]->start();
+}
+
+/***
+ * Stop Capture
+ * Author: Matthew Ribbins
+ * Description: Stop every capture thread. One still stuck in its device is left to it, along with its camera,
+ *              rather than hold up shutting down or be deleted from under it.
+ */
+void SourceRegistry::StopCapture(void)
+{
+    for(int i = 0; i < count; i++) {
+        if(!captureThreads[i]) continue;
+        if(captureThreads[i]->Stop()) {
+            delete captureThreads[i];
+        } else {
+            LOG_WARNING(LOG_CAMERA, "Camera %d is stuck in its device, not waiting for it", i);
+            stuck[i] = true;
+        }
+        captureThreads[i] = NULL;
+    }
+}
+
+int SourceRegistry::GetCount(void)
+{
+    return count;
+}
+
+/***
+ * Is Tiering
+ * Author: Matthew Ribbins
+ * Description: Whether local cameras drop to the analysis capture format when they aren't needed on air
+ */
+bool SourceRegistry::IsTiering(void)
+{
+    return tiering;
+}
+
+Camera *SourceRegistry::GetCamera(int sourceId)
+{
+    if(sourceId < 0 || sourceId >= count) return NULL;
+    return cameras[sourceId];
+}
+
+SourceState &SourceRegistry::GetState(void)
+{
+    return state;
+}
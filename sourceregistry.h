@@ -0,0 +1,45 @@
+#ifndef SOURCEREGISTRY_H
+#define SOURCEREGISTRY_H
+
+#include <QSettings>
+#include <QList>
+
+#include "camera.h"
+#include "capturethread.h"
+#include "radioviz.h"
+
+// Per source state for the decision tick. One array per field, so each pass over the sources walks contiguous
+// memory and the policy's loops can be vectorised.
+typedef struct _SourceState {
+    float levels[MAX_CAMERAS_AVAILABLE];
+    int movement[MAX_CAMERAS_AVAILABLE];
+    float scores[MAX_CAMERAS_AVAILABLE];
+    bool active[MAX_CAMERAS_AVAILABLE];
+    float presence[MAX_CAMERAS_AVAILABLE];
+    float bleed[MAX_CAMERAS_AVAILABLE];
+} SourceState;
+
+class SourceRegistry
+{
+public:
+    SourceRegistry();
+    ~SourceRegistry();
+    int Add(Camera *camera);
+    void AddLocalCameras(QSettings &settings, const QList<int> &devices, bool allIfNone);
+    void StartCapture(int sourceId, QObject *receiver, const char *slot);
+    void StopCapture(void);
+    int GetCount(void);
+    bool IsTiering(void);
+    Camera *GetCamera(int sourceId);
+    SourceState &GetState(void);
+
+private:
+    Camera *cameras[MAX_CAMERAS_AVAILABLE];
+    CaptureThread *captureThreads[MAX_CAMERAS_AVAILABLE];
+    bool stuck[MAX_CAMERAS_AVAILABLE];
+    int count;
+    bool tiering;
+    SourceState state;
+};
+
+#endif // SOURCEREGISTRY_H
@@ -0,0 +1,94 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <string.h>
+
+// Lock free ring between one producer thread and one consumer thread, e.g. an audio callback and whoever reads its
+// samples. Neither side ever waits or allocates. Size must be a power of two.
+template<typename T, unsigned int Size>
+class SpscRing
+{
+public:
+    SpscRing()
+    {
+        head.store(0);
+        tail.store(0);
+        dropped.store(0);
+    }
+
+    // Producer: add up to count items, the rest are dropped and counted
+    unsigned int Push(const T *items, unsigned int count)
+    {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        unsigned int space = Size - (h - tail.load(std::memory_order_acquire));
+
+        if(count > space) {
+            dropped.fetch_add(count - space, std::memory_order_relaxed);
+            count = space;
+        }
+        unsigned int start = h & (Size - 1);
+        unsigned int first = (count < Size - start) ? count : Size - start;
+        memcpy(&buffer[start], items, first * sizeof(T));
+        memcpy(&buffer[0], items + first, (count - first) * sizeof(T));
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: take up to count items
+    unsigned int Pop(T *items, unsigned int count)
+    {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        unsigned int available = head.load(std::memory_order_acquire) - t;
+
+        if(count > available) count = available;
+        unsigned int start = t & (Size - 1);
+        unsigned int first = (count < Size - start) ? count : Size - start;
+        memcpy(items, &buffer[start], first * sizeof(T));
+        memcpy(items + first, &buffer[0], (count - first) * sizeof(T));
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: throw away up to count of the oldest items
+    unsigned int Skip(unsigned int count)
+    {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        unsigned int available = head.load(std::memory_order_acquire) - t;
+
+        if(count > available) count = available;
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    // Either side: items waiting, which may have changed by the time it is used
+    unsigned int GetAvailable(void)
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    // Producer: where the next item pushed will be, counting from the ring's start (wraps)
+    unsigned int GetWritePosition(void)
+    {
+        return head.load(std::memory_order_relaxed);
+    }
+
+    // Consumer: where the next item popped is, on the same count
+    unsigned int GetReadPosition(void)
+    {
+        return tail.load(std::memory_order_relaxed);
+    }
+
+    unsigned int TakeDropped(void)
+    {
+        return dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    T buffer[Size];
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    std::atomic<unsigned int> dropped;
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,258 @@
+/***
+ * RadioViz - switchingcore.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: The part of switching a studio that both MainWindow and HeadlessSwitcher need: scores for the
+ *              policy, the stalled camera watchdog and capture tiers. Nothing here touches a widget, a transition or
+ *              the output, so the two can't drift apart in how they decide.
+ *
+ */
+#include "switchingcore.h"
+
+SwitchingCore::SwitchingCore(SourceRegistry *sources, SwitchingPolicy *policy)
+{
+    this->sources = sources;
+    this->policy = policy;
+    audio = NULL;
+    studioIndex = -1;
+    detector = NULL;
+    detectorStudio = -1;
+    bleedDetector = NULL;
+    for(int i = 0; i < MAX_CAMERAS_AVAILABLE; i++) {
+        stalled[i] = false;
+        tierCandidateTime[i] = 0;
+        tierWaitStart[i] = 0;
+    }
+}
+
+/***
+ * Set Studio
+ * Author: Matthew Ribbins
+ * Description: Where the levels come from, and the name our log lines start with
+ */
+void SwitchingCore::SetStudio(const QByteArray &studioName, AudioWorker *audio, int studioIndex)
+{
+    this->studioName = studioName;
+    this->audio = audio;
+    this->studioIndex = studioIndex;
+}
+
+/***
+ * Set Detector
+ * Author: Matthew Ribbins
+ * Description: Person detection to weight the scores with, NULL for none
+ */
+void SwitchingCore::SetDetector(PersonDetector *detector, int detectorStudio)
+{
+    this->detector = detector;
+    this->detectorStudio = detectorStudio;
+}
+
+/***
+ * Set Bleed Detector
+ * Author: Matthew Ribbins
+ * Description: Bleed rejection for the levels, NULL for none. It stays the caller's to stop and delete.
+ */
+void SwitchingCore::SetBleedDetector(BleedDetector *bleedDetector)
+{
+    this->bleedDetector = bleedDetector;
+}
+
+/***
+ * Read Levels
+ * Author: Matthew Ribbins
+ * Description: The latest level of every mic into the source state. Stalled cameras can't be cut to, however loud
+ *              they are.
+ */
+void SwitchingCore::ReadLevels(void)
+{
+    SourceState &state = sources->GetState();
+
+    for(int i = 0; i < sources->GetCount(); i++) {
+        state.levels[i] = stalled[i] ? AUDIO_LEVEL_SILENCE : audio->GetLevel(studioIndex, i);
+        LOG_DEBUG(LOG_AUDIO, "%sCamera %d: %f", studioName.constData(), i, state.levels[i]);
+    }
+}
+
+/***
+ * Read Movement
+ * Author: Matthew Ribbins
+ * Description: Movement of every camera into the source state, none for stalled cameras
+ */
+void SwitchingCore::ReadMovement(void)
+{
+    SourceState &state = sources->GetState();
+
+    for(int i = 0; i < sources->GetCount(); i++) {
+        EVENT_SCOPE("motion", i);
+        state.movement[i] = stalled[i] ? 0 : sources->GetCamera(i)->GetMovementDetection();
+        LOG_DEBUG(LOG_CAMERA, "%sCamera %d: %d", studioName.constData(), i, state.movement[i]);
+    }
+}
+
+/***
+ * Select Based On Audio
+ * Author: Matthew Ribbins
+ * Description: Weight the levels from ReadLevels() and pick the loudest camera. Cameras with nobody in shot, and
+ *              mics hearing someone nearer another mic, count for less. The levels are left weighted, as the policy
+ *              saw them.
+ *
+ * Return: (int) camera to change to, or -1 to stay where we are
+ */
+int SwitchingCore::SelectBasedOnAudio(void)
+{
+    SourceState &state = sources->GetState();
+    int count = sources->GetCount();
+
+    if(detector) {
+        detector->UpdateLevels(detectorStudio, state.levels, count);
+        detector->GetPresence(detectorStudio, state.presence, count);
+        policy->WeightLevels(state.levels, state.presence, count);
+    }
+    if(bleedDetector) {
+        bleedDetector->GetBleed(state.bleed, count);
+        policy->RejectBleed(state.levels, state.bleed, count);
+    }
+
+    return policy->SelectBasedOnAudio(state.levels, state.active, count);
+}
+
+/***
+ * Select Based On Video
+ * Author: Matthew Ribbins
+ * Description: Weight the movement from ReadMovement() and pick the camera with the most
+ *
+ * Return: (int) camera to change to, or -1 to stay where we are
+ */
+int SwitchingCore::SelectBasedOnVideo(void)
+{
+    SourceState &state = sources->GetState();
+    int count = sources->GetCount();
+
+    if(detector) {
+        detector->UpdateMovement(detectorStudio, state.movement, count);
+        detector->GetPresence(detectorStudio, state.presence, count);
+        policy->WeightMovement(state.movement, state.presence, count);
+    }
+
+    return policy->SelectBasedOnVideo(state.movement, state.active, count);
+}
+
+/***
+ * Is Ready For Program
+ * Author: Matthew Ribbins
+ * Description: Automatic switching only cuts to a camera once it is capturing at full format, so there is no
+ *              stall or low resolution frame on air while it renegotiates. If it isn't yet, it is brought up and
+ *              we wait, for at most CAMERA_TIER_CUT_TIMEOUT. Manual cuts don't wait.
+ *
+ * Return: (bool) true if we can cut to the camera now
+ */
+bool SwitchingCore::IsReadyForProgram(int cameraId)
+{
+    Camera *camera = sources->GetCamera(cameraId);
+    qint64 now = TimeshiftBuffer::Now();
+
+    if(!camera) return true;
+    if(stalled[cameraId]) return false;
+    if(!sources->IsTiering() || CAMERA_TIER_FULL == camera->GetCaptureTier()) {
+        tierWaitStart[cameraId] = 0;
+        return true;
+    }
+
+    camera->SetCaptureTier(CAMERA_TIER_FULL);
+    tierCandidateTime[cameraId] = now;
+    if(!tierWaitStart[cameraId]) {
+        LOG_DEBUG(LOG_SWITCHING, "%sWaiting for camera %d to come up to full capture", studioName.constData(), cameraId);
+        tierWaitStart[cameraId] = now;
+    }
+    if(now - tierWaitStart[cameraId] < CAMERA_TIER_CUT_TIMEOUT) return false;
+
+    LOG_WARNING(LOG_SWITCHING, "%sCamera %d took too long to come up to full capture, cutting anyway",
+                studioName.constData(), cameraId);
+    tierWaitStart[cameraId] = 0;
+    return true;
+}
+
+/***
+ * Update Stalled Sources
+ * Author: Matthew Ribbins
+ * Description: Watchdog for the capture threads. A camera that has stopped giving us frames is left out of
+ *              selection until it recovers (its capture thread reopens it meanwhile).
+ *
+ * Return: (bool) true if the program camera has stalled and there is another to cut to, which an automatic mode
+ *         should do
+ */
+bool SwitchingCore::UpdateStalledSources(int programCamera)
+{
+    qint64 now = TimeshiftBuffer::Now();
+    int count = sources->GetCount();
+    int healthy = 0;
+
+    for(int i = 0; i < count; i++) {
+        bool isStalled = sources->GetCamera(i)->IsStalled(now);
+        healthy += !isStalled;
+        if(isStalled == stalled[i]) continue;
+
+        stalled[i] = isStalled;
+        if(isStalled)
+            LOG_WARNING(LOG_SWITCHING, "%sCamera %d has stalled, leaving it out until it recovers", studioName.constData(), i);
+        else
+            LOG_INFO(LOG_SWITCHING, "%sCamera %d has recovered", studioName.constData(), i);
+    }
+
+    return (programCamera >= 0 && programCamera < count && stalled[programCamera] && healthy);
+}
+
+/***
+ * Update Capture Tiers
+ * Author: Matthew Ribbins
+ * Description: Cameras that are on program, or are likely to be cut to soon, capture at the full format and the
+ *              rest at the analysis format. A camera is a candidate if it is close to the threshold for the mode
+ *              we are in, and it stays at full for CAMERA_TIER_HOLD after that so we don't keep renegotiating.
+ */
+void SwitchingCore::UpdateCaptureTiers(int mode, const bool *onProgram)
+{
+    SourceState &state = sources->GetState();
+    qint64 now = TimeshiftBuffer::Now();
+
+    if(!sources->IsTiering()) return;
+
+    for(int i = 0; i < sources->GetCount(); i++) {
+        bool candidate = onProgram[i] || state.active[i];
+        if(MODE_AUTO_AUDIO == mode)
+            candidate = candidate || (state.levels[i] > policy->GetAudioThreshold() - CAMERA_TIER_AUDIO_MARGIN);
+        else if(MODE_AUTO_MOVEMENT == mode)
+            candidate = candidate || (state.movement[i] * 2 > policy->GetMovementThreshold());
+
+        if(candidate) tierCandidateTime[i] = now;
+        sources->GetCamera(i)->SetCaptureTier((now - tierCandidateTime[i] < CAMERA_TIER_HOLD) ? CAMERA_TIER_FULL : CAMERA_TIER_ANALYSIS);
+    }
+}
+
+/***
+ * Is Stalled
+ * Author: Matthew Ribbins
+ * Description: As of the last UpdateStalledSources()
+ */
+bool SwitchingCore::IsStalled(int cameraId)
+{
+    if(cameraId < 0 || cameraId >= MAX_CAMERAS_AVAILABLE) return false;
+    return stalled[cameraId];
+}
+
+/***
+ * Get Next Healthy
+ * Author: Matthew Ribbins
+ * Description: The next camera after this one that hasn't stalled, wrapping round
+ *
+ * Return: (int) camera, or this one if every other has stalled
+ */
+int SwitchingCore::GetNextHealthy(int cameraId)
+{
+    int count = sources->GetCount();
+
+    for(int i = 1; i <= count; i++) {
+        int next = (cameraId + i) % count;
+        if(!stalled[next]) return next;
+    }
+    return cameraId;
+}
@@ -0,0 +1,52 @@
+#ifndef SWITCHINGCORE_H
+#define SWITCHINGCORE_H
+
+#include <QByteArray>
+
+#include "camera.h"
+#include "sourceregistry.h"
+#include "audioworker.h"
+#include "persondetector.h"
+#include "bleeddetector.h"
+#include "switchingpolicy.h"
+#include "timeshiftbuffer.h"
+#include "eventtrace.h"
+#include "logger.h"
+#include "radioviz.h"
+
+// A studio's switching state that isn't to do with the display: reading the scores, which cameras have stalled, which
+// capture at full format and whether one is ready to cut to. Shared by MainWindow and HeadlessSwitcher, which own
+// the sources and policy, and decide what a cut means for them.
+class SwitchingCore
+{
+public:
+    SwitchingCore(SourceRegistry *sources, SwitchingPolicy *policy);
+    void SetStudio(const QByteArray &studioName, AudioWorker *audio, int studioIndex);
+    void SetDetector(PersonDetector *detector, int detectorStudio);
+    void SetBleedDetector(BleedDetector *bleedDetector);
+
+    void ReadLevels(void);
+    void ReadMovement(void);
+    int SelectBasedOnAudio(void);
+    int SelectBasedOnVideo(void);
+    bool IsReadyForProgram(int cameraId);
+    bool UpdateStalledSources(int programCamera);
+    void UpdateCaptureTiers(int mode, const bool *onProgram);
+    bool IsStalled(int cameraId);
+    int GetNextHealthy(int cameraId);
+
+private:
+    SourceRegistry *sources;
+    SwitchingPolicy *policy;
+    QByteArray studioName;
+    AudioWorker *audio;
+    int studioIndex;
+    PersonDetector *detector;
+    int detectorStudio;
+    BleedDetector *bleedDetector;
+    bool stalled[MAX_CAMERAS_AVAILABLE];
+    qint64 tierCandidateTime[MAX_CAMERAS_AVAILABLE];
+    qint64 tierWaitStart[MAX_CAMERAS_AVAILABLE];
+};
+
+#endif // SWITCHINGCORE_H
@@ -0,0 +1,162 @@
+/***
+ * RadioViz - switchingpolicy.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Camera switching policy. Given the audio levels or movement of each camera, decide which camera
+ *              should be on. No devices, Qt or timing in here.
+ *
+ */
+#include "switchingpolicy.h"
+
+SwitchingPolicy::SwitchingPolicy(float audioThreshold, int movementThreshold)
+{
+    this->audioThreshold = audioThreshold;
+    this->movementThreshold = movementThreshold;
+    this->presenceWeight = 0;
+    this->bleedWeight = 0;
+    this->activeCount = 0;
+}
+
+/***
+ * Select Based On Audio
+ * Author: Matthew Ribbins
+ * Description: Cameras above the audio threshold are active, and the loudest camera wins
+ *
+ * Return: (int) camera to change to, or -1 to stay where we are
+ */
+int SwitchingPolicy::SelectBasedOnAudio(const float *levels, bool *active, int count)
+{
+    int loudestCamera = 0;
+    float loudestCameraLevel = -50;
+    int activeTotal = 0;
+
+    // Threshold every camera first, with no branches so the compiler can vectorise it
+    for(int i = 0; i < count; i++) {
+        active[i] = (levels[i] > audioThreshold);
+        activeTotal += active[i];
+    }
+    activeCount = activeTotal;
+    if(!activeCount) return -1;
+
+    for(int i = 0; i < count; i++) {
+        if(levels[i] > loudestCameraLevel) {
+            loudestCamera = i;
+            loudestCameraLevel = levels[i];
+        }
+    }
+    return loudestCamera;
+}
+
+/***
+ * Select Based On Video
+ * Author: Matthew Ribbins
+ * Description: Cameras with movement above the threshold are active, and the one with the most movement wins
+ *
+ * Return: (int) camera to change to, or -1 to stay where we are
+ */
+int SwitchingPolicy::SelectBasedOnVideo(const int *movement, bool *active, int count)
+{
+    int highestActive = -1;
+    int highestActiveLevel = 0;
+    int activeTotal = 0;
+
+    for(int i = 0; i < count; i++) {
+        active[i] = (movement[i] > movementThreshold);
+        activeTotal += active[i];
+    }
+    activeCount = activeTotal;
+    if(!activeCount) return -1;
+
+    for(int i = 0; i < count; i++) {
+        if(active[i] && movement[i] > highestActiveLevel) {
+            highestActive = i;
+            highestActiveLevel = movement[i];
+        }
+    }
+    return highestActive;
+}
+
+/***
+ * Weight Levels
+ * Author: Matthew Ribbins
+ * Description: Turn down cameras with nobody in shot by up to POLICY_PRESENCE_PENALTY dB, depending on the
+ *              presence weight. presence is 0 (nobody) to 1 (someone, or we don't know).
+ */
+void SwitchingPolicy::WeightLevels(float *levels, const float *presence, int count)
+{
+    for(int i = 0; i < count; i++)
+        levels[i] -= presenceWeight * (1 - presence[i]) * POLICY_PRESENCE_PENALTY;
+}
+
+/***
+ * Weight Movement
+ * Author: Matthew Ribbins
+ * Description: Scale down movement from cameras with nobody in shot, so a swinging door counts for less than a
+ *              presenter. A weight of 1 ignores movement without a person entirely.
+ */
+void SwitchingPolicy::WeightMovement(int *movement, const float *presence, int count)
+{
+    for(int i = 0; i < count; i++)
+        movement[i] = (int)(movement[i] * (1 - presenceWeight * (1 - presence[i])));
+}
+
+/***
+ * Reject Bleed
+ * Author: Matthew Ribbins
+ * Description: Turn down mics that are hearing someone nearer another mic by up to POLICY_BLEED_PENALTY dB,
+ *              depending on the bleed weight. bleed is 0 (nearest, or we don't know) to 1 (sure it is bleed).
+ */
+void SwitchingPolicy::RejectBleed(float *levels, const float *bleed, int count)
+{
+    for(int i = 0; i < count; i++)
+        levels[i] -= bleedWeight * bleed[i] * POLICY_BLEED_PENALTY;
+}
+
+/***
+ * Get Active Count
+ * Author: Matthew Ribbins
+ * Description: Number of active cameras at the last decision
+ */
+int SwitchingPolicy::GetActiveCount(void)
+{
+    return activeCount;
+}
+
+void SwitchingPolicy::SetAudioThreshold(float threshold)
+{
+    audioThreshold = threshold;
+}
+
+float SwitchingPolicy::GetAudioThreshold(void)
+{
+    return audioThreshold;
+}
+
+void SwitchingPolicy::SetMovementThreshold(int threshold)
+{
+    movementThreshold = threshold;
+}
+
+int SwitchingPolicy::GetMovementThreshold(void)
+{
+    return movementThreshold;
+}
+
+void SwitchingPolicy::SetPresenceWeight(float weight)
+{
+    presenceWeight = weight;
+}
+
+float SwitchingPolicy::GetPresenceWeight(void)
+{
+    return presenceWeight;
+}
+
+void SwitchingPolicy::SetBleedWeight(float weight)
+{
+    bleedWeight = weight;
+}
+
+float SwitchingPolicy::GetBleedWeight(void)
+{
+    return bleedWeight;
+}
@@ -0,0 +1,39 @@
+#ifndef SWITCHINGPOLICY_H
+#define SWITCHINGPOLICY_H
+
+// Most a camera with nobody in shot is turned down by (dB), at a presence weight of 1
+#define POLICY_PRESENCE_PENALTY 12
+// Most a mic that is only hearing someone nearer another mic is turned down by (dB), at a bleed weight of 1. Bleed
+// in a small studio is typically 6-12 dB down on the nearest mic.
+#define POLICY_BLEED_PENALTY 12
+
+// Switching decisions, kept apart from MainWindow (and Qt) so recorded traces can be replayed through them
+class SwitchingPolicy
+{
+public:
+    SwitchingPolicy(float audioThreshold, int movementThreshold);
+    int SelectBasedOnAudio(const float *levels, bool *active, int count);
+    int SelectBasedOnVideo(const int *movement, bool *active, int count);
+    int GetActiveCount(void);
+    void WeightLevels(float *levels, const float *presence, int count);
+    void WeightMovement(int *movement, const float *presence, int count);
+    void RejectBleed(float *levels, const float *bleed, int count);
+
+    void SetAudioThreshold(float threshold);
+    float GetAudioThreshold(void);
+    void SetMovementThreshold(int threshold);
+    int GetMovementThreshold(void);
+    void SetPresenceWeight(float weight);
+    float GetPresenceWeight(void);
+    void SetBleedWeight(float weight);
+    float GetBleedWeight(void);
+
+private:
+    float audioThreshold;
+    int movementThreshold;
+    float presenceWeight;
+    float bleedWeight;
+    int activeCount;
+};
+
+#endif // SWITCHINGPOLICY_H
@@ -0,0 +1,58 @@
+/***
+ * RadioViz - syntheticcamera.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: A camera with no device, for measuring latency. Each frame has a moving bar, so there is movement
+ *              to detect, and a latency strip holding its frame counter and the time it was captured.
+ *
+ */
+#include <unistd.h>
+
+#include "syntheticcamera.h"
+
+SyntheticCamera::SyntheticCamera(int width, int height, int fps)
+    : Camera()
+{
+    this->width = width;
+    this->height = height;
+    this->fps = (fps > 0) ? fps : CAMERA_DEFAULT_FPS;
+    this->counter = 0;
+    this->nextFrame = 0;
+}
+
+/***
+ * Capture Frame
+ * Author: Matthew Ribbins
+ * Description: Wait until the next frame is due, as a device would, then draw it into the back buffer and stamp
+ *              it with the time just before it is published
+ */
+int SyntheticCamera::CaptureFrame(void)
+{
+    int64_t now = LatencyStrip::Now();
+
+    if(!nextFrame) nextFrame = now;
+    if(now < nextFrame)
+        usleep(nextFrame - now);
+    nextFrame += 1000000 / fps;
+
+    cv::Mat *back = GetBackBuffer(width, height);
+    if(!back) return CAPTURE_DROPPED;
+    cv::Mat &frame = *back;
+    frame.setTo(cv::Scalar(64, 64, 64));
+    int barX = (counter * 8) % width;
+    cv::rectangle(frame, cv::Rect(barX, height / 4, width / 16, height / 2), cv::Scalar(255, 255, 255), CV_FILLED);
+
+    LatencyStrip::Encode(frame, counter++, LatencyStrip::Now());
+    SaveStoredFrame(frame);
+    PublishFrame();
+    return CAPTURE_NEW_FRAME;
+}
+
+/***
+ * Get Audio Level
+ * Author: Matthew Ribbins
+ * Description: Silence, we have no audio device
+ */
+float SyntheticCamera::GetAudioLevelFromDevice(void)
+{
+    return AUDIO_LEVEL_SILENCE + GetAudioGain();
+}
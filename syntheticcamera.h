@@ -0,0 +1,25 @@
+#ifndef SYNTHETICCAMERA_H
+#define SYNTHETICCAMERA_H
+
+#include <opencv2/opencv.hpp>
+
+#include "camera.h"
+#include "latencystrip.h"
+#include "radioviz.h"
+
+class SyntheticCamera : public Camera
+{
+public:
+    SyntheticCamera(int width, int height, int fps);
+    int CaptureFrame(void);
+    float GetAudioLevelFromDevice(void);
+
+private:
+    int width;
+    int height;
+    int fps;
+    unsigned int counter;
+    int64_t nextFrame;
+};
+
+#endif // SYNTHETICCAMERA_H
@@ -0,0 +1,272 @@
+/***
+ * RadioViz - threadpolicy.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: CPU affinity and scheduling for each class of thread, and how late each thread wakes up. On a shared
+ *              machine other processes can hold a capture or audio thread off the CPU long enough to drop frames or
+ *              glitch audio, so each class can be pinned to its own CPUs and audio/capture run SCHED_FIFO/SCHED_RR
+ *              with our memory locked.
+ *
+ *              Settings, for each of gui, capture, audio, analysis and network:
+ *                Threads/<class>Cpus      CPUs to run on, e.g. 2,3 or 4-7
+ *                Threads/<class>Policy    other (default), fifo or rr
+ *                Threads/<class>Priority  real time priority, for fifo and rr
+ *              and Threads/lockMemory to lock all our memory, which needs RLIMIT_MEMLOCK to cover the timeshift
+ *              buffers as well.
+ *
+ *              Real time scheduling needs CAP_SYS_NICE or an rtprio limit. If we don't have it the thread carries
+ *              on with normal scheduling and a warning is logged.
+ *
+ */
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "threadpolicy.h"
+
+static const char *classNames[THREAD_CLASS_COUNT] = { "gui", "capture", "audio", "analysis", "network" };
+
+ThreadClassPolicy ThreadPolicy::policies[THREAD_CLASS_COUNT];
+QMutex ThreadPolicy::jitterMutex;
+std::vector<ThreadJitter *> ThreadPolicy::jitters;
+qint64 ThreadPolicy::lastReport = 0;
+
+static thread_local ThreadJitter *threadJitter = NULL;
+
+qint64 ThreadPolicy::Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/***
+ * Load Thread Policy
+ * Author: Matthew Ribbins
+ * Description: Read each class's CPUs and scheduling from the settings, and lock our memory if asked. Call this
+ *              before any of the threads start.
+ */
+void ThreadPolicy::Load(QSettings &settings)
+{
+    for(int i = 0; i < THREAD_CLASS_COUNT; i++) {
+        ThreadClassPolicy &policy = policies[i];
+        QString prefix = QString("Threads/").append(classNames[i]);
+        QString cpus = settings.value(prefix + "Cpus").toString();
+        QString scheduling = settings.value(prefix + "Policy", "other").toString().toLower();
+
+        CPU_ZERO(&policy.cpus);
+        policy.cpuCount = 0;
+        if(!cpus.isEmpty() && !ParseCpus(cpus, policy.cpus, policy.cpuCount))
+            LOG_WARNING(LOG_GENERAL, "Warning: Bad CPU list for %s threads, not pinning them", classNames[i]);
+
+        if("fifo" == scheduling) {
+            policy.policy = SCHED_FIFO;
+        } else if("rr" == scheduling) {
+            policy.policy = SCHED_RR;
+        } else {
+            policy.policy = SCHED_OTHER;
+            if("other" != scheduling)
+                LOG_WARNING(LOG_GENERAL, "Warning: Unknown scheduling policy for %s threads", classNames[i]);
+        }
+
+        policy.priority = settings.value(prefix + "Priority", THREAD_DEFAULT_PRIORITY).toInt();
+        if(SCHED_OTHER != policy.policy) {
+            int min = sched_get_priority_min(policy.policy);
+            int max = sched_get_priority_max(policy.policy);
+            if(policy.priority < min) policy.priority = min;
+            if(policy.priority > max) policy.priority = max;
+        }
+    }
+
+    if(settings.value(QString("Threads/lockMemory"), false).toBool()) {
+        if(mlockall(MCL_CURRENT | MCL_FUTURE))
+            LOG_WARNING(LOG_GENERAL, "Warning: Could not lock memory: %s", strerror(errno));
+        else
+            LOG_INFO(LOG_GENERAL, "Memory locked");
+    }
+}
+
+/***
+ * Parse CPUs
+ * Author: Matthew Ribbins
+ * Description: CPU set from a list like 0,2,4-7
+ *
+ * Return: (bool) false if the list isn't valid
+ */
+bool ThreadPolicy::ParseCpus(const QString &list, cpu_set_t &cpus, int &count)
+{
+    QStringList items = list.split(',', QString::SkipEmptyParts);
+
+    for(int i = 0; i < items.size(); i++) {
+        QStringList range = items.at(i).trimmed().split('-');
+        bool firstOk, lastOk = true;
+        int first = range.at(0).toInt(&firstOk);
+        int last = (range.size() > 1) ? range.at(1).toInt(&lastOk) : first;
+
+        if(!firstOk || !lastOk || range.size() > 2 || first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for(int cpu = first; cpu <= last; cpu++) {
+            if(!CPU_ISSET(cpu, &cpus)) count++;
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    return count > 0;
+}
+
+/***
+ * Apply Thread Policy
+ * Author: Matthew Ribbins
+ * Description: Pin the calling thread to its class's CPUs and give it its class's scheduling. The thread is
+ *              reported on, and named in saved event traces, by name from then on.
+ */
+void ThreadPolicy::Apply(int threadClass, const char *name)
+{
+    ThreadJitter *jitter = GetJitter();
+    int err;
+
+    strncpy(jitter->name, name, sizeof(jitter->name) - 1);
+    EventTrace::SetThreadName(name);
+    if(threadClass < 0 || threadClass >= THREAD_CLASS_COUNT) return;
+    ThreadClassPolicy &policy = policies[threadClass];
+
+#ifdef __linux__
+    if(policy.cpuCount) {
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &policy.cpus);
+        if(err)
+            LOG_WARNING(LOG_GENERAL, "Warning: Could not pin %s to its CPUs: %s", name, strerror(err));
+    }
+#endif
+
+    if(SCHED_OTHER != policy.policy) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = policy.priority;
+        err = pthread_setschedparam(pthread_self(), policy.policy, &param);
+        if(err) {
+            LOG_WARNING(LOG_GENERAL, "Warning: Could not give %s real time scheduling: %s", name, strerror(err));
+        } else {
+            LOG_INFO(LOG_GENERAL, "%s running %s priority %d", name,
+                     (SCHED_FIFO == policy.policy) ? "SCHED_FIFO" : "SCHED_RR", policy.priority);
+        }
+    }
+}
+
+/***
+ * Get Jitter
+ * Author: Matthew Ribbins
+ * Description: The calling thread's jitter record, made the first time it is needed. Records are never freed, as
+ *              they may still be reported on after their thread has gone.
+ */
+ThreadJitter *ThreadPolicy::GetJitter(void)
+{
+    if(!threadJitter) {
+        ThreadJitter *jitter = new ThreadJitter;
+        memset(jitter->name, 0, sizeof(jitter->name));
+        jitter->samples.store(0);
+        jitter->total.store(0);
+        jitter->max.store(0);
+        jitter->switches.store(0);
+        jitter->lastTick = 0;
+        jitter->period = 0;
+        jitter->lastSwitches = -1;
+
+        QMutexLocker locker(&jitterMutex);
+        snprintf(jitter->name, sizeof(jitter->name), "thread%d", (int)jitters.size());
+        jitters.push_back(jitter);
+        threadJitter = jitter;
+    }
+    return threadJitter;
+}
+
+/***
+ * Record Jitter
+ * Author: Matthew Ribbins
+ * Description: Add one wake up that was deviation (ns) away from when it should have been, along with how many
+ *              times since the last one the thread was taken off the CPU when it didn't want to be
+ */
+void ThreadPolicy::Record(ThreadJitter *jitter, qint64 deviation)
+{
+    jitter->samples.fetch_add(1, std::memory_order_relaxed);
+    jitter->total.fetch_add(deviation, std::memory_order_relaxed);
+    if(deviation > jitter->max.load(std::memory_order_relaxed))
+        jitter->max.store(deviation, std::memory_order_relaxed);
+
+#ifdef __linux__
+    struct rusage usage;
+    if(!getrusage(RUSAGE_THREAD, &usage)) {
+        if(jitter->lastSwitches >= 0)
+            jitter->switches.fetch_add(usage.ru_nivcsw - jitter->lastSwitches, std::memory_order_relaxed);
+        jitter->lastSwitches = usage.ru_nivcsw;
+    }
+#endif
+}
+
+/***
+ * Tick
+ * Author: Matthew Ribbins
+ * Description: Called once per loop by threads that run periodically, such as the GUI timer or a camera's frames.
+ *              Jitter is how far each period is from the thread's recent average period.
+ */
+void ThreadPolicy::Tick(void)
+{
+    ThreadJitter *jitter = GetJitter();
+    qint64 now = Now();
+
+    if(jitter->lastTick) {
+        qint64 interval = now - jitter->lastTick;
+        if(jitter->period) {
+            Record(jitter, (interval > jitter->period) ? interval - jitter->period : jitter->period - interval);
+            jitter->period += (interval - jitter->period) / THREAD_PERIOD_SMOOTHING;
+        } else {
+            jitter->period = interval;
+        }
+    }
+    jitter->lastTick = now;
+}
+
+/***
+ * Sleep
+ * Author: Matthew Ribbins
+ * Description: Sleep for us microseconds. Jitter is how late we woke up.
+ */
+void ThreadPolicy::Sleep(qint64 us)
+{
+    ThreadJitter *jitter = GetJitter();
+    qint64 wake = Now() + us * 1000;
+    struct timespec ts;
+
+    ts.tv_sec = wake / 1000000000LL;
+    ts.tv_nsec = wake % 1000000000LL;
+    while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+
+    qint64 late = Now() - wake;
+    Record(jitter, (late > 0) ? late : 0);
+}
+
+/***
+ * Report Jitter
+ * Author: Matthew Ribbins
+ * Description: Every THREAD_REPORT_INTERVAL, log each thread's mean and worst jitter and how often it was
+ *              preempted since the last report. Call it as often as you like.
+ */
+void ThreadPolicy::Report(void)
+{
+    qint64 now = Now();
+
+    if(now - lastReport < THREAD_REPORT_INTERVAL * 1000000LL) return;
+    lastReport = now;
+
+    QMutexLocker locker(&jitterMutex);
+    for(size_t i = 0; i < jitters.size(); i++) {
+        ThreadJitter *jitter = jitters[i];
+        long long samples = jitter->samples.exchange(0, std::memory_order_relaxed);
+        long long total = jitter->total.exchange(0, std::memory_order_relaxed);
+        long long max = jitter->max.exchange(0, std::memory_order_relaxed);
+        long long switches = jitter->switches.exchange(0, std::memory_order_relaxed);
+
+        if(!samples) continue;
+        LOG_INFO(LOG_GENERAL, "Thread %s jitter mean %.3f max %.3f ms over %lld wake ups, preempted %lld times",
+                 jitter->name, total / 1e6 / samples, max / 1e6, samples, switches);
+    }
+}
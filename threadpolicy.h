@@ -0,0 +1,71 @@
+#ifndef THREADPOLICY_H
+#define THREADPOLICY_H
+
+#include <QSettings>
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+#include "logger.h"
+#include "eventtrace.h"
+
+// Thread classes, each with its own CPU set and scheduling from the settings
+#define THREAD_CLASS_GUI 0
+#define THREAD_CLASS_CAPTURE 1
+#define THREAD_CLASS_AUDIO 2
+#define THREAD_CLASS_ANALYSIS 3
+#define THREAD_CLASS_NETWORK 4
+#define THREAD_CLASS_COUNT 5
+
+// Real time priority if a class asks for SCHED_FIFO/SCHED_RR without giving one
+#define THREAD_DEFAULT_PRIORITY 50
+
+// How often jitter is reported (ms), and how quickly a thread's average period follows changes (1/n per tick)
+#define THREAD_REPORT_INTERVAL 10000
+#define THREAD_PERIOD_SMOOTHING 16
+
+typedef struct _ThreadClassPolicy {
+    cpu_set_t cpus;
+    int cpuCount;
+    int policy;
+    int priority;
+} ThreadClassPolicy;
+
+// Written by the thread it belongs to, read and reset by whoever reports
+typedef struct _ThreadJitter {
+    char name[16];
+    std::atomic<long long> samples;
+    std::atomic<long long> total;
+    std::atomic<long long> max;
+    std::atomic<long long> switches;
+    qint64 lastTick;
+    qint64 period;
+    long lastSwitches;
+} ThreadJitter;
+
+class ThreadPolicy
+{
+public:
+    static void Load(QSettings &settings);
+    static void Apply(int threadClass, const char *name);
+    static void Tick(void);
+    static void Sleep(qint64 us);
+    static void Report(void);
+    static qint64 Now(void);
+
+private:
+    static bool ParseCpus(const QString &list, cpu_set_t &cpus, int &count);
+    static ThreadJitter *GetJitter(void);
+    static void Record(ThreadJitter *jitter, qint64 deviation);
+
+    static ThreadClassPolicy policies[THREAD_CLASS_COUNT];
+    static QMutex jitterMutex;
+    static std::vector<ThreadJitter *> jitters;
+    static qint64 lastReport;
+};
+
+#endif // THREADPOLICY_H
@@ -0,0 +1,160 @@
+/***
+ * RadioViz - timeshiftbuffer.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Timeshift buffer for instant replay. Keeps the last few seconds of compressed (JPEG) frames for a
+ *              camera in one preallocated block of memory, indexed by sequence number and timestamp.
+ *
+ */
+#include "timeshiftbuffer.h"
+
+/***
+ * Timeshift Buffer Constructor
+ * Author: Matthew Ribbins
+ * Description: Everything is allocated here. seconds is how far back we keep, budget is the memory for frames in
+ *              bytes, and fps sizes the index.
+ */
+TimeshiftBuffer::TimeshiftBuffer(int seconds, int budget, int fps)
+{
+    capacity = budget;
+    maxEntries = seconds * fps * 2;
+    duration = (qint64)seconds * 1000;
+
+    data = new uchar[capacity];
+    entries = new TimeshiftEntry[maxEntries];
+    firstSequence = 0;
+    nextSequence = 0;
+    writeOffset = 0;
+}
+
+TimeshiftBuffer::~TimeshiftBuffer()
+{
+    delete[] data;
+    delete[] entries;
+}
+
+/***
+ * Now
+ * Author: Matthew Ribbins
+ * Description: Monotonic clock in ms that all timeshift timestamps use
+ */
+qint64 TimeshiftBuffer::Now(void)
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock.msecsSinceReference();
+}
+
+TimeshiftEntry &TimeshiftBuffer::Entry(qint64 sequence)
+{
+    return entries[sequence % maxEntries];
+}
+
+/***
+ * Push Frame
+ * Author: Matthew Ribbins
+ * Description: Append a compressed frame. Frames are written one after the other, wrapping to the start when
+ *              the next one doesn't fit, and the oldest frames are dropped to make room or once they are too old.
+ *
+ * Return: (bool) false if the frame is bigger than the whole buffer
+ */
+bool TimeshiftBuffer::Push(const uchar *data, int length, qint64 timestamp)
+{
+    if(length <= 0 || length > capacity) return false;
+
+    QMutexLocker locker(&mutex);
+
+    if(writeOffset + length > capacity) {
+        // Everything from here to the end is older than anything at the start, so it goes first
+        while(firstSequence < nextSequence && Entry(firstSequence).offset >= writeOffset)
+            firstSequence++;
+        writeOffset = 0;
+    }
+
+    // Drop anything we are about to write over, anything too old, and make room in the index
+    while(firstSequence < nextSequence) {
+        TimeshiftEntry &oldest = Entry(firstSequence);
+        bool overlaps = (oldest.offset < writeOffset + length && oldest.offset + oldest.length > writeOffset);
+        bool expired = (timestamp - oldest.timestamp > duration);
+        bool full = (nextSequence - firstSequence >= maxEntries);
+
+        if(!overlaps && !expired && !full) break;
+        firstSequence++;
+    }
+
+    memcpy(this->data + writeOffset, data, length);
+
+    TimeshiftEntry &entry = Entry(nextSequence);
+    entry.timestamp = timestamp;
+    entry.offset = writeOffset;
+    entry.length = length;
+    nextSequence++;
+
+    writeOffset += length;
+    return true;
+}
+
+/***
+ * Find Frame
+ * Author: Matthew Ribbins
+ * Description: Binary search for the last frame at or before timestamp
+ *
+ * Return: (qint64) sequence number, or the oldest frame if timestamp is before it. -1 if the buffer is empty.
+ */
+qint64 TimeshiftBuffer::Find(qint64 timestamp)
+{
+    QMutexLocker locker(&mutex);
+    qint64 low = firstSequence;
+    qint64 high = nextSequence - 1;
+
+    if(firstSequence == nextSequence) return -1;
+    if(Entry(low).timestamp >= timestamp) return low;
+
+    while(low < high) {
+        qint64 middle = low + (high - low + 1) / 2;
+        if(Entry(middle).timestamp <= timestamp)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+/***
+ * Read Frame
+ * Author: Matthew Ribbins
+ * Description: Copy a frame out of the buffer, since it may be written over once we let go of the lock
+ *
+ * Return: (bool) false if the frame has already been dropped or doesn't exist yet
+ */
+bool TimeshiftBuffer::Read(qint64 sequence, std::vector<uchar> &packet, qint64 *timestamp)
+{
+    QMutexLocker locker(&mutex);
+
+    if(sequence < firstSequence || sequence >= nextSequence) return false;
+
+    TimeshiftEntry &entry = Entry(sequence);
+    packet.assign(data + entry.offset, data + entry.offset + entry.length);
+    if(timestamp) *timestamp = entry.timestamp;
+    return true;
+}
+
+qint64 TimeshiftBuffer::GetFirstSequence(void)
+{
+    QMutexLocker locker(&mutex);
+    return firstSequence;
+}
+
+qint64 TimeshiftBuffer::GetLastSequence(void)
+{
+    QMutexLocker locker(&mutex);
+    return nextSequence - 1;
+}
+
+int TimeshiftBuffer::GetUsedBytes(void)
+{
+    QMutexLocker locker(&mutex);
+    int used = 0;
+    for(qint64 i = firstSequence; i < nextSequence; i++)
+        used += Entry(i).length;
+    return used;
+}
@@ -0,0 +1,45 @@
+#ifndef TIMESHIFTBUFFER_H
+#define TIMESHIFTBUFFER_H
+
+#include <QMutex>
+#include <QElapsedTimer>
+#include <vector>
+
+#include "radioviz.h"
+
+typedef struct _TimeshiftEntry {
+    qint64 timestamp;
+    int offset;
+    int length;
+} TimeshiftEntry;
+
+class TimeshiftBuffer
+{
+public:
+    TimeshiftBuffer(int seconds, int budget, int fps);
+    ~TimeshiftBuffer();
+    bool Push(const uchar *data, int length, qint64 timestamp);
+    qint64 Find(qint64 timestamp);
+    bool Read(qint64 sequence, std::vector<uchar> &packet, qint64 *timestamp);
+    qint64 GetFirstSequence(void);
+    qint64 GetLastSequence(void);
+    int GetUsedBytes(void);
+
+    static qint64 Now(void);
+
+private:
+    uchar *data;
+    int capacity;
+    TimeshiftEntry *entries;
+    int maxEntries;
+    qint64 firstSequence;
+    qint64 nextSequence;
+    int writeOffset;
+    qint64 duration;
+    QMutex mutex;
+
+protected:
+    TimeshiftEntry &Entry(qint64 sequence);
+};
+
+#endif // TIMESHIFTBUFFER_H
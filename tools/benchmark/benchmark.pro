@@ -0,0 +1,51 @@
+#-------------------------------------------------
+#
+# Microbenchmarks for the per-frame and per-buffer kernels
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG   += console alloccount
+CONFIG   -= app_bundle
+
+alloccount: DEFINES += ALLOCATION_COUNTER
+
+TARGET = benchmark
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../camera.cpp \
+    ../../camerawidget.cpp \
+    ../../latencystrip.cpp \
+    ../../timeshiftbuffer.cpp \
+    ../../jpegdc.cpp \
+    ../../framepool.cpp \
+    ../../gccphat.cpp \
+    ../../eventtrace.cpp \
+    ../../transition.cpp \
+    ../../compositor.cpp \
+    ../../allocationcounter.cpp \
+    ../../logger.cpp
+
+HEADERS += ../../camera.h \
+    ../../camerawidget.h \
+    ../../latencystrip.h \
+    ../../radioviz.h \
+    ../../timeshiftbuffer.h \
+    ../../jpegdc.h \
+    ../../framepool.h \
+    ../../gccphat.h \
+    ../../eventtrace.h \
+    ../../transition.h \
+    ../../compositor.h \
+    ../../allocationcounter.h \
+    ../../logger.h
+
+macx: INCLUDEPATH += /usr/local/include/
+
+unix: LIBS += -L/usr/local/lib -lbenchmark -lavutil -lavcodec -lavformat -lavdevice  -lswscale -lopencv_core -lopencv_imgproc -lopencv_highgui -lrt -lasound -ljack -lpthread -lportaudio
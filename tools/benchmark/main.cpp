@@ -0,0 +1,523 @@
+/***
+ * RadioViz - tools/benchmark/main.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Microbenchmarks (Google Benchmark) for the per-frame and per-buffer kernels, on synthetic frames
+ *              at 544p, 720p and 1080p. Use --benchmark_format=json or --benchmark_out=<file> for results that can
+ *              be compared between revisions, e.g. with Google Benchmark's compare.py. Built with the allocation
+ *              counter, so every benchmark also reports heap allocations per iteration, and BM_SteadyState fails,
+ *              exiting 2, if the per-frame loop makes any heap allocation once it has warmed up.
+ *
+ */
+#include <stdio.h>
+#include <benchmark/benchmark.h>
+#include <QApplication>
+
+#include "camera.h"
+#include "camerawidget.h"
+#include "transition.h"
+#include "compositor.h"
+#include "jpegdc.h"
+#include "framepool.h"
+#include "gccphat.h"
+#include "eventtrace.h"
+#include "allocationcounter.h"
+#include "logger.h"
+
+// Camera's conversions are protected, open them up
+class BenchmarkCamera : public Camera
+{
+public:
+    using Camera::MatToPixmap;
+    using Camera::MatToPixmapGray;
+    using Camera::AVPictureToPixmap;
+    using Camera::SaveStoredFrame;
+};
+
+static cv::Mat SyntheticFrame(int width, int height, int type, int seed)
+{
+    cv::Mat frame(height, width, type);
+    cv::RNG rng(seed);
+    rng.fill(frame, cv::RNG::UNIFORM, 0, 256);
+    return frame;
+}
+
+/***
+ * Count Allocations
+ * Author: Matthew Ribbins
+ * Description: Report heap allocations per iteration since start, which is taken before the timed loop
+ */
+static void CountAllocations(benchmark::State &state, unsigned long long start)
+{
+    state.counters["allocs"] = benchmark::Counter(AllocationCounter::GetThreadAllocations() - start,
+                                                  benchmark::Counter::kAvgIterations);
+}
+
+#define FRAME_SIZES ->Args({960, 544})->Args({1280, 720})->Args({1920, 1080})->Unit(benchmark::kMicrosecond)
+
+static void BM_MatToPixmap(benchmark::State &state)
+{
+    BenchmarkCamera camera;
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(camera.MatToPixmap(frame));
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * frame.total() * frame.elemSize());
+}
+BENCHMARK(BM_MatToPixmap) FRAME_SIZES;
+
+static void BM_MatToPixmapGray(benchmark::State &state)
+{
+    BenchmarkCamera camera;
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC1, 1);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(camera.MatToPixmapGray(frame));
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * frame.total() * frame.elemSize());
+}
+BENCHMARK(BM_MatToPixmapGray) FRAME_SIZES;
+
+static void BM_AVPictureToPixmap(benchmark::State &state)
+{
+    BenchmarkCamera camera;
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(camera.AVPictureToPixmap(frame.rows, frame.cols, frame.data));
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * frame.total() * frame.elemSize());
+}
+BENCHMARK(BM_AVPictureToPixmap) FRAME_SIZES;
+
+static void BM_SaveStoredFrame(benchmark::State &state)
+{
+    BenchmarkCamera camera;
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        camera.SaveStoredFrame(frame);
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * frame.total() * frame.elemSize());
+}
+BENCHMARK(BM_SaveStoredFrame) FRAME_SIZES;
+
+/***
+ * Frame Pool Cycle
+ * Author: Matthew Ribbins
+ * Description: One frame's trip through the pool: acquire a buffer, convert a captured BGR frame into it, share it
+ *              with a reader and give it back. Once the pool has its buffers there should be no allocations.
+ */
+static void BM_FramePoolCycle(benchmark::State &state)
+{
+    cv::Mat captured = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+
+    FramePool::Reserve(FRAMEPOOL_BUFFERS_PER_SOURCE, captured.cols, captured.rows, CV_8UC3);
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        Frame frame = FramePool::Acquire(captured.cols, captured.rows, CV_8UC3);
+        cv::Mat back = frame.GetMat();
+        cv::cvtColor(captured, back, CV_BGR2RGB);
+
+        Frame reader = frame;
+        frame.Release();
+        benchmark::DoNotOptimize(reader.GetMat().data);
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * captured.total() * captured.elemSize());
+}
+BENCHMARK(BM_FramePoolCycle) FRAME_SIZES;
+
+static void BM_GetMovementDetection(benchmark::State &state)
+{
+    BenchmarkCamera camera;
+
+    // Three different frames, so there is movement to find
+    for(int i = 0; i < 3; i++)
+        camera.SaveStoredFrame(SyntheticFrame(state.range(0), state.range(1), CV_8UC3, i));
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(camera.GetMovementDetection());
+    }
+    CountAllocations(state, allocations);
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+BENCHMARK(BM_GetMovementDetection) FRAME_SIZES;
+
+static void BM_CalculateAudioLevel(benchmark::State &state)
+{
+    float samples[FRAMES_PER_BUFFER];
+    cv::Mat wrapper(1, FRAMES_PER_BUFFER, CV_32FC1, samples);
+    cv::RNG(1).fill(wrapper, cv::RNG::UNIFORM, -1.0f, 1.0f);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(Camera::CalculateAudioLevel(samples, FRAMES_PER_BUFFER));
+    }
+    CountAllocations(state, allocations);
+    state.SetItemsProcessed(state.iterations() * FRAMES_PER_BUFFER);
+}
+BENCHMARK(BM_CalculateAudioLevel);
+
+// One hop of bleed rejection for 2 to 16 mics. Items are samples per mic, so keeping up in real time needs
+// SAMPLE_RATE items a second.
+static void BM_GccPhatHop(benchmark::State &state)
+{
+    int mics = state.range(0);
+    std::vector<float> samples(mics * BLEED_FRAME);
+    const float *frames[GCCPHAT_MAX_MICS];
+    cv::Mat wrapper(1, (int)samples.size(), CV_32FC1, &samples[0]);
+    cv::RNG(1).fill(wrapper, cv::RNG::UNIFORM, -1.0f, 1.0f);
+    for(int m = 0; m < mics; m++)
+        frames[m] = &samples[m * BLEED_FRAME];
+
+    GccPhat phat(BLEED_FRAME, SAMPLE_RATE);
+    phat.SetMics(mics, BLEED_DEFAULT_MAX_DELAY);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        phat.Analyse(frames, true);
+        benchmark::DoNotOptimize(phat.GetBleed(0));
+    }
+    CountAllocations(state, allocations);
+    state.SetItemsProcessed(state.iterations() * BLEED_HOP);
+}
+BENCHMARK(BM_GccPhatHop)->Arg(2)->Arg(4)->Arg(8)->Arg(16);
+
+static void BM_PutFrameRGB(benchmark::State &state)
+{
+    QWidget parent;
+    parent.resize(1920, 1080);
+    CameraWidget widget(&parent);
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        widget.putFrameRGB(frame);
+    }
+    CountAllocations(state, allocations);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PutFrameRGB) FRAME_SIZES;
+
+static void BM_PutFrame(benchmark::State &state)
+{
+    // Scaling to a 1080p display, as on the studio screens
+    QWidget parent;
+    parent.resize(1920, 1080);
+    CameraWidget widget(&parent);
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+    QPixmap pixmap = QPixmap::fromImage(QImage(frame.data, frame.cols, frame.rows, frame.step, QImage::Format_RGB888));
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        widget.putFrame(pixmap);
+    }
+    CountAllocations(state, allocations);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PutFrame) FRAME_SIZES;
+
+static void BM_TransitionMix(benchmark::State &state)
+{
+    cv::Mat from = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+    cv::Mat to = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 2);
+    cv::Mat output(from.size(), CV_8UC3);
+    int length = from.total() * from.elemSize();
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        Transition::BlendMix(from.data, to.data, output.data, length, TRANSITION_WEIGHT_MAX / 3);
+        benchmark::ClobberMemory();
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_TransitionMix) FRAME_SIZES;
+
+static void BM_CompositorQuad(benchmark::State &state)
+{
+    Compositor compositor;
+    int sources[COMPOSITOR_MAX_SOURCES] = { 0, 1, 2, 3 };
+    cv::Mat frames[COMPOSITOR_MAX_SOURCES];
+    unsigned int frameNumber = 0;
+
+    compositor.SetCanvasSize(state.range(0), state.range(1));
+    compositor.SetSources(sources, COMPOSITOR_MAX_SOURCES);
+    for(int i = 0; i < COMPOSITOR_MAX_SOURCES; i++)
+        frames[i] = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, i);
+
+    // Every source has a new frame each time
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        frameNumber++;
+        for(int i = 0; i < COMPOSITOR_MAX_SOURCES; i++)
+            compositor.PutFrame(i, frames[i], frameNumber);
+    }
+    CountAllocations(state, allocations);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CompositorQuad) FRAME_SIZES;
+
+static void BM_JpegDcDecode(benchmark::State &state)
+{
+    JpegDcDecoder decoder;
+    std::vector<uchar> jpeg;
+    std::vector<int> params;
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+
+    params.push_back(CV_IMWRITE_JPEG_QUALITY);
+    params.push_back(TIMESHIFT_JPEG_QUALITY);
+    cv::GaussianBlur(frame, frame, cv::Size(9, 9), 0);
+    cv::imencode(".jpg", frame, jpeg, params);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(decoder.Decode(&jpeg[0], jpeg.size()));
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * jpeg.size());
+}
+BENCHMARK(BM_JpegDcDecode) FRAME_SIZES;
+
+static void BM_JpegFullDecode(benchmark::State &state)
+{
+    std::vector<uchar> jpeg;
+    std::vector<int> params;
+    cv::Mat frame = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, 1);
+    cv::Mat decoded;
+
+    params.push_back(CV_IMWRITE_JPEG_QUALITY);
+    params.push_back(TIMESHIFT_JPEG_QUALITY);
+    cv::GaussianBlur(frame, frame, cv::Size(9, 9), 0);
+    cv::imencode(".jpg", frame, jpeg, params);
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        cv::imdecode(jpeg, CV_LOAD_IMAGE_COLOR, &decoded);
+    }
+    CountAllocations(state, allocations);
+    state.SetBytesProcessed(state.iterations() * jpeg.size());
+}
+BENCHMARK(BM_JpegFullDecode) FRAME_SIZES;
+
+static void BM_LogDisabled(benchmark::State &state)
+{
+    int value = 0;
+
+    Logger::SetLevel(LOG_CAMERA, LOG_LEVEL_INFO);
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        LOG_DEBUG(LOG_CAMERA, "Camera has %d/%d=%%%d", value, 1000, 0);
+        benchmark::DoNotOptimize(value++);
+    }
+    CountAllocations(state, allocations);
+}
+BENCHMARK(BM_LogDisabled);
+
+static void BM_LogEnabled(benchmark::State &state)
+{
+    int value = 0;
+
+    Logger::SetLevel(LOG_CAMERA, LOG_LEVEL_DEBUG);
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        LOG_DEBUG(LOG_CAMERA, "Camera has %d/%d=%%%d", value, 1000, 0);
+        benchmark::DoNotOptimize(value++);
+    }
+    CountAllocations(state, allocations);
+    Logger::SetLevel(LOG_CAMERA, LOG_LEVEL_DEFAULT);
+}
+BENCHMARK(BM_LogEnabled);
+
+/***
+ * Event Scope
+ * Author: Matthew Ribbins
+ * Description: What an EVENT_SCOPE costs with tracing off and on. A capture thread makes a handful of events a
+ *              frame, so on is still far below 1% of a 33 ms frame.
+ */
+static void BM_EventScopeDisabled(benchmark::State &state)
+{
+    int value = 0;
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        EVENT_SCOPE("benchmark", 0);
+        benchmark::DoNotOptimize(value++);
+    }
+    CountAllocations(state, allocations);
+}
+BENCHMARK(BM_EventScopeDisabled);
+
+static void BM_EventScopeEnabled(benchmark::State &state)
+{
+    int value = 0;
+
+    EventTrace::Start("/dev/null", EVENT_DEFAULT_SECONDS);
+    {
+        // The thread's ring is made by its first event
+        EVENT_SCOPE("benchmark", 0);
+    }
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        EVENT_SCOPE("benchmark", 0);
+        benchmark::DoNotOptimize(value++);
+    }
+    CountAllocations(state, allocations);
+    EventTrace::Stop();
+}
+BENCHMARK(BM_EventScopeEnabled);
+
+static void BM_QDebug(benchmark::State &state)
+{
+    int value = 0;
+
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    for(auto _ : state) {
+        qDebug() << "Camera has " << value << "/" << 1000 << "=%" << 0;
+        benchmark::DoNotOptimize(value++);
+    }
+    CountAllocations(state, allocations);
+}
+BENCHMARK(BM_QDebug);
+
+/***
+ * Steady State
+ * Author: Matthew Ribbins
+ * Description: One frame of the capture -> analyse -> display loop, without the devices or painting: store the
+ *              motion frame, detect movement, run a mix, put two cameras on the compositor and scale for display.
+ *              After warming up every step must make no heap allocations at all, or the run fails and the
+ *              benchmark exits non-zero (see main()). One step is let off, and named in the check: the
+ *              compositor's INTER_AREA cv::resize, which builds its area tables on the heap every call. Even there
+ *              no allocation may be frame sized. OpenCV runs on this thread for the loop, as how its
+ *              parallel_for_ backend (TBB, OpenMP, pthreads) queues work is down to how it was built.
+ */
+static int steadyStateFailures = 0;
+
+static void BM_SteadyState(benchmark::State &state)
+{
+    BenchmarkCamera cameras[2];
+    Transition transition;
+    Compositor compositor;
+    int sources[2] = { 0, 1 };
+    cv::Mat frames[2][2];
+    cv::Mat transitionFrame;
+    unsigned int frameNumber = 0;
+    QWidget parent;
+    parent.resize(1920, 1080);
+    CameraWidget widget(&parent);
+
+    for(int i = 0; i < 2; i++) {
+        frames[i][0] = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, i * 2);
+        frames[i][1] = SyntheticFrame(state.range(0), state.range(1), CV_8UC3, i * 2 + 1);
+    }
+    compositor.SetCanvasSize(state.range(0), state.range(1));
+    compositor.SetSources(sources, 2);
+
+    // Long enough not to finish while we are timing
+    transition.Start(0, TRANSITION_MIX, 1000000);
+
+    // Allocations made by each step, see step(). Only the composite step may make any, see above.
+    static const char *stepNames[] = { "allocs_gray", "allocs_motion", "allocs_transition", "allocs_composite",
+                                       "allocs_display" };
+    static const bool stepMayAllocate[] = { false, false, false, true, false };
+    static char error[128];
+    enum { STEP_GRAY, STEP_MOTION, STEP_TRANSITION, STEP_COMPOSITE, STEP_DISPLAY, STEP_COUNT };
+    unsigned long long stepAllocations[STEP_COUNT];
+    unsigned long long mark = 0;
+    auto step = [&](int index) {
+        unsigned long long now = AllocationCounter::GetThreadAllocations();
+        stepAllocations[index] += now - mark;
+        mark = now;
+    };
+
+    auto frame = [&]() {
+        const cv::Mat &a = frames[0][frameNumber & 1];
+        const cv::Mat &b = frames[1][frameNumber & 1];
+
+        frameNumber++;
+        mark = AllocationCounter::GetThreadAllocations();
+        cameras[0].SaveStoredFrame(a);
+        cameras[1].SaveStoredFrame(b);
+        step(STEP_GRAY);
+        benchmark::DoNotOptimize(cameras[0].GetMovementDetection());
+        benchmark::DoNotOptimize(cameras[1].GetMovementDetection());
+        step(STEP_MOTION);
+        transition.Render(a, b, true, transitionFrame);
+        step(STEP_TRANSITION);
+        compositor.PutFrame(0, a, frameNumber);
+        compositor.PutFrame(1, b, frameNumber);
+        step(STEP_COMPOSITE);
+        widget.putFrameRGB(compositor.GetCanvas());
+        step(STEP_DISPLAY);
+    };
+
+    int openCvThreads = cv::getNumThreads();
+    cv::setNumThreads(0);
+    for(int i = 0; i < 4; i++)
+        frame();
+
+    for(int i = 0; i < STEP_COUNT; i++)
+        stepAllocations[i] = 0;
+    unsigned long long allocations = AllocationCounter::GetThreadAllocations();
+    unsigned long long largeAllocations = AllocationCounter::GetThreadLargeAllocations();
+    for(auto _ : state) {
+        frame();
+    }
+    CountAllocations(state, allocations);
+    state.counters["large_allocs"] = AllocationCounter::GetThreadLargeAllocations() - largeAllocations;
+    for(int i = 0; i < STEP_COUNT; i++)
+        state.counters[stepNames[i]] = benchmark::Counter(stepAllocations[i], benchmark::Counter::kAvgIterations);
+
+    cv::setNumThreads(openCvThreads);
+
+    error[0] = '\0';
+    if(AllocationCounter::GetThreadLargeAllocations() != largeAllocations)
+        snprintf(error, sizeof(error), "Frame sized heap allocation in the steady state loop");
+    for(int i = 0; i < STEP_COUNT && !error[0]; i++) {
+        if(stepAllocations[i] && !stepMayAllocate[i])
+            snprintf(error, sizeof(error), "%llu heap allocations in %s after warming up", stepAllocations[i],
+                     stepNames[i] + 7);
+    }
+    if(error[0]) {
+        steadyStateFailures++;
+        state.SkipWithError(error);
+    }
+}
+BENCHMARK(BM_SteadyState) FRAME_SIZES;
+
+static void SilentMessageHandler(QtMsgType, const QMessageLogContext &, const QString &)
+{
+}
+
+int main(int argc, char **argv)
+{
+    // Pixmaps need a QApplication, but not a display
+    if(qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+
+    // The kernels log with qDebug, which would swamp the results
+    qInstallMessageHandler(SilentMessageHandler);
+
+    // The kernels' own log messages, and BM_LogEnabled's, go nowhere
+    Logger::Start("/dev/null");
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    Logger::Stop();
+
+    if(steadyStateFailures)
+        fprintf(stderr, "BM_SteadyState failed: heap allocations in the steady state loop\n");
+    return steadyStateFailures ? 2 : 0;
+}
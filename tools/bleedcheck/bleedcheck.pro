@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Checks the delays GCC-PHAT finds for bleed rejection
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = bleedcheck
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../gccphat.cpp
+
+HEADERS += ../../gccphat.h
+
+macx: INCLUDEPATH += /usr/local/include/
+
+unix: LIBS += -L/usr/local/lib -lopencv_core
@@ -0,0 +1,144 @@
+/***
+ * RadioViz - tools/bleedcheck/main.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Checks the delays GCC-PHAT (gccphat.cpp) finds between mics, with no audio devices. A talker (noise)
+ *              is heard by every mic after a delay of its own, under a little noise of the mic's own, and fed
+ *              through GccPhat a hop at a time as bleed rejection does:
+ *
+ *              - Every pair's lead must have the right sign, and be within a sample of the true difference.
+ *              - A mic that heard the talker GCCPHAT_MIN_LEAD or more samples after another must be taken for
+ *                bleed. The nearest mic must not, and nor must one only as far behind as the capture alignment
+ *                can leave two mics at the same distance.
+ *
+ * Usage: bleedcheck [--seed n]
+ *
+ * Exits 0 if every check passed, 2 if any failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "gccphat.h"
+
+// As bleed rejection runs it, see BLEED_FRAME, BLEED_HOP and BLEED_DEFAULT_MAX_DELAY in radioviz.h
+#define BLEEDCHECK_FRAME 1024
+#define BLEEDCHECK_HOP 512
+#define BLEEDCHECK_SAMPLE_RATE 44100
+#define BLEEDCHECK_MAX_DELAY 10
+// Hops fed in for each case, about 2.3 s
+#define BLEEDCHECK_HOPS 200
+// Each mic's own noise, relative to the talker (-20 dB)
+#define BLEEDCHECK_MIC_NOISE 0.1f
+// A mic is bleed above this, and clear of it below BLEEDCHECK_NOT_BLEED
+#define BLEEDCHECK_BLEED 0.3f
+#define BLEEDCHECK_NOT_BLEED 0.1f
+// Worst misalignment between two mics that BleedDetector::Align leaves (6.5 samples in simulation), rounded up
+#define BLEEDCHECK_WORST_SKEW 7
+
+static int failures = 0;
+static unsigned int seed = 1;
+
+static void Check(bool passed, const char *name, const char *detail)
+{
+    printf("%-6s %s%s%s\n", passed ? "ok" : "FAILED", name, detail[0] ? ": " : "", detail);
+    if(!passed) failures++;
+}
+
+// Uniform noise from -1 to 1 (xorshift), the same every run for a seed
+static float Noise(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (float)seed / 2147483648.0f - 1.0f;
+}
+
+/***
+ * Check Delays
+ * Author: Matthew Ribbins
+ * Description: One talker heard by mics mics, mic m delays[m] samples after it spoke. The delays must be no more
+ *              than BLEEDCHECK_MAX_DELAY apart.
+ */
+static void CheckDelays(const char *name, const int *delays, int mics)
+{
+    int length = BLEEDCHECK_HOPS * BLEEDCHECK_HOP + BLEEDCHECK_FRAME;
+    int longest = BLEEDCHECK_MAX_DELAY * BLEEDCHECK_SAMPLE_RATE / 1000;
+    std::vector<float> talker(length + longest);
+    std::vector<std::vector<float> > heard(mics, std::vector<float>(length));
+    const float *frames[GCCPHAT_MAX_MICS];
+    int nearest = 0;
+    char check[128];
+    char detail[128];
+
+    for(size_t n = 0; n < talker.size(); n++)
+        talker[n] = Noise();
+    for(int m = 0; m < mics; m++) {
+        for(int n = 0; n < length; n++)
+            heard[m][n] = talker[n + longest - delays[m]] + BLEEDCHECK_MIC_NOISE * Noise();
+        if(delays[m] < delays[nearest]) nearest = m;
+    }
+
+    GccPhat phat(BLEEDCHECK_FRAME, BLEEDCHECK_SAMPLE_RATE);
+    phat.SetMics(mics, BLEEDCHECK_MAX_DELAY);
+    for(int hop = 0; hop < BLEEDCHECK_HOPS; hop++) {
+        for(int m = 0; m < mics; m++)
+            frames[m] = &heard[m][hop * BLEEDCHECK_HOP];
+        phat.Analyse(frames, true);
+    }
+
+    // a heard the talker delays[b] - delays[a] samples sooner than b
+    for(int a = 0; a < mics; a++) {
+        for(int b = a + 1; b < mics; b++) {
+            int expected = delays[b] - delays[a];
+            int lead = phat.GetLead(a, b);
+            bool sign = (expected > 0) ? lead > 0 : ((expected < 0) ? lead < 0 : true);
+
+            snprintf(check, sizeof(check), "%s, mics %d and %d lead", name, a + 1, b + 1);
+            snprintf(detail, sizeof(detail), "%d samples, expected %d, coherence %.2f", lead, expected,
+                     phat.GetCoherence(a, b));
+            Check(sign && abs(lead - expected) <= 1 && phat.GetLead(b, a) == -lead, check, detail);
+        }
+    }
+
+    for(int m = 0; m < mics; m++) {
+        int behind = delays[m] - delays[nearest];
+        float bleed = phat.GetBleed(m);
+        bool isBleed = behind > BLEEDCHECK_WORST_SKEW && behind >= GCCPHAT_MIN_LEAD;
+
+        snprintf(check, sizeof(check), "%s, mic %d %s", name, m + 1, isBleed ? "is bleed" : "is not bleed");
+        snprintf(detail, sizeof(detail), "%d samples behind, bleed %.2f", behind, bleed);
+        Check(isBleed ? bleed > BLEEDCHECK_BLEED : bleed < BLEEDCHECK_NOT_BLEED, check, detail);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = (unsigned int)atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: bleedcheck [--seed n]\n");
+            return 1;
+        }
+    }
+    if(!seed) seed = 1;
+
+    const int nearestFirst[] = { 0, 45, 120 };
+    const int nearestLast[] = { 130, 60, 0 };
+    const int fourMics[] = { 30, 0, 200, 85 };
+    const int misaligned[] = { 0, BLEEDCHECK_WORST_SKEW };
+    const int justBehind[] = { GCCPHAT_MIN_LEAD, 0 };
+    // Over 2 m further away, so little of a frame is heard by both
+    const int farApart[] = { 0, 300 };
+
+    CheckDelays("nearest first", nearestFirst, 3);
+    CheckDelays("nearest last", nearestLast, 3);
+    CheckDelays("four mics", fourMics, 4);
+    CheckDelays("misaligned", misaligned, 2);
+    CheckDelays("just behind", justBehind, 2);
+    CheckDelays("far apart", farApart, 2);
+
+    printf("%s\n", failures ? "FAILED" : "All checks passed");
+    return failures ? 2 : 0;
+}
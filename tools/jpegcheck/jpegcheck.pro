@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Checks for the MJPEG default Huffman tables and the DC-only decoder
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = jpegcheck
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../jpegdc.cpp
+
+HEADERS += ../../jpegdc.h
+
+macx: INCLUDEPATH += /usr/local/include/
+
+unix: LIBS += -L/usr/local/lib -lopencv_core -lopencv_imgproc -lopencv_highgui
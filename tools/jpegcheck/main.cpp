@@ -0,0 +1,194 @@
+/***
+ * RadioViz - tools/jpegcheck/main.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Checks the MJPEG handling in jpegdc.cpp against OpenCV's JPEG codec, with no cameras. Test frames are
+ *              JPEG encoded, then have their Huffman tables stripped as a UVC camera sends them:
+ *
+ *              - JpegDcDecoder::AddDefaultHuffmanTables() must leave a frame with tables alone, and put tables
+ *                back into a stripped frame so that cv::imdecode gives exactly the pixels of the original.
+ *              - The DC-only decoder must give the same thumbnail with or without the tables, and it must match
+ *                the 8x8 block averages of the fully decoded frame's luma.
+ *
+ * Usage: jpegcheck [--quality q]
+ *
+ * Exits 0 if every check passed, 2 if any failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "jpegdc.h"
+
+// Most the DC thumbnail may differ from the decoded luma's block average. The decoded frame has been through the
+// IDCT, chroma upsampling and conversion to BGR and back, each rounding.
+#define JPEGCHECK_MEAN_TOLERANCE 1.0
+#define JPEGCHECK_MAX_TOLERANCE 8
+
+static int failures = 0;
+
+static void Check(bool passed, const char *name, const char *detail)
+{
+    printf("%-6s %s%s%s\n", passed ? "ok" : "FAILED", name, detail[0] ? ": " : "", detail);
+    if(!passed) failures++;
+}
+
+/***
+ * Make Frame
+ * Author: Matthew Ribbins
+ * Description: A test card with gradients, hard edges and texture, so every table gets used
+ */
+static cv::Mat MakeFrame(int width, int height)
+{
+    cv::Mat frame(height, width, CV_8UC3);
+    unsigned int seed = 12345;
+
+    for(int y = 0; y < height; y++) {
+        unsigned char *row = frame.ptr<unsigned char>(y);
+        for(int x = 0; x < width; x++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) & 15;
+            bool box = ((x / 40) + (y / 40)) & 1;
+            row[x * 3] = (unsigned char)((x * 255) / width);
+            row[x * 3 + 1] = (unsigned char)(box ? 200 + noise : 30 + noise);
+            row[x * 3 + 2] = (unsigned char)((y * 255) / height);
+        }
+    }
+    return frame;
+}
+
+/***
+ * Strip Huffman Tables
+ * Author: Matthew Ribbins
+ * Description: Every DHT segment out of a JPEG, as MJPEG cameras send frames
+ *
+ * Return: (int) DHT segments removed
+ */
+static int StripHuffmanTables(const std::vector<unsigned char> &jpeg, std::vector<unsigned char> &stripped)
+{
+    size_t p = 2;
+    int removed = 0;
+
+    stripped.assign(jpeg.begin(), jpeg.begin() + 2);
+    while(p + 4 <= jpeg.size()) {
+        int marker = jpeg[p + 1];
+        size_t length = (jpeg[p + 2] << 8) | jpeg[p + 3];
+
+        if(JPEG_MARKER_SOS == marker) break;
+        if(JPEG_MARKER_DHT == marker)
+            removed++;
+        else
+            stripped.insert(stripped.end(), jpeg.begin() + p, jpeg.begin() + p + 2 + length);
+        p += 2 + length;
+    }
+    stripped.insert(stripped.end(), jpeg.begin() + p, jpeg.end());
+    return removed;
+}
+
+/***
+ * Check DC Thumbnail
+ * Author: Matthew Ribbins
+ * Description: Compare a DC thumbnail with the block averages of the decoded frame's luma
+ */
+static void CheckDcThumbnail(JpegDcDecoder &decoder, const cv::Mat &decoded, const char *name)
+{
+    cv::Mat gray;
+    char detail[128];
+    double total = 0;
+    int worst = 0;
+    int blocks = 0;
+
+    cv::cvtColor(decoded, gray, CV_BGR2GRAY);
+    for(int by = 0; by < decoder.GetHeight(); by++) {
+        for(int bx = 0; bx < decoder.GetWidth(); bx++) {
+            int sum = 0;
+            for(int y = 0; y < 8; y++)
+                for(int x = 0; x < 8; x++)
+                    sum += gray.at<unsigned char>(by * 8 + y, bx * 8 + x);
+            int difference = abs((sum + 32) / 64 - decoder.GetThumbnail()[by * decoder.GetStride() + bx]);
+            total += difference;
+            if(difference > worst) worst = difference;
+            blocks++;
+        }
+    }
+
+    double mean = blocks ? total / blocks : 0;
+    snprintf(detail, sizeof(detail), "%dx%d, mean difference %.2f, worst %d", decoder.GetWidth(), decoder.GetHeight(),
+             mean, worst);
+    Check(blocks && mean <= JPEGCHECK_MEAN_TOLERANCE && worst <= JPEGCHECK_MAX_TOLERANCE, name, detail);
+}
+
+/***
+ * Check Frame
+ * Author: Matthew Ribbins
+ * Description: Every check on one frame size
+ */
+static void CheckFrame(int width, int height, int quality)
+{
+    std::vector<unsigned char> jpeg, stripped, unchanged;
+    std::vector<int> params;
+    cv::Mat original, restored;
+    JpegDcDecoder decoder, strippedDecoder;
+    char name[64], detail[128];
+
+    params.push_back(CV_IMWRITE_JPEG_QUALITY);
+    params.push_back(quality);
+    cv::imencode(".jpg", MakeFrame(width, height), jpeg, params);
+    int removed = StripHuffmanTables(jpeg, stripped);
+    printf("%dx%d at quality %d: %d bytes, %d DHT segments stripped\n", width, height, quality, (int)jpeg.size(), removed);
+
+    snprintf(name, sizeof(name), "%dx%d has tables", width, height);
+    unchanged = jpeg;
+    Check(!JpegDcDecoder::AddDefaultHuffmanTables(unchanged) && unchanged == jpeg, name, "left alone");
+
+    snprintf(name, sizeof(name), "%dx%d stripped", width, height);
+    size_t strippedSize = stripped.size();
+    bool added = JpegDcDecoder::AddDefaultHuffmanTables(stripped);
+    original = cv::imdecode(jpeg, CV_LOAD_IMAGE_COLOR);
+    restored = cv::imdecode(stripped, CV_LOAD_IMAGE_COLOR);
+    bool identical = !original.empty() && !restored.empty() && original.size() == restored.size() &&
+                     !memcmp(original.data, restored.data, original.total() * original.elemSize());
+    snprintf(detail, sizeof(detail), "%d bytes of tables added, %s", (int)(stripped.size() - strippedSize),
+             identical ? "decodes to the original's pixels" : "doesn't decode to the original's pixels");
+    Check(removed && added && identical, name, detail);
+
+    // The DC decoder falls back to the default tables itself, so the stripped frame must give the same thumbnail
+    StripHuffmanTables(jpeg, stripped);
+    snprintf(name, sizeof(name), "%dx%d DC thumbnail", width, height);
+    if(!decoder.Decode(jpeg.data(), jpeg.size()) || original.empty()) {
+        Check(false, name, "didn't decode");
+        return;
+    }
+    CheckDcThumbnail(decoder, original, name);
+
+    snprintf(name, sizeof(name), "%dx%d DC thumbnail stripped", width, height);
+    bool same = strippedDecoder.Decode(stripped.data(), stripped.size()) &&
+                strippedDecoder.GetWidth() == decoder.GetWidth() && strippedDecoder.GetHeight() == decoder.GetHeight();
+    for(int y = 0; same && y < decoder.GetHeight(); y++)
+        same = !memcmp(decoder.GetThumbnail() + y * decoder.GetStride(),
+                       strippedDecoder.GetThumbnail() + y * strippedDecoder.GetStride(), decoder.GetWidth());
+    Check(same, name, same ? "same as with the tables" : "differs from with the tables");
+}
+
+int main(int argc, char *argv[])
+{
+    int quality = 80;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--quality") && i + 1 < argc)
+            quality = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: jpegcheck [--quality q]\n");
+            return 1;
+        }
+    }
+
+    CheckFrame(320, 240, quality);
+    CheckFrame(640, 480, quality);
+    CheckFrame(1280, 720, quality);
+    CheckFrame(328, 248, quality);
+
+    printf("%s\n", failures ? "FAILED" : "All checks passed");
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,252 @@
+/***
+ * RadioViz - tools/metricsexport/main.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Export metrics logs (Metrics/file) for analysis. Logs are read in the order given, so a day's worth
+ *              of rotated files can be exported as one table. By default a CSV is written with a row per decision
+ *              tick; --columns writes a raw little endian file per column instead, plus a schema.txt naming them,
+ *              which loads straight into numpy or pandas without parsing.
+ *
+ *              Cameras are numbered from 0 as in the logs. Levels and movement of cameras that weren't there are
+ *              empty in the CSV (NaN and -1 in columns), as are program and decision when there wasn't one.
+ *
+ * Usage: metricsexport <log> [log...] [--csv file] [--columns dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "metricslog.h"
+
+// A column of the --columns export
+typedef struct _ColumnFile {
+    char name[32];
+    const char *type;
+    FILE *file;
+} ColumnFile;
+
+static void Usage(void)
+{
+    fprintf(stderr, "Usage: metricsexport <log> [log...] [--csv file] [--columns dir]\n");
+}
+
+/***
+ * Write CSV Header
+ * Author: Matthew Ribbins
+ */
+static void WriteCsvHeader(FILE *file, int cameras)
+{
+    fprintf(file, "time,tick,mode,program,decision");
+    for(int i = 0; i < cameras; i++)
+        fprintf(file, ",level%d,movement%d,active%d,stalled%d", i, i, i, i);
+    fprintf(file, "\n");
+}
+
+/***
+ * Write CSV Row
+ * Author: Matthew Ribbins
+ * Description: time is local, to the millisecond
+ */
+static void WriteCsvRow(FILE *file, const MetricsRow &row, int64_t time, int cameras)
+{
+    char stamp[32];
+    time_t seconds = (time_t)(time / 1000);
+    struct tm local;
+
+    localtime_r(&seconds, &local);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+    fprintf(file, "%s.%03d,%u,%u,", stamp, (int)(time % 1000), row.tick, row.mode);
+    if(row.program >= 0) fprintf(file, "%d", row.program);
+    fprintf(file, ",");
+    if(row.decision >= 0) fprintf(file, "%d", row.decision);
+
+    for(int i = 0; i < cameras; i++) {
+        if(i < row.count && row.levels[i] == row.levels[i])
+            fprintf(file, ",%.2f", row.levels[i]);
+        else
+            fprintf(file, ",");
+        if(i < row.count && row.movement[i] >= 0)
+            fprintf(file, ",%d", row.movement[i]);
+        else
+            fprintf(file, ",");
+        fprintf(file, ",%d,%d", (row.active >> i) & 1, (row.stalled >> i) & 1);
+    }
+    fprintf(file, "\n");
+}
+
+/***
+ * Open Columns
+ * Author: Matthew Ribbins
+ * Description: One file per column in dir, named <column>.bin
+ *
+ * Return: (bool) false if any couldn't be made
+ */
+static bool OpenColumns(const char *dir, int cameras, std::vector<ColumnFile> &columns)
+{
+    const char *fixed[][2] = { { "time", "int64" }, { "tick", "uint32" }, { "mode", "uint8" },
+                               { "program", "int8" }, { "decision", "int8" } };
+    char path[METRICS_PATH_SIZE];
+    ColumnFile column;
+
+    mkdir(dir, 0755);
+    for(size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        snprintf(column.name, sizeof(column.name), "%s", fixed[i][0]);
+        column.type = fixed[i][1];
+        columns.push_back(column);
+    }
+    for(int i = 0; i < cameras; i++) {
+        snprintf(column.name, sizeof(column.name), "level%d", i);
+        column.type = "float32";
+        columns.push_back(column);
+        snprintf(column.name, sizeof(column.name), "movement%d", i);
+        column.type = "int16";
+        columns.push_back(column);
+        snprintf(column.name, sizeof(column.name), "active%d", i);
+        column.type = "uint8";
+        columns.push_back(column);
+        snprintf(column.name, sizeof(column.name), "stalled%d", i);
+        column.type = "uint8";
+        columns.push_back(column);
+    }
+
+    for(size_t i = 0; i < columns.size(); i++) {
+        snprintf(path, sizeof(path), "%s/%s.bin", dir, columns[i].name);
+        columns[i].file = fopen(path, "wb");
+        if(!columns[i].file) {
+            fprintf(stderr, "Could not write %s\n", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+/***
+ * Write Column Row
+ * Author: Matthew Ribbins
+ * Description: One value to each column file, in the order OpenColumns made them
+ */
+static void WriteColumnRow(std::vector<ColumnFile> &columns, const MetricsRow &row, int64_t time, int cameras)
+{
+    size_t n = 0;
+
+    fwrite(&time, sizeof(time), 1, columns[n++].file);
+    fwrite(&row.tick, sizeof(row.tick), 1, columns[n++].file);
+    fwrite(&row.mode, sizeof(row.mode), 1, columns[n++].file);
+    fwrite(&row.program, sizeof(row.program), 1, columns[n++].file);
+    fwrite(&row.decision, sizeof(row.decision), 1, columns[n++].file);
+    for(int i = 0; i < cameras; i++) {
+        float level = (i < row.count) ? row.levels[i] : NAN;
+        int16_t movement = (i < row.count) ? row.movement[i] : -1;
+        uint8_t active = (row.active >> i) & 1;
+        uint8_t stalled = (row.stalled >> i) & 1;
+        fwrite(&level, sizeof(level), 1, columns[n++].file);
+        fwrite(&movement, sizeof(movement), 1, columns[n++].file);
+        fwrite(&active, sizeof(active), 1, columns[n++].file);
+        fwrite(&stalled, sizeof(stalled), 1, columns[n++].file);
+    }
+}
+
+/***
+ * Close Columns
+ * Author: Matthew Ribbins
+ * Description: Close the column files and describe them in schema.txt, a line per column: name, type, rows
+ *
+ * Return: (bool) false if anything failed to write
+ */
+static bool CloseColumns(const char *dir, std::vector<ColumnFile> &columns, long rows)
+{
+    char path[METRICS_PATH_SIZE];
+    bool ok = true;
+
+    snprintf(path, sizeof(path), "%s/schema.txt", dir);
+    FILE *schema = fopen(path, "w");
+    if(!schema) ok = false;
+
+    for(size_t i = 0; i < columns.size(); i++) {
+        if(fclose(columns[i].file)) ok = false;
+        if(schema) fprintf(schema, "%s.bin %s %ld\n", columns[i].name, columns[i].type, rows);
+    }
+    if(schema && fclose(schema)) ok = false;
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<const char *> logs;
+    const char *csvPath = NULL;
+    const char *columnsPath = NULL;
+    std::vector<ColumnFile> columns;
+    MetricsReader reader;
+    MetricsRow row;
+    FILE *csv = NULL;
+    int cameras = 0;
+    long rows = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--csv") && i + 1 < argc)
+            csvPath = argv[++i];
+        else if(!strcmp(argv[i], "--columns") && i + 1 < argc)
+            columnsPath = argv[++i];
+        else if(argv[i][0] == '-') {
+            Usage();
+            return 1;
+        } else
+            logs.push_back(argv[i]);
+    }
+    if(logs.empty()) {
+        Usage();
+        return 1;
+    }
+
+    // Every log gets as many camera columns as the widest of them
+    for(size_t i = 0; i < logs.size(); i++) {
+        if(!reader.Open(logs[i])) {
+            fprintf(stderr, "Could not open metrics log %s\n", logs[i]);
+            return 1;
+        }
+        if(reader.GetHeader().cameras > cameras) cameras = reader.GetHeader().cameras;
+        reader.Close();
+    }
+
+    if(columnsPath) {
+        if(!OpenColumns(columnsPath, cameras, columns)) return 1;
+    } else {
+        csv = csvPath ? fopen(csvPath, "w") : stdout;
+        if(!csv) {
+            fprintf(stderr, "Could not write %s\n", csvPath);
+            return 1;
+        }
+        WriteCsvHeader(csv, cameras);
+    }
+
+    for(size_t i = 0; i < logs.size(); i++) {
+        long logRows = 0;
+
+        reader.Open(logs[i]);
+        int64_t startTime = reader.GetHeader().startTime;
+        while(reader.Next(row)) {
+            if(columnsPath)
+                WriteColumnRow(columns, row, startTime + row.time, cameras);
+            else
+                WriteCsvRow(csv, row, startTime + row.time, cameras);
+            logRows++;
+        }
+        reader.Close();
+        fprintf(stderr, "%s: %ld rows\n", logs[i], logRows);
+        rows += logRows;
+    }
+
+    if(columnsPath) {
+        if(!CloseColumns(columnsPath, columns, rows)) {
+            fprintf(stderr, "Could not finish writing %s\n", columnsPath);
+            return 1;
+        }
+    } else if(csv != stdout && fclose(csv)) {
+        fprintf(stderr, "Could not finish writing %s\n", csvPath);
+        return 1;
+    }
+    return 0;
+}
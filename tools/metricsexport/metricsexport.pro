@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Export metrics logs to CSV or a file per column
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = metricsexport
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../metricslog.cpp
+
+HEADERS += ../../metricslog.h
+
+unix: LIBS += -lpthread
@@ -0,0 +1,229 @@
+/***
+ * RadioViz - tools/tracereplay/main.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Replay a recorded metric trace through the switching policy, with no devices, Qt or real time.
+ *              Reports how many switches were made, how long after a camera became active we switched to it, and
+ *              any decisions that differ from a reference (by default, the decisions recorded with the trace).
+ *
+ * Usage: tracereplay <trace> [--audio-threshold dB] [--movement-threshold n] [--reference file]
+ *                            [--write-decisions file] [--repeat n]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#include "switchingpolicy.h"
+#include "tracefile.h"
+
+#define MAX_DIFFERENCES_SHOWN 10
+
+typedef struct _ReplayResult {
+    long records;
+    long switches;
+    long switchesTo[TRACE_MAX_CAMERAS];
+    std::vector<long> latencies;
+    std::vector<int> decisions;
+    long differences;
+    uint32_t lastTick;
+} ReplayResult;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "Usage: tracereplay <trace> [--audio-threshold dB] [--movement-threshold n] [--reference file]\n"
+                    "                           [--write-decisions file] [--repeat n]\n");
+}
+
+/***
+ * Load Reference
+ * Author: Matthew Ribbins
+ * Description: Reference decisions are a text file with one decision per record (-1 for no change)
+ */
+static bool LoadReference(const char *path, std::vector<int> &reference)
+{
+    FILE *file = fopen(path, "r");
+    int decision;
+
+    if(!file) return false;
+    while(fscanf(file, "%d", &decision) == 1)
+        reference.push_back(decision);
+    fclose(file);
+    return true;
+}
+
+/***
+ * Replay
+ * Author: Matthew Ribbins
+ * Description: Run every record through the policy, keeping track of what would be on program
+ */
+static bool Replay(const char *path, SwitchingPolicy &policy, const std::vector<int> *reference, ReplayResult &result)
+{
+    TraceReader reader;
+    TraceRecord record;
+    bool active[TRACE_MAX_CAMERAS];
+    bool wasActive[TRACE_MAX_CAMERAS];
+    long onsetTick[TRACE_MAX_CAMERAS];
+    int movement[TRACE_MAX_CAMERAS];
+    int currentCamera = -1;
+
+    if(!reader.Open(path)) return false;
+
+    memset(&wasActive, 0, sizeof(wasActive));
+    memset(&result.switchesTo, 0, sizeof(result.switchesTo));
+    for(int i = 0; i < TRACE_MAX_CAMERAS; i++)
+        onsetTick[i] = -1;
+    result.records = 0;
+    result.switches = 0;
+    result.differences = 0;
+    result.lastTick = 0;
+    result.latencies.clear();
+    result.decisions.clear();
+
+    while(reader.Next(record)) {
+        int decision;
+
+        if(currentCamera < 0) currentCamera = record.currentCamera;
+
+        if(TRACE_RECORD_AUDIO == record.kind) {
+            decision = policy.SelectBasedOnAudio(record.values, active, record.count);
+        } else {
+            for(int i = 0; i < record.count; i++)
+                movement[i] = (int)record.values[i];
+            decision = policy.SelectBasedOnVideo(movement, active, record.count);
+        }
+
+        // Onset is when a camera goes from inactive to active
+        for(int i = 0; i < record.count; i++) {
+            if(active[i] && !wasActive[i]) onsetTick[i] = record.tick;
+            if(!active[i]) onsetTick[i] = -1;
+            wasActive[i] = active[i];
+        }
+
+        if(decision >= 0 && decision != currentCamera) {
+            result.switches++;
+            result.switchesTo[decision]++;
+            if(onsetTick[decision] >= 0)
+                result.latencies.push_back(record.tick - onsetTick[decision]);
+            currentCamera = decision;
+        }
+
+        // Compare with the reference, or what was decided when the trace was recorded
+        int expected = reference ? (result.records < (long)reference->size() ? (*reference)[result.records] : -2) : record.decision;
+        if(expected != decision) {
+            if(result.differences < MAX_DIFFERENCES_SHOWN)
+                printf("  difference at record %ld (tick %u): expected %d, got %d\n", result.records, record.tick, expected, decision);
+            result.differences++;
+        }
+
+        result.decisions.push_back(decision);
+        result.lastTick = record.tick;
+        result.records++;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *tracePath = NULL;
+    const char *referencePath = NULL;
+    const char *decisionsPath = NULL;
+    std::vector<int> reference;
+    ReplayResult result;
+    TraceReader reader;
+    int repeat = 1;
+    double start, elapsed;
+
+    if(argc < 2) {
+        Usage();
+        return 1;
+    }
+    tracePath = argv[1];
+
+    if(!reader.Open(tracePath)) {
+        fprintf(stderr, "Could not open trace %s\n", tracePath);
+        return 1;
+    }
+    TraceHeader header = reader.GetHeader();
+    reader.Close();
+
+    // Default to the thresholds the trace was recorded with
+    SwitchingPolicy policy(header.audioThreshold, header.movementThreshold);
+
+    for(int i = 2; i < argc; i++) {
+        if(!strcmp(argv[i], "--audio-threshold") && i + 1 < argc)
+            policy.SetAudioThreshold(atof(argv[++i]));
+        else if(!strcmp(argv[i], "--movement-threshold") && i + 1 < argc)
+            policy.SetMovementThreshold(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--reference") && i + 1 < argc)
+            referencePath = argv[++i];
+        else if(!strcmp(argv[i], "--write-decisions") && i + 1 < argc)
+            decisionsPath = argv[++i];
+        else if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+            repeat = std::max(1, atoi(argv[++i]));
+        else {
+            Usage();
+            return 1;
+        }
+    }
+
+    if(referencePath && !LoadReference(referencePath, reference)) {
+        fprintf(stderr, "Could not open reference %s\n", referencePath);
+        return 1;
+    }
+
+    printf("Replaying %s (audio threshold %.1f dB, movement threshold %d)\n", tracePath, policy.GetAudioThreshold(), policy.GetMovementThreshold());
+
+    start = Now();
+    for(int i = 0; i < repeat; i++) {
+        if(!Replay(tracePath, policy, referencePath ? &reference : NULL, result)) {
+            fprintf(stderr, "Could not replay %s\n", tracePath);
+            return 1;
+        }
+    }
+    elapsed = (Now() - start) / repeat;
+
+    double traceSeconds = (double)result.lastTick * header.tickInterval / 1000.0;
+    printf("Records:   %ld over %.1f s of show\n", result.records, traceSeconds);
+    printf("Replay:    %.3f ms (%.0fx real time)\n", elapsed * 1000.0, elapsed > 0 ? traceSeconds / elapsed : 0.0);
+    printf("Switches:  %ld\n", result.switches);
+    for(int i = 0; i < TRACE_MAX_CAMERAS; i++) {
+        if(result.switchesTo[i]) printf("  to camera %d: %ld\n", i, result.switchesTo[i]);
+    }
+
+    if(!result.latencies.empty()) {
+        std::vector<long> sorted(result.latencies);
+        double total = 0;
+
+        std::sort(sorted.begin(), sorted.end());
+        for(size_t i = 0; i < sorted.size(); i++)
+            total += sorted[i];
+        printf("Latency:   mean %.0f ms, median %ld ms, p95 %ld ms, max %ld ms (from onset)\n",
+               total / sorted.size() * header.tickInterval,
+               sorted[sorted.size() / 2] * header.tickInterval,
+               sorted[(sorted.size() * 95) / 100] * header.tickInterval,
+               sorted.back() * header.tickInterval);
+    }
+    printf("Differences: %ld\n", result.differences);
+
+    if(decisionsPath) {
+        FILE *file = fopen(decisionsPath, "w");
+        if(!file) {
+            fprintf(stderr, "Could not write %s\n", decisionsPath);
+            return 1;
+        }
+        for(size_t i = 0; i < result.decisions.size(); i++)
+            fprintf(file, "%d\n", result.decisions[i]);
+        fclose(file);
+    }
+
+    return result.differences ? 2 : 0;
+}
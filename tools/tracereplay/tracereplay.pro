@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Trace replay harness for the camera switching policy
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = tracereplay
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../switchingpolicy.cpp \
+    ../../tracefile.cpp
+
+HEADERS += ../../switchingpolicy.h \
+    ../../tracefile.h
@@ -0,0 +1,125 @@
+/***
+ * RadioViz - tracefile.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Read and write metric traces. Each record is what one switching decision was made from: the audio
+ *              levels (float) or movement (int16) of every camera, the camera on program and what was decided.
+ *              Writes are buffered, so recording costs no more than a memcpy per decision most of the time.
+ *
+ */
+#include "tracefile.h"
+
+TraceWriter::TraceWriter()
+{
+    file = NULL;
+}
+
+TraceWriter::~TraceWriter()
+{
+    Close();
+}
+
+/***
+ * Open Trace for Writing
+ * Author: Matthew Ribbins
+ */
+bool TraceWriter::Open(const char *path, const TraceHeader &header)
+{
+    Close();
+    file = fopen(path, "wb");
+    if(!file) return false;
+
+    setvbuf(file, buffer, _IOFBF, TRACE_BUFFER_SIZE);
+    fwrite(&header, sizeof(TraceHeader), 1, file);
+    return true;
+}
+
+void TraceWriter::Close(void)
+{
+    if(file) fclose(file);
+    file = NULL;
+}
+
+bool TraceWriter::IsOpen(void)
+{
+    return file != NULL;
+}
+
+/***
+ * Write Record
+ * Author: Matthew Ribbins
+ * Description: 8 byte record header, then only as many values as there are cameras
+ */
+void TraceWriter::WriteRecord(const TraceRecord &record)
+{
+    if(!file || record.count > TRACE_MAX_CAMERAS) return;
+
+    fwrite(&record, 8, 1, file);
+    if(TRACE_RECORD_AUDIO == record.kind) {
+        fwrite(record.values, sizeof(float), record.count, file);
+    } else {
+        int16_t movement[TRACE_MAX_CAMERAS];
+        for(int i = 0; i < record.count; i++)
+            movement[i] = (int16_t)record.values[i];
+        fwrite(movement, sizeof(int16_t), record.count, file);
+    }
+}
+
+TraceReader::TraceReader()
+{
+    file = NULL;
+}
+
+TraceReader::~TraceReader()
+{
+    Close();
+}
+
+/***
+ * Open Trace for Reading
+ * Author: Matthew Ribbins
+ */
+bool TraceReader::Open(const char *path)
+{
+    Close();
+    file = fopen(path, "rb");
+    if(!file) return false;
+
+    setvbuf(file, buffer, _IOFBF, TRACE_BUFFER_SIZE);
+    if(fread(&header, sizeof(TraceHeader), 1, file) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void TraceReader::Close(void)
+{
+    if(file) fclose(file);
+    file = NULL;
+}
+
+const TraceHeader &TraceReader::GetHeader(void)
+{
+    return header;
+}
+
+/***
+ * Next Record
+ * Author: Matthew Ribbins
+ *
+ * Return: (bool) false at the end of the trace, or if it is truncated
+ */
+bool TraceReader::Next(TraceRecord &record)
+{
+    if(!file) return false;
+    if(fread(&record, 8, 1, file) != 1 || record.count > TRACE_MAX_CAMERAS) return false;
+
+    if(TRACE_RECORD_AUDIO == record.kind)
+        return fread(record.values, sizeof(float), record.count, file) == record.count;
+
+    int16_t movement[TRACE_MAX_CAMERAS];
+    if(fread(movement, sizeof(int16_t), record.count, file) != record.count) return false;
+    for(int i = 0; i < record.count; i++)
+        record.values[i] = movement[i];
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Metric trace file, what the switching policy saw on each decision
+#define TRACE_MAGIC 0x52545652 // "RVTR"
+#define TRACE_VERSION 1
+#define TRACE_MAX_CAMERAS 32
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+#define TRACE_RECORD_AUDIO 1
+#define TRACE_RECORD_VIDEO 2
+
+typedef struct _TraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t tickInterval;
+    float audioThreshold;
+    int32_t movementThreshold;
+} TraceHeader;
+
+typedef struct _TraceRecord {
+    uint32_t tick;
+    uint8_t kind;
+    int8_t currentCamera;
+    int8_t decision;
+    uint8_t count;
+    float values[TRACE_MAX_CAMERAS];
+} TraceRecord;
+
+class TraceWriter
+{
+public:
+    TraceWriter();
+    ~TraceWriter();
+    bool Open(const char *path, const TraceHeader &header);
+    void Close(void);
+    bool IsOpen(void);
+    void WriteRecord(const TraceRecord &record);
+
+private:
+    FILE *file;
+    char buffer[TRACE_BUFFER_SIZE];
+};
+
+class TraceReader
+{
+public:
+    TraceReader();
+    ~TraceReader();
+    bool Open(const char *path);
+    void Close(void);
+    const TraceHeader &GetHeader(void);
+    bool Next(TraceRecord &record);
+
+private:
+    FILE *file;
+    TraceHeader header;
+    char buffer[TRACE_BUFFER_SIZE];
+};
+
+#endif // TRACEFILE_H
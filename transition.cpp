@@ -0,0 +1,227 @@
+/***
+ * RadioViz - transition.cpp
+ * Author: Matthew Ribbins, 2015
+ * Description: Transitions between two live cameras (mix, dip to black, wipe). Blending is done with
+ *              8-bit fixed point kernels straight from the two cameras' frame buffers into one output frame.
+ *
+ */
+#include "transition.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+Transition::Transition()
+{
+    fromCamera = 0;
+    type = TRANSITION_CUT;
+    duration = 0;
+    isActive = false;
+    waiting = false;
+}
+
+/***
+ * Start Transition
+ * Author: Matthew Ribbins
+ * Description: Begin a transition away from fromCamera. The camera we are going to is whatever is on program.
+ *              It doesn't start moving until that camera has a frame for it, see Render().
+ */
+void Transition::Start(int fromCamera, int type, int duration)
+{
+    this->fromCamera = fromCamera;
+    this->type = type;
+    this->duration = duration;
+
+    isActive = (type != TRANSITION_CUT && duration > 0);
+    waiting = isActive;
+    if(isActive)
+        timer.start();
+}
+
+void Transition::Stop(void)
+{
+    isActive = false;
+}
+
+bool Transition::IsActive(void)
+{
+    return isActive;
+}
+
+int Transition::GetFromCamera(void)
+{
+    return fromCamera;
+}
+
+/***
+ * Render Transition
+ * Author: Matthew Ribbins
+ * Description: Render the current position of the transition into output. Both frames must be RGB24 and the
+ *              same size, output is only reallocated if its size changes.
+ *
+ *              Until the camera we are going to has a current frame of the same size (toReady, and e.g. it isn't
+ *              still coming up from analysis only or a smaller capture format), the old camera is held and the
+ *              transition doesn't start. If that takes more than TRANSITION_WAIT_TIMEOUT we cut instead, and say so.
+ *
+ * Return: (bool) false if the transition has finished or cannot be rendered, and the caller should cut
+ */
+bool Transition::Render(const cv::Mat &from, const cv::Mat &to, bool toReady, cv::Mat &output)
+{
+    int weight;
+
+    if(!isActive) return false;
+
+    bool usable = !from.empty() && !to.empty() && from.size() == to.size() &&
+                  from.type() == CV_8UC3 && to.type() == CV_8UC3;
+    if(waiting) {
+        if(toReady && usable) {
+            waiting = false;
+            timer.start();
+        } else if(timer.elapsed() < TRANSITION_WAIT_TIMEOUT && !from.empty() && from.type() == CV_8UC3) {
+            from.copyTo(output);
+            return true;
+        } else {
+            LOG_WARNING(LOG_DISPLAY, "Warning: Camera had no frame to transition to after %d ms, cutting instead",
+                        TRANSITION_WAIT_TIMEOUT);
+            isActive = false;
+            return false;
+        }
+    }
+
+    if(timer.elapsed() >= duration) {
+        isActive = false;
+        return false;
+    }
+    if(!usable) {
+        LOG_WARNING(LOG_DISPLAY, "Warning: Transition frames stopped matching, cutting instead");
+        isActive = false;
+        return false;
+    }
+
+    weight = (int)(timer.elapsed() * TRANSITION_WEIGHT_MAX / duration);
+    output.create(to.rows, to.cols, CV_8UC3);
+
+    switch(type) {
+        case TRANSITION_MIX:
+            RenderMix(from, to, output, weight);
+            break;
+        case TRANSITION_DIP:
+            RenderDip(from, to, output, weight);
+            break;
+        case TRANSITION_WIPE:
+            RenderWipe(from, to, output, weight);
+            break;
+        default:
+            isActive = false;
+            return false;
+    }
+    return true;
+}
+
+void Transition::RenderMix(const cv::Mat &from, const cv::Mat &to, cv::Mat &output, int weight)
+{
+    int rowLength = to.cols * 3;
+
+    if(from.isContinuous() && to.isContinuous() && output.isContinuous()) {
+        BlendMix(from.data, to.data, output.data, rowLength * to.rows, weight);
+        return;
+    }
+    for(int i = 0; i < to.rows; i++)
+        BlendMix(from.ptr<uchar>(i), to.ptr<uchar>(i), output.ptr<uchar>(i), rowLength, weight);
+}
+
+void Transition::RenderDip(const cv::Mat &from, const cv::Mat &to, cv::Mat &output, int weight)
+{
+    // First half fades the old camera out, second half fades the new one in
+    const cv::Mat &source = (weight < TRANSITION_WEIGHT_MAX / 2) ? from : to;
+    int level = abs(TRANSITION_WEIGHT_MAX - weight * 2);
+    int rowLength = to.cols * 3;
+
+    if(source.isContinuous() && output.isContinuous()) {
+        BlendScale(source.data, output.data, rowLength * to.rows, level);
+        return;
+    }
+    for(int i = 0; i < to.rows; i++)
+        BlendScale(source.ptr<uchar>(i), output.ptr<uchar>(i), rowLength, level);
+}
+
+void Transition::RenderWipe(const cv::Mat &from, const cv::Mat &to, cv::Mat &output, int weight)
+{
+    // Left to right wipe, no blending needed so just copy each side of the edge
+    int edge = (to.cols * weight / TRANSITION_WEIGHT_MAX) * 3;
+    int rowLength = to.cols * 3;
+
+    for(int i = 0; i < to.rows; i++) {
+        uchar *out = output.ptr<uchar>(i);
+        memcpy(out, to.ptr<uchar>(i), edge);
+        memcpy(out + edge, from.ptr<uchar>(i) + edge, rowLength - edge);
+    }
+}
+
+/***
+ * Blend Mix
+ * Author: Matthew Ribbins
+ * Description: out = (a * (256 - weight) + b * weight) / 256 on every byte. Weight is 0-256, which keeps each
+ *              product within 16 bits so eight bytes can be worked on at a time in each half of an SSE2 register.
+ */
+void Transition::BlendMix(const uchar *a, const uchar *b, uchar *out, int length, int weight)
+{
+    int i = 0;
+    int inverse = TRANSITION_WEIGHT_MAX - weight;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(TRANSITION_WEIGHT_MAX / 2);
+    const __m128i wa = _mm_set1_epi16((short)inverse);
+    const __m128i wb = _mm_set1_epi16((short)weight);
+
+    for(; i + 16 <= length; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for(; i < length; i++)
+        out[i] = (uchar)((a[i] * inverse + b[i] * weight + TRANSITION_WEIGHT_MAX / 2) >> 8);
+}
+
+/***
+ * Blend Scale
+ * Author: Matthew Ribbins
+ * Description: out = a * weight / 256 on every byte, used to fade to and from black
+ */
+void Transition::BlendScale(const uchar *a, uchar *out, int length, int weight)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(TRANSITION_WEIGHT_MAX / 2);
+    const __m128i wa = _mm_set1_epi16((short)weight);
+
+    for(; i + 16 <= length; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa);
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa);
+
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for(; i < length; i++)
+        out[i] = (uchar)((a[i] * weight + TRANSITION_WEIGHT_MAX / 2) >> 8);
+}
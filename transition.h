@@ -0,0 +1,37 @@
+#ifndef TRANSITION_H
+#define TRANSITION_H
+
+#include <QElapsedTimer>
+#include <opencv2/opencv.hpp>
+
+#include "logger.h"
+#include "radioviz.h"
+
+class Transition
+{
+public:
+    Transition();
+    void Start(int fromCamera, int type, int duration);
+    void Stop(void);
+    bool IsActive(void);
+    int GetFromCamera(void);
+    bool Render(const cv::Mat &from, const cv::Mat &to, bool toReady, cv::Mat &output);
+
+    static void BlendMix(const uchar *a, const uchar *b, uchar *out, int length, int weight);
+    static void BlendScale(const uchar *a, uchar *out, int length, int weight);
+
+private:
+    QElapsedTimer timer;
+    int fromCamera;
+    int type;
+    int duration;
+    bool isActive;
+    bool waiting;
+
+protected:
+    void RenderMix(const cv::Mat &from, const cv::Mat &to, cv::Mat &output, int weight);
+    void RenderDip(const cv::Mat &from, const cv::Mat &to, cv::Mat &output, int weight);
+    void RenderWipe(const cv::Mat &from, const cv::Mat &to, cv::Mat &output, int weight);
+};
+
+#endif // TRANSITION_H